@@ -0,0 +1,130 @@
+# back-end/app/api/routes/admin.py
+
+import logging
+from fastapi import APIRouter, Depends, HTTPException, Query
+from fastapi.responses import PlainTextResponse
+from starlette.concurrency import run_in_threadpool
+
+from app.core.security import require_admin, require_writer
+from app.schemas.trace import TraceRequestResponse
+from app.services.mqtt_client import publish_command
+from app.services.profiler import profile_for, to_collapsed, get_continuous_profiler
+from app.services.flow import reload_flow, get_flow_status
+from app.services.alerts import reload_alerts, get_alert_metrics, send_test_alert
+from app.services.retention import run_retention, get_retention_runs
+
+# Every route in this router requires the admin token
+router = APIRouter(dependencies=[Depends(require_admin)])
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Profiling Endpoints
+# =====================================================================
+# Output is in the collapsed-stack format, ready for flamegraph.pl or
+# https://www.speedscope.app. The root frame of every stack is the thread name
+# (e.g. "mqtt-network" for the paho network thread).
+
+@router.get("/profile", response_class=PlainTextResponse)
+async def profile(
+    seconds: float = Query(10, gt=0, le=300),
+    hz: float = Query(100, gt=0, le=1000)
+):
+    """Samples every thread for N seconds and returns the collapsed stacks."""
+    logger.info(f"On-demand profile requested: {seconds}s at {hz} Hz")
+    try:
+        # Sampling sleeps between samples; keep it off the event loop
+        counts = await run_in_threadpool(profile_for, seconds, hz)
+    except RuntimeError as e:
+        raise HTTPException(status_code=409, detail=str(e))
+    return to_collapsed(counts)
+
+@router.get("/profile/continuous", response_class=PlainTextResponse)
+async def profile_continuous(minutes: int = Query(60, ge=1, le=1440)):
+    """Returns the always-on profiler's aggregated stacks for the last N minutes."""
+    profiler = get_continuous_profiler()
+    if profiler is None:
+        raise HTTPException(status_code=404, detail="Continuous profiler is not enabled (PROFILER_ALWAYS_ON).")
+    return to_collapsed(profiler.snapshot(minutes))
+
+# =====================================================================
+# Device Diagnostics
+# =====================================================================
+
+@router.post("/devices/{device_id}/trace", response_model=TraceRequestResponse, dependencies=[Depends(require_writer)])
+async def request_trace(device_id: str, seconds: int = Query(10, ge=1, le=600)):
+    """
+    Asks a device to record every raw beam edge for N seconds. The trace is
+    uploaded in the background and appears under GET /v1/traces when complete.
+    """
+    command = f"trace start {seconds}"
+    sent = publish_command(device_id, command)
+    if not sent:
+        raise HTTPException(status_code=503, detail="MQTT client is not connected.")
+    return TraceRequestResponse(device_id=device_id, command=command, sent=sent)
+
+# =====================================================================
+# Flow Balance
+# =====================================================================
+
+@router.post("/flow/reload", dependencies=[Depends(require_writer)])
+async def flow_reload():
+    """
+    Re-reads stations and station_links after they were edited. What is in
+    transit is rebuilt from the stored counts; totals restart from zero.
+    """
+    try:
+        await run_in_threadpool(reload_flow)
+    except Exception as e:
+        logger.error(f"Could not reload the station links: {e}")
+        raise HTTPException(status_code=500, detail="Could not reload the station links")
+    return {"links": len(get_flow_status())}
+
+# =====================================================================
+# Alerts
+# =====================================================================
+
+@router.post("/alerts/reload", dependencies=[Depends(require_writer)])
+async def alerts_reload():
+    """Re-reads alert_rules after they were edited; aggregates are rebuilt from the stored counts."""
+    try:
+        await run_in_threadpool(reload_alerts)
+    except Exception as e:
+        logger.error(f"Could not reload the alert rules: {e}")
+        raise HTTPException(status_code=500, detail="Could not reload the alert rules")
+    return {"rules": get_alert_metrics()["rules"]}
+
+@router.post("/alerts/rules/{rule_id}/test", dependencies=[Depends(require_writer)])
+async def alerts_test(rule_id: int, device_id: str = Query("test-device")):
+    """Sends a test notification to a rule's webhook right away (no retries, not recorded)."""
+    try:
+        await run_in_threadpool(send_test_alert, rule_id, device_id)
+    except KeyError:
+        raise HTTPException(status_code=404, detail=f"No enabled alert rule {rule_id} (reload after adding it).")
+    except Exception as e:
+        raise HTTPException(status_code=502, detail=f"Webhook failed: {e}")
+    return {"rule_id": rule_id, "sent": True}
+
+# =====================================================================
+# Retention
+# =====================================================================
+
+@router.post("/retention/run", dependencies=[Depends(require_writer)])
+async def retention_run():
+    """Runs the retention job now (it also runs every cleanup_interval_hours) and returns its report."""
+    try:
+        report = await run_in_threadpool(run_retention)
+    except Exception as e:
+        logger.error(f"Retention job failed: {e}")
+        raise HTTPException(status_code=500, detail="Retention job failed")
+    if report is None:
+        raise HTTPException(status_code=409, detail="The retention job is already running.")
+    return report
+
+@router.get("/retention/runs")
+async def retention_runs(limit: int = Query(20, ge=1, le=500)):
+    """Latest retention runs: rows demoted, estimated space freed, table sizes and runtime."""
+    try:
+        return await run_in_threadpool(get_retention_runs, limit)
+    except Exception as e:
+        logger.error(f"Could not read the retention runs: {e}")
+        raise HTTPException(status_code=500, detail="Could not read the retention runs")
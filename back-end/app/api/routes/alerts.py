@@ -0,0 +1,41 @@
+# back-end/app/api/routes/alerts.py
+
+import logging
+from fastapi import APIRouter, Depends, HTTPException, Query
+from psycopg2.extensions import connection
+from psycopg2.extras import RealDictCursor
+
+from app.core.security import require_writer
+from app.db.session import read_db_dependency
+from app.schemas.alert import AlertResponse, AlertEventResponse
+from app.services.alerts import get_alert_status
+
+router = APIRouter()
+logger = logging.getLogger(__name__)
+
+@router.get("/alerts", response_model=list[AlertResponse], dependencies=[Depends(require_writer)])
+async def get_alerts():
+    """Alerts firing now, oldest first. Served from memory."""
+    return get_alert_status()
+
+@router.get("/alerts/events", response_model=list[AlertEventResponse])
+async def get_alert_events(
+    db: connection = Depends(read_db_dependency),
+    rule_id: int | None = Query(None),
+    device_id: str | None = Query(None),
+    limit: int = Query(100, ge=1, le=1000)
+):
+    """Notifications sent by the alert rules, newest first."""
+    try:
+        with db.cursor(cursor_factory=RealDictCursor) as cur:
+            cur.execute(
+                "SELECT id, rule_id, device_id, status, value, message, since_at, attempts, delivered_at, error, "
+                "created_at FROM alert_events "
+                "WHERE (%s::INTEGER IS NULL OR rule_id = %s) AND (%s::VARCHAR IS NULL OR device_id = %s) "
+                "ORDER BY created_at DESC LIMIT %s",
+                (rule_id, rule_id, device_id, device_id, limit)
+            )
+            return cur.fetchall()
+    except Exception as e:
+        logger.error(f"Error fetching alert events: {e}")
+        raise HTTPException(status_code=500, detail="Failed to fetch alert events.")
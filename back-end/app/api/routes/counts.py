@@ -1,12 +1,15 @@
 # back-end/app/api/routes/counts.py
 
 import logging
+from datetime import datetime
 from fastapi import APIRouter, Depends, HTTPException, Query
 from psycopg2.extensions import connection
 from psycopg2.extras import RealDictCursor
 
-from app.db.session import db_dependency
-from app.schemas.count import CountResponse, StatisticsResponse, GrafanaTimeSeriesResponse
+from app.db.session import fresh_read_db_dependency, read_db_dependency
+from app.schemas.count import (
+    CountResponse, StatisticsResponse, GrafanaTimeSeriesResponse, RollupResponse, RollupInvalidationResponse
+)
 
 router = APIRouter()
 logger = logging.getLogger(__name__)
@@ -14,10 +17,12 @@ logger = logging.getLogger(__name__)
 # =====================================================================
 # Standard API Endpoints
 # =====================================================================
+# These reads must reflect recent ingest: the replica serves them only while
+# its lag is within DB_REPLICA_MAX_LAG_S, otherwise the primary does.
 
 @router.get("/counts", response_model=list[CountResponse])
 async def get_counts(
-    db: connection = Depends(db_dependency),
+    db: connection = Depends(fresh_read_db_dependency),
     limit: int = Query(100, le=1000),
     offset: int = Query(0)
 ):
@@ -35,7 +40,7 @@ async def get_counts(
         raise HTTPException(status_code=500, detail="Failed to fetch counts.")
 
 @router.get("/counts/statistics", response_model=StatisticsResponse)
-async def get_statistics(db: connection = Depends(db_dependency)):
+async def get_statistics(db: connection = Depends(fresh_read_db_dependency)):
     """Retrieves aggregated statistics about the counts."""
     try:
         with db.cursor() as cur:
@@ -65,10 +70,65 @@ async def get_statistics(db: connection = Depends(db_dependency)):
         logger.error(f"Error fetching statistics: {e}")
         raise HTTPException(status_code=500, detail="Failed to fetch statistics.")
 
+# =====================================================================
+# Minute Rollups
+# =====================================================================
+# count_rollups is kept up to date by database triggers. Late counts that
+# patch a closed minute are listed as invalidations: a cache (or a copy of
+# the rollups elsewhere) polls them and re-reads only those ranges.
+
+@router.get("/counts/rollups", response_model=list[RollupResponse])
+async def get_rollups(
+    start: datetime,
+    end: datetime,
+    device_id: str | None = None,
+    db: connection = Depends(fresh_read_db_dependency)
+):
+    """Products per device and minute in [start, end)."""
+    try:
+        with db.cursor(cursor_factory=RealDictCursor) as cur:
+            cur.execute(
+                "SELECT minute, device_id, counts FROM count_rollups "
+                "WHERE minute >= %s AND minute < %s AND (%s::VARCHAR IS NULL OR device_id = %s) "
+                "ORDER BY minute, device_id LIMIT 100000",
+                (start, end, device_id, device_id)
+            )
+            return cur.fetchall()
+    except Exception as e:
+        logger.error(f"Error fetching rollups: {e}")
+        raise HTTPException(status_code=500, detail="Failed to fetch rollups.")
+
+@router.get("/counts/rollups/invalidations", response_model=list[RollupInvalidationResponse])
+async def get_rollup_invalidations(
+    after_id: int = Query(0, ge=0),
+    limit: int = Query(1000, le=10000),
+    db: connection = Depends(fresh_read_db_dependency)
+):
+    """
+    Rollup ranges patched after they closed, oldest first. Poll with the last
+    id seen. Ids are assigned before commit, so the newest 2 s are held back
+    until every earlier id is visible.
+    """
+    try:
+        with db.cursor(cursor_factory=RealDictCursor) as cur:
+            cur.execute(
+                "SELECT id, device_id, range_start, range_end, counts_delta, created_at "
+                "FROM rollup_invalidations "
+                "WHERE id > %s AND created_at < NOW() - INTERVAL '2 seconds' "
+                "ORDER BY id LIMIT %s",
+                (after_id, limit)
+            )
+            return cur.fetchall()
+    except Exception as e:
+        logger.error(f"Error fetching rollup invalidations: {e}")
+        raise HTTPException(status_code=500, detail="Failed to fetch rollup invalidations.")
+
 # =====================================================================
 # Grafana API Endpoints (for simple-json-datasource)
 # =====================================================================
 # Note: Grafana expects datapoints as [value, timestamp_in_milliseconds]
+# Dashboard queries tolerate replication lag, so they are served by the read
+# replica whenever one is configured and reachable.
 
 async def _fetch_grafana_timeseries(db: connection, view_name: str, target_name: str, value_column: str, days_limit: int = 30):
     """Generic helper to fetch time series data from a database view."""
@@ -97,6 +157,38 @@ async def _fetch_grafana_timeseries(db: connection, view_name: str, target_name:
         logger.error(f"Error fetching Grafana data from view '{view_name}': {e}")
         raise HTTPException(status_code=500, detail=f"Failed to fetch data for {target_name}")
 
+# Flow balance series, one per station link, from the per-minute rows of flow_minutes
+_FLOW_SERIES = {
+    "flow_wip": ("WIP", "wip"),
+    "flow_lost": ("Lost per Minute", "lost"),
+    "flow_loss_rate": ("Loss Rate", "lost::REAL / NULLIF(matched + lost, 0)"),
+    "flow_transit_p50": ("Transit p50 (s)", "transit_p50_s"),
+    "flow_transit_p90": ("Transit p90 (s)", "transit_p90_s"),
+}
+
+async def _fetch_flow_timeseries(db: connection, target: str, hours_limit: int = 24):
+    """One series per station link for a _FLOW_SERIES target."""
+    label, expression = _FLOW_SERIES[target]
+    try:
+        with db.cursor() as cur:
+            cur.execute(
+                f"""
+                SELECT upstream || ' -> ' || downstream, {expression}, EXTRACT(EPOCH FROM minute) * 1000
+                FROM flow_minutes
+                WHERE minute >= NOW() - %s * INTERVAL '1 hour'
+                ORDER BY upstream, downstream, minute
+                """,
+                (hours_limit,)
+            )
+            series = {}
+            for link, value, ts_ms in cur.fetchall():
+                series.setdefault(link, []).append([value, int(ts_ms)])
+            return [GrafanaTimeSeriesResponse(target=f"{link} {label}", datapoints=datapoints)
+                    for link, datapoints in series.items()]
+    except Exception as e:
+        logger.error(f"Error fetching Grafana flow data for '{target}': {e}")
+        raise HTTPException(status_code=500, detail=f"Failed to fetch data for {target}")
+
 @router.get("/grafana", response_model=dict)
 async def grafana_root():
     """Root endpoint for Grafana datasource to confirm connectivity."""
@@ -110,11 +202,12 @@ async def grafana_search():
         "daily_counts",
         "production_speed",
         "today_stats_table", # For table panels
-        "recent_counts"      # For time series
+        "recent_counts",     # For time series
+        *_FLOW_SERIES,       # Per station link
     ]
 
 @router.post("/grafana/query", response_model=list)
-async def grafana_query(request: dict, db: connection = Depends(db_dependency)):
+async def grafana_query(request: dict, db: connection = Depends(read_db_dependency)):
     """
     Main query endpoint for Grafana.
     It receives targets from a dashboard and returns the corresponding data.
@@ -137,6 +230,9 @@ async def grafana_query(request: dict, db: connection = Depends(db_dependency)):
     if target == "recent_counts":
         return await _fetch_grafana_timeseries(db, "recent_counts_24h", "Real-time Counts", "id", days_limit=1) # Value is not used here, just the timestamp matters
 
+    if target in _FLOW_SERIES:
+        return await _fetch_flow_timeseries(db, target)
+
     if target == "today_stats_table":
         try:
             with db.cursor(cursor_factory=RealDictCursor) as cur:
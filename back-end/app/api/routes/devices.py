@@ -0,0 +1,21 @@
+# back-end/app/api/routes/devices.py
+
+from fastapi import APIRouter, HTTPException
+
+from app.schemas.device import DeviceResponse
+from app.services.devices import get_device, list_devices
+
+router = APIRouter()
+
+@router.get("/devices", response_model=list[DeviceResponse])
+async def get_devices():
+    """Latest state of every device, by id. Served from the shared device table, without the database."""
+    return list_devices()
+
+@router.get("/devices/{device_id}", response_model=DeviceResponse)
+async def get_device_state(device_id: str):
+    """Latest state of one device."""
+    device = get_device(device_id)
+    if device is None:
+        raise HTTPException(status_code=404, detail=f"Device {device_id} has not been seen.")
+    return device
@@ -0,0 +1,19 @@
+# back-end/app/api/routes/flow.py
+
+import logging
+from fastapi import APIRouter, Depends
+
+from app.core.security import require_writer
+from app.schemas.flow import FlowLinkResponse
+from app.services.flow import get_flow_status
+
+router = APIRouter()
+logger = logging.getLogger(__name__)
+
+@router.get("/flow", response_model=list[FlowLinkResponse], dependencies=[Depends(require_writer)])
+async def get_flow():
+    """
+    WIP, loss rate and transit times of every station link (stations and
+    station_links tables). Served from memory; history is in flow_minutes.
+    """
+    return get_flow_status()
@@ -0,0 +1,96 @@
+# back-end/app/api/routes/prometheus.py
+
+import logging
+import time
+from urllib.parse import parse_qsl
+from fastapi import APIRouter, Depends, Request
+from fastapi.responses import JSONResponse
+from psycopg2.extensions import connection
+
+from app.db.session import read_db_dependency
+from app.services import prometheus as promql
+
+router = APIRouter()
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Prometheus HTTP API (for Grafana's Prometheus datasource)
+# =====================================================================
+# Point a Prometheus datasource at http://<backend>:8000/prometheus. Grafana
+# sends GET or form-encoded POST requests, both accepted, and expects
+# Prometheus' own envelope, errors included, so these routes answer with it
+# instead of raising HTTPException. Served by the read replica when there is
+# one, like the other dashboard queries.
+# The POST variants are the same operations, so only the GET ones are in the
+# OpenAPI schema.
+
+SERIES_LOOKBACK_S = 86400  # series/labels without start: the last day
+
+async def _params(request: Request) -> dict[str, list[str]]:
+    items = list(request.query_params.multi_items())
+    if request.method == "POST":
+        items += parse_qsl((await request.body()).decode(), keep_blank_values=True)
+    params: dict[str, list[str]] = {}
+    for key, value in items:
+        params.setdefault(key, []).append(value)
+    return params
+
+def _one(params: dict, name: str) -> str | None:
+    values = params.get(name)
+    return values[-1] if values else None
+
+def _range(params: dict) -> tuple[float, float]:
+    end = promql.parse_time(_one(params, "end"), time.time())
+    return promql.parse_time(_one(params, "start"), end - SERIES_LOOKBACK_S), end
+
+def _error(status_code: int, error_type: str, message: str) -> JSONResponse:
+    return JSONResponse(status_code=status_code,
+                        content={"status": "error", "errorType": error_type, "error": message})
+
+async def _answer(request: Request, db: connection, evaluate):
+    """Runs evaluate(cursor, params) and wraps its data in the Prometheus envelope."""
+    params = await _params(request)
+    try:
+        with db.cursor() as cur:
+            return {"status": "success", "data": evaluate(cur, params)}
+    except promql.QueryError as e:
+        return _error(400, "bad_data", str(e))
+    except Exception as e:
+        logger.error(f"Error answering Prometheus API request {request.url.path}: {e}")
+        return _error(500, "internal", "Failed to evaluate the query.")
+
+@router.get("/api/v1/query_range")
+@router.post("/api/v1/query_range", include_in_schema=False)
+async def query_range(request: Request, db: connection = Depends(read_db_dependency)):
+    """Evaluates a query at each step in [start, end]."""
+    return await _answer(request, db, lambda cur, p: promql.query_range(
+        cur, _one(p, "query") or "",
+        promql.parse_time(_one(p, "start")), promql.parse_time(_one(p, "end")), promql.parse_step(_one(p, "step"))
+    ))
+
+@router.get("/api/v1/query")
+@router.post("/api/v1/query", include_in_schema=False)
+async def query_instant(request: Request, db: connection = Depends(read_db_dependency)):
+    """Evaluates a query at one time (default: now)."""
+    return await _answer(request, db, lambda cur, p: promql.query_instant(
+        cur, _one(p, "query") or "", promql.parse_time(_one(p, "time"), time.time())
+    ))
+
+@router.get("/api/v1/series")
+@router.post("/api/v1/series", include_in_schema=False)
+async def series(request: Request, db: connection = Depends(read_db_dependency)):
+    """Label sets of the series matching match[] with data in [start, end]."""
+    return await _answer(request, db, lambda cur, p: promql.series(cur, p.get("match[]", []), *_range(p)))
+
+@router.get("/api/v1/labels")
+@router.post("/api/v1/labels", include_in_schema=False)
+async def labels(request: Request, db: connection = Depends(read_db_dependency)):
+    return await _answer(request, db, lambda cur, p: promql.label_names())
+
+@router.get("/api/v1/label/{name}/values")
+async def label_values(name: str, request: Request, db: connection = Depends(read_db_dependency)):
+    return await _answer(request, db, lambda cur, p: promql.label_values(cur, name, p.get("match[]", []), *_range(p)))
+
+@router.get("/api/v1/metadata")
+async def metadata(request: Request, db: connection = Depends(read_db_dependency)):
+    return await _answer(request, db, lambda cur, p: promql.metadata())
@@ -1,14 +1,20 @@
 # back-end/app/api/routes/system.py
 
 import logging
+import math
 from fastapi import APIRouter, Depends, HTTPException, Query
+from fastapi.responses import PlainTextResponse
 from psycopg2.extensions import connection
 
-from app.db.session import db_dependency
+from app.core.security import require_writer
+from app.db.session import db_dependency, get_replica_status
 from app.schemas.system import (
     HealthResponse, MqttStatusResponse, SystemLogResponse, ApiInfoResponse
 )
-from app.services.mqtt_client import get_mqtt_status
+from app.services.mqtt_client import get_belt_speeds, get_mqtt_status
+from app.services.flow import get_flow_metrics
+from app.services.transitions import get_transition_stats
+from app.services.alerts import get_alert_metrics
 
 # APIRouter allows us to declare routes in different files
 router = APIRouter()
@@ -46,7 +52,7 @@ async def health_check(db: connection = Depends(db_dependency)):
         database_connected=db_connected
     )
 
-@router.get("/mqtt-status", response_model=MqttStatusResponse)
+@router.get("/mqtt-status", response_model=MqttStatusResponse, dependencies=[Depends(require_writer)])
 async def mqtt_status():
     """Returns the current status of the MQTT client."""
     try:
@@ -57,6 +63,92 @@ async def mqtt_status():
             status_code=500, detail="Could not retrieve MQTT status"
         )
 
+@router.get("/metrics", response_class=PlainTextResponse, dependencies=[Depends(require_writer)])
+async def metrics():
+    """Exposes operational metrics in the Prometheus text format."""
+    replica = get_replica_status()
+    lag = replica["lag_seconds"]
+
+    lines = [
+        "# HELP terelina_db_replica_configured Whether a read replica is configured.",
+        "# TYPE terelina_db_replica_configured gauge",
+        f"terelina_db_replica_configured {int(replica['configured'])}",
+        "# HELP terelina_db_replica_up Whether the read replica answered the last lag check.",
+        "# TYPE terelina_db_replica_up gauge",
+        f"terelina_db_replica_up {int(lag is not None)}",
+        "# HELP terelina_db_replica_lag_seconds Replay lag of the read replica (+Inf while it is not streaming).",
+        "# TYPE terelina_db_replica_lag_seconds gauge",
+        f"terelina_db_replica_lag_seconds {'NaN' if lag is None else '+Inf' if math.isinf(lag) else lag}",
+        "# HELP terelina_db_replica_max_lag_seconds Lag above which fresh reads use the primary.",
+        "# TYPE terelina_db_replica_max_lag_seconds gauge",
+        f"terelina_db_replica_max_lag_seconds {replica['max_lag_seconds']}",
+        "# HELP terelina_db_reads_total Read queries by the database they were routed to.",
+        "# TYPE terelina_db_reads_total counter",
+    ]
+    for route, total in replica["routed_reads"].items():
+        lines.append(f'terelina_db_reads_total{{route="{route}"}} {total}')
+
+    lines += [
+        "# HELP terelina_belt_speed_mm_per_second Belt speed measured by a device's encoder.",
+        "# TYPE terelina_belt_speed_mm_per_second gauge",
+    ]
+    for device, mm_s in get_belt_speeds().items():
+        lines.append(f'terelina_belt_speed_mm_per_second{{device="{device}"}} {mm_s}')
+
+    flow = get_flow_metrics()
+    lines += [
+        "# HELP terelina_flow_wip Products in transit between two stations.",
+        "# TYPE terelina_flow_wip gauge",
+    ]
+    lines += [f'terelina_flow_wip{{link="{link["link"]}"}} {link["wip"]}' for link in flow]
+    lines += [
+        "# HELP terelina_flow_products_total Products of a station link since start-up, by outcome.",
+        "# TYPE terelina_flow_products_total counter",
+    ]
+    for link in flow:
+        for outcome, total in link["totals"].items():
+            lines.append(f'terelina_flow_products_total{{link="{link["link"]}",outcome="{outcome}"}} {total}')
+    lines += [
+        "# HELP terelina_flow_transit_seconds Time matched products took between two stations.",
+        "# TYPE terelina_flow_transit_seconds histogram",
+    ]
+    for link in flow:
+        for le, count in link["transit_buckets"]:
+            lines.append(f'terelina_flow_transit_seconds_bucket{{link="{link["link"]}",le="{le}"}} {count}')
+        lines.append(f'terelina_flow_transit_seconds_sum{{link="{link["link"]}"}} {link["transit_sum_s"]}')
+        lines.append(f'terelina_flow_transit_seconds_count{{link="{link["link"]}"}} {link["totals"]["matched"]}')
+
+    transitions = get_transition_stats()
+    lines += [
+        "# HELP terelina_transitions_recorded_total Raw state transitions recorded since start-up.",
+        "# TYPE terelina_transitions_recorded_total counter",
+        f"terelina_transitions_recorded_total {transitions['recorded']}",
+        "# HELP terelina_transitions_stored_total Raw state transitions stored in transition_blocks since start-up.",
+        "# TYPE terelina_transitions_stored_total counter",
+        f"terelina_transitions_stored_total {transitions['stored']}",
+        "# HELP terelina_transitions_buffered Raw state transitions waiting to be stored.",
+        "# TYPE terelina_transitions_buffered gauge",
+        f"terelina_transitions_buffered {transitions['buffered']}",
+    ]
+
+    alerts = get_alert_metrics()
+    lines += [
+        "# HELP terelina_alert_rules Enabled alert rules.",
+        "# TYPE terelina_alert_rules gauge",
+        f"terelina_alert_rules {alerts['rules']}",
+        "# HELP terelina_alerts_firing Devices an alert rule is firing for.",
+        "# TYPE terelina_alerts_firing gauge",
+    ]
+    lines += [f'terelina_alerts_firing{{rule="{rule}"}} {n}' for rule, n in alerts["firing"].items()]
+    lines += [
+        "# HELP terelina_alert_notifications_total Alert notifications since start-up, by outcome.",
+        "# TYPE terelina_alert_notifications_total counter",
+    ]
+    lines += [f'terelina_alert_notifications_total{{outcome="{outcome}"}} {n}'
+              for outcome, n in alerts["notifications"].items()]
+
+    return "\n".join(lines) + "\n"
+
 @router.get("/logs", response_model=list[SystemLogResponse])
 async def get_system_logs(
     db: connection = Depends(db_dependency),
@@ -0,0 +1,58 @@
+# back-end/app/api/routes/traces.py
+
+import logging
+from fastapi import APIRouter, Depends, HTTPException, Query
+from psycopg2.extensions import connection
+from psycopg2.extras import RealDictCursor
+
+from app.db.session import read_db_dependency
+from app.schemas.trace import TraceSummaryResponse
+
+router = APIRouter()
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Raw Edge Trace Endpoints
+# =====================================================================
+# Traces are requested with POST /admin/devices/{device_id}/trace and arrive
+# asynchronously once the device has finished capturing and uploading.
+
+@router.get("/traces", response_model=list[TraceSummaryResponse])
+async def list_traces(
+    db: connection = Depends(read_db_dependency),
+    device_id: str | None = Query(None),
+    limit: int = Query(50, le=500)
+):
+    """Lists stored raw edge traces, newest first."""
+    try:
+        with db.cursor(cursor_factory=RealDictCursor) as cur:
+            sql_query = "SELECT id, device_id, trace_id, received_at, complete, edge_count FROM edge_traces"
+            params = []
+            if device_id:
+                sql_query += " WHERE device_id = %s"
+                params.append(device_id)
+            sql_query += " ORDER BY received_at DESC LIMIT %s"
+            params.append(limit)
+            cur.execute(sql_query, tuple(params))
+            return cur.fetchall()
+    except Exception as e:
+        logger.error(f"Error listing edge traces: {e}")
+        raise HTTPException(status_code=500, detail="Failed to list traces.")
+
+@router.get("/traces/{trace_pk}", response_model=dict)
+async def get_trace(trace_pk: int, db: connection = Depends(read_db_dependency)):
+    """
+    Returns a trace document. Save it to a file and replay it with:
+    python back-end/scripts/fleet_simulator.py --trace <file>
+    """
+    try:
+        with db.cursor() as cur:
+            cur.execute("SELECT trace FROM edge_traces WHERE id = %s", (trace_pk,))
+            row = cur.fetchone()
+    except Exception as e:
+        logger.error(f"Error fetching edge trace {trace_pk}: {e}")
+        raise HTTPException(status_code=500, detail="Failed to fetch trace.")
+
+    if not row:
+        raise HTTPException(status_code=404, detail="Trace not found.")
+    return row[0]
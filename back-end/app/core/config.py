@@ -14,6 +14,13 @@ class Settings(BaseSettings):
     DB_PASSWORD: str
     DB_NAME: str
 
+    # Optional streaming read replica. When DB_REPLICA_HOST is unset, every
+    # query goes to the primary.
+    DB_REPLICA_HOST: str | None = None
+    DB_REPLICA_PORT: int = 5432
+    DB_REPLICA_MAX_LAG_S: float = 5.0       # Above this, "fresh" reads fall back to the primary
+    DB_REPLICA_LAG_CHECK_S: float = 2.0     # How long a lag measurement is reused
+
     # MQTT
     MQTT_BROKER_HOST: str
     MQTT_BROKER_PORT: int
@@ -21,9 +28,50 @@ class Settings(BaseSettings):
     MQTT_USERNAME: str | None = None
     MQTT_PASSWORD: str | None = None
     MQTT_CLIENT_ID: str
+    MQTT_TOPIC_TRACE: str = "sensors/barrier/trace/+"           # Raw edge trace chunks; last level is the device id
+    MQTT_TOPIC_COMMAND_PREFIX: str = "sensors/barrier/cmd"      # Device commands go to <prefix>/<device_id>
+    MQTT_TOPIC_ALARM: str = "sensors/barrier/alarm/+"           # Device alarms (e.g. jam)
+    MQTT_TOPIC_BACKLOG: str = "sensors/barrier/backlog/+"       # Products replayed by devices after an outage
+    MQTT_TOPIC_TIME_REQ: str = "sensors/barrier/time/req/+"     # Clock-sync pings from devices (no NTP on site)
+    MQTT_TOPIC_TIME_RESP_PREFIX: str = "sensors/barrier/time/resp"  # Clock-sync replies go to <prefix>/<device_id>
+    MQTT_TOPIC_HEARTBEAT: str = "sensors/barrier/heartbeat/#"  # Device heartbeats and Last Wills; last level is the device id
+
+    # Acknowledgments of committed products (devices with the durable product log)
+    ACK_TOPIC_PREFIX: str = "sensors/barrier/ack"   # Retained "<epoch>,<n>" to <prefix>/<device_id>
+    ACK_PUBLISH_INTERVAL_S: float = 1.0             # How often moved watermarks are stored and published
+    ACK_GAP_WARN_S: float = 600.0                   # Warn when a gap stalls a device's watermark this long
+
+    # Cross-station flow balance (stations and station_links tables)
+    FLOW_ALLOWED_LATENESS_S: float = 30.0   # Counts are joined once this old; later arrivals only count as late
+    FLOW_TICK_S: float = 1.0                # How often the join advances and closed minutes are stored
+
+    # Raw state transitions (transition_blocks table), replayed by back-end/scripts/recount_transitions.py
+    TRANSITIONS_ENABLED: bool = True
+    TRANSITION_BLOCK_S: float = 300.0       # A device's block is stored after this long...
+    TRANSITION_BLOCK_MAX: int = 4096        # ...or once it holds this many transitions
+
+    # Alerts (alert_rules table)
+    ALERTS_ENABLED: bool = True
+    ALERT_TICK_S: float = 1.0               # How often timers (windows, offline deadlines, shifts) are checked
+    ALERT_WEBHOOK_TIMEOUT_S: float = 5.0
+    ALERT_WEBHOOK_ATTEMPTS: int = 4         # Retried after 1, 4 and 16 s
+
+    # Live device state (/v1/devices), shared by the API workers in shared memory
+    DEVICES_SHM_PATH: str = "/dev/shm/terelina_devices"
+    DEVICES_MAX: int = 1024                 # Slots in the table: devices seen since it was created
+
+    # Retention of raw counts and rollups (policies in system_settings; runs every cleanup_interval_hours)
+    RETENTION_ENABLED: bool = True
+    RETENTION_CHECK_S: float = 600.0        # How often the backend checks whether the job is due
 
     # Application
     LOG_LEVEL: str = "INFO"
+    ADMIN_TOKEN: str | None = None          # Bearer token for /admin endpoints (disabled if unset)
+
+    # Profiling
+    PROFILER_ALWAYS_ON: bool = False        # Keep a low-rate profile of the last hour
+    PROFILER_ALWAYS_ON_HZ: float = 5.0
+    PROFILER_RETENTION_MINUTES: int = 60
 
     class Config:
         # This tells Pydantic to read variables from a .env file
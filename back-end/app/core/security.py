@@ -0,0 +1,39 @@
+# back-end/app/core/security.py
+
+import secrets
+from fastapi import Header, HTTPException
+
+from app.core.config import settings
+
+def require_admin(authorization: str | None = Header(None)):
+    """
+    FastAPI dependency guarding admin endpoints.
+    Expects 'Authorization: Bearer <ADMIN_TOKEN>'. Admin endpoints are
+    disabled entirely while ADMIN_TOKEN is not configured.
+    """
+    if not settings.ADMIN_TOKEN:
+        raise HTTPException(status_code=503, detail="Admin endpoints are disabled (ADMIN_TOKEN not set).")
+
+    scheme, _, token = (authorization or "").partition(" ")
+    if scheme.lower() != "bearer" or not secrets.compare_digest(token, settings.ADMIN_TOKEN):
+        raise HTTPException(status_code=401, detail="Invalid admin token.",
+                            headers={"WWW-Authenticate": "Bearer"})
+
+# Set by main.py in the worker that runs the MQTT client and the background
+# services (the device table's writer); the others only serve the API.
+_writer_worker = False
+
+def set_writer_worker(writer: bool):
+    global _writer_worker
+    _writer_worker = writer
+
+def require_writer():
+    """
+    FastAPI dependency guarding endpoints served from the background services'
+    memory (alerts, flow, metrics, MQTT status) or acting on them (reloads,
+    retention). Other workers answer 503 instead of empty data or a no-op;
+    clients retry and reach the writer.
+    """
+    if not _writer_worker:
+        raise HTTPException(status_code=503, detail="This worker does not run the background services; retry.",
+                            headers={"Retry-After": "1"})
@@ -1,14 +1,20 @@
 # back-end/app/db/session.py
 
+import psycopg2
 import psycopg2.pool
 import logging
+import math
+import threading
+import time
 from contextlib import contextmanager
 from app.core.config import settings
 
 logger = logging.getLogger(__name__)
 
-# Create a connection pool. It's thread-safe and will be created only once.
-db_pool = psycopg2.pool.SimpleConnectionPool(
+# Create a connection pool, created only once. Threaded: the MQTT thread and the
+# background services (acks, flow, transitions, alerts, retention, lag probe)
+# take connections concurrently.
+db_pool = psycopg2.pool.ThreadedConnectionPool(
     minconn=1,
     maxconn=10, # Adjust maxconn based on expected load
     host=settings.DB_HOST,
@@ -18,11 +24,57 @@ db_pool = psycopg2.pool.SimpleConnectionPool(
     password=settings.DB_PASSWORD
 )
 
+# Optional read replica pool. minconn=0 so a replica that is down at startup
+# does not prevent the API from booting; reads simply stay on the primary.
+replica_pool = None
+if settings.DB_REPLICA_HOST:
+    replica_pool = psycopg2.pool.ThreadedConnectionPool(
+        minconn=0,
+        maxconn=10,
+        host=settings.DB_REPLICA_HOST,
+        port=settings.DB_REPLICA_PORT,
+        dbname=settings.DB_NAME,
+        user=settings.DB_USER,
+        password=settings.DB_PASSWORD,
+        connect_timeout=3
+    )
+
+# Cached replica lag (seconds). None means "unknown / unreachable", infinity
+# a replica that answers but is not streaming from the primary.
+_replica_lag_s = None
+_replica_lag_checked_at = 0.0
+_replica_probing = False
+_replica_lock = threading.Lock()
+_route_counts = {"primary": 0, "replica": 0, "fallback": 0}
+_route_lock = threading.Lock()
+
+# Without a streaming WAL receiver the replica is frozen, however caught up it
+# looks. Otherwise its lag is the larger of the replay lag (zero once all WAL
+# received is replayed) and how far its heartbeat is behind the primary's.
+_REPLICA_LAG_QUERY = """
+    SELECT
+        (SELECT status FROM pg_stat_wal_receiver) = 'streaming',
+        CASE
+            WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0
+            ELSE COALESCE(EXTRACT(EPOCH FROM (NOW() - pg_last_xact_replay_timestamp())), 0)
+        END,
+        (SELECT beat_at FROM replica_heartbeat WHERE id = 1)
+"""
+
+# Stamps the primary's heartbeat and returns the previous stamp, which the
+# replica has had a whole check interval to replay.
+_HEARTBEAT_QUERY = """
+    UPDATE replica_heartbeat AS h SET beat_at = NOW()
+    FROM (SELECT beat_at FROM replica_heartbeat WHERE id = 1 FOR UPDATE) AS previous
+    WHERE h.id = 1
+    RETURNING previous.beat_at
+"""
+
 @contextmanager
 def get_db_connection():
     """
     Provides a database connection from the pool.
-    
+
     This is a context manager that automatically handles getting a
     connection and returning it to the pool.
     """
@@ -38,10 +90,137 @@ def get_db_connection():
         if conn:
             db_pool.putconn(conn)
 
+def _measure_replica_lag():
+    """Queries the replica for its lag. Returns None if unreachable."""
+    conn = None
+    try:
+        conn = replica_pool.getconn()
+        conn.autocommit = True
+        with conn.cursor() as cur:
+            cur.execute(_REPLICA_LAG_QUERY)
+            streaming, replay_lag, replica_beat = cur.fetchone()
+    except Exception as e:
+        logger.warning(f"Could not measure replica lag: {e}")
+        if conn:
+            # Drop the broken connection instead of returning it to the pool
+            replica_pool.putconn(conn, close=True)
+            conn = None
+        return None
+    finally:
+        if conn:
+            replica_pool.putconn(conn)
+
+    if not streaming:
+        return float("inf")
+    lag = float(replay_lag)
+    try:
+        with get_db_connection() as primary:
+            with primary.cursor() as cur:
+                cur.execute(_HEARTBEAT_QUERY)
+                row = cur.fetchone()
+            primary.commit()
+        if row and replica_beat is not None:
+            lag = max(lag, (row[0] - replica_beat).total_seconds())
+    except Exception as e:
+        logger.warning(f"Could not stamp the replica heartbeat: {e}")
+    return lag
+
+def get_replica_lag():
+    """
+    Returns the replica lag in seconds, refreshed at most every
+    DB_REPLICA_LAG_CHECK_S. One request probes the replica while the others
+    keep using the last measurement.
+    """
+    global _replica_lag_s, _replica_lag_checked_at, _replica_probing
+    if replica_pool is None:
+        return None
+
+    with _replica_lock:
+        if _replica_probing or time.monotonic() - _replica_lag_checked_at < settings.DB_REPLICA_LAG_CHECK_S:
+            return _replica_lag_s
+        _replica_probing = True
+    lag = None
+    try:
+        lag = _measure_replica_lag()
+    finally:
+        with _replica_lock:
+            _replica_lag_s = lag
+            _replica_lag_checked_at = time.monotonic()
+            _replica_probing = False
+    return lag
+
+def _count_route(route: str):
+    with _route_lock:
+        _route_counts[route] += 1
+
+@contextmanager
+def get_read_connection(max_lag_s: float | None = None):
+    """
+    Provides a read-only connection, preferring the replica.
+
+    With max_lag_s=None any reachable, streaming replica is used (dashboards
+    tolerate a few seconds of staleness). Otherwise the replica is used only while its
+    lag is within max_lag_s, and the primary serves the read instead.
+    """
+    lag = get_replica_lag()
+    use_replica = lag is not None and math.isfinite(lag) and (max_lag_s is None or lag <= max_lag_s)
+
+    if not use_replica:
+        _count_route("fallback" if replica_pool is not None else "primary")
+        with get_db_connection() as conn:
+            yield conn
+        return
+
+    _count_route("replica")
+    conn = None
+    try:
+        conn = replica_pool.getconn()
+        yield conn
+    except psycopg2.OperationalError as e:
+        logger.error(f"Replica connection error: {e}")
+        if conn:
+            replica_pool.putconn(conn, close=True)
+            conn = None
+        raise
+    finally:
+        if conn:
+            # Read-only sessions never commit; end the implicit transaction
+            conn.rollback()
+            replica_pool.putconn(conn)
+
+def _route_snapshot() -> dict:
+    with _route_lock:
+        return dict(_route_counts)
+
+def get_replica_status():
+    """Returns replica routing information for health checks and metrics."""
+    return {
+        "configured": replica_pool is not None,
+        "lag_seconds": get_replica_lag(),
+        "max_lag_seconds": settings.DB_REPLICA_MAX_LAG_S,
+        "routed_reads": _route_snapshot(),
+    }
+
 def db_dependency():
     """
     A FastAPI dependency that yields a database connection.
     This manages the connection lifecycle for each API request.
     """
     with get_db_connection() as conn:
-        yield conn
\ No newline at end of file
+        yield conn
+
+def read_db_dependency():
+    """
+    A FastAPI dependency for dashboard queries that tolerate replication lag.
+    Uses the replica whenever it is reachable.
+    """
+    with get_read_connection() as conn:
+        yield conn
+
+def fresh_read_db_dependency():
+    """
+    A FastAPI dependency for reads that must reflect recent ingest.
+    Uses the replica only while its lag is within DB_REPLICA_MAX_LAG_S.
+    """
+    with get_read_connection(max_lag_s=settings.DB_REPLICA_MAX_LAG_S) as conn:
+        yield conn
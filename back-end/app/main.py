@@ -5,8 +5,16 @@ from fastapi import FastAPI
 from fastapi.middleware.cors import CORSMiddleware
 
 from app.core.config import settings
-from app.api.routes import system, counts
-from app.services.mqtt_client import start_mqtt_client, stop_mqtt_client
+from app.core.security import set_writer_worker
+from app.api.routes import system, counts, traces, flow, alerts, devices, prometheus, admin
+from app.services.devices import start_device_table, stop_device_table
+from app.services.mqtt_client import start_mqtt_client, stop_mqtt_client, publish_retained
+from app.services.acks import start_ack_flusher, stop_ack_flusher
+from app.services.flow import start_flow_joiner, stop_flow_joiner
+from app.services.transitions import start_transition_recorder, stop_transition_recorder
+from app.services.alerts import start_alerts, stop_alerts
+from app.services.retention import start_retention, stop_retention
+from app.services.profiler import start_continuous_profiler, stop_continuous_profiler
 
 # --- Logging Configuration ---
 # Configure logging at the application's entry point
@@ -41,20 +49,48 @@ app.add_middleware(
 # Include the modularized routers with prefixes for versioning and organization
 app.include_router(system.router, tags=["System & Health"])
 app.include_router(counts.router, prefix="/v1", tags=["Counts & Statistics"])
+app.include_router(traces.router, prefix="/v1", tags=["Raw Edge Traces"])
+app.include_router(flow.router, prefix="/v1", tags=["Flow Balance"])
+app.include_router(alerts.router, prefix="/v1", tags=["Alerts"])
+app.include_router(devices.router, prefix="/v1", tags=["Devices"])
+app.include_router(prometheus.router, prefix="/prometheus", tags=["Prometheus API"])
+app.include_router(admin.router, prefix="/admin", tags=["Admin"])
 
 # --- Startup and Shutdown Events ---
 @app.on_event("startup")
 async def startup_event():
-    """Starts the MQTT client when the application starts."""
+    """Starts the MQTT client and the background services (acknowledgments, flow, transitions, alerts, retention, profiler)."""
     logger.info("FastAPI application starting up...")
+    start_continuous_profiler()
+    try:
+        writer = start_device_table()
+    except OSError as e:
+        logger.error(f"Could not open the shared device table: {e}")
+        writer = True
+    set_writer_worker(writer)
+    if not writer:
+        logger.info("Another worker runs the MQTT client and the background services; this one serves the API.")
+        return
     try:
         start_mqtt_client()
         logger.info("MQTT client started successfully.")
     except Exception as e:
         logger.error(f"Failed to start MQTT client on startup: {e}")
+    start_ack_flusher(publish_retained)
+    start_flow_joiner()
+    start_transition_recorder()
+    start_alerts()
+    start_retention()
 
 @app.on_event("shutdown")
 async def shutdown_event():
-    """Stops the MQTT client when the application shuts down."""
+    """Stops the MQTT client (and the optional profiler) when the application shuts down."""
     logger.info("FastAPI application shutting down...")
-    stop_mqtt_client()
\ No newline at end of file
+    stop_retention()
+    stop_alerts()
+    stop_flow_joiner()
+    stop_ack_flusher()
+    stop_mqtt_client()
+    stop_transition_recorder()
+    stop_device_table()
+    stop_continuous_profiler()
\ No newline at end of file
@@ -0,0 +1,30 @@
+# back-end/app/schemas/alert.py
+
+from pydantic import BaseModel
+from typing import Optional
+from datetime import datetime
+
+class AlertResponse(BaseModel):
+    """An alert rule currently firing for one device."""
+    rule_id: int
+    rule: str
+    kind: str
+    device_id: str
+    since: datetime
+    value: Optional[float] = None
+    notified: bool
+    message: Optional[str] = None
+
+class AlertEventResponse(BaseModel):
+    """A notification sent to a rule's webhook (or given up after its retries)."""
+    id: int
+    rule_id: int
+    device_id: str
+    status: str
+    value: Optional[float] = None
+    message: Optional[str] = None
+    since_at: Optional[datetime] = None
+    attempts: int
+    delivered_at: Optional[datetime] = None
+    error: Optional[str] = None
+    created_at: datetime
@@ -16,6 +16,21 @@ class StatisticsResponse(BaseModel):
     last_count_timestamp: Optional[datetime] = None
     query_timestamp: datetime = Field(default_factory=datetime.now)
 
+class RollupResponse(BaseModel):
+    """Products counted by one device in one minute."""
+    minute: datetime
+    device_id: str
+    counts: int
+
+class RollupInvalidationResponse(BaseModel):
+    """A closed rollup range [range_start, range_end) patched after it was read."""
+    id: int
+    device_id: str  # '*' for every device
+    range_start: datetime
+    range_end: datetime
+    counts_delta: Optional[int] = None
+    created_at: datetime
+
 class GrafanaTimeSeriesDatapoint(BaseModel):
     """
     Represents a single datapoint for Grafana's simple-json-datasource.
@@ -0,0 +1,23 @@
+# back-end/app/schemas/device.py
+
+from pydantic import BaseModel
+from typing import Optional
+from datetime import datetime
+
+class DeviceResponse(BaseModel):
+    """Latest known state of a device, from its states, counts, heartbeats and alarms."""
+    device_id: str
+    state: Optional[str] = None             # Sensor state: interrupted or clear
+    state_since: Optional[datetime] = None
+    online: Optional[bool] = None           # False after the broker published its Last Will
+    last_seen: Optional[datetime] = None
+    counted: int = 0                        # Products stored since the device table was created
+    last_count: Optional[datetime] = None
+    log_n: Optional[int] = None             # Latest number of its durable product log
+    rssi: Optional[int] = None
+    uptime_s: Optional[int] = None
+    heap: Optional[int] = None              # Free heap (bytes), from heartbeats
+    cfg: Optional[int] = None               # CONFIG_VERSION of its firmware, from heartbeats
+    queue: Optional[int] = None             # Messages waiting in its outbound queue, from heartbeats
+    heartbeat_at: Optional[datetime] = None
+    alarms: list[str] = []
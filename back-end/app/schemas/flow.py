@@ -0,0 +1,47 @@
+# back-end/app/schemas/flow.py
+
+from pydantic import BaseModel
+from typing import List, Optional
+from datetime import datetime
+
+class FlowTotals(BaseModel):
+    """Counts of a station link since the backend started."""
+    upstream: int
+    downstream: int
+    matched: int
+    lost: int
+    unmatched: int
+    late: int
+    loss_rate: Optional[float] = None
+
+class TransitBucket(BaseModel):
+    """Transit times up to 'le' seconds (null: longer than the last edge)."""
+    le: Optional[float] = None
+    count: int
+
+class FlowWindow(BaseModel):
+    """Counts and transit-time distribution of a station link over the last hour."""
+    upstream: int
+    downstream: int
+    matched: int
+    lost: int
+    unmatched: int
+    loss_rate: Optional[float] = None
+    transit_mean_s: Optional[float] = None
+    transit_p50_s: Optional[float] = None
+    transit_p90_s: Optional[float] = None
+    transit_p99_s: Optional[float] = None
+    transit_histogram: List[TransitBucket]
+
+class FlowLinkResponse(BaseModel):
+    """Flow balance of one belt section between two stations."""
+    upstream: str
+    downstream: str
+    upstream_device: str
+    downstream_device: str
+    transit_min_s: float
+    transit_max_s: float
+    wip: int
+    joined_until: Optional[datetime] = None
+    totals: FlowTotals
+    last_hour: FlowWindow
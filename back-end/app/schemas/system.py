@@ -16,7 +16,10 @@ class MqttStatusResponse(BaseModel):
     connected: bool
     broker: str
     subscribed_topic: str
-    last_sensor_state: str
+    sensor_states: dict[str, str]  # Last stable beam state per device
+    last_sensor_state: str = Field(
+        description="Deprecated: state of the device updated last. Use sensor_states.", deprecated=True
+    )
 
 class SystemLogResponse(BaseModel):
     """Schema for a single system log entry."""
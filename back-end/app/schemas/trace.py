@@ -0,0 +1,19 @@
+# back-end/app/schemas/trace.py
+
+from pydantic import BaseModel
+from datetime import datetime
+
+class TraceSummaryResponse(BaseModel):
+    """Schema for a stored raw edge trace, without its edges."""
+    id: int
+    device_id: str
+    trace_id: int
+    received_at: datetime
+    complete: bool
+    edge_count: int
+
+class TraceRequestResponse(BaseModel):
+    """Schema for the response to a trace capture request."""
+    device_id: str
+    command: str
+    sent: bool
@@ -0,0 +1,192 @@
+# back-end/app/services/acks.py
+
+import logging
+import threading
+import time
+
+from app.core.config import settings
+from app.db.session import get_db_connection
+
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Commit Watermarks
+# =====================================================================
+#
+# Devices built with the durable product log (firmware_esp32/src/product_log.cpp)
+# number their products "n" = 1, 2, 3... within a random log "epoch". A
+# product is acknowledged once its row is committed in pizza_counts. The
+# device trims its flash log below the acknowledgment, so it must cover only
+# products that are committed *and* every product before them: it is the
+# highest n below which nothing is missing (the watermark), not the highest
+# n seen. Products arrive out of order (live states, backlog, replays), so
+# numbers above a gap wait in a pending set until the gap fills.
+#
+# A gap is skipped only when the device declares it: every product carries
+# "first", the oldest number still in its flash log. Unacknowledged numbers
+# below it were dropped by the device's flash bound and will never arrive.
+# A gap that stalls the watermark for ACK_GAP_WARN_S is only logged: a slow
+# replay (the backlog class is rate-limited) must not be acknowledged away.
+
+class _DeviceLog:
+    __slots__ = ("epoch", "watermark", "pending", "first", "gap_since", "gap_warned", "dirty")
+
+    def __init__(self, epoch: int, watermark: int = 0):
+        self.epoch = epoch
+        self.watermark = watermark
+        self.pending = set()
+        self.first = 0          # Oldest number still in the device's flash, as last declared
+        self.gap_since = None   # When the watermark last stopped in front of a gap (monotonic)
+        self.gap_warned = False
+        self.dirty = False      # Watermark not yet stored and published
+
+_logs: dict[str, _DeviceLog] = {}
+_lock = threading.Lock()
+_flusher = None
+
+def _advance(log: _DeviceLog, now: float):
+    """Moves the watermark over contiguous committed numbers and over those the device dropped."""
+    start = log.watermark
+    if log.first - 1 > log.watermark:
+        # The device no longer has these: committed or not, they will never be sent
+        dropped = log.first - 1 - log.watermark - sum(1 for n in log.pending if n < log.first)
+        if dropped:
+            logger.warning(f"Device dropped {dropped} unacknowledged product(s) of log epoch {log.epoch} "
+                           f"below {log.first}; acknowledging past them.")
+        log.watermark = log.first - 1
+        log.pending = {n for n in log.pending if n > log.watermark}
+    while log.watermark + 1 in log.pending:
+        log.watermark += 1
+        log.pending.discard(log.watermark)
+    if log.watermark != start:
+        log.dirty = True
+        log.gap_since = None  # The gap timer restarts whenever the watermark moves
+        log.gap_warned = False
+    if not log.pending:
+        log.gap_since = None
+    elif log.gap_since is None:
+        log.gap_since = now
+    elif not log.gap_warned and now - log.gap_since >= settings.ACK_GAP_WARN_S:
+        log.gap_warned = True
+        logger.warning(f"Acknowledgment of epoch {log.epoch} stalled at {log.watermark} for "
+                       f"{settings.ACK_GAP_WARN_S:.0f} s: {len(log.pending)} product(s) wait above the gap.")
+
+def record_commit(device_id: str, epoch: int, n: int, first: int = 0):
+    """
+    Marks product n of a device's log epoch as committed (or already present).
+    first is the oldest number the device still has (0 if not sent).
+    """
+    now = time.monotonic()
+    with _lock:
+        log = _logs.get(device_id)
+        if log is None or log.epoch != epoch:
+            # First product of a new log (e.g. the device's flash was erased)
+            if log is not None:
+                logger.info(f"Device {device_id} started log epoch {epoch} (was {log.epoch}).")
+            log = _logs[device_id] = _DeviceLog(epoch)
+        log.first = max(log.first, first)
+        if n > log.watermark:
+            log.pending.add(n)
+        _advance(log, now)
+
+def get_ack_status() -> dict:
+    """Watermark and numbers waiting above a gap, per device."""
+    with _lock:
+        return {device: {"epoch": log.epoch, "acked": log.watermark, "pending": len(log.pending)}
+                for device, log in _logs.items()}
+
+# =====================================================================
+# Storage and Publishing
+# =====================================================================
+
+def _load_watermarks():
+    """Restores the last stored watermarks, so acknowledgments resume after a restart."""
+    try:
+        with get_db_connection() as conn:
+            with conn.cursor() as cur:
+                cur.execute("SELECT device_id, log_epoch, acked_n FROM device_acks")
+                rows = cur.fetchall()
+    except Exception as e:
+        logger.error(f"Could not load device acknowledgments: {e}")
+        return
+    with _lock:
+        for device_id, epoch, acked in rows:
+            _logs.setdefault(device_id, _DeviceLog(epoch, acked))
+    logger.info(f"Loaded acknowledgments of {len(rows)} device(s).")
+
+def _flush(publish):
+    """Stores and publishes (retained) every watermark that moved."""
+    now = time.monotonic()
+    with _lock:
+        for log in _logs.values():
+            _advance(log, now)  # Stalled gaps are also reported without new products
+        changed = [(device, log.epoch, log.watermark) for device, log in _logs.items() if log.dirty]
+    if not changed:
+        return
+
+    # Store first: a published acknowledgment lets the device delete its copy
+    try:
+        with get_db_connection() as conn:
+            with conn.cursor() as cur:
+                cur.executemany(
+                    "INSERT INTO device_acks (device_id, log_epoch, acked_n, updated_at) "
+                    "VALUES (%s, %s, %s, NOW()) "
+                    "ON CONFLICT (device_id) DO UPDATE SET log_epoch = EXCLUDED.log_epoch, "
+                    "acked_n = EXCLUDED.acked_n, updated_at = EXCLUDED.updated_at",
+                    changed
+                )
+                conn.commit()
+    except Exception as e:
+        logger.error(f"Could not store device acknowledgments: {e}")
+        return
+
+    for device, epoch, acked in changed:
+        if not publish(f"{settings.ACK_TOPIC_PREFIX}/{device}", f"{epoch},{acked}"):
+            continue  # Stays dirty: retried on the next flush
+        with _lock:
+            log = _logs.get(device)
+            if log and log.epoch == epoch and log.watermark == acked:
+                log.dirty = False
+
+class AckFlusher:
+    """Stores and publishes moved watermarks every ACK_PUBLISH_INTERVAL_S in a background thread."""
+
+    def __init__(self, publish):
+        self._publish = publish
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, name="ack-flusher", daemon=True)
+
+    def _run(self):
+        while not self._stop.wait(settings.ACK_PUBLISH_INTERVAL_S):
+            try:
+                _flush(self._publish)
+            except Exception as e:
+                logger.error(f"Acknowledgment flush failed: {e}")
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join(timeout=2)
+        _flush(self._publish)  # Last watermarks before shutdown
+
+def start_ack_flusher(publish):
+    """
+    Loads the stored watermarks and starts publishing acknowledgments.
+    publish(topic, payload) must send a retained QoS 1 message and return
+    True if it was handed to the broker.
+    """
+    global _flusher
+    if _flusher:
+        return
+    _load_watermarks()
+    _flusher = AckFlusher(publish)
+    _flusher.start()
+    logger.info(f"Acknowledgment flusher started (every {settings.ACK_PUBLISH_INTERVAL_S} s).")
+
+def stop_ack_flusher():
+    global _flusher
+    if _flusher:
+        _flusher.stop()
+        _flusher = None
@@ -0,0 +1,558 @@
+# back-end/app/services/alerts.py
+
+import heapq
+import itertools
+import json
+import logging
+import queue
+import threading
+import time
+import urllib.request
+from datetime import datetime, timedelta, timezone
+from zoneinfo import ZoneInfo, ZoneInfoNotFoundError
+
+from app.core.config import settings
+from app.db.session import get_db_connection
+
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Alert Rules on Live Aggregates
+# =====================================================================
+#
+# Rules (alert_rules table) are evaluated against per-device aggregates kept
+# in memory, never by polling SQL:
+#   low_count        fewer than <threshold> products in the last window_s
+#   offline          no message from the device for <threshold> seconds
+#   throughput_drop  rate over the last window_s is <threshold> % below the
+#                    rate over the baseline_s before it
+# A rule without a device applies to every device. A rule with a shift
+# (local times, system_settings 'timezone') only fires inside it, once its
+# whole window is inside it.
+#
+# Counts go into 10 s buckets per device, and every window length the rules
+# use keeps a running sum. A count adds to the sums and re-evaluates only the
+# rules of its device. Everything that changes without a count is a timer in
+# one heap: a bucket leaving a window, an offline deadline, a shift boundary.
+# So the cost follows the traffic and the timers, not the number of rules.
+#
+# An alert (rule x device) notifies its webhook when it starts firing and
+# when it resolves; evaluations in between send nothing. One that fires
+# again within the rule's cooldown_s of its last notification is suppressed
+# (and so is its resolution). Notifications carry a dedup_key, are retried,
+# and are recorded in alert_events.
+
+BUCKET_S = 10
+KINDS = ("low_count", "offline", "throughput_drop")
+MIN_BASELINE_COUNTS = 10  # throughput_drop needs this many products in its baseline
+
+class _Rule:
+    __slots__ = ("id", "name", "kind", "device_id", "threshold", "window_s", "baseline_s", "shift_start",
+                 "shift_end", "webhook_url", "cooldown_s")
+
+    def __init__(self, id, name, kind, device_id, threshold, window_s, baseline_s, shift_start, shift_end,
+                 webhook_url, cooldown_s):
+        self.id, self.name, self.kind, self.device_id = id, name, kind, device_id
+        self.threshold = float(threshold)
+        self.window_s = -(-int(window_s) // BUCKET_S) * BUCKET_S  # Whole buckets
+        self.baseline_s = -(-int(baseline_s) // BUCKET_S) * BUCKET_S
+        self.shift_start, self.shift_end = shift_start, shift_end
+        self.webhook_url = webhook_url
+        self.cooldown_s = cooldown_s
+
+    def windows(self) -> tuple:
+        if self.kind == "low_count":
+            return (self.window_s,)
+        if self.kind == "throughput_drop":
+            return (self.window_s, self.window_s + self.baseline_s)
+        return ()
+
+class _Device:
+    __slots__ = ("observed_since", "last_seen", "buckets", "sums", "offline_firing")
+
+    def __init__(self, observed_since: float):
+        self.observed_since = observed_since  # The aggregates are complete from here on
+        self.last_seen = None
+        self.buckets = {}   # Bucket number -> products
+        self.sums = {}      # Window (s) -> products in the last window
+        self.offline_firing = 0
+
+class _Alert:
+    __slots__ = ("firing", "since", "value", "notified_at", "notified", "check_due")
+
+    def __init__(self):
+        self.firing = False
+        self.since = None
+        self.value = None
+        self.notified_at = None   # Last firing notification sent (for the cooldown)
+        self.notified = False     # This firing was notified, so its resolution is too
+        self.check_due = None     # Pending re-check (offline deadline, window complete)
+
+_rules: dict[int, _Rule] = {}
+_rules_by_device: dict[str, list[_Rule]] = {}
+_wildcard_rules: list[_Rule] = []
+_windows: tuple = ()
+_devices: dict[str, _Device] = {}
+_alerts: dict[tuple[int, str], _Alert] = {}
+_timers = []                   # (due, seq, kind, args)
+_seq = itertools.count()
+_tz = timezone.utc
+_lock = threading.Lock()
+_outbox = queue.Queue()
+_stats = {"delivered": 0, "failed": 0, "suppressed": 0}
+_evaluator = None
+_notifier = None
+
+def _schedule(due: float, kind: str, *args):
+    heapq.heappush(_timers, (due, next(_seq), kind, args))
+
+def _device_rules(device_id: str) -> list[_Rule]:
+    return _rules_by_device.get(device_id, []) + _wildcard_rules
+
+def _device(device_id: str, now: float) -> _Device:
+    device = _devices.get(device_id)
+    if device is None:
+        device = _devices[device_id] = _Device(now)
+        device.sums = dict.fromkeys(_windows, 0)
+    return device
+
+# =====================================================================
+# Shifts
+# =====================================================================
+
+def _in_shift(rule: _Rule, t: float) -> bool:
+    local = datetime.fromtimestamp(t, _tz).time()
+    if rule.shift_start <= rule.shift_end:
+        return rule.shift_start <= local < rule.shift_end
+    return local >= rule.shift_start or local < rule.shift_end  # Overnight shift
+
+def _active(rule: _Rule, now: float) -> bool:
+    """Inside the rule's shift, with its whole window inside it too."""
+    if rule.shift_start is None or rule.shift_end is None:
+        return True
+    return _in_shift(rule, now) and (rule.kind == "offline" or _in_shift(rule, now - rule.window_s))
+
+def _next_boundary(rule: _Rule, now: float) -> float:
+    """Next time _active() may change without a count: the shift end, or its start plus the window."""
+    local = datetime.fromtimestamp(now, _tz)
+    boundaries = []
+    for moment, offset in ((rule.shift_end, 0), (rule.shift_start, 0 if rule.kind == "offline" else rule.window_s)):
+        at = datetime.combine(local.date(), moment, _tz) + timedelta(seconds=offset)
+        while at.timestamp() <= now:
+            at += timedelta(days=1)
+        boundaries.append(at.timestamp())
+    return min(boundaries)
+
+# =====================================================================
+# Evaluation
+# =====================================================================
+
+def _describe(rule: _Rule, device_id: str, value: float) -> str:
+    if rule.kind == "low_count":
+        return (f"{device_id}: {value:.0f} product(s) in the last {rule.window_s / 60:g} min "
+                f"(alert below {rule.threshold:g})")
+    if rule.kind == "offline":
+        return f"{device_id}: no message for {value:.0f} s (alert after {rule.threshold:g} s)"
+    return (f"{device_id}: throughput {value:.0f} % below the previous {rule.baseline_s / 60:g} min over the "
+            f"last {rule.window_s / 60:g} min (alert above {rule.threshold:g} %)")
+
+def _check_at(rule: _Rule, device_id: str, alert: _Alert, due: float):
+    if alert.check_due is None:
+        alert.check_due = due
+        _schedule(due, "check", rule.id, device_id)
+
+def _evaluate(rule: _Rule, device_id: str, device: _Device, now: float):
+    """Re-checks one alert against the device's aggregates and notifies on a change."""
+    key = (rule.id, device_id)
+    alert = _alerts.get(key)
+    if alert is None:
+        alert = _alerts[key] = _Alert()
+    active = _active(rule, now)
+    value = None
+    firing = False
+    observed = sum(rule.windows()[-1:])
+    if now - device.observed_since < observed:
+        _check_at(rule, device_id, alert, device.observed_since + observed)  # Not a whole window seen yet
+    elif rule.kind == "low_count":
+        value = device.sums[rule.window_s]
+        firing = active and value < rule.threshold
+    elif rule.kind == "offline":
+        value = now - device.last_seen
+        firing = active and value >= rule.threshold
+        if active and not firing:
+            _check_at(rule, device_id, alert, device.last_seen + rule.threshold)
+    else:
+        recent = device.sums[rule.window_s]
+        baseline = device.sums[rule.window_s + rule.baseline_s] - recent
+        if baseline >= MIN_BASELINE_COUNTS:
+            value = 100 * (1 - (recent / rule.window_s) / (baseline / rule.baseline_s))
+            firing = active and value > rule.threshold
+    alert.value = value
+
+    if firing == alert.firing:
+        return
+    alert.firing = firing
+    if rule.kind == "offline":
+        device.offline_firing += 1 if firing else -1
+    if firing:
+        alert.since = now
+        if alert.notified_at is not None and now - alert.notified_at < rule.cooldown_s:
+            alert.notified = False
+            _stats["suppressed"] += 1
+            logger.info(f"Alert '{rule.name}' on {device_id} suppressed (cooldown): {_describe(rule, device_id, value)}")
+            return
+        alert.notified = True
+        alert.notified_at = now
+        _notify(rule, device_id, alert, "firing", now)
+    elif alert.notified:
+        alert.notified = False
+        _notify(rule, device_id, alert, "resolved", now)
+
+def _evaluate_device(device_id: str, device: _Device, now: float, kinds=KINDS):
+    for rule in _device_rules(device_id):
+        if rule.kind in kinds:
+            _evaluate(rule, device_id, device, now)
+
+def _notify(rule: _Rule, device_id: str, alert: _Alert, status: str, now: float):
+    value = alert.value
+    message = _describe(rule, device_id, value) if value is not None else f"{device_id}: {rule.name}"
+    logger.warning(f"Alert '{rule.name}' {status}: {message}")
+    _outbox.put({
+        "rule_id": rule.id,
+        "webhook_url": rule.webhook_url,
+        "payload": {
+            "dedup_key": f"{rule.id}:{device_id}:{int(alert.since)}",
+            "status": status,
+            "rule": {"id": rule.id, "name": rule.name, "kind": rule.kind, "threshold": rule.threshold,
+                     "window_s": rule.window_s},
+            "device_id": device_id,
+            "value": round(value, 3) if value is not None else None,
+            "message": message,
+            "since": datetime.fromtimestamp(alert.since, timezone.utc).isoformat(),
+            "at": datetime.fromtimestamp(now, timezone.utc).isoformat(),
+        },
+    })
+
+def _add_counts(device_id: str, device: _Device, bucket: int, n: int, now_bucket: int):
+    """Adds n products to a bucket and to the windows still covering it."""
+    if bucket not in device.buckets:
+        device.buckets[bucket] = 0
+        # One timer per bucket: the next window it leaves (see _run_timers)
+        window = next(w for w in _windows if bucket + w // BUCKET_S > now_bucket)
+        _schedule((bucket + window // BUCKET_S) * BUCKET_S, "expire", device_id, bucket, window)
+    device.buckets[bucket] += n
+    for window in _windows:
+        if bucket + window // BUCKET_S > now_bucket:
+            device.sums[window] += n
+
+def record_alert_count(device_id: str, age_ms: int = 0):
+    """A product stored for a device (age_ms ago)."""
+    now = time.time()
+    bucket = int((now - age_ms / 1000) // BUCKET_S)
+    now_bucket = int(now // BUCKET_S)
+    with _lock:
+        device = _device(device_id, now)
+        device.last_seen = now
+        if not _windows or bucket + max(_windows) // BUCKET_S <= now_bucket:
+            if device.offline_firing:
+                _evaluate_device(device_id, device, now, ("offline",))
+            return  # Too old for any window
+        _add_counts(device_id, device, bucket, 1, now_bucket)
+        _evaluate_device(device_id, device, now)
+
+def record_device_seen(device_id: str):
+    """Any message from a device: it is online."""
+    now = time.time()
+    with _lock:
+        device = _devices.get(device_id)
+        if device is None:
+            device = _device(device_id, now)
+            device.last_seen = now
+            _evaluate_device(device_id, device, now)  # Starts its offline checks
+            return
+        device.last_seen = now
+        if device.offline_firing:
+            _evaluate_device(device_id, device, now, ("offline",))
+
+def _run_timers(now: float):
+    """Handles every timer due: windows moving past buckets, offline deadlines, shift boundaries."""
+    dirty = {}
+    while _timers and _timers[0][0] <= now:
+        _, _, kind, args = heapq.heappop(_timers)
+        if kind == "expire":
+            device_id, bucket, window = args
+            device = _devices[device_id]
+            device.sums[window] -= device.buckets.get(bucket, 0)
+            longer = _windows.index(window) + 1
+            if longer < len(_windows):
+                _schedule((bucket + _windows[longer] // BUCKET_S) * BUCKET_S, "expire", device_id, bucket,
+                          _windows[longer])
+            else:
+                device.buckets.pop(bucket, None)
+            dirty[device_id] = device
+        elif kind == "check":
+            rule_id, device_id = args
+            rule, alert, device = _rules.get(rule_id), _alerts.get(args), _devices.get(device_id)
+            if alert is not None:
+                alert.check_due = None
+            if rule is not None and device is not None:
+                _evaluate(rule, device_id, device, now)
+        elif kind == "shift":
+            rule = _rules.get(args[0])
+            if rule is not None:
+                targets = [rule.device_id] if rule.device_id else list(_devices)
+                for device_id in targets:
+                    if device_id in _devices:
+                        _evaluate(rule, device_id, _devices[device_id], now)
+                _schedule(_next_boundary(rule, now), "shift", rule.id)
+    for device_id, device in dirty.items():
+        _evaluate_device(device_id, device, now, ("low_count", "throughput_drop"))
+
+def get_alert_status() -> list[dict]:
+    """Firing alerts, oldest first."""
+    with _lock:
+        firing = [(key, alert) for key, alert in _alerts.items() if alert.firing and key[0] in _rules]
+        return [{
+            "rule_id": rule_id,
+            "rule": _rules[rule_id].name,
+            "kind": _rules[rule_id].kind,
+            "device_id": device_id,
+            "since": datetime.fromtimestamp(alert.since, timezone.utc),
+            "value": alert.value,
+            "notified": alert.notified,
+            "message": _describe(_rules[rule_id], device_id, alert.value) if alert.value is not None else None,
+        } for (rule_id, device_id), alert in sorted(firing, key=lambda item: item[1].since)]
+
+def get_alert_metrics() -> dict:
+    with _lock:
+        firing = {}
+        for (rule_id, _), alert in _alerts.items():
+            if alert.firing and rule_id in _rules:
+                firing[_rules[rule_id].name] = firing.get(_rules[rule_id].name, 0) + 1
+        return {"rules": len(_rules), "firing": firing, "notifications": dict(_stats),
+                "timers": len(_timers)}
+
+# =====================================================================
+# Configuration and Storage
+# =====================================================================
+
+def _load_timezone(cur):
+    global _tz
+    cur.execute("SELECT value FROM system_settings WHERE key = 'timezone'")
+    row = cur.fetchone()
+    try:
+        _tz = ZoneInfo(row[0]) if row else timezone.utc
+    except (ZoneInfoNotFoundError, ValueError):
+        logger.warning(f"Unknown timezone {row[0]!r} in system_settings; alert shifts use UTC.")
+        _tz = timezone.utc
+
+def reload_alerts():
+    """
+    Loads the enabled rules and rebuilds the aggregates from the stored counts,
+    so a restart neither misses nor repeats alerts. The firing state and the
+    cooldowns come from alert_events.
+    """
+    global _rules, _rules_by_device, _wildcard_rules, _windows, _devices, _alerts, _timers
+    with get_db_connection() as conn:
+        with conn.cursor() as cur:
+            _load_timezone(cur)
+            cur.execute(
+                "SELECT id, name, kind, device_id, threshold, window_s, baseline_s, shift_start, shift_end, "
+                "webhook_url, cooldown_s FROM alert_rules WHERE enabled ORDER BY id"
+            )
+            rules = [_Rule(*row) for row in cur.fetchall()]
+            windows = tuple(sorted({w for rule in rules for w in rule.windows()}))
+            history_s = max(windows, default=0)
+            cur.execute(
+                "SELECT device_id, FLOOR(EXTRACT(EPOCH FROM \"timestamp\") / %s)::BIGINT, COUNT(*) "
+                "FROM pizza_counts WHERE device_id IS NOT NULL AND \"timestamp\" >= NOW() - %s * INTERVAL '1 second' "
+                "GROUP BY 1, 2",
+                (BUCKET_S, history_s)
+            )
+            buckets = cur.fetchall()
+            cur.execute(
+                "SELECT device_id, EXTRACT(EPOCH FROM MAX(\"timestamp\")) FROM pizza_counts "
+                "WHERE device_id IS NOT NULL AND \"timestamp\" >= NOW() - INTERVAL '1 day' GROUP BY 1"
+            )
+            last_counts = cur.fetchall()
+            # Latest event per alert (is it firing?), and its last firing notification (cooldown)
+            cur.execute(
+                "SELECT DISTINCT ON (rule_id, device_id) rule_id, device_id, status, since_at, "
+                "EXTRACT(EPOCH FROM MAX(created_at) FILTER (WHERE status = 'firing') "
+                "OVER (PARTITION BY rule_id, device_id)) "
+                "FROM alert_events WHERE created_at >= NOW() - INTERVAL '1 day' "
+                "ORDER BY rule_id, device_id, created_at DESC"
+            )
+            events = cur.fetchall()
+
+    now = time.time()
+    now_bucket = int(now // BUCKET_S)
+    with _lock:
+        previous = _devices
+        _rules = {rule.id: rule for rule in rules}
+        _rules_by_device, _wildcard_rules = {}, []
+        for rule in rules:
+            if rule.device_id:
+                _rules_by_device.setdefault(rule.device_id, []).append(rule)
+            else:
+                _wildcard_rules.append(rule)
+        _windows, _devices, _alerts, _timers = windows, {}, {}, []
+
+        # The stored counts cover the longest window; a device named by a rule
+        # but silent for a day counts as seen at load
+        loaded_since = now - history_s
+        for device_id, at in last_counts:
+            _device(device_id, loaded_since).last_seen = float(at)
+        for device_id, old in previous.items():
+            if old.last_seen is not None:
+                device = _device(device_id, loaded_since)
+                device.last_seen = max(device.last_seen or 0, old.last_seen)
+        for device_id in _rules_by_device:
+            device = _device(device_id, loaded_since)
+            if device.last_seen is None:
+                device.last_seen = now
+        for device_id, bucket, n in buckets:
+            _add_counts(device_id, _device(device_id, loaded_since), int(bucket), int(n), now_bucket)
+        for rule_id, device_id, status, since_at, last_firing in events:
+            if rule_id in _rules and device_id in _devices:
+                alert = _alerts[(rule_id, device_id)] = _Alert()
+                alert.notified_at = float(last_firing) if last_firing is not None else None
+                if status == "firing":
+                    alert.firing = alert.notified = True
+                    alert.since = since_at.timestamp() if since_at else now
+                    if _rules[rule_id].kind == "offline":
+                        _devices[device_id].offline_firing += 1
+
+        for rule in rules:
+            if rule.shift_start is not None and rule.shift_end is not None:
+                _schedule(_next_boundary(rule, now), "shift", rule.id)
+        for device_id, device in _devices.items():
+            _evaluate_device(device_id, device, now)
+    logger.info(f"Alerts: {len(rules)} rule(s), {len(_devices)} device(s), {len(windows)} window length(s).")
+
+# =====================================================================
+# Webhook Delivery
+# =====================================================================
+
+def post_webhook(url: str, payload: dict):
+    """POSTs one JSON notification; raises on a network error or a non-2xx answer."""
+    request = urllib.request.Request(url, data=json.dumps(payload).encode(), method="POST",
+                                     headers={"Content-Type": "application/json"})
+    with urllib.request.urlopen(request, timeout=settings.ALERT_WEBHOOK_TIMEOUT_S) as response:
+        if not 200 <= response.status < 300:
+            raise RuntimeError(f"HTTP {response.status}")
+
+def send_test_alert(rule_id: int, device_id: str):
+    """POSTs a "test" notification for a loaded rule; raises KeyError for an unknown rule."""
+    with _lock:
+        rule = _rules[rule_id]
+    now = datetime.now(timezone.utc).isoformat()
+    post_webhook(rule.webhook_url, {
+        "dedup_key": f"{rule.id}:{device_id}:test", "status": "test",
+        "rule": {"id": rule.id, "name": rule.name, "kind": rule.kind, "threshold": rule.threshold,
+                 "window_s": rule.window_s},
+        "device_id": device_id, "value": None, "message": f"Test notification of '{rule.name}'",
+        "since": now, "at": now,
+    })
+
+def _store_event(item: dict, attempts: int, error: str | None):
+    payload = item["payload"]
+    try:
+        with get_db_connection() as conn:
+            with conn.cursor() as cur:
+                cur.execute(
+                    "INSERT INTO alert_events (rule_id, device_id, status, value, message, since_at, "
+                    "attempts, delivered_at, error) "
+                    "VALUES (%s, %s, %s, %s, %s, %s, %s, CASE WHEN %s IS NULL THEN NOW() END, %s)",
+                    (item["rule_id"], payload["device_id"], payload["status"], payload["value"],
+                     payload["message"], payload["since"], attempts, error, error)
+                )
+                conn.commit()
+    except Exception as e:
+        logger.error(f"Could not store alert event: {e}")
+
+class AlertNotifier:
+    """Delivers notifications to the rules' webhooks, retrying with backoff, in a background thread."""
+
+    def __init__(self):
+        self._stop = threading.Event()
+        self._retries = []  # (due, seq, item, attempts)
+        self._thread = threading.Thread(target=self._run, name="alert-notifier", daemon=True)
+
+    def _deliver(self, item: dict, attempts: int):
+        try:
+            post_webhook(item["webhook_url"], item["payload"])
+        except Exception as e:
+            if attempts < settings.ALERT_WEBHOOK_ATTEMPTS and not self._stop.is_set():
+                heapq.heappush(self._retries, (time.monotonic() + 4 ** (attempts - 1), next(_seq), item, attempts + 1))
+                return
+            logger.error(f"Alert webhook {item['webhook_url']} failed {attempts} time(s): {e}")
+            _stats["failed"] += 1
+            _store_event(item, attempts, str(e)[:500])
+            return
+        _stats["delivered"] += 1
+        _store_event(item, attempts, None)
+
+    def _run(self):
+        while not self._stop.is_set():
+            if self._retries and self._retries[0][0] <= time.monotonic():
+                _, _, item, attempts = heapq.heappop(self._retries)
+                self._deliver(item, attempts)
+                continue
+            try:
+                item = _outbox.get(timeout=0.5)
+            except queue.Empty:
+                continue
+            self._deliver(item, 1)
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join(timeout=settings.ALERT_WEBHOOK_TIMEOUT_S + 1)
+
+class AlertEvaluator:
+    """Runs the due timers every ALERT_TICK_S in a background thread."""
+
+    def __init__(self):
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, name="alert-evaluator", daemon=True)
+
+    def _run(self):
+        while not self._stop.wait(settings.ALERT_TICK_S):
+            try:
+                with _lock:
+                    _run_timers(time.time())
+            except Exception as e:
+                logger.error(f"Alert evaluation failed: {e}")
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join(timeout=2)
+
+def start_alerts():
+    """Loads the alert rules and starts evaluating and delivering them."""
+    global _evaluator, _notifier
+    if _evaluator or not settings.ALERTS_ENABLED:
+        return
+    try:
+        reload_alerts()
+    except Exception as e:
+        logger.error(f"Could not load the alert rules: {e}")
+    _notifier = AlertNotifier()
+    _notifier.start()
+    _evaluator = AlertEvaluator()
+    _evaluator.start()
+
+def stop_alerts():
+    global _evaluator, _notifier
+    if _evaluator:
+        _evaluator.stop()
+        _evaluator = None
+    if _notifier:
+        _notifier.stop()
+        _notifier = None
@@ -0,0 +1,291 @@
+# back-end/app/services/devices.py
+
+import json
+import logging
+import mmap
+import os
+import struct
+import tempfile
+import threading
+import time
+import zlib
+
+try:
+    import fcntl
+except ImportError:  # Windows: a single worker, which always writes
+    fcntl = None
+
+from app.core.config import settings
+
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Live Device State
+# =====================================================================
+#
+# The latest known state of every device (sensor state, products counted, last
+# seen, RSSI, heap, config version, outbound queue, active alarms), updated
+# from its states, counts, heartbeats and alarms. It lives in a table in shared
+# memory (DEVICES_SHM_PATH), so every API worker answers /v1/devices from the
+# same data without touching the database.
+#
+# Only one worker writes it: the first to lock the table, which is also the
+# one running the MQTT client (see main.py). Each slot holds one device as
+# JSON and a sequence number that is odd while the slot is being written;
+# readers copy the slot and retry until they see the same even number before
+# and after. Devices are found by open addressing on the CRC32 of their id,
+# so a lookup touches one or two slots. Slots are never freed: the table
+# keeps every device seen since it was created (DEVICES_MAX at most).
+
+_MAGIC = b"TRLDEV1\0"
+_HEADER = struct.Struct("<8sII")        # magic, slots, slot size
+_SLOT_HEADER = struct.Struct("<QHH")    # sequence, id length, data length
+_SLOT_BYTES = 512
+_ID_BYTES = 64
+_DATA_BYTES = _SLOT_BYTES - _SLOT_HEADER.size - _ID_BYTES
+_READ_RETRIES = 100
+_BUSY = ("", None)  # _read_slot: the slot stayed mid-write (or unreadable) through every retry
+
+_lock = threading.Lock()
+_map = None          # mmap of the table (read-only in readers)
+_map_inode = None
+_writer = False
+_lock_fd = None
+_slots: dict[str, int] = {}       # Writer: device -> slot
+_devices: dict[str, dict] = {}    # Writer: device -> its latest state
+
+def _path() -> str:
+    path = settings.DEVICES_SHM_PATH
+    if not os.path.isdir(os.path.dirname(path) or "."):
+        path = os.path.join(tempfile.gettempdir(), os.path.basename(path))  # No /dev/shm (e.g. not Linux)
+    return path
+
+def _size(slots: int) -> int:
+    return _HEADER.size + slots * _SLOT_BYTES
+
+def _slot_count() -> int:
+    return _HEADER.unpack_from(_map, 0)[1]
+
+def _offset(slot: int) -> int:
+    return _HEADER.size + slot * _SLOT_BYTES
+
+# =====================================================================
+# Writer (the worker running the MQTT client)
+# =====================================================================
+
+def start_device_table() -> bool:
+    """
+    Opens the shared device table. Returns True if this worker took the writer
+    lock and should run the MQTT client and the background services.
+    """
+    global _map, _map_inode, _writer, _lock_fd
+    if _writer:
+        return True
+    path = _path()
+    lock_fd = os.open(path + ".lock", os.O_RDWR | os.O_CREAT, 0o600)
+    if fcntl is not None:
+        try:
+            fcntl.flock(lock_fd, fcntl.LOCK_EX | fcntl.LOCK_NB)
+        except OSError:
+            os.close(lock_fd)
+            return False
+    _lock_fd = lock_fd
+
+    slots = settings.DEVICES_MAX
+    fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o644)
+    try:
+        header = os.pread(fd, _HEADER.size, 0)
+        if len(header) < _HEADER.size or _HEADER.unpack(header) != (_MAGIC, slots, _SLOT_BYTES):
+            # New table, or one of another size: replaced, so readers of the old one never see it shrink
+            os.close(fd)
+            tmp = f"{path}.{os.getpid()}"
+            fd = os.open(tmp, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o644)
+            os.ftruncate(fd, _size(slots))
+            os.pwrite(fd, _HEADER.pack(_MAGIC, slots, _SLOT_BYTES), 0)
+            os.replace(tmp, path)
+        _map = mmap.mmap(fd, _size(slots))
+        _map_inode = os.fstat(fd).st_ino
+    finally:
+        os.close(fd)
+
+    # Devices already in the table (the previous writer's), so their slots are reused
+    for slot in range(slots):
+        entry = _read_slot(slot)
+        if entry and entry is not _BUSY:
+            _slots[entry[0]] = slot
+            _devices[entry[0]] = entry[1]
+    _writer = True
+    logger.info(f"Device table {path}: {len(_devices)} device(s), {slots} slots.")
+    return True
+
+def stop_device_table():
+    global _map, _writer, _lock_fd
+    with _lock:
+        _writer = False
+        if _map is not None:
+            _map.close()
+            _map = None
+        if _lock_fd is not None:
+            os.close(_lock_fd)  # Releases the writer lock
+            _lock_fd = None
+
+def _store(device_id: str, device: dict):
+    """Writes a device's state to its slot (claimed on first use). Called with _lock held."""
+    slot = _slots.get(device_id)
+    if slot is None:
+        key = device_id.encode()[:_ID_BYTES]
+        slots = _slot_count()
+        start = zlib.crc32(key) % slots
+        for probe in range(slots):
+            candidate = (start + probe) % slots
+            if _SLOT_HEADER.unpack_from(_map, _offset(candidate))[1] == 0:
+                slot = _slots[device_id] = candidate
+                break
+        else:
+            logger.warning(f"Device table full ({slots} slots): {device_id} is not shared (raise DEVICES_MAX).")
+            _slots[device_id] = -1
+            return
+    if slot < 0:
+        return
+    key = device_id.encode()[:_ID_BYTES]
+    data = json.dumps(device, separators=(",", ":")).encode()
+    if len(data) > _DATA_BYTES:
+        data = json.dumps({k: device[k] for k in ("state", "last_seen", "online") if k in device}).encode()
+    offset = _offset(slot)
+    seq = struct.unpack_from("<Q", _map, offset)[0]
+    struct.pack_into("<Q", _map, offset, seq + 1)  # Odd: being written
+    struct.pack_into("<HH", _map, offset + 8, len(key), len(data))
+    base = offset + _SLOT_HEADER.size
+    _map[base:base + len(key)] = key
+    _map[base + _ID_BYTES:base + _ID_BYTES + len(data)] = data
+    struct.pack_into("<Q", _map, offset, seq + 2)
+
+def _update(device_id: str, changes: dict, count: bool = False, alarm: tuple | None = None, seen: bool = True):
+    if not _writer or not device_id:
+        return
+    now = time.time()
+    with _lock:
+        if not _writer:
+            return
+        device = dict(_devices.get(device_id) or {"counted": 0, "alarms": []})
+        device.update(changes)
+        if seen:
+            device["last_seen"] = now
+        if changes.get("state") and changes["state"] != (_devices.get(device_id) or {}).get("state"):
+            device["state_since"] = now
+        if count:
+            device["counted"] += 1
+            device["last_count"] = now
+        if alarm:
+            kind, active = alarm
+            device["alarms"] = sorted(set(device["alarms"]) | {kind} if active else set(device["alarms"]) - {kind})
+        _devices[device_id] = device
+        _store(device_id, device)
+
+def record_device_state(device_id: str, state: str, data: dict):
+    """A live state message: the sensor state and the link stats it carries."""
+    changes = {"state": state, "online": True}
+    for key in ("rssi", "uptime_s", "seq"):
+        if isinstance(data.get(key), int):
+            changes[key] = data[key]
+    _update(device_id, changes)
+
+def record_device_count(device_id: str, log_n: int | None = None):
+    """A product of the device was stored."""
+    _update(device_id, {"log_n": log_n} if log_n else {}, count=True)
+
+def record_device_heartbeat(device_id: str, data: dict, retained: bool = False):
+    """
+    A heartbeat (online, with rssi/heap/cfg/queue) or the broker's "offline"
+    Last Will. A retained one, replayed by the broker on subscribe, may be
+    old: it sets the fields but not last seen.
+    """
+    changes = {"online": data.get("status") != "offline"}
+    if not retained:
+        changes["heartbeat_at"] = time.time()
+    for key in ("rssi", "uptime_s", "heap", "cfg", "queue"):
+        if isinstance(data.get(key), int):
+            changes[key] = data[key]
+    _update(device_id, changes, seen=not retained)
+
+def record_device_alarm(device_id: str, kind: str, active: bool):
+    _update(device_id, {}, alarm=(str(kind), bool(active)))
+
+def record_device_message(device_id: str):
+    """Any other message (e.g. a backlog product): only last seen moves."""
+    _update(device_id, {})
+
+# =====================================================================
+# Readers (every worker)
+# =====================================================================
+
+def _attach() -> bool:
+    """Maps the table read-only, again if the writer replaced it."""
+    global _map, _map_inode
+    if _writer:
+        return True
+    path = _path()
+    try:
+        inode = os.stat(path).st_ino
+    except FileNotFoundError:
+        return False
+    if _map is not None and inode == _map_inode:
+        return True
+    with open(path, "rb") as f:
+        size = os.fstat(f.fileno()).st_size
+        if size < _HEADER.size:
+            return False
+        _map = mmap.mmap(f.fileno(), size, access=mmap.ACCESS_READ)
+        _map_inode = inode
+    if _HEADER.unpack_from(_map, 0)[0] != _MAGIC or size < _size(_slot_count()):
+        _map = None
+        return False
+    return True
+
+def _read_slot(slot: int) -> tuple[str, dict] | None:
+    """
+    (device_id, state) of a slot, None if empty; retried while the writer is
+    in the slot, then _BUSY. A busy slot is not empty: lookups probe past it.
+    """
+    offset = _offset(slot)
+    for _ in range(_READ_RETRIES):
+        raw = _map[offset:offset + _SLOT_BYTES]
+        seq, id_len, data_len = _SLOT_HEADER.unpack_from(raw)
+        if seq & 1 or struct.unpack_from("<Q", _map, offset)[0] != seq:
+            time.sleep(0)
+            continue
+        if id_len == 0:
+            return None
+        base = _SLOT_HEADER.size
+        try:
+            return (raw[base:base + id_len].decode(),
+                    json.loads(raw[base + _ID_BYTES:base + _ID_BYTES + data_len]))
+        except ValueError:
+            return _BUSY
+    return _BUSY
+
+def _public(device_id: str, device: dict) -> dict:
+    return {"device_id": device_id, **device}
+
+def get_device(device_id: str) -> dict | None:
+    """The latest state of one device, or None if it was never seen."""
+    if not _attach():
+        return None
+    key = device_id.encode()[:_ID_BYTES]
+    slots = _slot_count()
+    start = zlib.crc32(key) % slots
+    for probe in range(slots):
+        entry = _read_slot((start + probe) % slots)
+        if entry is None:
+            return None
+        if entry is not _BUSY and entry[0] == device_id:
+            return _public(*entry)
+    return None
+
+def list_devices() -> list[dict]:
+    """The latest state of every device, by id."""
+    if not _attach():
+        return []
+    entries = (_read_slot(slot) for slot in range(_slot_count()))
+    return sorted((_public(*entry) for entry in entries if entry and entry is not _BUSY),
+                  key=lambda d: d["device_id"])
@@ -0,0 +1,158 @@
+# back-end/app/services/edge_traces.py
+
+import json
+import logging
+import struct
+import threading
+import time
+from datetime import datetime, timezone
+
+from app.db.session import get_db_connection
+
+logger = logging.getLogger(__name__)
+
+# Document format shared with back-end/scripts/fleet_simulator.py --trace
+TRACE_FORMAT = "terelina-edge-trace/1"
+
+# Chunk header, see firmware_esp32/src/edge_trace.cpp for the layout
+_HEADER = struct.Struct("<cBHHBBII")
+_FLAG_LAST = 0x01
+_FLAG_OVERFLOW = 0x02
+_FLAG_INITIAL_INTERRUPTED = 0x04
+
+# Traces whose last chunk never arrives are stored as incomplete after this
+_REASSEMBLY_TIMEOUT_S = 300
+
+# Module-level state: (device_id, trace_id) -> partial trace
+_pending = {}
+_lock = threading.Lock()
+
+# =====================================================================
+# Chunk Decoding
+# =====================================================================
+
+def _decode_varints(data: bytes) -> list:
+    values, value, shift = [], 0, 0
+    for byte in data:
+        value |= (byte & 0x7F) << shift
+        if byte & 0x80:
+            shift += 7
+        else:
+            values.append(value)
+            value, shift = 0, 0
+    return values
+
+def decode_chunk(payload: bytes) -> dict:
+    """Decodes one binary trace chunk. Raises ValueError on malformed input."""
+    if len(payload) < _HEADER.size:
+        raise ValueError("trace chunk shorter than its header")
+    magic, version, trace_id, index, flags, edge_count, t0_us, duration_ms = _HEADER.unpack_from(payload)
+    if magic != b"T" or version != 1:
+        raise ValueError(f"unsupported trace chunk (magic={magic!r}, version={version})")
+
+    values = _decode_varints(payload[_HEADER.size:])
+    if len(values) != edge_count:
+        raise ValueError(f"chunk {index} declares {edge_count} edges but contains {len(values)}")
+
+    edges, t = [], t0_us
+    for value in values:
+        t += value >> 1
+        edges.append([t, value & 1])
+
+    return {
+        "trace_id": trace_id,
+        "index": index,
+        "last": bool(flags & _FLAG_LAST),
+        "overflowed": bool(flags & _FLAG_OVERFLOW),
+        "initial_interrupted": int(bool(flags & _FLAG_INITIAL_INTERRUPTED)),
+        "duration_ms": duration_ms,
+        "edges": edges,
+    }
+
+# =====================================================================
+# Reassembly and Storage
+# =====================================================================
+
+def _build_document(device_id: str, trace: dict) -> dict:
+    last_index = trace["last_index"]
+    expected = range(last_index + 1) if last_index is not None else range(max(trace["chunks"]) + 1)
+    missing = [i for i in expected if i not in trace["chunks"]]
+
+    edges = []
+    for index in sorted(trace["chunks"]):
+        edges.extend(trace["chunks"][index])
+
+    return {
+        "format": TRACE_FORMAT,
+        "device_id": device_id,
+        "trace_id": trace["trace_id"],
+        "received_at": trace["received_at"],
+        "duration_ms": trace["duration_ms"],
+        "initial_interrupted": trace["initial_interrupted"],
+        "overflowed": trace["overflowed"],
+        "complete": last_index is not None and not missing,
+        "missing_chunks": missing,
+        "edges": edges,  # [t_us since capture start, 1 = beam interrupted]
+    }
+
+def _store_document(doc: dict):
+    try:
+        with get_db_connection() as conn:
+            with conn.cursor() as cur:
+                cur.execute(
+                    """
+                    INSERT INTO edge_traces (device_id, trace_id, complete, edge_count, trace)
+                    VALUES (%s, %s, %s, %s, %s)
+                    """,
+                    (doc["device_id"], doc["trace_id"], doc["complete"], len(doc["edges"]), json.dumps(doc))
+                )
+                conn.commit()
+        logger.info(f"Edge trace stored: device={doc['device_id']} trace={doc['trace_id']} "
+                    f"edges={len(doc['edges'])} complete={doc['complete']}")
+    except Exception as e:
+        logger.error(f"Failed to store edge trace: {e}")
+
+def _expire_stale(now: float) -> list:
+    """Removes traces that stopped receiving chunks. Caller holds _lock."""
+    stale = [key for key, t in _pending.items() if now - t["updated"] > _REASSEMBLY_TIMEOUT_S]
+    return [(key[0], _pending.pop(key)) for key in stale]
+
+def handle_trace_chunk(device_id: str, payload: bytes):
+    """Adds a chunk to its trace and stores the trace once all chunks arrived."""
+    try:
+        chunk = decode_chunk(payload)
+    except ValueError as e:
+        logger.warning(f"Invalid trace chunk from {device_id}: {e}")
+        return
+
+    finished = []
+    now = time.time()
+    with _lock:
+        finished.extend(_expire_stale(now))
+
+        key = (device_id, chunk["trace_id"])
+        if chunk["index"] == 0 and 0 in _pending.get(key, {}).get("chunks", {}):
+            # The device restarted its trace ids; flush what we had
+            finished.append((device_id, _pending.pop(key)))
+
+        trace = _pending.setdefault(key, {
+            "trace_id": chunk["trace_id"],
+            "received_at": datetime.now(timezone.utc).isoformat(),
+            "duration_ms": chunk["duration_ms"],
+            "initial_interrupted": chunk["initial_interrupted"],
+            "overflowed": False,
+            "last_index": None,
+            "chunks": {},
+        })
+        trace["chunks"][chunk["index"]] = chunk["edges"]
+        trace["overflowed"] |= chunk["overflowed"]
+        trace["updated"] = now
+        if chunk["last"]:
+            trace["last_index"] = chunk["index"]
+
+        if trace["last_index"] is not None and len(trace["chunks"]) == trace["last_index"] + 1:
+            finished.append((device_id, _pending.pop(key)))
+
+    # Database writes happen outside the lock
+    for dev, trace in finished:
+        _store_document(_build_document(dev, trace))
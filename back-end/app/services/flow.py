@@ -0,0 +1,400 @@
+# back-end/app/services/flow.py
+
+import bisect
+import collections
+import logging
+import threading
+import time
+from datetime import datetime, timezone
+
+from app.core.config import settings
+from app.db.session import get_db_connection
+
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Cross-Station Flow Balance
+# =====================================================================
+#
+# Stations (one counting device each) are linked into a line graph by
+# station_links, e.g. oven exit -> packaging. Per link, the count streams of
+# both ends are joined on event time. Products keep their order on the
+# belt, so a downstream count takes the product in transit whose transit
+# time is closest to the middle of transit_min_s..transit_max_s; older
+# products skipped over can no longer arrive and are lost (scrap), as are
+# products still in transit after transit_max_s. The window should bracket
+# the real transit tightly: a learned average would drift by whole products.
+# Downstream counts with nothing to take are unmatched (usually a missed
+# upstream count). What is in transit is the link's WIP.
+#
+# Counts arrive slightly out of order (queueing on the devices, several
+# MQTT streams), so they wait in per-second buckets until the watermark
+# (now - FLOW_ALLOWED_LATENESS_S) passes them and are joined in time
+# order. Waiting, joining and expiring are O(1) per count (amortized).
+# Counts already behind the watermark when they arrive (e.g. a device
+# replaying an outage backlog) are stored as usual but only counted as
+# late here.
+
+# Upper edges of the transit-time histogram buckets: 0.5 s to ~1 h, 10 % apart (one more bucket is open-ended)
+TRANSIT_BUCKETS_S = tuple(round(0.5 * 1.1 ** k, 3) for k in range(95))
+METRICS_BUCKET_STEP = 4  # /metrics exports every 4th edge (46 % apart)
+WINDOW_MINUTES = 60  # Window of the rates and distributions reported per link
+
+class _Counters:
+    """Counters of one link, since start-up or in one minute (a slot of the link's ring)."""
+    __slots__ = ("minute", "upstream", "downstream", "matched", "lost", "unmatched", "late", "wip",
+                 "transit_sum_s", "histogram")
+
+    def __init__(self, minute: int = -1, wip: int = 0):
+        self.minute = minute
+        self.upstream = self.downstream = self.matched = self.lost = self.unmatched = self.late = 0
+        self.wip = wip  # In transit at the end of the minute (so far)
+        self.transit_sum_s = 0.0
+        self.histogram = [0] * (len(TRANSIT_BUCKETS_S) + 1)
+
+class _Link:
+    __slots__ = ("upstream", "downstream", "upstream_device", "downstream_device", "transit_min_ms",
+                 "transit_max_ms", "expected_ms", "in_transit", "totals", "ring")
+
+    def __init__(self, upstream, downstream, upstream_device, downstream_device, transit_min_s, transit_max_s):
+        self.upstream = upstream
+        self.downstream = downstream
+        self.upstream_device = upstream_device
+        self.downstream_device = downstream_device
+        self.transit_min_ms = int(transit_min_s * 1000)
+        self.transit_max_ms = int(transit_max_s * 1000)
+        self.expected_ms = (self.transit_min_ms + self.transit_max_ms) // 2
+        self.in_transit = collections.deque()  # Upstream count times (ms), oldest first
+        self.reset_counters()
+
+    def reset_counters(self):
+        self.totals = _Counters()
+        self.ring = [_Counters() for _ in range(WINDOW_MINUTES)]
+
+    def slot(self, t_ms: int) -> _Counters:
+        """Counters of the minute of t_ms. Only called with join times, which never go back."""
+        minute = t_ms // 60000
+        slot = self.ring[minute % WINDOW_MINUTES]
+        if slot.minute != minute:
+            slot.__init__(minute, len(self.in_transit))
+        return slot
+
+    def _count(self, t_ms: int, field: str):
+        for counters in (self.totals, self.slot(t_ms)):
+            setattr(counters, field, getattr(counters, field) + 1)
+
+    def on_upstream(self, t_ms: int):
+        self.in_transit.append(t_ms)
+        self._count(t_ms, "upstream")
+
+    def on_downstream(self, t_ms: int):
+        self.expire(t_ms)
+        self._count(t_ms, "downstream")
+        # Skip (as lost) products while the next one is a strictly closer match; each is skipped once
+        in_transit = self.in_transit
+        while len(in_transit) > 1 and t_ms - in_transit[1] >= self.transit_min_ms and \
+                abs(t_ms - in_transit[1] - self.expected_ms) < abs(t_ms - in_transit[0] - self.expected_ms):
+            in_transit.popleft()
+            self._count(t_ms, "lost")
+        if not in_transit or t_ms - in_transit[0] < self.transit_min_ms:
+            self._count(t_ms, "unmatched")
+            return
+        transit_s = (t_ms - in_transit.popleft()) / 1000
+        bucket = bisect.bisect_left(TRANSIT_BUCKETS_S, transit_s)
+        for counters in (self.totals, self.slot(t_ms)):
+            counters.matched += 1
+            counters.transit_sum_s += transit_s
+            counters.histogram[bucket] += 1
+
+    def expire(self, now_ms: int):
+        """Counts as lost the products in transit for longer than transit_max_s."""
+        while self.in_transit and now_ms - self.in_transit[0] > self.transit_max_ms:
+            self._count(self.in_transit.popleft() + self.transit_max_ms, "lost")
+
+_links: list[_Link] = []
+_by_device: dict[str, list[tuple[_Link, bool]]] = {}  # Device -> [(link, device is the upstream end)]
+_pending: dict[int, list[tuple[int, str]]] = {}       # Second -> (time ms, device) waiting for the watermark
+_joined_s = 0        # Every second up to this one has been joined
+_stored_minute = 0   # Every minute up to this one is in flow_minutes
+_lock = threading.Lock()
+_joiner = None
+
+def _now_ms() -> int:
+    return int(time.time() * 1000)
+
+def _watermark_s() -> int:
+    return (_now_ms() - int(settings.FLOW_ALLOWED_LATENESS_S * 1000)) // 1000
+
+def record_station_count(device_id: str, age_ms: int = 0):
+    """Queues a stored count for the join; ignored for devices that are not a station."""
+    t_ms = _now_ms() - age_ms
+    with _lock:
+        links = _by_device.get(device_id)
+        if not links:
+            return
+        second = t_ms // 1000
+        if second <= _joined_s:
+            for link, _ in links:
+                link.totals.late += 1
+            return
+        _pending.setdefault(second, []).append((t_ms, device_id))
+
+def _join_until(second: int):
+    """Joins the pending counts up to the given second, in time order, and expires overdue products."""
+    global _joined_s
+    if not _links:
+        _joined_s = max(_joined_s, second)
+        return
+    while _joined_s < second:
+        _joined_s += 1
+        for t_ms, device_id in sorted(_pending.pop(_joined_s, ())):
+            for link, is_upstream in _by_device.get(device_id, ()):
+                if is_upstream:
+                    link.on_upstream(t_ms)
+                else:
+                    link.on_downstream(t_ms)
+        end_ms = (_joined_s + 1) * 1000
+        for link in _links:
+            link.expire(end_ms)
+            link.slot(end_ms - 1).wip = len(link.in_transit)
+
+# =====================================================================
+# Reporting
+# =====================================================================
+
+def _percentile(histogram: list[int], q: float) -> float | None:
+    """Estimates a quantile of the transit time by interpolating inside its histogram bucket."""
+    total = sum(histogram)
+    if total == 0:
+        return None
+    rank = q * total
+    seen = 0
+    for bucket, count in enumerate(histogram):
+        if count and seen + count >= rank:
+            if bucket == len(TRANSIT_BUCKETS_S):
+                return float(TRANSIT_BUCKETS_S[-1])  # Open-ended bucket: a lower bound
+            low = TRANSIT_BUCKETS_S[bucket - 1] if bucket else 0.0
+            return round(low + (TRANSIT_BUCKETS_S[bucket] - low) * (rank - seen) / count, 3)
+        seen += count
+    return None
+
+def _loss_rate(counters: _Counters) -> float | None:
+    settled = counters.matched + counters.lost
+    return round(counters.lost / settled, 4) if settled else None
+
+def _window(link: _Link) -> _Counters:
+    """Sums the ring slots of the last WINDOW_MINUTES minutes."""
+    current = (_joined_s * 1000) // 60000
+    window = _Counters()
+    for slot in link.ring:
+        if current - WINDOW_MINUTES < slot.minute <= current:
+            for field in ("upstream", "downstream", "matched", "lost", "unmatched"):
+                setattr(window, field, getattr(window, field) + getattr(slot, field))
+            window.transit_sum_s += slot.transit_sum_s
+            window.histogram = [a + b for a, b in zip(window.histogram, slot.histogram)]
+    return window
+
+def get_flow_status() -> list[dict]:
+    """WIP, counts, loss rate and transit-time distribution of every link."""
+    with _lock:
+        joined_until = datetime.fromtimestamp(_joined_s + 1, tz=timezone.utc) if _links else None
+        status = []
+        for link in _links:
+            totals, window = link.totals, _window(link)
+            status.append({
+                "upstream": link.upstream,
+                "downstream": link.downstream,
+                "upstream_device": link.upstream_device,
+                "downstream_device": link.downstream_device,
+                "transit_min_s": link.transit_min_ms / 1000,
+                "transit_max_s": link.transit_max_ms / 1000,
+                "wip": len(link.in_transit),
+                "joined_until": joined_until,
+                "totals": {
+                    "upstream": totals.upstream, "downstream": totals.downstream, "matched": totals.matched,
+                    "lost": totals.lost, "unmatched": totals.unmatched, "late": totals.late,
+                    "loss_rate": _loss_rate(totals),
+                },
+                "last_hour": {
+                    "upstream": window.upstream, "downstream": window.downstream, "matched": window.matched,
+                    "lost": window.lost, "unmatched": window.unmatched,
+                    "loss_rate": _loss_rate(window),
+                    "transit_mean_s": round(window.transit_sum_s / window.matched, 3) if window.matched else None,
+                    "transit_p50_s": _percentile(window.histogram, 0.5),
+                    "transit_p90_s": _percentile(window.histogram, 0.9),
+                    "transit_p99_s": _percentile(window.histogram, 0.99),
+                    "transit_histogram": [{"le": le, "count": count} for le, count in
+                                          zip(TRANSIT_BUCKETS_S + (None,), window.histogram)],
+                },
+            })
+        return status
+
+def get_flow_metrics() -> list[dict]:
+    """Totals since start-up and cumulative transit buckets per link, for /metrics."""
+    with _lock:
+        return [{
+            "link": f"{link.upstream}->{link.downstream}",
+            "wip": len(link.in_transit),
+            "totals": {field: getattr(link.totals, field)
+                       for field in ("upstream", "downstream", "matched", "lost", "unmatched", "late")},
+            "transit_sum_s": link.totals.transit_sum_s,
+            "transit_buckets": _cumulative(link.totals.histogram),
+        } for link in _links]
+
+def _cumulative(histogram: list[int]) -> list[tuple]:
+    """(le, count up to le) for every METRICS_BUCKET_STEP-th edge, then "+Inf"."""
+    buckets = []
+    total = 0
+    for bucket, count in enumerate(histogram[:-1]):
+        total += count
+        if bucket % METRICS_BUCKET_STEP == METRICS_BUCKET_STEP - 1:
+            buckets.append((TRANSIT_BUCKETS_S[bucket], total))
+    buckets.append(("+Inf", total + histogram[-1]))
+    return buckets
+
+# =====================================================================
+# Configuration and Storage
+# =====================================================================
+
+def _load_links() -> list[_Link]:
+    """Reads the line graph. A station feeds and is fed by at most one link (the join assumes FIFO belts)."""
+    with get_db_connection() as conn:
+        with conn.cursor() as cur:
+            cur.execute(
+                "SELECT l.upstream, l.downstream, u.device_id, d.device_id, l.transit_min_s, l.transit_max_s "
+                "FROM station_links l "
+                "JOIN stations u ON u.station = l.upstream "
+                "JOIN stations d ON d.station = l.downstream "
+                "ORDER BY l.upstream, l.downstream"
+            )
+            rows = cur.fetchall()
+    links, feeds, fed = [], set(), set()
+    for upstream, downstream, upstream_device, downstream_device, transit_min_s, transit_max_s in rows:
+        if upstream in feeds or downstream in fed:
+            logger.warning(f"Ignoring link {upstream} -> {downstream}: splits and merges cannot be joined "
+                           f"in belt order.")
+            continue
+        feeds.add(upstream)
+        fed.add(downstream)
+        links.append(_Link(upstream, downstream, upstream_device, downstream_device, transit_min_s, transit_max_s))
+    return links
+
+def _recent_counts(devices: list[str], seconds: float) -> list[tuple[str, int]]:
+    with get_db_connection() as conn:
+        with conn.cursor() as cur:
+            cur.execute(
+                "SELECT device_id, (EXTRACT(EPOCH FROM \"timestamp\") * 1000)::BIGINT FROM pizza_counts "
+                "WHERE device_id = ANY(%s) AND \"timestamp\" >= NOW() - %s * INTERVAL '1 second' "
+                "ORDER BY \"timestamp\"",
+                (devices, seconds)
+            )
+            return cur.fetchall()
+
+def reload_flow():
+    """
+    Loads the line graph and rebuilds what is in transit from the stored
+    counts. Totals and the reporting window restart from zero.
+    """
+    global _links, _by_device, _pending, _joined_s, _stored_minute
+    links = _load_links()
+    by_device = {}
+    for link in links:
+        by_device.setdefault(link.upstream_device, []).append((link, True))
+        by_device.setdefault(link.downstream_device, []).append((link, False))
+    # Twice the longest transit: downstream counts early in the replay take
+    # products counted before it, which only settles after one transit
+    replay_s = 2 * max((link.transit_max_ms / 1000 for link in links), default=0) \
+        + settings.FLOW_ALLOWED_LATENESS_S
+    counts = _recent_counts(list(by_device), replay_s) if links else []
+
+    with _lock:
+        _links, _by_device, _pending = links, by_device, {}
+        _joined_s = (_now_ms() // 1000) - int(replay_s) - 1
+        for device_id, t_ms in counts:
+            if t_ms // 1000 > _joined_s:
+                _pending.setdefault(t_ms // 1000, []).append((t_ms, device_id))
+        _join_until(_watermark_s())
+        for link in links:
+            link.reset_counters()
+        _stored_minute = (_joined_s * 1000) // 60000
+    logger.info(f"Flow balance: {len(links)} station link(s), {len(counts)} recent count(s) replayed.")
+
+def _closed_minutes() -> list[tuple]:
+    """flow_minutes rows of the minutes the watermark has left since the last call."""
+    global _stored_minute
+    current = (_joined_s * 1000) // 60000
+    rows = []
+    for minute in range(max(_stored_minute + 1, current - WINDOW_MINUTES + 1), current):
+        at = datetime.fromtimestamp(minute * 60, tz=timezone.utc)
+        for link in _links:
+            slot = link.ring[minute % WINDOW_MINUTES]
+            if slot.minute != minute:
+                continue
+            rows.append((at, link.upstream, link.downstream, slot.upstream, slot.downstream, slot.matched,
+                         slot.lost, slot.unmatched, slot.wip, _percentile(slot.histogram, 0.5),
+                         _percentile(slot.histogram, 0.9)))
+    _stored_minute = max(_stored_minute, current - 1)
+    return rows
+
+def _tick():
+    with _lock:
+        _join_until(_watermark_s())
+        rows = _closed_minutes()
+    if not rows:
+        return
+    try:
+        with get_db_connection() as conn:
+            with conn.cursor() as cur:
+                cur.executemany(
+                    "INSERT INTO flow_minutes (minute, upstream, downstream, upstream_count, downstream_count, "
+                    "matched, lost, unmatched, wip, transit_p50_s, transit_p90_s) "
+                    "VALUES (%s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s) "
+                    "ON CONFLICT (upstream, downstream, minute) DO UPDATE SET "
+                    "upstream_count = EXCLUDED.upstream_count, downstream_count = EXCLUDED.downstream_count, "
+                    "matched = EXCLUDED.matched, lost = EXCLUDED.lost, unmatched = EXCLUDED.unmatched, "
+                    "wip = EXCLUDED.wip, transit_p50_s = EXCLUDED.transit_p50_s, "
+                    "transit_p90_s = EXCLUDED.transit_p90_s",
+                    rows
+                )
+                conn.commit()
+    except Exception as e:
+        logger.error(f"Could not store flow minutes: {e}")
+
+class FlowJoiner:
+    """Advances the watermark every FLOW_TICK_S and stores closed minutes, in a background thread."""
+
+    def __init__(self):
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, name="flow-joiner", daemon=True)
+
+    def _run(self):
+        while not self._stop.wait(settings.FLOW_TICK_S):
+            try:
+                _tick()
+            except Exception as e:
+                logger.error(f"Flow join failed: {e}")
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join(timeout=2)
+
+def start_flow_joiner():
+    """Loads the line graph and starts joining station counts."""
+    global _joiner
+    if _joiner:
+        return
+    try:
+        reload_flow()
+    except Exception as e:
+        logger.error(f"Could not load the station links: {e}")
+    _joiner = FlowJoiner()
+    _joiner.start()
+
+def stop_flow_joiner():
+    global _joiner
+    if _joiner:
+        _joiner.stop()
+        _joiner = None
@@ -6,18 +6,26 @@ import logging
 import time
 import os
 from psycopg2 import Error
+from psycopg2.extras import Json
 
 from app.core.config import settings
 from app.db.session import get_db_connection
+from app.services.edge_traces import handle_trace_chunk
+from app.services.acks import record_commit
+from app.services.flow import record_station_count
+from app.services.transitions import record_transition, INTERRUPTED, CLEAR, LOGGED_CLEAR, BACKLOG_PRODUCT
+from app.services.alerts import record_alert_count, record_device_seen
+from app.services.devices import (record_device_state, record_device_count, record_device_heartbeat,
+                                  record_device_alarm, record_device_message)
 
 logger = logging.getLogger(__name__)
 
 # Module-level state for the MQTT client
 _client = None
-_last_state = "unknown"
-_last_transition_ms = 0
-_initialized = False
-_DEBOUNCE_MS = 100  # Ignore state transitions faster than this (in ms)
+_sensor_states: dict[str, tuple[str, int]] = {}  # device -> (last stable state, its time in ms)
+_last_state = "unknown"  # Of the device updated last; only for the deprecated last_sensor_state
+_DEBOUNCE_MS = 100  # Ignore state transitions faster than this (in ms), per device
+_belt_speeds: dict[str, tuple[int, float]] = {}  # device -> (mm/s, time reported) from encoder-equipped devices
 
 # =====================================================================
 # Database Interaction
@@ -36,18 +44,47 @@ def _log_system_event(level: str, message: str, source: str = "mqtt"):
     except Exception as e:
         logger.error(f"Failed to log system event to DB: {e}")
 
-def _handle_pizza_count(sensor_id: str):
-    """Inserts a new pizza count record into the database."""
+def _handle_pizza_count(sensor_id: str, age_ms: int = 0, shape: dict | None = None, belt: dict | None = None,
+                        log: tuple[int, int, int] | None = None):
+    """
+    Inserts a new pizza count record into the database.
+    age_ms is how long ago the product was detected (messages queued on the device).
+    shape is the light-curtain profile of the product, when the device has one.
+    belt carries the encoder-measured length and gap before the product (0 = unknown).
+    log is the (epoch, n, first) number of the product in the device's durable
+    log, with the oldest number still in it: the same product may arrive
+    several times (live, backlog, replay) and is stored once; once committed
+    it is acknowledged back to the device.
+    """
+    length_mm = (belt or {}).get("len_mm") or None
+    gap_mm = (belt or {}).get("gap_mm") or None
+    log_epoch, log_n, log_first = log or (None, None, 0)
     try:
         # get_db_connection() uses the connection pool
         with get_db_connection() as conn:
             with conn.cursor() as cur:
                 # The timestamp is handled by the database's NOW() function
-                cur.execute("INSERT INTO pizza_counts (timestamp) VALUES (NOW())")
+                cur.execute(
+                    "INSERT INTO pizza_counts (timestamp, shape, length_mm, gap_mm, device_id, log_epoch, log_n) "
+                    "VALUES (NOW() - %s * INTERVAL '1 millisecond', %s, %s, %s, %s, %s, %s) "
+                    "ON CONFLICT DO NOTHING",
+                    (age_ms, Json(shape) if shape else None, length_mm, gap_mm, sensor_id, log_epoch, log_n)
+                )
+                inserted = cur.rowcount > 0
                 conn.commit()
 
+        if log:
+            record_commit(sensor_id, log_epoch, log_n, log_first)
+        if not inserted:
+            logger.debug(f"Product {log_n} of {sensor_id} (epoch {log_epoch}) already counted.")
+            return
+
         logger.info(f"Pizza count saved! Sensor ID: {sensor_id}")
+        record_station_count(sensor_id, age_ms)
+        record_alert_count(sensor_id, age_ms)
+        record_device_count(sensor_id, log_n)
         _log_system_event("INFO", f"Pizza counted from sensor: {sensor_id}")
+        _log_shape_defects(sensor_id, shape)
 
     except Error as e:
         logger.error(f"PostgreSQL error while saving count: {e}")
@@ -66,6 +103,11 @@ def _on_connect(client, userdata, flags, rc, properties=None):
         logger.info(f"Successfully connected to MQTT broker at {settings.MQTT_BROKER_HOST}")
         _log_system_event("INFO", "MQTT client connected")
         client.subscribe(settings.MQTT_TOPIC_STATE, qos=1)
+        client.subscribe(settings.MQTT_TOPIC_TRACE, qos=0)
+        client.subscribe(settings.MQTT_TOPIC_ALARM, qos=1)
+        client.subscribe(settings.MQTT_TOPIC_BACKLOG, qos=1)
+        client.subscribe(settings.MQTT_TOPIC_TIME_REQ, qos=0)
+        client.subscribe(settings.MQTT_TOPIC_HEARTBEAT, qos=1)
     else:
         logger.error(f"Failed to connect to MQTT broker, return code: {rc}")
         _log_system_event("ERROR", f"MQTT connection failed (code: {rc})")
@@ -81,15 +123,253 @@ def _normalize_state(raw_state: str) -> str | None:
     if raw_state is None:
         return None
     s = str(raw_state).strip().lower()
-    if s.startswith("interrompid") or s.startswith("interrupted"):
+    if s.startswith("interrompid") or s.startswith("interrupted") or s == "i":
         return "interrupted"
-    if s == "livre" or s == "clear":
+    if s == "livre" or s == "clear" or s == "c":
         return "clear"
     return None
 
+_SHAPE_FIELDS = ("w_mm", "len_mm", "x_mm", "pieces", "fill", "peak", "flags")
+_BELT_FIELDS = ("pos_mm", "mm_s", "len_mm", "gap_mm")
+_SHAPE_BROKEN = 1
+_SHAPE_FOLDED = 2
+
+def _parse_compact_shape(shape_str: str) -> dict | None:
+    """Parses the ";<w_mm>,<len_mm>,<x_mm>,<pieces>,<fill>,<peak>,<flags>" suffix of a compact payload."""
+    fields = shape_str.split(",")
+    if len(fields) != len(_SHAPE_FIELDS):
+        return None
+    try:
+        return dict(zip(_SHAPE_FIELDS, (int(f) for f in fields)))
+    except ValueError:
+        return None
+
+def _parse_compact_sections(data: dict, sections: list[str]):
+    """Adds the optional ";<shape>;<belt>;<epoch>,<n>[,<first>]" sections of a compact payload (any may be empty)."""
+    if sections and sections[0]:
+        data["shape"] = _parse_compact_shape(sections[0])
+    if len(sections) > 1 and sections[1]:
+        fields = sections[1].split(",")
+        try:
+            if len(fields) == len(_BELT_FIELDS):
+                data["belt"] = dict(zip(_BELT_FIELDS, (int(f) for f in fields)))
+        except ValueError:
+            pass
+    if len(sections) > 2 and sections[2]:
+        fields = sections[2].split(",")
+        if len(fields) in (2, 3):
+            data["log"] = dict(zip(("epoch", "n", "first"), fields))
+
+def _parse_compact_payload(payload_str: str) -> dict | None:
+    """
+    Parses the compact state payload sent over MQTT-SN:
+    "<id>,<i|c>,<rssi>,<uptime_s>[,<seq>[,<age_ms>[,<ts>]]][;<shape>[;<belt>[;<epoch>,<n>[,<first>]]]]".
+    Returns None if malformed.
+    """
+    head, *sections = payload_str.strip().split(";")
+    fields = head.split(",")
+    if len(fields) < 2 or not fields[0]:
+        return None
+    data = {"id": fields[0], "state": fields[1]}
+    for key, value in zip(("rssi", "uptime_s", "seq", "age_ms", "ts"), fields[2:]):
+        try:
+            data[key] = int(value)
+        except ValueError:
+            return None
+    _parse_compact_sections(data, sections)
+    return data
+
+def _valid_shape(value) -> dict | None:
+    """Keeps a light-curtain "shape" object only if it has the expected integer fields."""
+    if not isinstance(value, dict):
+        return None
+    try:
+        return {key: int(value[key]) for key in _SHAPE_FIELDS}
+    except (KeyError, TypeError, ValueError):
+        return None
+
+def _valid_belt(value) -> dict | None:
+    """Keeps an encoder "belt" object only if it has the expected integer fields."""
+    if not isinstance(value, dict):
+        return None
+    try:
+        return {key: int(value[key]) for key in _BELT_FIELDS}
+    except (KeyError, TypeError, ValueError):
+        return None
+
+def _valid_log(value) -> tuple[int, int, int] | None:
+    """Returns (epoch, n, first) from a durable-log "log" object (first 0 if absent), or None."""
+    if not isinstance(value, dict):
+        return None
+    try:
+        epoch, n, first = int(value["epoch"]), int(value["n"]), int(value.get("first", 0))
+    except (KeyError, TypeError, ValueError):
+        return None
+    return (epoch, n, first) if n > 0 else None
+
+def get_belt_speeds() -> dict[str, int]:
+    """Latest belt speed (mm/s) reported by each encoder-equipped device in the last few minutes."""
+    cutoff = time.time() - 300
+    return {device: mm_s for device, (mm_s, at) in _belt_speeds.items() if at >= cutoff}
+
+def _log_shape_defects(sensor_id: str, shape: dict | None):
+    """Records broken or folded products seen by a light curtain in the system log."""
+    if not shape:
+        return
+    defects = [name for bit, name in ((_SHAPE_BROKEN, "broken"), (_SHAPE_FOLDED, "folded")) if shape["flags"] & bit]
+    if defects:
+        message = (f"Product flagged {'/'.join(defects)} by {sensor_id} "
+                   f"(width {shape['w_mm']} mm, length {shape['len_mm']} mm, {shape['pieces']} piece(s))")
+        logger.warning(message)
+        _log_system_event("WARNING", message, source="sensor")
+
+def _parse_age_ms(value) -> int:
+    """Queueing age reported by the device; missing or invalid means 'now'."""
+    try:
+        return max(0, int(value))
+    except (TypeError, ValueError):
+        return 0
+
+_MAX_TS_SKEW_MS = 24 * 3600 * 1000  # A device "ts" further off than this is not trusted
+
+def _event_age_ms(data: dict) -> int:
+    """
+    How long ago the event happened. Devices whose clock is synchronized with
+    ours (see _handle_time_request) send the event time "ts" in Unix ms, which
+    stays exact across device restarts and retransmissions; otherwise the
+    queueing age "age_ms" is used.
+    """
+    try:
+        ts = int(data.get("ts"))
+    except (TypeError, ValueError):
+        return _parse_age_ms(data.get("age_ms"))
+    age = int(time.time() * 1000) - ts
+    if abs(age) > _MAX_TS_SKEW_MS:
+        return _parse_age_ms(data.get("age_ms"))
+    return max(0, age)
+
+def _handle_time_request(client, device_id: str, payload: bytes, received_us: int):
+    """
+    Answers a device clock-sync ping "<seq>,<t1>" with "<seq>,<t1>,<t2>,<t3>":
+    t2 when the request arrived, t3 when the reply is sent (Unix microseconds).
+    The device estimates its offset and drift from these, NTP style.
+    """
+    try:
+        seq, t1 = payload.decode().strip().split(",")
+        int(seq), int(t1)
+    except (UnicodeDecodeError, ValueError):
+        logger.warning(f"Malformed time request from {device_id}: {payload!r}")
+        return
+    reply = f"{seq},{t1},{received_us},{time.time_ns() // 1000}"
+    client.publish(f"{settings.MQTT_TOPIC_TIME_RESP_PREFIX}/{device_id}", reply, qos=0)
+
+def _handle_backlog_message(device_id: str, payload_str: str):
+    """
+    Counts a product replayed from a device's backlog. These are complete
+    products (interrupted -> clear) queued while the device was offline, so
+    they bypass the live state machine.
+    JSON {"id","seq","age_ms","dwell_ms"[,"ts"][,"shape"][,"belt"][,"log"]} or
+    compact "<id>,<seq>,<age_ms>,<dwell_ms>[,<ts>][;<shape>[;<belt>[;<epoch>,<n>[,<first>]]]]".
+    """
+    try:
+        if payload_str.lstrip().startswith("{"):
+            data = json.loads(payload_str)
+        else:
+            head, *sections = payload_str.strip().split(";")
+            data = dict(zip(("id", "seq", "age_ms", "dwell_ms", "ts"), head.split(",")))
+            _parse_compact_sections(data, sections)
+        age_ms = _event_age_ms(data)
+        sensor_id = data.get("id") or device_id
+    except (json.JSONDecodeError, AttributeError):
+        logger.warning(f"Malformed backlog message from {device_id}: {payload_str!r}")
+        return
+
+    logger.info(f"Backlog product from {sensor_id} (seq={data.get('seq')}, {age_ms} ms old).")
+    record_device_seen(sensor_id)
+    record_device_message(sensor_id)
+    log = _valid_log(data.get("log"))
+    if not log:
+        # Logged products are recounted from pizza_counts by their number
+        record_transition(sensor_id, int(time.time() * 1000) - age_ms, BACKLOG_PRODUCT)
+    _handle_pizza_count(sensor_id, age_ms, _valid_shape(data.get("shape")), _valid_belt(data.get("belt")), log)
+
+def _handle_alarm_message(device_id: str, payload_str: str):
+    """Records a device alarm (e.g. a jammed line) in the system log."""
+    try:
+        data = json.loads(payload_str)
+    except json.JSONDecodeError:
+        logger.warning(f"Malformed alarm from {device_id}: {payload_str!r}")
+        return
+    if not isinstance(data, dict):
+        return
+
+    record_device_seen(device_id)
+    kind = data.get("alarm", "unknown")
+    record_device_alarm(device_id, kind, bool(data.get("active")))
+    if data.get("active"):
+        message = f"Alarm '{kind}' raised on {device_id} after {data.get('duration_ms', 0)} ms"
+        logger.warning(message)
+        _log_system_event("WARNING", message, source="sensor")
+    else:
+        message = f"Alarm '{kind}' cleared on {device_id}"
+        logger.info(message)
+        _log_system_event("INFO", message, source="sensor")
+
+def _handle_heartbeat_message(topic: str, payload_str: str, retained: bool):
+    """
+    Updates a device's live state from its heartbeat: JSON
+    {"id","status","rssi","uptime_s","heap","cfg","queue"}, compact
+    "<id>,<status>,<rssi>,<uptime_s>,<heap>,<cfg>,<queue>" (MQTT-SN), or a
+    plain "online"/"offline" (older firmware, and the Last Will), whose device
+    is the last topic level.
+    """
+    base = settings.MQTT_TOPIC_HEARTBEAT.rstrip("/#")
+    topic_device = topic[len(base) + 1:] if topic.startswith(base + "/") else None
+    text = payload_str.strip()
+    try:
+        if text.startswith("{"):
+            data = json.loads(text)
+        elif "," in text:
+            fields = text.split(",")
+            data = {"id": fields[0], "status": fields[1]}
+            data.update((key, int(value)) for key, value in zip(("rssi", "uptime_s", "heap", "cfg", "queue"), fields[2:]))
+        else:
+            data = {"status": text}
+    except (json.JSONDecodeError, ValueError):
+        data = None
+    if not isinstance(data, dict):
+        logger.warning(f"Malformed heartbeat on {topic}: {payload_str!r}")
+        return
+    device_id = data.get("id") or topic_device
+    if not device_id:
+        logger.debug(f"Heartbeat without a device on {topic}: {payload_str!r}")
+        return
+
+    if data.get("status") != "offline" and not retained:
+        record_device_seen(device_id)
+    record_device_heartbeat(device_id, data, retained)
+
 def _on_message(client, userdata, msg):
     """Callback for when a message is received from the broker."""
-    global _last_state, _initialized, _last_transition_ms
+    global _last_state
+    # Clock-sync pings are answered first: their latency is the measurement
+    if mqtt.topic_matches_sub(settings.MQTT_TOPIC_TIME_REQ, msg.topic):
+        _handle_time_request(client, msg.topic.rsplit("/", 1)[-1], msg.payload, time.time_ns() // 1000)
+        return
+
+    # Raw edge traces are binary and handled separately
+    if mqtt.topic_matches_sub(settings.MQTT_TOPIC_TRACE, msg.topic):
+        handle_trace_chunk(msg.topic.rsplit("/", 1)[-1], msg.payload)
+        return
+    if mqtt.topic_matches_sub(settings.MQTT_TOPIC_BACKLOG, msg.topic):
+        _handle_backlog_message(msg.topic.rsplit("/", 1)[-1], msg.payload.decode(errors="ignore"))
+        return
+    if mqtt.topic_matches_sub(settings.MQTT_TOPIC_ALARM, msg.topic):
+        _handle_alarm_message(msg.topic.rsplit("/", 1)[-1], msg.payload.decode(errors="ignore"))
+        return
+    if mqtt.topic_matches_sub(settings.MQTT_TOPIC_HEARTBEAT, msg.topic):
+        _handle_heartbeat_message(msg.topic, msg.payload.decode(errors="ignore"), msg.retain)
+        return
 
     try:
         payload_str = msg.payload.decode(errors="ignore")
@@ -99,7 +379,14 @@ def _on_message(client, userdata, msg):
             logger.debug("Empty payload received, ignoring.")
             return
 
-        data = json.loads(payload_str)
+        if payload_str.lstrip().startswith("{"):
+            data = json.loads(payload_str)
+        else:
+            # MQTT-SN devices send a compact comma-separated payload
+            data = _parse_compact_payload(payload_str)
+            if data is None:
+                logger.warning(f"Message ignored: malformed compact payload: {payload_str!r}")
+                return
 
         # --- Hardening: JSON must be an object/dict ---
         if not isinstance(data, dict):
@@ -112,23 +399,49 @@ def _on_message(client, userdata, msg):
             return
 
         sensor_id = data.get("id", "ESP32_Barrier_001")
-        now_ms = int(time.time() * 1000)
-
-        # Debounce to prevent false positives from sensor flickering
-        if _last_transition_ms and (now_ms - _last_transition_ms) < _DEBOUNCE_MS:
-            logger.debug(f"State transition ignored due to debounce. New state: {state}")
-            # NOTE: do NOT update _last_state here; keep the previous stable state.
-            return
-
-        # --- Core Logic: Detect product on state transition ---
-        # A product is counted when the beam goes from 'interrupted' to 'clear'.
-        if _last_state == "interrupted" and state == "clear":
-            logger.info("Product detected (interrupted -> clear). Saving count.")
-            _handle_pizza_count(sensor_id)
-
+        record_device_seen(sensor_id)
+        record_device_state(sensor_id, state, data)
+        belt = _valid_belt(data.get("belt"))
+        if belt:
+            _belt_speeds[sensor_id] = (belt["mm_s"], time.time())
+
+        # Devices queue states behind higher-priority traffic and report when the
+        # event happened (ts or age_ms), so debounce on that, not on arrival.
+        age_ms = _event_age_ms(data)
+        now_ms = int(time.time() * 1000) - age_ms
+
+        # Stored raw, before the decision below, so it can be replayed with other parameters
+        log = _valid_log(data.get("log")) if state == "clear" else None
+        record_transition(sensor_id, now_ms, LOGGED_CLEAR if log else CLEAR if state == "clear" else INTERRUPTED)
+
+        # Each device has its own state machine: interleaved stations must not
+        # debounce each other or pair one's interruption with another's clear
+        last_state, last_transition_ms = _sensor_states.get(sensor_id, ("unknown", 0))
+
+        # A "clear" numbered by the device's durable log is a product the device
+        # already debounced: it is counted by its number, even if the state
+        # machine missed its "interrupted", and duplicates are dropped. It is
+        # not debounced here, or a neighbouring transition would drop it and
+        # stall the acknowledgment until the device replays its log.
+        if log:
+            logger.info(f"Logged product {log[1]} from {sensor_id}. Saving count.")
+            _handle_pizza_count(sensor_id, age_ms, _valid_shape(data.get("shape")), _valid_belt(data.get("belt")),
+                                log)
+        else:
+            # Debounce to prevent false positives from sensor flickering
+            if last_transition_ms and (now_ms - last_transition_ms) < _DEBOUNCE_MS:
+                logger.debug(f"State transition of {sensor_id} ignored due to debounce. New state: {state}")
+                # NOTE: do NOT update the device's state here; keep the previous stable state.
+                return
+
+            # --- Core Logic: Detect product on state transition ---
+            # A product is counted when the beam goes from 'interrupted' to 'clear'.
+            if last_state == "interrupted" and state == "clear":
+                logger.info(f"Product detected on {sensor_id} (interrupted -> clear). Saving count.")
+                _handle_pizza_count(sensor_id, age_ms, _valid_shape(data.get("shape")), _valid_belt(data.get("belt")))
+
+        _sensor_states[sensor_id] = (state, now_ms)
         _last_state = state
-        _last_transition_ms = now_ms
-        _initialized = True
 
     except json.JSONDecodeError:
         logger.warning(f"Could not decode JSON from payload: {payload_str!r}")
@@ -168,6 +481,9 @@ def start_mqtt_client():
             keepalive=60
         )
         _client.loop_start()  # Starts a background thread for the client
+        if getattr(_client, "_thread", None):
+            # Name the network thread so it is recognizable in profiles
+            _client._thread.name = "mqtt-network"
         logger.info("MQTT client started successfully.")
         return _client
 
@@ -185,15 +501,30 @@ def stop_mqtt_client():
         _client.disconnect()
         logger.info("MQTT client stopped.")
 
+def publish_command(device_id: str, command: str) -> bool:
+    """Publishes a text command (e.g. "trace start 10") to a device's command topic."""
+    if not _client or not _client.is_connected():
+        logger.warning(f"Cannot send command to {device_id}: MQTT client not connected.")
+        return False
+
+    topic = f"{settings.MQTT_TOPIC_COMMAND_PREFIX}/{device_id}"
+    info = _client.publish(topic, command, qos=1)
+    logger.info(f"Command sent to {device_id}: {command!r}")
+    return info.rc == mqtt.MQTT_ERR_SUCCESS
+
+def publish_retained(topic: str, payload: str) -> bool:
+    """Publishes a retained QoS 1 message (device acknowledgments); False if not connected."""
+    if not _client or not _client.is_connected():
+        return False
+    return _client.publish(topic, payload, qos=1, retain=True).rc == mqtt.MQTT_ERR_SUCCESS
+
 def get_mqtt_status():
     """Returns the current status of the MQTT client."""
-    if not _client:
-        return {"status": "not_initialized", "connected": False}
-
     return {
-        "status": "running",
-        "connected": _client.is_connected(),
+        "status": "running" if _client else "not_initialized",
+        "connected": bool(_client and _client.is_connected()),
         "broker": f"{settings.MQTT_BROKER_HOST}:{settings.MQTT_BROKER_PORT}",
         "subscribed_topic": settings.MQTT_TOPIC_STATE,
+        "sensor_states": {device_id: state for device_id, (state, _) in sorted(_sensor_states.items())},
         "last_sensor_state": _last_state
     }
@@ -0,0 +1,133 @@
+# back-end/app/services/profiler.py
+
+import collections
+import logging
+import os
+import sys
+import threading
+import time
+
+from app.core.config import settings
+
+logger = logging.getLogger(__name__)
+
+# Module-level state for the sampling profiler
+_MAX_STACK_DEPTH = 64
+_oneshot_lock = threading.Lock()
+_continuous = None
+
+# =====================================================================
+# Stack Sampling
+# =====================================================================
+
+def _frame_label(frame) -> str:
+    """Formats a frame as 'file.py:function' (stable across line changes)."""
+    code = frame.f_code
+    return f"{os.path.basename(code.co_filename)}:{code.co_name}"
+
+def _sample_once(counts: collections.Counter, skip_thread_id: int):
+    """Adds one sample of every thread's stack to counts, as collapsed stacks."""
+    names = {t.ident: t.name for t in threading.enumerate()}
+    for thread_id, frame in sys._current_frames().items():
+        if thread_id == skip_thread_id:
+            continue
+
+        stack = []
+        while frame is not None and len(stack) < _MAX_STACK_DEPTH:
+            stack.append(_frame_label(frame))
+            frame = frame.f_back
+        stack.append(names.get(thread_id, f"thread-{thread_id}"))
+
+        # Collapsed format is root-first: "thread;outer;...;inner"
+        counts[";".join(reversed(stack))] += 1
+
+def to_collapsed(counts: collections.Counter) -> str:
+    """
+    Renders samples in the collapsed-stack format ("frame;frame;frame count"),
+    accepted by flamegraph.pl, speedscope and inferno.
+    """
+    return "".join(f"{stack} {n}\n" for stack, n in counts.most_common())
+
+def profile_for(seconds: float, hz: float) -> collections.Counter:
+    """
+    Samples all threads for the given duration, in the calling thread.
+    Only one on-demand profile runs at a time; raises RuntimeError if busy.
+    """
+    if not _oneshot_lock.acquire(blocking=False):
+        raise RuntimeError("A profile is already running")
+
+    try:
+        counts = collections.Counter()
+        me = threading.get_ident()
+        interval = 1.0 / hz
+        deadline = time.monotonic() + seconds
+        next_sample = time.monotonic()
+        while next_sample < deadline:
+            _sample_once(counts, me)
+            next_sample += interval
+            time.sleep(max(0.0, next_sample - time.monotonic()))
+        return counts
+    finally:
+        _oneshot_lock.release()
+
+# =====================================================================
+# Always-On Mode
+# =====================================================================
+
+class ContinuousProfiler:
+    """
+    Samples all threads at a low rate in a background thread and keeps one
+    aggregated bucket per minute for the configured retention.
+    """
+
+    def __init__(self, hz: float, retention_minutes: int):
+        self.hz = hz
+        self._buckets = collections.deque(maxlen=retention_minutes)  # (minute, Counter)
+        self._lock = threading.Lock()
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, name="profiler", daemon=True)
+
+    def _run(self):
+        me = threading.get_ident()
+        interval = 1.0 / self.hz
+        while not self._stop.wait(interval):
+            minute = int(time.time() // 60)
+            with self._lock:
+                if not self._buckets or self._buckets[-1][0] != minute:
+                    self._buckets.append((minute, collections.Counter()))
+                _sample_once(self._buckets[-1][1], me)
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join(timeout=2)
+
+    def snapshot(self, minutes: int) -> collections.Counter:
+        """Merges the buckets of the last N minutes."""
+        oldest = int(time.time() // 60) - minutes + 1
+        merged = collections.Counter()
+        with self._lock:
+            for minute, counts in self._buckets:
+                if minute >= oldest:
+                    merged.update(counts)
+        return merged
+
+def start_continuous_profiler():
+    """Starts the always-on profiler if enabled in settings."""
+    global _continuous
+    if not settings.PROFILER_ALWAYS_ON or _continuous:
+        return
+    _continuous = ContinuousProfiler(settings.PROFILER_ALWAYS_ON_HZ, settings.PROFILER_RETENTION_MINUTES)
+    _continuous.start()
+    logger.info(f"Continuous profiler started at {settings.PROFILER_ALWAYS_ON_HZ} Hz.")
+
+def stop_continuous_profiler():
+    global _continuous
+    if _continuous:
+        _continuous.stop()
+        _continuous = None
+
+def get_continuous_profiler():
+    return _continuous
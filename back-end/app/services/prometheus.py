@@ -0,0 +1,384 @@
+# back-end/app/services/prometheus.py
+
+import ast
+import operator
+import re
+from datetime import datetime
+
+# =====================================================================
+# Prometheus Query Subset
+# =====================================================================
+#
+# Enough of PromQL and of the Prometheus HTTP API for Grafana's native
+# Prometheus datasource (see routes/prometheus.py), over three series per
+# device read from the rollups: count_rollups, then count_rollups_hourly for
+# hours demoted by retention.
+#
+#   terelina_counts        products in the step ending at each sample
+#   terelina_throughput    the same, in products per hour
+#   terelina_availability  share of the step's minutes in which the device counted
+#
+# Samples are at start + k * step. The sample at t covers the minutes that
+# start in [t - step, t), so with a step in whole minutes every minute falls
+# in exactly one sample and sums over steps add up. An hourly rollup falls in
+# the sample of its hour's start and has no availability.
+#
+# A query is a selector (terelina_counts{device_id=~"ESP32_.*"}), optionally
+# aggregated with sum/avg/min/max/count [by|without (labels)], or a constant
+# expression such as Grafana's "1+1" connection test.
+
+METRICS = {
+    "terelina_counts": "Products counted in the step.",
+    "terelina_throughput": "Products per hour over the step.",
+    "terelina_availability": "Share of the step's minutes in which the device counted products.",
+}
+LABELS = ["__name__", "device_id"]
+MAX_POINTS = 11000      # Per series, as in Prometheus
+INSTANT_STEP_S = 60.0   # Window of an instant query: the minute before it
+
+_AGGREGATIONS = {
+    "sum": sum,
+    "avg": lambda values: sum(values) / len(values),
+    "min": min,
+    "max": max,
+    "count": len,
+}
+
+
+class QueryError(ValueError):
+    """A query or parameter that is rejected (HTTP 400, errorType bad_data)."""
+
+# =====================================================================
+# Parameters
+# =====================================================================
+
+_DURATION = re.compile(r"(\d+(?:\.\d+)?)(ms|s|m|h|d|w|y)")
+_UNITS = {"ms": 0.001, "s": 1, "m": 60, "h": 3600, "d": 86400, "w": 604800, "y": 31536000}
+
+def parse_time(value: str | None, default: float | None = None) -> float:
+    """A Unix timestamp in seconds or an RFC 3339 time."""
+    if value in (None, ""):
+        if default is None:
+            raise QueryError("missing time parameter")
+        return default
+    try:
+        return float(value)
+    except ValueError:
+        pass
+    try:
+        return datetime.fromisoformat(value.replace("Z", "+00:00")).timestamp()
+    except ValueError:
+        raise QueryError(f"cannot parse {value!r} to a valid timestamp")
+
+def parse_step(value: str | None) -> float:
+    """Seconds, as a number or a duration such as 5m or 1h30m."""
+    if value in (None, ""):
+        raise QueryError("missing step parameter")
+    try:
+        step = float(value)
+    except ValueError:
+        parts = _DURATION.findall(value)
+        if not parts or "".join(n + u for n, u in parts) != value:
+            raise QueryError(f"cannot parse {value!r} to a valid duration")
+        step = sum(float(n) * _UNITS[u] for n, u in parts)
+    if step <= 0:
+        raise QueryError("zero or negative query resolution step widths are not accepted. Try a positive integer")
+    return step
+
+# =====================================================================
+# Parser
+# =====================================================================
+
+_TOKEN = re.compile(r"""\s*(?:
+    (?P<number>(?:\d+\.?\d*|\.\d+)(?:[eE][+-]?\d+)?)
+  | (?P<name>[a-zA-Z_:][a-zA-Z0-9_:]*)
+  | (?P<string>"(?:[^"\\]|\\.)*"|'(?:[^'\\]|\\.)*')
+  | (?P<op>=~|!~|!=|[=(){},+\-*/\[\]])
+)""", re.VERBOSE)
+
+def _tokenize(query: str) -> list[tuple[str, str]]:
+    tokens, pos = [], 0
+    query = query.rstrip()
+    while pos < len(query):
+        match = _TOKEN.match(query, pos)
+        if not match:
+            raise QueryError(f"unexpected character {query[pos:].lstrip()[:1]!r} in query")
+        kind = match.lastgroup
+        value = match.group(kind)
+        tokens.append((kind, ast.literal_eval(value) if kind == "string" else value))
+        pos = match.end()
+    return tokens
+
+class _Parser:
+    """Recursive descent over the tokens: ("selector", matchers) or ("agg", op, grouping, inner)."""
+
+    def __init__(self, query: str):
+        self.tokens = _tokenize(query)
+        self.pos = 0
+
+    def peek(self) -> tuple[str | None, str | None]:
+        return self.tokens[self.pos] if self.pos < len(self.tokens) else (None, None)
+
+    def take(self, kind: str, value: str | None = None) -> str:
+        token = self.peek()
+        if token[0] != kind or (value is not None and token[1] != value):
+            found = f"{token[1]!r}" if token[0] else "end of query"
+            raise QueryError(f"unexpected {found}, expected {value or kind}")
+        self.pos += 1
+        return token[1]
+
+    def parse(self):
+        node = self.expression()
+        if self.peek()[1] == "[":
+            raise QueryError("range selectors are not supported: samples already cover their step")
+        if self.pos < len(self.tokens):
+            raise QueryError(f"unexpected {self.peek()[1]!r} after the expression")
+        return node
+
+    def expression(self):
+        kind, value = self.peek()
+        if kind == "name" and value in _AGGREGATIONS:
+            return self.aggregation()
+        if kind == "name" and self.pos + 1 < len(self.tokens) and self.tokens[self.pos + 1][1] == "(":
+            raise QueryError(f"function {value}() is not supported: use sum, avg, min, max or count")
+        if kind == "name" or value == "{":
+            return self.selector()
+        raise QueryError(f"unexpected {value!r}" if kind else "empty query")
+
+    def aggregation(self):
+        op = self.take("name")
+        grouping = self.grouping()
+        self.take("op", "(")
+        inner = self.expression()
+        self.take("op", ")")
+        return ("agg", op, grouping or self.grouping(), inner)
+
+    def grouping(self) -> tuple[str, list[str]] | None:
+        kind, value = self.peek()
+        if kind != "name" or value not in ("by", "without"):
+            return None
+        self.pos += 1
+        self.take("op", "(")
+        labels = []
+        while self.peek()[1] != ")":
+            labels.append(self.take("name"))
+            if self.peek()[1] == ",":
+                self.pos += 1
+        self.take("op", ")")
+        return (value, labels)
+
+    def selector(self):
+        matchers = []
+        if self.peek()[0] == "name":
+            matchers.append(("__name__", "=", self.take("name")))
+        if self.peek()[1] == "{":
+            self.pos += 1
+            while self.peek()[1] != "}":
+                label = self.take("name")
+                op = self.take("op")
+                if op not in ("=", "!=", "=~", "!~"):
+                    raise QueryError(f"unexpected {op!r} in label matching, expected one of =, !=, =~, !~")
+                value = self.take("string")
+                if op in ("=~", "!~"):
+                    try:
+                        value = re.compile(value)
+                    except re.error as e:
+                        raise QueryError(f"invalid regular expression {value!r}: {e}")
+                matchers.append((label, op, value))
+                if self.peek()[1] == ",":
+                    self.pos += 1
+            self.take("op", "}")
+        if not matchers:
+            raise QueryError("vector selector must contain at least one label matcher")
+        return ("selector", matchers)
+
+def parse_selector(query: str) -> list:
+    """The matchers of a series selector (match[] parameters)."""
+    node = _Parser(query).parse()
+    if node[0] != "selector":
+        raise QueryError(f"{query!r} is not a series selector")
+    return node[1]
+
+_CONSTANT_OPS = {ast.Add: operator.add, ast.Sub: operator.sub, ast.Mult: operator.mul,
+                 ast.Div: operator.truediv, ast.USub: operator.neg, ast.UAdd: operator.pos}
+
+def _constant(query: str) -> float | None:
+    """The value of an expression of numbers only, None for anything else."""
+    tokens = _tokenize(query)
+    if not tokens or any(kind not in ("number", "op") or kind == "op" and value not in "+-*/()"
+                         for kind, value in tokens):
+        return None
+
+    def value(node):
+        if isinstance(node, ast.Constant) and isinstance(node.value, (int, float)):
+            return float(node.value)
+        if isinstance(node, ast.BinOp) and type(node.op) in _CONSTANT_OPS:
+            left, right = value(node.left), value(node.right)
+            if isinstance(node.op, ast.Div) and right == 0:
+                return float("nan") if left == 0 else float("inf") * (1 if left > 0 else -1)
+            return _CONSTANT_OPS[type(node.op)](left, right)
+        if isinstance(node, ast.UnaryOp) and type(node.op) in _CONSTANT_OPS:
+            return _CONSTANT_OPS[type(node.op)](value(node.operand))
+        raise QueryError("unsupported constant expression")
+
+    try:
+        return value(ast.parse(query.strip(), mode="eval").body)
+    except SyntaxError:
+        raise QueryError("invalid constant expression")
+
+# =====================================================================
+# Evaluation
+# =====================================================================
+
+def _matches(labels: dict, matchers: list) -> bool:
+    for label, op, value in matchers:
+        actual = labels.get(label, "")
+        if op == "=" and actual != value or op == "!=" and actual == value:
+            return False
+        if op == "=~" and not value.fullmatch(actual) or op == "!~" and value.fullmatch(actual):
+            return False
+    return True
+
+def _fetch(cur, start: float, step: float, points: int, device_id: str | None) -> dict:
+    """{device: {sample index: (counts, active minutes or None)}} from both rollup tables."""
+    params = {"start": start, "step": step, "from": start - step,
+              "to": start + (points - 1) * step, "device": device_id}
+    cur.execute(
+        """
+        SELECT device_id, k, SUM(counts)::BIGINT, SUM(active)::BIGINT FROM (
+            SELECT device_id, FLOOR((EXTRACT(EPOCH FROM minute) - %(start)s) / %(step)s)::BIGINT + 1 AS k,
+                   counts, (counts > 0)::INT AS active
+            FROM count_rollups
+            WHERE minute >= to_timestamp(%(from)s) AND minute < to_timestamp(%(to)s)
+              AND (%(device)s::VARCHAR IS NULL OR device_id = %(device)s)
+            UNION ALL
+            SELECT device_id, FLOOR((EXTRACT(EPOCH FROM hour) - %(start)s) / %(step)s)::BIGINT + 1,
+                   counts, NULL
+            FROM count_rollups_hourly
+            WHERE hour >= to_timestamp(%(from)s) AND hour < to_timestamp(%(to)s)
+              AND (%(device)s::VARCHAR IS NULL OR device_id = %(device)s)
+        ) AS rollups
+        GROUP BY 1, 2
+        """,
+        params
+    )
+    devices: dict[str, dict] = {}
+    for device, k, counts, active in cur.fetchall():
+        if 0 <= k < points:
+            devices.setdefault(device, {})[k] = (counts, active)
+    return devices
+
+def _value(metric: str, counts: int, active: int | None, step: float) -> float | None:
+    if metric == "terelina_counts":
+        return float(counts)
+    if metric == "terelina_throughput":
+        return counts * 3600.0 / step
+    return None if active is None else min(1.0, active * 60.0 / max(step, 60.0))
+
+def _select(cur, matchers: list, start: float, step: float, points: int) -> list:
+    names = [name for name in METRICS if _matches({"__name__": name}, [m for m in matchers if m[0] == "__name__"])]
+    if not names:
+        return []
+    device_id = next((value for label, op, value in matchers if label == "device_id" and op == "="), None)
+    devices = _fetch(cur, start, step, points, device_id)
+    series = []
+    for name in names:
+        for device, samples in sorted(devices.items()):
+            labels = {"__name__": name, "device_id": device}
+            if _matches(labels, matchers):
+                series.append((labels, [_value(name, *samples.get(k, (0, 0)), step) for k in range(points)]))
+    return series
+
+def _aggregate(op: str, grouping: tuple | None, series: list) -> list:
+    groups: dict[tuple, tuple[dict, list]] = {}
+    for labels, values in series:
+        labels = {k: v for k, v in labels.items() if k != "__name__"}
+        if grouping is None:
+            kept = {}
+        elif grouping[0] == "by":
+            kept = {k: v for k, v in labels.items() if k in grouping[1]}
+        else:
+            kept = {k: v for k, v in labels.items() if k not in grouping[1]}
+        groups.setdefault(tuple(sorted(kept.items())), (kept, []))[1].append(values)
+    result = []
+    for labels, members in groups.values():
+        values = []
+        for column in zip(*members):
+            present = [v for v in column if v is not None]
+            values.append(float(_AGGREGATIONS[op](present)) if present else None)
+        result.append((labels, values))
+    return result
+
+def _evaluate(cur, node, start: float, step: float, points: int) -> list:
+    if node[0] == "selector":
+        return _select(cur, node[1], start, step, points)
+    _, op, grouping, inner = node
+    return _aggregate(op, grouping, _evaluate(cur, inner, start, step, points))
+
+def _format(value: float) -> str:
+    if value != value:
+        return "NaN"
+    if value in (float("inf"), float("-inf")):
+        return "+Inf" if value > 0 else "-Inf"
+    return f"{value:.15g}"
+
+def query_range(cur, query: str, start: float, end: float, step: float) -> dict:
+    """The data of a /api/v1/query_range answer: a matrix, one sample per step."""
+    if end < start:
+        raise QueryError("end timestamp must not be before start time")
+    points = int((end - start) // step) + 1
+    if points > MAX_POINTS:
+        raise QueryError("exceeded maximum resolution of 11,000 points per timeseries. Try decreasing the query resolution (?step=XX)")
+    constant = _constant(query)
+    if constant is not None:
+        series = [({}, [constant] * points)]
+    else:
+        series = _evaluate(cur, _Parser(query).parse(), start, step, points)
+    result = []
+    for labels, values in series:
+        samples = [[start + k * step, _format(v)] for k, v in enumerate(values) if v is not None]
+        if samples:
+            result.append({"metric": labels, "values": samples})
+    return {"resultType": "matrix", "result": result}
+
+def query_instant(cur, query: str, at: float) -> dict:
+    """The data of a /api/v1/query answer: a scalar, or a vector over the minute before `at`."""
+    constant = _constant(query)
+    if constant is not None:
+        return {"resultType": "scalar", "result": [at, _format(constant)]}
+    series = _evaluate(cur, _Parser(query).parse(), at, INSTANT_STEP_S, 1)
+    return {"resultType": "vector",
+            "result": [{"metric": labels, "value": [at, _format(values[0])]}
+                       for labels, values in series if values[0] is not None]}
+
+def _devices(cur, start: float, end: float) -> list[str]:
+    cur.execute(
+        "SELECT device_id FROM count_rollups WHERE minute >= to_timestamp(%s) AND minute < to_timestamp(%s) "
+        "UNION SELECT device_id FROM count_rollups_hourly WHERE hour >= to_timestamp(%s) AND hour < to_timestamp(%s)",
+        (start, end, start, end)
+    )
+    return sorted(row[0] for row in cur.fetchall())
+
+def series(cur, selectors: list[str], start: float, end: float) -> list[dict]:
+    """Label sets of the series with data in [start, end) matching any of the selectors."""
+    if not selectors:
+        raise QueryError("no match[] parameter provided")
+    matchers = [parse_selector(s) for s in selectors]
+    devices = _devices(cur, start, end)
+    return [labels for labels in ({"__name__": name, "device_id": device} for name in METRICS for device in devices)
+            if any(_matches(labels, m) for m in matchers)]
+
+def label_names() -> list[str]:
+    return LABELS
+
+def label_values(cur, label: str, selectors: list[str], start: float, end: float) -> list[str]:
+    if label not in LABELS:
+        return []
+    if selectors:
+        return sorted({labels[label] for labels in series(cur, selectors, start, end)})
+    if label == "__name__":
+        return list(METRICS)
+    return _devices(cur, start, end)
+
+def metadata() -> dict:
+    return {name: [{"type": "gauge", "help": help_, "unit": ""}] for name, help_ in METRICS.items()}
@@ -0,0 +1,313 @@
+# back-end/app/services/retention.py
+
+import logging
+import threading
+import time
+from datetime import timedelta
+
+from psycopg2.extras import RealDictCursor
+
+from app.core.config import settings
+from app.db.session import get_db_connection
+
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Progressive Downsampling
+# =====================================================================
+#
+# Raw counts (pizza_counts) are kept raw_retention_days, the minute rollups
+# (count_rollups) rollup_retention_months and the hourly rollups
+# (count_rollups_hourly) forever; all three are settings in system_settings.
+# The job demotes the oldest data in batches of retention_batch_hours, one
+# transaction each:
+#   - raw counts are deleted without touching their rollups (the trigger skips
+#     deletes with terelina.retention on). The deleted rows are regrouped per
+#     device and minute and compared with count_rollups in the same statement;
+#     on any difference the batch is rolled back and the job stops there, so
+#     every raw count after raw_before is still stored and can rebuild rollups.
+#   - minute rollups are moved into hourly ones. The moved minutes are summed
+#     per hour and device and compared with how much each hourly row changed;
+#     on any difference the batch is rolled back and the job stops. Only minutes
+#     whose raw counts are gone are demoted: rebuilt minutes would otherwise be
+#     counted twice by the views, which add both tables.
+
+_LOCK_KEY = 7318201      # pg_try_advisory_lock: one job at a time across backend workers
+_TUPLE_OVERHEAD = 28     # Tuple header and line pointer, on top of pg_column_size
+_TABLES = ("pizza_counts", "count_rollups", "count_rollups_hourly")
+
+_job = None
+
+def _settings(cur) -> dict:
+    cur.execute(
+        "SELECT key, value FROM system_settings WHERE key IN "
+        "('raw_retention_days', 'rollup_retention_months', 'retention_batch_hours')"
+    )
+    values = {key: int(value) for key, value in cur.fetchall() if value is not None}
+    return {"raw_days": values.get("raw_retention_days", 90),
+            "minute_months": values.get("rollup_retention_months", 12),
+            "batch_hours": max(1, values.get("retention_batch_hours", 6))}
+
+def _table_bytes(cur) -> int:
+    cur.execute("SELECT " + " + ".join(f"pg_total_relation_size('{t}')" for t in _TABLES))
+    return cur.fetchone()[0]
+
+def _demote_raw(cur, start, end) -> tuple:
+    """Deletes the raw counts of [start, end). Returns (rows, bytes, minutes differing from count_rollups)."""
+    cur.execute("SET LOCAL terelina.retention = 'on'")
+    cur.execute(
+        """
+        WITH deleted AS (
+            DELETE FROM pizza_counts WHERE "timestamp" >= %(start)s AND "timestamp" < %(end)s
+            RETURNING DATE_TRUNC('minute', "timestamp") AS minute, COALESCE(device_id, '') AS device_id,
+                      pg_column_size(pizza_counts.*) AS bytes),
+        raw AS (
+            SELECT minute, device_id, COUNT(*) AS counts, SUM(bytes) AS bytes FROM deleted GROUP BY 1, 2),
+        rollups AS (
+            SELECT minute, device_id, counts FROM count_rollups WHERE minute >= %(start)s AND minute < %(end)s)
+        SELECT (SELECT COALESCE(SUM(counts), 0)::BIGINT FROM raw),
+               (SELECT COALESCE(SUM(bytes), 0)::BIGINT FROM raw),
+               (SELECT COUNT(*) FROM raw r FULL JOIN rollups c USING (minute, device_id)
+                WHERE COALESCE(r.counts, 0) <> COALESCE(c.counts, 0)
+                  -- Ranges recounted from another source differ from the raw counts on purpose
+                  AND NOT EXISTS (
+                      SELECT 1 FROM rollup_rebuild_jobs j
+                      WHERE j.swapped_at IS NOT NULL AND j.source <> 'counts'
+                        AND minute >= j.range_start AND minute < j.range_end))
+        """,
+        {"start": start, "end": end}
+    )
+    rows, size, differing = cur.fetchone()
+    return rows, size + rows * _TUPLE_OVERHEAD, differing
+
+def _demote_minutes(cur, start, end) -> tuple:
+    """
+    Merges the minute rollups of [start, end) into hourly ones. Returns (minute
+    rows, hourly rows added, bytes, hours differing): per hour and device, the
+    moved minutes are compared with how much the hourly row changed from the
+    statement's snapshot.
+    """
+    cur.execute(
+        """
+        WITH hourly_before AS (
+            SELECT hour, device_id, counts FROM count_rollups_hourly WHERE hour >= %(start)s AND hour < %(end)s),
+        moved AS (
+            DELETE FROM count_rollups WHERE minute >= %(start)s AND minute < %(end)s
+            RETURNING minute, device_id, counts, pg_column_size(count_rollups.*) AS bytes),
+        grouped AS (
+            SELECT DATE_TRUNC('hour', minute) AS hour, device_id, SUM(counts) AS counts FROM moved GROUP BY 1, 2),
+        merged AS (
+            INSERT INTO count_rollups_hourly AS h (hour, device_id, counts)
+            SELECT hour, device_id, counts FROM grouped
+            ON CONFLICT (hour, device_id) DO UPDATE SET counts = h.counts + EXCLUDED.counts
+            RETURNING h.hour, h.device_id, h.counts, (xmax = 0) AS added, pg_column_size(h.*) AS bytes),
+        deltas AS (
+            SELECT m.hour, m.device_id, m.counts - COALESCE(b.counts, 0) AS counts
+            FROM merged m LEFT JOIN hourly_before b USING (hour, device_id))
+        SELECT (SELECT COUNT(*) FROM moved), (SELECT COALESCE(SUM(counts), 0) FROM moved),
+               (SELECT COALESCE(SUM(bytes), 0) FROM moved),
+               (SELECT COUNT(*) FROM merged WHERE added),
+               (SELECT COALESCE(SUM(bytes), 0) FROM merged WHERE added),
+               (SELECT COUNT(*) FROM grouped g FULL JOIN deltas d USING (hour, device_id)
+                WHERE COALESCE(g.counts, 0) <> COALESCE(d.counts, 0))
+        """,
+        {"start": start, "end": end}
+    )
+    minute_rows, moved, minute_bytes, hourly_rows, hourly_bytes, differing = cur.fetchone()
+    if minute_rows:
+        # Copies of the rollups (GET /v1/counts/rollups) drop the minutes
+        cur.execute(
+            "INSERT INTO rollup_invalidations (device_id, range_start, range_end, counts_delta) "
+            "VALUES ('*', %s, %s, %s)",
+            (start, end, -moved)
+        )
+    size = (minute_bytes + minute_rows * _TUPLE_OVERHEAD) - (hourly_bytes + hourly_rows * _TUPLE_OVERHEAD)
+    return minute_rows, hourly_rows, size, differing
+
+def _oldest(cur, query: str, cutoff):
+    cur.execute(query, (cutoff,))
+    oldest = cur.fetchone()[0]
+    return oldest.replace(minute=0, second=0, microsecond=0) if oldest else None
+
+def run_retention(stop: threading.Event | None = None) -> dict | None:
+    """
+    Runs the retention job once: cleanup_old_logs(), then the raw counts and
+    minute rollups past their retention are demoted. Returns the run's report
+    (also stored in retention_runs), or None if another job holds the lock.
+    """
+    started = time.monotonic()
+    run_id = None
+    report = {"status": "ok", "raw_rows": 0, "minute_rows": 0, "hourly_rows": 0, "batches": 0,
+              "bytes_freed": 0, "raw_before": None, "minutes_before": None, "notes": []}
+    with get_db_connection() as conn:
+        with conn.cursor() as cur:
+            cur.execute("SELECT pg_try_advisory_lock(%s)", (_LOCK_KEY,))
+            if not cur.fetchone()[0]:
+                conn.rollback()
+                return None
+            try:
+                policy = _settings(cur)
+                cur.execute("SELECT cleanup_old_logs()")
+                cur.execute("SELECT MAX(raw_before) FROM retention_runs")
+                raw_before = cur.fetchone()[0]
+                report["size_before"] = _table_bytes(cur)
+                cur.execute("INSERT INTO retention_runs (size_before) VALUES (%s) RETURNING id", (report["size_before"],))
+                run_id = cur.fetchone()[0]
+                cur.execute("SELECT DATE_TRUNC('hour', NOW())")
+                now = cur.fetchone()[0]
+                conn.commit()
+
+                batch = timedelta(hours=policy["batch_hours"])
+                stopped = lambda: stop is not None and stop.is_set()
+
+                # Raw counts older than raw_retention_days
+                if policy["raw_days"] > 0:
+                    cutoff = now - timedelta(days=policy["raw_days"])
+                    while not stopped():
+                        start = _oldest(cur, 'SELECT MIN("timestamp") FROM pizza_counts WHERE "timestamp" < %s', cutoff)
+                        if start is None:
+                            raw_before = max(raw_before or cutoff, cutoff)
+                            break
+                        end = min(start + batch, cutoff)
+                        rows, size, differing = _demote_raw(cur, start, end)
+                        if differing:
+                            conn.rollback()
+                            report["status"] = "blocked"
+                            note = (f"{differing} minute(s) between {start:%Y-%m-%d %H:%M} and "
+                                              f"{end:%Y-%m-%d %H:%M} UTC differ from their rollups; raw counts "
+                                              f"kept from there on (check with back-end/scripts/check_rollups.py "
+                                              f"and rebuild_rollups.py)")
+                            report["notes"].append(note)
+                            logger.warning(f"Retention: {note}.")
+                            raw_before = max(raw_before or start, start)
+                            break
+                        conn.commit()
+                        report["raw_rows"] += rows
+                        report["bytes_freed"] += size
+                        report["batches"] += 1
+                        raw_before = max(raw_before or end, end)
+                report["raw_before"] = raw_before
+
+                # Minute rollups older than rollup_retention_months, and without raw counts
+                if policy["minute_months"] > 0 and raw_before is not None:
+                    cur.execute("SELECT %s - make_interval(months => %s)", (now, policy["minute_months"]))
+                    cutoff = min(cur.fetchone()[0], raw_before)
+                    while not stopped():
+                        start = _oldest(cur, "SELECT MIN(minute) FROM count_rollups WHERE minute < %s", cutoff)
+                        if start is None:
+                            report["minutes_before"] = cutoff
+                            break
+                        end = min(start + batch, cutoff)
+                        minute_rows, hourly_rows, size, differing = _demote_minutes(cur, start, end)
+                        if differing:
+                            conn.rollback()
+                            report["status"] = "blocked"
+                            note = (f"{differing} hourly rollup(s) between {start:%Y-%m-%d %H:%M} and "
+                                              f"{end:%Y-%m-%d %H:%M} UTC did not grow by the minute rollups merged "
+                                              f"into them; minutes kept")
+                            report["notes"].append(note)
+                            logger.warning(f"Retention: {note}.")
+                            break
+                        conn.commit()
+                        report["minute_rows"] += minute_rows
+                        report["hourly_rows"] += hourly_rows
+                        report["bytes_freed"] += size
+                        report["batches"] += 1
+                        report["minutes_before"] = end
+
+                if stopped() and report["status"] == "ok":
+                    report["status"] = "stopped"
+                report["size_after"] = _table_bytes(cur)
+                report["seconds"] = round(time.monotonic() - started, 3)
+                cur.execute(
+                    "UPDATE retention_runs SET finished_at = NOW(), status = %(status)s, raw_before = %(raw_before)s, "
+                    "minutes_before = %(minutes_before)s, raw_rows = %(raw_rows)s, minute_rows = %(minute_rows)s, "
+                    "hourly_rows = %(hourly_rows)s, batches = %(batches)s, bytes_freed = %(bytes_freed)s, "
+                    "size_after = %(size_after)s, seconds = %(seconds)s, note = %(note)s WHERE id = %(id)s",
+                    {**report, "note": "; ".join(report["notes"]) or None, "id": run_id}
+                )
+                cur.execute(
+                    "INSERT INTO system_logs (level, message, source) VALUES (%s, %s, 'backend')",
+                    ("INFO" if report["status"] in ("ok", "stopped") else "WARNING",
+                     f"Retention {report['status']}: {report['raw_rows']} raw counts deleted, "
+                     f"{report['minute_rows']} minute rollups merged into {report['hourly_rows']} new hourly ones, "
+                     f"~{report['bytes_freed'] / 1e6:.1f} MB freed in {report['seconds']:.1f} s")
+                )
+                conn.commit()
+            except Exception:
+                conn.rollback()
+                try:
+                    if run_id is not None:
+                        cur.execute("UPDATE retention_runs SET finished_at = NOW(), status = 'failed', seconds = %s "
+                                    "WHERE id = %s", (round(time.monotonic() - started, 3), run_id))
+                        conn.commit()
+                except Exception:
+                    conn.rollback()
+                raise
+            finally:
+                cur.execute("SELECT pg_advisory_unlock(%s)", (_LOCK_KEY,))
+                conn.commit()
+
+    logger.info(f"Retention {report['status']} in {report['seconds']:.1f} s: {report['raw_rows']} raw counts "
+                f"deleted (before {report['raw_before']}), {report['minute_rows']} minute rollups merged into "
+                f"{report['hourly_rows']} new hourly ones (before {report['minutes_before']}), "
+                f"~{report['bytes_freed'] / 1e6:.1f} MB freed in {report['batches']} batch(es).")
+    return report
+
+def get_retention_runs(limit: int = 20) -> list:
+    """Latest runs of the retention job, newest first."""
+    with get_db_connection() as conn:
+        with conn.cursor(cursor_factory=RealDictCursor) as cur:
+            cur.execute("SELECT * FROM retention_runs ORDER BY id DESC LIMIT %s", (limit,))
+            rows = cur.fetchall()
+            conn.rollback()
+    return rows
+
+def _due() -> bool:
+    """True once cleanup_interval_hours have passed since the last run started."""
+    with get_db_connection() as conn:
+        with conn.cursor() as cur:
+            cur.execute(
+                "SELECT MAX(started_at) > NOW() - make_interval(hours => COALESCE("
+                "(SELECT value::INTEGER FROM system_settings WHERE key = 'cleanup_interval_hours'), 24)) "
+                "FROM retention_runs WHERE status <> 'failed'"
+            )
+            recent = cur.fetchone()[0]
+            conn.rollback()
+    return not recent
+
+class RetentionJob:
+    """Checks every RETENTION_CHECK_S whether the retention job is due and runs it in a background thread."""
+
+    def __init__(self):
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, name="retention", daemon=True)
+
+    def _run(self):
+        while not self._stop.wait(settings.RETENTION_CHECK_S):
+            try:
+                if _due():
+                    run_retention(self._stop)
+            except Exception as e:
+                logger.error(f"Retention job failed: {e}")
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join(timeout=5)  # A batch in progress finishes first
+
+def start_retention():
+    global _job
+    if _job or not settings.RETENTION_ENABLED:
+        return
+    _job = RetentionJob()
+    _job.start()
+    logger.info(f"Retention job started (checked every {settings.RETENTION_CHECK_S} s).")
+
+def stop_retention():
+    global _job
+    if _job:
+        _job.stop()
+        _job = None
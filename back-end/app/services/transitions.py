@@ -0,0 +1,172 @@
+# back-end/app/services/transitions.py
+
+import logging
+import sys
+import threading
+import time
+from array import array
+from datetime import datetime, timezone
+
+from psycopg2 import Binary
+
+from app.core.config import settings
+from app.db.session import get_db_connection
+
+logger = logging.getLogger(__name__)
+
+# =====================================================================
+# Raw State Transitions
+# =====================================================================
+#
+# Every state message is recorded before the debounce and the state machine
+# of mqtt_client decide whether it ends a product, so that decision can be
+# replayed later with other parameters (back-end/scripts/recount_transitions.py).
+# Transitions are buffered per device and stored as one transition_blocks row
+# per block: the times as int32 ms deltas and the kinds as one byte each, two
+# columns the recount reads with numpy without parsing. Blocks of a few
+# thousand transitions are large enough for TOAST to compress them.
+# Blocks keep the arrival order, which is the order the state machine saw.
+
+INTERRUPTED = 0
+CLEAR = 1
+LOGGED_CLEAR = 2      # A clear numbered by the device's durable log: counted by its number
+BACKLOG_PRODUCT = 3   # A product replayed from an unlogged backlog: bypasses the state machine
+
+_MAX_DELTA_MS = 2**31 - 1
+_MAX_QUEUED_BLOCKS = 1000  # Closed blocks kept while the database is unreachable
+
+class _Block:
+    __slots__ = ("first_ms", "last_ms", "low_ms", "high_ms", "deltas", "kinds", "opened")
+
+    def __init__(self, t_ms: int, now: float):
+        self.first_ms = self.last_ms = self.low_ms = self.high_ms = t_ms
+        self.deltas = array("i")
+        self.kinds = bytearray()
+        self.opened = now
+
+    def add(self, t_ms: int, kind: int):
+        self.deltas.append(t_ms - self.last_ms)
+        self.kinds.append(kind)
+        self.last_ms = t_ms
+        self.low_ms = min(self.low_ms, t_ms)
+        self.high_ms = max(self.high_ms, t_ms)
+
+    def row(self, device_id: str) -> tuple:
+        deltas = array("i", self.deltas)
+        if sys.byteorder == "big":
+            deltas.byteswap()  # Stored little-endian
+        return (device_id,
+                datetime.fromtimestamp(self.low_ms / 1000, timezone.utc),
+                datetime.fromtimestamp(self.high_ms / 1000, timezone.utc),
+                self.first_ms, len(self.kinds), Binary(deltas.tobytes()), Binary(bytes(self.kinds)))
+
+_blocks: dict[str, _Block] = {}  # Open block per device
+_closed: list[tuple[str, _Block]] = []
+_lock = threading.Lock()
+_partitions: set[str] = set()    # Months whose partition is known to exist
+_recorded = 0
+_stored = 0
+_recorder = None
+
+def record_transition(device_id: str, t_ms: int, kind: int):
+    """Buffers one raw transition of a device (event time in Unix ms)."""
+    global _recorded
+    if not settings.TRANSITIONS_ENABLED:
+        return
+    now = time.monotonic()
+    with _lock:
+        block = _blocks.get(device_id)
+        if block is not None and abs(t_ms - block.last_ms) > _MAX_DELTA_MS:
+            _closed.append((device_id, _blocks.pop(device_id)))  # Delta would not fit: start a new block
+            block = None
+        if block is None:
+            block = _blocks[device_id] = _Block(t_ms, now)
+        block.add(t_ms, kind)
+        _recorded += 1
+        if len(block.kinds) >= settings.TRANSITION_BLOCK_MAX:
+            _closed.append((device_id, _blocks.pop(device_id)))
+
+def get_transition_stats() -> dict:
+    with _lock:
+        return {"recorded": _recorded, "stored": _stored,
+                "buffered": sum(len(b.kinds) for b in _blocks.values()) + sum(len(b.kinds) for _, b in _closed)}
+
+def _ensure_partitions(cur, blocks: list):
+    """Creates the monthly partitions the blocks go to (ensure_transition_partition in schema.sql)."""
+    for _, block in blocks:
+        start = datetime.fromtimestamp(block.low_ms / 1000, timezone.utc)
+        month = f"{start:%Y%m}"
+        if month not in _partitions:
+            cur.execute("SELECT ensure_transition_partition(%s)", (start,))
+            _partitions.add(month)
+
+def _flush(close_all: bool = False):
+    """Stores the full blocks and those open for TRANSITION_BLOCK_S (all of them with close_all)."""
+    global _stored
+    now = time.monotonic()
+    with _lock:
+        for device_id in [d for d, b in _blocks.items() if close_all or now - b.opened >= settings.TRANSITION_BLOCK_S]:
+            _closed.append((device_id, _blocks.pop(device_id)))
+        blocks = _closed[:]
+        _closed.clear()
+    if not blocks:
+        return
+
+    try:
+        with get_db_connection() as conn:
+            with conn.cursor() as cur:
+                _ensure_partitions(cur, blocks)
+                cur.executemany(
+                    "INSERT INTO transition_blocks (device_id, block_start, block_end, first_ms, n, t_deltas, kinds) "
+                    "VALUES (%s, %s, %s, %s, %s, %s, %s)",
+                    [block.row(device_id) for device_id, block in blocks]
+                )
+                conn.commit()
+    except Exception as e:
+        _partitions.clear()  # The failure may have rolled a partition back
+        with _lock:
+            _closed[:0] = blocks  # Retried on the next flush, oldest first
+            dropped = len(_closed) - _MAX_QUEUED_BLOCKS
+            if dropped > 0:
+                del _closed[:dropped]
+        logger.error(f"Could not store raw transitions: {e}" + (f" ({dropped} block(s) dropped)" if dropped > 0 else ""))
+        return
+    with _lock:
+        _stored += sum(len(block.kinds) for _, block in blocks)
+
+class TransitionRecorder:
+    """Stores closed transition blocks every few seconds in a background thread."""
+
+    def __init__(self):
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, name="transition-recorder", daemon=True)
+
+    def _run(self):
+        while not self._stop.wait(min(5.0, settings.TRANSITION_BLOCK_S)):
+            try:
+                _flush()
+            except Exception as e:
+                logger.error(f"Transition flush failed: {e}")
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join(timeout=2)
+        _flush(close_all=True)  # Open blocks before shutdown
+
+def start_transition_recorder():
+    global _recorder
+    if _recorder or not settings.TRANSITIONS_ENABLED:
+        return
+    _recorder = TransitionRecorder()
+    _recorder.start()
+    logger.info(f"Transition recorder started (blocks of up to {settings.TRANSITION_BLOCK_MAX} transitions "
+                f"or {settings.TRANSITION_BLOCK_S} s).")
+
+def stop_transition_recorder():
+    global _recorder
+    if _recorder:
+        _recorder.stop()
+        _recorder = None
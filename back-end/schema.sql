@@ -10,6 +10,214 @@ CREATE TABLE IF NOT EXISTS pizza_counts (
     "timestamp" TIMESTAMPTZ NOT NULL DEFAULT NOW()
 );
 
+-- Light-curtain profile of the product (w_mm, len_mm, x_mm, pieces, fill, peak, flags); NULL for single-beam sensors
+ALTER TABLE pizza_counts ADD COLUMN IF NOT EXISTS shape JSONB;
+-- Belt-encoder measures: product length and gap before it, independent of belt speed; NULL without an encoder
+ALTER TABLE pizza_counts ADD COLUMN IF NOT EXISTS length_mm INTEGER;
+ALTER TABLE pizza_counts ADD COLUMN IF NOT EXISTS gap_mm INTEGER;
+-- Reporting device, and the product's number in its durable flash log (NULL for devices without one)
+ALTER TABLE pizza_counts ADD COLUMN IF NOT EXISTS device_id VARCHAR(64);
+ALTER TABLE pizza_counts ADD COLUMN IF NOT EXISTS log_epoch BIGINT;
+ALTER TABLE pizza_counts ADD COLUMN IF NOT EXISTS log_n BIGINT;
+
+-- Per device: every product of log_epoch up to acked_n is committed (published back to the device, retained)
+CREATE TABLE IF NOT EXISTS device_acks (
+    device_id VARCHAR(64) PRIMARY KEY,
+    log_epoch BIGINT NOT NULL,
+    acked_n BIGINT NOT NULL,
+    updated_at TIMESTAMPTZ NOT NULL DEFAULT NOW()
+);
+
+-- Products per device and minute, kept up to date by the rollup triggers below (device '' = unknown)
+CREATE TABLE IF NOT EXISTS count_rollups (
+    minute TIMESTAMPTZ NOT NULL,
+    device_id VARCHAR(64) NOT NULL,
+    counts INTEGER NOT NULL,
+    updated_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    PRIMARY KEY (minute, device_id)
+);
+
+-- Products per device and hour, kept forever: minute rollups older than rollup_retention_months
+-- are merged into it by the retention job (app/services/retention.py)
+CREATE TABLE IF NOT EXISTS count_rollups_hourly (
+    hour TIMESTAMPTZ NOT NULL,
+    device_id VARCHAR(64) NOT NULL,
+    counts INTEGER NOT NULL,
+    PRIMARY KEY (hour, device_id)
+);
+
+-- Per device: latest count time seen (capped at NOW()). A minute is closed once the watermark
+-- is rollup_allowed_lateness_s past its end
+CREATE TABLE IF NOT EXISTS rollup_watermarks (
+    device_id VARCHAR(64) PRIMARY KEY,
+    watermark TIMESTAMPTZ NOT NULL,
+    updated_at TIMESTAMPTZ NOT NULL DEFAULT NOW()
+);
+
+-- Closed rollup ranges [range_start, range_end) patched by late or deleted counts; caches and
+-- replicas re-read only these (also sent as NOTIFY rollup_invalidated). device_id '*' = every device
+CREATE TABLE IF NOT EXISTS rollup_invalidations (
+    id BIGSERIAL PRIMARY KEY,
+    device_id VARCHAR(64) NOT NULL,
+    range_start TIMESTAMPTZ NOT NULL,
+    range_end TIMESTAMPTZ NOT NULL,
+    counts_delta INTEGER,
+    created_at TIMESTAMPTZ NOT NULL DEFAULT NOW()
+);
+
+-- Rollup rebuild jobs (back-end/scripts/rebuild_rollups.py). Each chunk (device x time slice)
+-- commits its staged rollups together with its row in rollup_rebuild_chunks, so a job resumes
+-- where it stopped; the swap replaces count_rollups over the job's range in one transaction
+CREATE TABLE IF NOT EXISTS rollup_rebuild_jobs (
+    job VARCHAR(64) PRIMARY KEY,
+    range_start TIMESTAMPTZ NOT NULL,
+    range_end TIMESTAMPTZ NOT NULL,
+    source VARCHAR(32) NOT NULL,
+    params JSONB,
+    started_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    swapped_at TIMESTAMPTZ
+);
+
+CREATE TABLE IF NOT EXISTS rollup_rebuild_chunks (
+    job VARCHAR(64) NOT NULL REFERENCES rollup_rebuild_jobs (job) ON DELETE CASCADE,
+    device_id VARCHAR(64) NOT NULL,
+    chunk_start TIMESTAMPTZ NOT NULL,
+    chunk_end TIMESTAMPTZ NOT NULL,
+    buckets INTEGER NOT NULL,
+    counts BIGINT NOT NULL,
+    seconds REAL NOT NULL,
+    done_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    PRIMARY KEY (job, device_id, chunk_start)
+);
+
+CREATE TABLE IF NOT EXISTS rollup_rebuild_staging (
+    job VARCHAR(64) NOT NULL REFERENCES rollup_rebuild_jobs (job) ON DELETE CASCADE,
+    minute TIMESTAMPTZ NOT NULL,
+    device_id VARCHAR(64) NOT NULL,
+    counts INTEGER NOT NULL,
+    PRIMARY KEY (job, device_id, minute)
+);
+
+-- Runs of the retention job (app/services/retention.py). Raw counts before raw_before are deleted,
+-- only their rollups remain; minute rollups before minutes_before are merged into
+-- count_rollups_hourly. bytes_freed estimates the heap space of the deleted rows, less the hourly
+-- rows added; size_before/size_after are the total size of the three tables
+CREATE TABLE IF NOT EXISTS retention_runs (
+    id SERIAL PRIMARY KEY,
+    started_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    finished_at TIMESTAMPTZ,
+    status VARCHAR(16) NOT NULL DEFAULT 'running',
+    raw_before TIMESTAMPTZ,
+    minutes_before TIMESTAMPTZ,
+    raw_rows BIGINT NOT NULL DEFAULT 0,
+    minute_rows BIGINT NOT NULL DEFAULT 0,
+    hourly_rows BIGINT NOT NULL DEFAULT 0,
+    batches INTEGER NOT NULL DEFAULT 0,
+    bytes_freed BIGINT NOT NULL DEFAULT 0,
+    size_before BIGINT,
+    size_after BIGINT,
+    seconds REAL,
+    note TEXT,
+    CONSTRAINT retention_runs_status_chk CHECK (status IN ('running', 'ok', 'blocked', 'stopped', 'failed'))
+);
+
+-- Production line graph: each station is one counting device (e.g. oven exit, packaging)
+CREATE TABLE IF NOT EXISTS stations (
+    station VARCHAR(64) PRIMARY KEY,
+    device_id VARCHAR(64) UNIQUE NOT NULL,
+    description TEXT
+);
+
+-- Belt sections between stations. A product counted upstream is expected downstream after
+-- transit_min_s..transit_max_s; past transit_max_s it is counted lost (see app/services/flow.py)
+CREATE TABLE IF NOT EXISTS station_links (
+    upstream VARCHAR(64) NOT NULL REFERENCES stations (station) ON DELETE CASCADE,
+    downstream VARCHAR(64) NOT NULL REFERENCES stations (station) ON DELETE CASCADE,
+    transit_min_s REAL NOT NULL DEFAULT 0,
+    transit_max_s REAL NOT NULL,
+    PRIMARY KEY (upstream, downstream),
+    CONSTRAINT station_links_transit_chk CHECK (transit_min_s >= 0 AND transit_max_s > transit_min_s)
+);
+
+-- Per link and minute: counts on both ends, matched/lost/unmatched products, WIP at the end of the minute
+CREATE TABLE IF NOT EXISTS flow_minutes (
+    minute TIMESTAMPTZ NOT NULL,
+    upstream VARCHAR(64) NOT NULL,
+    downstream VARCHAR(64) NOT NULL,
+    upstream_count INTEGER NOT NULL,
+    downstream_count INTEGER NOT NULL,
+    matched INTEGER NOT NULL,
+    lost INTEGER NOT NULL,
+    unmatched INTEGER NOT NULL,
+    wip INTEGER NOT NULL,
+    transit_p50_s REAL,
+    transit_p90_s REAL,
+    PRIMARY KEY (upstream, downstream, minute)
+);
+
+-- Alert rules evaluated in memory by the backend (app/services/alerts.py; POST /admin/alerts/reload
+-- after editing). threshold is products (low_count), seconds (offline) or percent (throughput_drop).
+-- device_id NULL = every device. shift_start/shift_end are local times (system_settings 'timezone');
+-- NULL = always
+CREATE TABLE IF NOT EXISTS alert_rules (
+    id SERIAL PRIMARY KEY,
+    name VARCHAR(128) NOT NULL,
+    kind VARCHAR(32) NOT NULL,
+    device_id VARCHAR(64),
+    threshold REAL NOT NULL,
+    window_s INTEGER NOT NULL DEFAULT 600,
+    baseline_s INTEGER NOT NULL DEFAULT 3600,
+    shift_start TIME,
+    shift_end TIME,
+    webhook_url TEXT NOT NULL,
+    cooldown_s INTEGER NOT NULL DEFAULT 900,
+    enabled BOOLEAN NOT NULL DEFAULT TRUE,
+    created_at TIMESTAMPTZ DEFAULT CURRENT_TIMESTAMP,
+    CONSTRAINT alert_rules_kind_chk CHECK (kind IN ('low_count', 'offline', 'throughput_drop')),
+    CONSTRAINT alert_rules_window_chk CHECK (window_s > 0 AND baseline_s > 0 AND cooldown_s >= 0)
+);
+
+-- Notifications sent (or given up) per alert; the latest one per rule and device restores the
+-- firing state and cooldown after a restart
+CREATE TABLE IF NOT EXISTS alert_events (
+    id BIGSERIAL PRIMARY KEY,
+    rule_id INTEGER NOT NULL REFERENCES alert_rules (id) ON DELETE CASCADE,
+    device_id VARCHAR(64) NOT NULL,
+    status VARCHAR(16) NOT NULL CHECK (status IN ('firing', 'resolved')),
+    value REAL,
+    message TEXT,
+    since_at TIMESTAMPTZ,
+    attempts INTEGER NOT NULL DEFAULT 1,
+    delivered_at TIMESTAMPTZ,
+    error TEXT,
+    created_at TIMESTAMPTZ DEFAULT CURRENT_TIMESTAMP
+);
+
+-- Raw state transitions of every device, stored before the debounce (app/services/transitions.py),
+-- so counts can be recomputed with other filter parameters (back-end/scripts/recount_transitions.py).
+-- One row per block of transitions, in arrival order: t_deltas holds int32 little-endian ms deltas
+-- (the first is 0, from first_ms), kinds one byte per transition (0 interrupted, 1 clear, 2 logged
+-- clear, 3 unlogged backlog product). Large blocks are compressed by TOAST. Monthly partitions are
+-- created on demand (ensure_transition_partition) and dropped after transition_retention_months
+CREATE TABLE IF NOT EXISTS transition_blocks (
+    device_id VARCHAR(64) NOT NULL,
+    block_start TIMESTAMPTZ NOT NULL,
+    block_end TIMESTAMPTZ NOT NULL,
+    first_ms BIGINT NOT NULL,
+    n INTEGER NOT NULL,
+    t_deltas BYTEA NOT NULL,
+    kinds BYTEA NOT NULL,
+    stored_at TIMESTAMPTZ DEFAULT CURRENT_TIMESTAMP
+) PARTITION BY RANGE (block_start);
+
+-- One row, stamped by the backend on every read replica lag check (app/db/session.py). The
+-- difference between its value on the primary and on the replica is how far the replica is
+-- behind, even while the primary is otherwise idle
+CREATE TABLE IF NOT EXISTS replica_heartbeat (
+    id SMALLINT PRIMARY KEY CHECK (id = 1),
+    beat_at TIMESTAMPTZ NOT NULL DEFAULT NOW()
+);
+
 -- System logs for monitoring and debugging
 CREATE TABLE IF NOT EXISTS system_logs (
     id SERIAL PRIMARY KEY,
@@ -30,17 +238,48 @@ CREATE TABLE IF NOT EXISTS system_settings (
     updated_at TIMESTAMPTZ NOT NULL DEFAULT NOW()
 );
 
+-- Raw beam edge traces uploaded by devices on demand (see edge_trace.cpp).
+-- 'trace' holds the document loaded by back-end/scripts/fleet_simulator.py --trace.
+CREATE TABLE IF NOT EXISTS edge_traces (
+    id SERIAL PRIMARY KEY,
+    device_id VARCHAR(64) NOT NULL,
+    trace_id INTEGER NOT NULL,
+    received_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    complete BOOLEAN NOT NULL,
+    edge_count INTEGER NOT NULL,
+    trace JSONB NOT NULL
+);
+
 -- ======================================================================
 -- Indexes (Performance Improvements)
 -- ======================================================================
 
 -- Speed up time-based queries and ordering
 CREATE INDEX IF NOT EXISTS idx_pizza_counts_timestamp ON pizza_counts ("timestamp" DESC);
+-- A logged product is stored once, however often the device replays it
+CREATE UNIQUE INDEX IF NOT EXISTS idx_pizza_counts_log
+    ON pizza_counts (device_id, log_epoch, log_n) WHERE log_n IS NOT NULL;
 
 -- Speed up log filtering and ordering
 CREATE INDEX IF NOT EXISTS idx_system_logs_timestamp ON system_logs ("timestamp" DESC);
 CREATE INDEX IF NOT EXISTS idx_system_logs_level ON system_logs (level);
 
+-- Expire old invalidations
+CREATE INDEX IF NOT EXISTS idx_rollup_invalidations_created ON rollup_invalidations (created_at);
+-- Flow of one device's station (backend start-up replays the products in transit)
+CREATE INDEX IF NOT EXISTS idx_pizza_counts_device ON pizza_counts (device_id, "timestamp" DESC);
+-- Flow history of all links, newest first
+CREATE INDEX IF NOT EXISTS idx_flow_minutes_minute ON flow_minutes (minute DESC);
+
+-- Latest alert events (backend start-up, history)
+CREATE INDEX IF NOT EXISTS idx_alert_events_created ON alert_events (created_at DESC);
+
+-- Transitions of one device over a time range (recounts)
+CREATE INDEX IF NOT EXISTS idx_transition_blocks_device ON transition_blocks (device_id, block_start);
+
+-- List traces per device, newest first
+CREATE INDEX IF NOT EXISTS idx_edge_traces_device ON edge_traces (device_id, received_at DESC);
+
 -- ======================================================================
 -- Views (Optimized for Grafana)
 -- ======================================================================
@@ -52,24 +291,28 @@ SELECT
   "timestamp" AS timestampz
 FROM pizza_counts;
 
--- Counts aggregated by hour
+-- Counts aggregated by hour (from the minute rollups, and the hourly rollups past their retention)
 CREATE OR REPLACE VIEW hourly_counts AS
 SELECT 
-    DATE_TRUNC('hour', "timestamp") AS hour,
-    COUNT(*) AS total_counts,
-    EXTRACT(EPOCH FROM DATE_TRUNC('hour', "timestamp")) AS timestamp_unix
-FROM pizza_counts
-GROUP BY DATE_TRUNC('hour', "timestamp")
+    hour,
+    SUM(counts) AS total_counts,
+    EXTRACT(EPOCH FROM hour) AS timestamp_unix
+FROM (SELECT DATE_TRUNC('hour', minute) AS hour, counts FROM count_rollups
+      UNION ALL
+      SELECT hour, counts FROM count_rollups_hourly) c
+GROUP BY hour
 ORDER BY hour;
 
--- Counts aggregated by day
+-- Counts aggregated by day (from the minute rollups, and the hourly rollups past their retention)
 CREATE OR REPLACE VIEW daily_counts AS
 SELECT 
-    DATE("timestamp") AS date,
-    COUNT(*) AS total_counts,
-    EXTRACT(EPOCH FROM DATE("timestamp")) AS timestamp_unix
-FROM pizza_counts
-GROUP BY DATE("timestamp")
+    DATE(hour) AS date,
+    SUM(counts) AS total_counts,
+    EXTRACT(EPOCH FROM DATE(hour)) AS timestamp_unix
+FROM (SELECT minute AS hour, counts FROM count_rollups
+      UNION ALL
+      SELECT hour, counts FROM count_rollups_hourly) c
+GROUP BY DATE(hour)
 ORDER BY date;
 
 -- Statistics for the current day
@@ -95,16 +338,16 @@ FROM pizza_counts
 WHERE "timestamp" >= CURRENT_TIMESTAMP - INTERVAL '24 hours'
 ORDER BY "timestamp" DESC;
 
--- Production speed (pizzas per hour)
+-- Production speed (pizzas per hour, from the minute rollups)
 CREATE OR REPLACE VIEW production_speed AS
 SELECT 
-    DATE_TRUNC('hour', "timestamp") AS hour,
-    COUNT(*) AS pizzas_per_hour,
-    EXTRACT(EPOCH FROM DATE_TRUNC('hour', "timestamp")) AS timestamp_unix,
-    ROUND(COUNT(*)::NUMERIC / 1, 2) AS pizzas_per_hour_decimal
-FROM pizza_counts
-WHERE "timestamp" >= CURRENT_TIMESTAMP - INTERVAL '24 hours'
-GROUP BY DATE_TRUNC('hour', "timestamp")
+    DATE_TRUNC('hour', minute) AS hour,
+    SUM(counts) AS pizzas_per_hour,
+    EXTRACT(EPOCH FROM DATE_TRUNC('hour', minute)) AS timestamp_unix,
+    ROUND(SUM(counts)::NUMERIC / 1, 2) AS pizzas_per_hour_decimal
+FROM count_rollups
+WHERE minute >= DATE_TRUNC('minute', CURRENT_TIMESTAMP - INTERVAL '24 hours')
+GROUP BY DATE_TRUNC('hour', minute)
 ORDER BY hour;
 
 -- ======================================================================
@@ -116,9 +359,16 @@ INSERT INTO system_settings (key, value, description) VALUES
 ('version', '1.0.0', 'Current System Version'),
 ('timezone', 'America/Sao_Paulo', 'System Timezone'),
 ('log_retention_days', '30', 'Days to keep logs'),
-('cleanup_interval_hours', '24', 'Interval for automatic cleanup')
+('cleanup_interval_hours', '24', 'Interval for automatic cleanup'),
+('rollup_allowed_lateness_s', '120', 'Seconds after a minute ends before late counts invalidate its rollup'),
+('transition_retention_months', '12', 'Months of raw state transitions to keep'),
+('raw_retention_days', '90', 'Days of raw counts to keep; older ones only remain as rollups (0 = forever)'),
+('rollup_retention_months', '12', 'Months of minute rollups to keep; older ones are merged into hourly rollups (0 = forever)'),
+('retention_batch_hours', '6', 'Hours of counts demoted per transaction by the retention job')
 ON CONFLICT (key) DO NOTHING;
 
+INSERT INTO replica_heartbeat (id) VALUES (1) ON CONFLICT (id) DO NOTHING;
+
 -- ======================================================================
 -- Functions & Triggers
 -- ======================================================================
@@ -158,9 +408,209 @@ BEGIN
 
     GET DIAGNOSTICS deleted_count = ROW_COUNT;
 
+    DELETE FROM rollup_invalidations
+    WHERE created_at < CURRENT_TIMESTAMP - (retention_days || ' days')::INTERVAL;
+
+    DELETE FROM alert_events
+    WHERE created_at < CURRENT_TIMESTAMP - (retention_days || ' days')::INTERVAL;
+
+    PERFORM drop_old_transition_partitions();
+
     INSERT INTO system_logs (level, message, source)
     VALUES ('INFO', 'Auto cleanup: ' || deleted_count || ' logs removed', 'system');
 
     RETURN deleted_count;
 END;
-$$ LANGUAGE plpgsql;
\ No newline at end of file
+$$ LANGUAGE plpgsql;
+
+-- Monthly partition of transition_blocks holding the given time (created if missing)
+CREATE OR REPLACE FUNCTION ensure_transition_partition(moment TIMESTAMPTZ)
+RETURNS TEXT AS $$
+DECLARE
+    month_start TIMESTAMP := DATE_TRUNC('month', moment AT TIME ZONE 'UTC');
+    part_name TEXT := 'transition_blocks_' || TO_CHAR(month_start, 'YYYYMM');
+BEGIN
+    EXECUTE format(
+        'CREATE TABLE IF NOT EXISTS %I PARTITION OF transition_blocks FOR VALUES FROM (%L) TO (%L)',
+        part_name, month_start AT TIME ZONE 'UTC', (month_start + INTERVAL '1 month') AT TIME ZONE 'UTC');
+    RETURN part_name;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Drop the transition partitions older than transition_retention_months (whole months)
+CREATE OR REPLACE FUNCTION drop_old_transition_partitions()
+RETURNS INTEGER AS $$
+DECLARE
+    retention_months INTEGER;
+    part RECORD;
+    dropped INTEGER := 0;
+BEGIN
+    SELECT value::INTEGER INTO retention_months
+    FROM system_settings
+    WHERE key = 'transition_retention_months';
+
+    IF retention_months IS NULL THEN
+        retention_months := 12; -- default
+    END IF;
+
+    FOR part IN
+        SELECT c.relname
+        FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid
+        WHERE i.inhparent = 'transition_blocks'::REGCLASS AND c.relname ~ '^transition_blocks_[0-9]{6}$'
+    LOOP
+        IF TO_DATE(RIGHT(part.relname, 6), 'YYYYMM') + INTERVAL '1 month'
+           <= DATE_TRUNC('month', CURRENT_TIMESTAMP AT TIME ZONE 'UTC') - retention_months * INTERVAL '1 month' THEN
+            EXECUTE format('DROP TABLE %I', part.relname);
+            dropped := dropped + 1;
+        END IF;
+    END LOOP;
+
+    RETURN dropped;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Minute rollups of pizza_counts. Every statement that stores, changes or deletes counts
+-- patches only the buckets it touches. Counts arriving after their minute closed (replayed
+-- backlogs, device-timestamped events) also record the patched range in rollup_invalidations.
+CREATE OR REPLACE FUNCTION rollup_apply(devices VARCHAR[], minutes TIMESTAMPTZ[], deltas INTEGER[])
+RETURNS VOID AS $$
+DECLARE
+    lateness INTERVAL;
+BEGIN
+    SELECT (value || ' seconds')::INTERVAL INTO lateness
+    FROM system_settings
+    WHERE key = 'rollup_allowed_lateness_s';
+
+    IF lateness IS NULL THEN
+        lateness := INTERVAL '120 seconds'; -- default
+    END IF;
+
+    INSERT INTO count_rollups AS r (device_id, minute, counts)
+    SELECT * FROM unnest(devices, minutes, deltas)
+    ON CONFLICT (minute, device_id) DO UPDATE
+        SET counts = r.counts + EXCLUDED.counts, updated_at = NOW();
+
+    IF EXISTS (SELECT 1 FROM unnest(deltas) AS d (delta) WHERE delta < 0) THEN
+        DELETE FROM count_rollups r
+        USING unnest(devices, minutes) AS d (device_id, minute)
+        WHERE r.device_id = d.device_id AND r.minute = d.minute AND r.counts <= 0;
+    END IF;
+
+    -- Patched closed minutes, as runs of consecutive minutes per device
+    INSERT INTO rollup_invalidations (device_id, range_start, range_end, counts_delta)
+    SELECT device_id, MIN(minute), MAX(minute) + INTERVAL '1 minute', SUM(delta)
+    FROM (
+        SELECT d.device_id, d.minute, d.delta,
+               d.minute - ROW_NUMBER() OVER (PARTITION BY d.device_id ORDER BY d.minute) * INTERVAL '1 minute' AS run
+        FROM unnest(devices, minutes, deltas) AS d (device_id, minute, delta)
+        JOIN rollup_watermarks w ON w.device_id = d.device_id
+        WHERE d.minute + INTERVAL '1 minute' + lateness <= w.watermark
+    ) closed
+    GROUP BY device_id, run;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION rollup_count_changes()
+RETURNS TRIGGER AS $$
+BEGIN
+    -- The retention job deletes raw counts whose rollups are kept (app/services/retention.py)
+    IF TG_OP = 'DELETE' AND current_setting('terelina.retention', TRUE) = 'on' THEN
+        RETURN NULL;
+    END IF;
+
+    -- Patch against the watermarks from before this statement, then advance them
+    IF TG_OP = 'INSERT' THEN
+        PERFORM rollup_apply(array_agg(device_id), array_agg(minute), array_agg(delta))
+        FROM (SELECT COALESCE(device_id, '') AS device_id, DATE_TRUNC('minute', "timestamp") AS minute,
+                     COUNT(*)::INTEGER AS delta
+              FROM new_counts GROUP BY 1, 2) d;
+    ELSIF TG_OP = 'DELETE' THEN
+        PERFORM rollup_apply(array_agg(device_id), array_agg(minute), array_agg(delta))
+        FROM (SELECT COALESCE(device_id, '') AS device_id, DATE_TRUNC('minute', "timestamp") AS minute,
+                     -COUNT(*)::INTEGER AS delta
+              FROM old_counts GROUP BY 1, 2) d;
+    ELSE
+        PERFORM rollup_apply(array_agg(device_id), array_agg(minute), array_agg(delta))
+        FROM (SELECT device_id, minute, SUM(delta)::INTEGER AS delta
+              FROM (SELECT COALESCE(device_id, '') AS device_id, DATE_TRUNC('minute', "timestamp") AS minute,
+                           -1 AS delta FROM old_counts
+                    UNION ALL
+                    SELECT COALESCE(device_id, ''), DATE_TRUNC('minute', "timestamp"), 1 FROM new_counts) c
+              GROUP BY 1, 2
+              HAVING SUM(delta) <> 0) d;
+    END IF;
+
+    IF TG_OP IN ('INSERT', 'UPDATE') THEN
+        INSERT INTO rollup_watermarks AS w (device_id, watermark)
+        SELECT COALESCE(device_id, ''), LEAST(MAX("timestamp"), NOW())
+        FROM new_counts
+        GROUP BY 1
+        ON CONFLICT (device_id) DO UPDATE
+            SET watermark = EXCLUDED.watermark, updated_at = NOW()
+            WHERE EXCLUDED.watermark > w.watermark;
+    END IF;
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+-- A TRUNCATE of pizza_counts resets every rollup, the hourly ones too: the views add both tables
+CREATE OR REPLACE FUNCTION rollup_count_truncate()
+RETURNS TRIGGER AS $$
+BEGIN
+    TRUNCATE count_rollups, count_rollups_hourly, rollup_watermarks;
+    INSERT INTO rollup_invalidations (device_id, range_start, range_end)
+    VALUES ('*', '-infinity', 'infinity');
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION notify_rollup_invalidation()
+RETURNS TRIGGER AS $$
+BEGIN
+    PERFORM pg_notify('rollup_invalidated', json_build_object(
+        'id', NEW.id, 'device_id', NEW.device_id,
+        'range_start', NEW.range_start, 'range_end', NEW.range_end)::TEXT);
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS rollup_pizza_counts_insert ON pizza_counts;
+CREATE TRIGGER rollup_pizza_counts_insert
+    AFTER INSERT ON pizza_counts
+    REFERENCING NEW TABLE AS new_counts
+    FOR EACH STATEMENT EXECUTE FUNCTION rollup_count_changes();
+
+DROP TRIGGER IF EXISTS rollup_pizza_counts_update ON pizza_counts;
+CREATE TRIGGER rollup_pizza_counts_update
+    AFTER UPDATE ON pizza_counts
+    REFERENCING OLD TABLE AS old_counts NEW TABLE AS new_counts
+    FOR EACH STATEMENT EXECUTE FUNCTION rollup_count_changes();
+
+DROP TRIGGER IF EXISTS rollup_pizza_counts_delete ON pizza_counts;
+CREATE TRIGGER rollup_pizza_counts_delete
+    AFTER DELETE ON pizza_counts
+    REFERENCING OLD TABLE AS old_counts
+    FOR EACH STATEMENT EXECUTE FUNCTION rollup_count_changes();
+
+DROP TRIGGER IF EXISTS rollup_pizza_counts_truncate ON pizza_counts;
+CREATE TRIGGER rollup_pizza_counts_truncate
+    AFTER TRUNCATE ON pizza_counts
+    FOR EACH STATEMENT EXECUTE FUNCTION rollup_count_truncate();
+
+DROP TRIGGER IF EXISTS notify_rollup_invalidations ON rollup_invalidations;
+CREATE TRIGGER notify_rollup_invalidations
+    AFTER INSERT ON rollup_invalidations
+    FOR EACH ROW EXECUTE FUNCTION notify_rollup_invalidation();
+
+-- Rollups of counts stored before the triggers existed (runs once, on an empty count_rollups)
+INSERT INTO count_rollups (minute, device_id, counts)
+SELECT DATE_TRUNC('minute', "timestamp"), COALESCE(device_id, ''), COUNT(*)
+FROM pizza_counts
+WHERE NOT EXISTS (SELECT 1 FROM count_rollups)
+GROUP BY 1, 2;
+
+INSERT INTO rollup_watermarks (device_id, watermark)
+SELECT COALESCE(device_id, ''), LEAST(MAX("timestamp"), NOW())
+FROM pizza_counts
+GROUP BY 1
+ON CONFLICT (device_id) DO NOTHING;
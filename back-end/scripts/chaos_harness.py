@@ -0,0 +1,380 @@
+# back-end/scripts/chaos_harness.py
+"""
+Failure-injection harness for the full counting pipeline.
+
+Runs the fleet simulator against the Docker Compose stack (mosquitto, Postgres,
+backend) and injects one fault per scenario. Simulated devices reach the broker
+through a local TCP proxy so that WiFi drops can be emulated as network
+partitions. For each scenario the harness reports:
+
+  - lost:          products that passed the beam but were never stored
+  - duplicated:    extra stored rows of a product already stored
+  - recovery_s:    seconds from the end of the fault until the first new count is stored
+  - peak_backlog:  largest number of published products not yet stored
+
+Usage (from the repository root, with the stack's .env in place):
+    python back-end/scripts/chaos_harness.py --report chaos_report
+
+The database is read at localhost:DB_PORT (override with DB_HOST_EXTERNAL),
+using the DB_* credentials from the environment. The harness only adds rows to
+pizza_counts; run it against a test database.
+
+Every simulated product carries a durable-log number (a new log epoch per
+scenario), so lost and duplicated products are found by identity: a lost
+product and a duplicated one do not cancel out.
+"""
+
+import argparse
+import json
+import logging
+import os
+import socket
+import subprocess
+import threading
+import time
+from dataclasses import dataclass, asdict, field
+
+import psycopg2
+
+from fleet_simulator import Fleet
+
+logger = logging.getLogger("chaos_harness")
+
+REPO_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+DB_FILL_PATH = "/var/lib/postgresql/data/chaos_fill"
+
+# =====================================================================
+# Fault Injectors
+# =====================================================================
+
+class TcpProxy:
+    """Forwards TCP connections to the broker and can drop them on demand."""
+
+    def __init__(self, listen_port: int, target_host: str, target_port: int):
+        self.listen_port = listen_port
+        self.target = (target_host, target_port)
+        self._partitioned = threading.Event()
+        self._sockets = set()
+        self._lock = threading.Lock()
+        self._server = socket.create_server(("127.0.0.1", listen_port), reuse_port=False)
+        threading.Thread(target=self._accept_loop, name="proxy-accept", daemon=True).start()
+
+    def _accept_loop(self):
+        while True:
+            client, _ = self._server.accept()
+            if self._partitioned.is_set():
+                client.close()
+                continue
+            try:
+                upstream = socket.create_connection(self.target, timeout=5)
+                upstream.settimeout(None)
+            except OSError:
+                client.close()
+                continue
+            with self._lock:
+                self._sockets.update((client, upstream))
+            threading.Thread(target=self._pump, args=(client, upstream), daemon=True).start()
+            threading.Thread(target=self._pump, args=(upstream, client), daemon=True).start()
+
+    def _pump(self, src, dst):
+        try:
+            while True:
+                data = src.recv(4096)
+                if not data:
+                    break
+                dst.sendall(data)
+        except OSError:
+            pass
+        finally:
+            self._close(src)
+            self._close(dst)
+
+    def _close(self, sock):
+        with self._lock:
+            self._sockets.discard(sock)
+        try:
+            sock.close()
+        except OSError:
+            pass
+
+    def partition(self):
+        """Drops every open connection and refuses new ones (like losing WiFi)."""
+        self._partitioned.set()
+        with self._lock:
+            sockets = list(self._sockets)
+        for sock in sockets:
+            try:
+                sock.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            self._close(sock)
+
+    def heal(self):
+        self._partitioned.clear()
+
+
+def compose(*args, check=True) -> subprocess.CompletedProcess:
+    """Runs a docker compose command from the repository root."""
+    cmd = ["docker", "compose", *args]
+    logger.debug(f"$ {' '.join(cmd)}")
+    return subprocess.run(cmd, cwd=REPO_ROOT, check=check, capture_output=True, text=True)
+
+
+def fill_db_disk(max_fill_gb: float):
+    """Fills the Postgres data filesystem, refusing if it is larger than max_fill_gb."""
+    out = compose("exec", "-T", "db", "df", "-Pk", "/var/lib/postgresql/data").stdout
+    available_kb = int(out.strip().splitlines()[-1].split()[3])
+    if available_kb > max_fill_gb * 1024 * 1024:
+        raise RuntimeError(
+            f"{available_kb // 1024} MB free on the database filesystem; refusing to fill more "
+            f"than {max_fill_gb} GB (raise --disk-fill-max-gb to allow it)"
+        )
+    # dd stops with ENOSPC once the filesystem is full, which is the point
+    compose("exec", "-T", "db", "sh", "-c", f"dd if=/dev/zero of={DB_FILL_PATH} bs=1M 2>/dev/null",
+            check=False)
+
+
+def clear_db_disk():
+    compose("exec", "-T", "db", "rm", "-f", DB_FILL_PATH, check=False)
+
+# =====================================================================
+# Measurement
+# =====================================================================
+
+class CountProbe:
+    """Reads stored counts. Returns None while the database is unreachable."""
+
+    def __init__(self, dsn: dict):
+        self.dsn = dsn
+
+    def _query(self, sql: str, params=()):
+        try:
+            with psycopg2.connect(connect_timeout=2, **self.dsn) as conn:
+                with conn.cursor() as cur:
+                    cur.execute(sql, params)
+                    return cur.fetchone()[0]
+        except psycopg2.Error:
+            return None
+
+    def total(self):
+        return self._query("SELECT COUNT(*) FROM pizza_counts")
+
+    def stored_products(self, device_ids: list, log_epoch: int):
+        """{(device_id, log_n): rows} of a scenario's products, None while the database is unreachable."""
+        try:
+            with psycopg2.connect(connect_timeout=2, **self.dsn) as conn:
+                with conn.cursor() as cur:
+                    cur.execute(
+                        "SELECT device_id, log_n, COUNT(*) FROM pizza_counts "
+                        "WHERE device_id = ANY(%s) AND log_epoch = %s GROUP BY 1, 2",
+                        (device_ids, log_epoch)
+                    )
+                    return {(device, n): rows for device, n, rows in cur.fetchall()}
+        except psycopg2.Error:
+            return None
+
+    def stored_since(self, epoch_s: float):
+        return self._query('SELECT COUNT(*) FROM pizza_counts WHERE "timestamp" >= to_timestamp(%s)',
+                           (epoch_s,))
+
+
+@dataclass
+class Scenario:
+    name: str
+    inject: callable
+    heal: callable
+
+
+@dataclass
+class ScenarioResult:
+    name: str
+    fault_s: float
+    products_generated: int = 0
+    products_published: int = 0
+    stored: int = 0
+    lost: int = 0
+    duplicated: int = 0
+    dropped_on_device: int = 0
+    recovery_s: float | None = None
+    peak_backlog: int = 0
+    error: str | None = None
+    notes: list = field(default_factory=list)
+
+
+def run_scenario(scenario: Scenario, args, probe: CountProbe) -> ScenarioResult:
+    result = ScenarioResult(name=scenario.name, fault_s=args.fault)
+    logger.info(f"--- Scenario: {scenario.name} ---")
+
+    baseline = probe.total()
+    if baseline is None:
+        result.error = "database unreachable before the scenario started"
+        return result
+
+    log_epoch = int(time.time())
+    fleet = Fleet(args.devices, "127.0.0.1", args.proxy_port, args.period, args.dwell, args.jitter,
+                  log_epoch=log_epoch)
+    fleet.start()
+
+    def sample_backlog():
+        stored = probe.total()
+        if stored is not None:
+            backlog = fleet.totals()["products_published"] - (stored - baseline)
+            result.peak_backlog = max(result.peak_backlog, backlog)
+
+    def observe(seconds: float):
+        end = time.time() + seconds
+        while time.time() < end:
+            sample_backlog()
+            time.sleep(args.poll)
+
+    try:
+        observe(args.warmup)
+
+        injected = False
+        try:
+            scenario.inject()
+            injected = True
+            observe(args.fault)
+        except Exception as e:
+            result.error = f"fault injection failed: {e}"
+        finally:
+            # Also after a failed injection: a partial fault must not leak into later scenarios
+            try:
+                scenario.heal()
+            except Exception as e:
+                result.notes.append(f"heal failed: {e}")
+        if not injected:
+            return result
+        healed_at = time.time()
+
+        # Recovery: the first count stored after the fault was cleared
+        while time.time() - healed_at < args.recovery_timeout:
+            sample_backlog()
+            if (probe.stored_since(healed_at) or 0) > 0:
+                result.recovery_s = round(time.time() - healed_at, 2)
+                break
+            time.sleep(args.poll)
+        else:
+            result.notes.append(f"no count stored within {args.recovery_timeout}s of healing")
+
+        observe(args.cooldown)
+    finally:
+        fleet.stop()
+
+    # Let in-flight messages settle before the final tally
+    previous = None
+    for _ in range(int(args.settle / args.poll) + 1):
+        current = probe.total()
+        if current is not None and current == previous:
+            break
+        previous = current
+        time.sleep(args.poll)
+
+    totals = fleet.totals()
+    result.products_generated = totals["products_generated"]
+    result.products_published = totals["products_published"]
+    result.dropped_on_device = totals["messages_dropped"]
+
+    generated = {(d.device_id, n) for d in fleet.devices for n in range(1, d.products_generated + 1)}
+    stored = probe.stored_products([d.device_id for d in fleet.devices], log_epoch)
+    if stored is None:
+        result.error = "database unreachable for the final tally"
+        return result
+    result.stored = sum(stored.values())
+    result.lost = len(generated - stored.keys())
+    result.duplicated = result.stored - len(stored)
+    unexpected = len(stored.keys() - generated)
+    if unexpected:
+        result.notes.append(f"{unexpected} stored product(s) never generated")
+    return result
+
+# =====================================================================
+# Reporting
+# =====================================================================
+
+def write_report(results: list, prefix: str):
+    with open(f"{prefix}.json", "w", encoding="utf-8") as f:
+        json.dump([asdict(r) for r in results], f, indent=2)
+
+    lines = [
+        "# Chaos Harness Report",
+        "",
+        "| Scenario | Fault (s) | Generated | Stored | Lost | Duplicated | Dropped on device | Recovery (s) | Peak backlog | Notes |",
+        "|---|---|---|---|---|---|---|---|---|---|",
+    ]
+    for r in results:
+        notes = "; ".join(([r.error] if r.error else []) + r.notes)
+        recovery = "-" if r.recovery_s is None else r.recovery_s
+        lines.append(
+            f"| {r.name} | {r.fault_s} | {r.products_generated} | {r.stored} | {r.lost} | "
+            f"{r.duplicated} | {r.dropped_on_device} | {recovery} | {r.peak_backlog} | {notes} |"
+        )
+    with open(f"{prefix}.md", "w", encoding="utf-8") as f:
+        f.write("\n".join(lines) + "\n")
+    print("\n".join(lines))
+
+# =====================================================================
+# Entry Point
+# =====================================================================
+
+def main():
+    parser = argparse.ArgumentParser(description="Inject faults into the Terelina pipeline and measure the impact.")
+    parser.add_argument("--scenarios", default="wifi_drop,broker_restart,db_restart,backend_kill,disk_full",
+                        help="Comma-separated list of scenarios to run, in order")
+    parser.add_argument("--devices", type=int, default=1)
+    parser.add_argument("--period", type=float, default=1.0, help="Mean seconds between products per device")
+    parser.add_argument("--dwell", type=float, default=0.3)
+    parser.add_argument("--jitter", type=float, default=0.2)
+    parser.add_argument("--warmup", type=float, default=10, help="Seconds of normal operation before the fault")
+    parser.add_argument("--fault", type=float, default=20, help="Seconds the fault is held")
+    parser.add_argument("--cooldown", type=float, default=10, help="Seconds observed after recovery")
+    parser.add_argument("--recovery-timeout", type=float, default=120)
+    parser.add_argument("--settle", type=float, default=10, help="Max seconds to wait for counts to settle")
+    parser.add_argument("--poll", type=float, default=0.5)
+    parser.add_argument("--broker-host", default="localhost")
+    parser.add_argument("--broker-port", type=int, default=1883)
+    parser.add_argument("--proxy-port", type=int, default=18830)
+    parser.add_argument("--disk-fill-max-gb", type=float, default=4.0)
+    parser.add_argument("--no-compose-up", action="store_true", help="Do not start the stack")
+    parser.add_argument("--report", default="chaos_report", help="Report path prefix (.json and .md)")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+
+    if not args.no_compose_up:
+        logger.info("Starting db, mqtt and backend containers...")
+        compose("up", "-d", "db", "mqtt", "backend")
+
+    dsn = {
+        "host": os.getenv("DB_HOST_EXTERNAL", "localhost"),
+        "port": int(os.getenv("DB_PORT", "5432")),
+        "dbname": os.getenv("DB_NAME", "terelina_db"),
+        "user": os.getenv("DB_USER", "postgres"),
+        "password": os.getenv("DB_PASSWORD", "postgres"),
+    }
+    probe = CountProbe(dsn)
+    proxy = TcpProxy(args.proxy_port, args.broker_host, args.broker_port)
+
+    available = {
+        "wifi_drop": Scenario("wifi_drop", proxy.partition, proxy.heal),
+        "broker_restart": Scenario("broker_restart",
+                                   lambda: compose("stop", "mqtt"), lambda: compose("start", "mqtt")),
+        "db_restart": Scenario("db_restart",
+                               lambda: compose("stop", "db"), lambda: compose("start", "db")),
+        "backend_kill": Scenario("backend_kill",
+                                 lambda: compose("kill", "backend"), lambda: compose("start", "backend")),
+        "disk_full": Scenario("disk_full",
+                              lambda: fill_db_disk(args.disk_fill_max_gb), clear_db_disk),
+    }
+
+    results = []
+    for name in [s.strip() for s in args.scenarios.split(",") if s.strip()]:
+        if name not in available:
+            parser.error(f"unknown scenario '{name}' (choose from {', '.join(available)})")
+        results.append(run_scenario(available[name], args, probe))
+
+    write_report(results, args.report)
+
+
+if __name__ == "__main__":
+    main()
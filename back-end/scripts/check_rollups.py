@@ -0,0 +1,174 @@
+# back-end/scripts/check_rollups.py
+"""
+Checks the minute rollups (count_rollups) against the raw counts, and checks
+that rollup_invalidations is enough to keep a copy of the rollups current.
+
+"snapshot" saves the rollups of the last --hours like a cache would, with the
+id of the newest invalidation. "verify" then plays that cache: it re-reads
+only the ranges invalidated since the snapshot and compares the result with
+the current rollups. Minutes that were still open at the snapshot (within
+rollup_allowed_lateness_s of their device's watermark) may change without an
+invalidation, so a cache must not keep them; they are skipped.
+It also compares the current rollups with a recount of pizza_counts.
+
+Usage (from the repository root, against a test database):
+    python back-end/scripts/fleet_simulator.py --devices 3 --duration 30      # Live traffic: sets the watermarks
+    python back-end/scripts/check_rollups.py snapshot --hours 24
+    python back-end/scripts/fleet_simulator.py --devices 3 --backlog 2000 --backlog-hours 12
+    python back-end/scripts/check_rollups.py verify
+
+The database is read at localhost:DB_PORT (override with DB_HOST_EXTERNAL),
+using the DB_* credentials from the environment. Exits with status 1 if a
+check fails.
+"""
+
+import argparse
+import json
+import logging
+import os
+import sys
+from datetime import datetime, timedelta, timezone
+
+import psycopg2
+
+logger = logging.getLogger("check_rollups")
+
+
+def connect():
+    return psycopg2.connect(
+        host=os.getenv("DB_HOST_EXTERNAL", "localhost"),
+        port=int(os.getenv("DB_PORT", "5432")),
+        dbname=os.getenv("DB_NAME", "terelina_db"),
+        user=os.getenv("DB_USER", "postgres"),
+        password=os.getenv("DB_PASSWORD", "postgres"),
+    )
+
+
+def read_rollups(cur, start: datetime, end: datetime, device_id: str | None = None) -> dict:
+    """{(device_id, minute ISO): counts} in [start, end)."""
+    cur.execute(
+        "SELECT device_id, minute, counts FROM count_rollups "
+        "WHERE minute >= %s AND minute < %s AND (%s::VARCHAR IS NULL OR device_id = %s)",
+        (start, end, device_id, device_id)
+    )
+    return {(device, minute.isoformat()): counts for device, minute, counts in cur.fetchall()}
+
+
+def closed_limits(cur) -> dict:
+    """{device_id: start of its newest closed minute}."""
+    cur.execute("SELECT value FROM system_settings WHERE key = 'rollup_allowed_lateness_s'")
+    row = cur.fetchone()
+    lateness = timedelta(seconds=int(row[0]) if row else 120)
+    cur.execute("SELECT device_id, watermark FROM rollup_watermarks")
+    return {device: at - lateness - timedelta(minutes=1) for device, at in cur.fetchall()}
+
+
+def snapshot(args):
+    end = datetime.now(timezone.utc)
+    start = end - timedelta(hours=args.hours)
+    with connect() as conn, conn.cursor() as cur:
+        cur.execute("SELECT COALESCE(MAX(id), 0) FROM rollup_invalidations")
+        last_id = cur.fetchone()[0]
+        rollups = read_rollups(cur, start, end + timedelta(days=1))
+        closed = closed_limits(cur)
+    with open(args.file, "w", encoding="utf-8") as f:
+        json.dump({
+            "start": start.isoformat(),
+            "last_invalidation_id": last_id,
+            "closed_before": {device: at.isoformat() for device, at in closed.items()},
+            "rollups": [[device, minute, counts] for (device, minute), counts in rollups.items()],
+        }, f)
+    logger.info(f"Saved {len(rollups)} rollup buckets since {start:%Y-%m-%d %H:%M} "
+                f"(last invalidation {last_id}) to {args.file}")
+
+
+def verify(args) -> bool:
+    with open(args.file, encoding="utf-8") as f:
+        saved = json.load(f)
+    start = datetime.fromisoformat(saved["start"])
+    end = datetime.now(timezone.utc) + timedelta(days=1)
+    cache = {(device, minute): counts for device, minute, counts in saved["rollups"]}
+    ok = True
+
+    with connect() as conn, conn.cursor() as cur:
+        # --- Apply the invalidations, as a cache would ---
+        # Clamped in SQL: a TRUNCATE invalidates (-infinity, infinity)
+        cur.execute(
+            "SELECT id, device_id, GREATEST(range_start, %s), LEAST(range_end, %s) "
+            "FROM rollup_invalidations WHERE id > %s ORDER BY id",
+            (start, end, saved["last_invalidation_id"])
+        )
+        invalidations = cur.fetchall()
+        minutes_reread = 0
+        for _, device_id, range_start, range_end in invalidations:
+            if range_start >= range_end:
+                continue
+            device = None if device_id == "*" else device_id
+            for key in [k for k in cache if (device is None or k[0] == device)
+                        and range_start <= datetime.fromisoformat(k[1]) < range_end]:
+                del cache[key]
+            fresh = read_rollups(cur, range_start, range_end, device)
+            cache.update(fresh)
+            minutes_reread += int((range_end - range_start).total_seconds() // 60)
+        logger.info(f"{len(invalidations)} invalidation(s) since the snapshot, {minutes_reread} minute(s) re-read")
+
+        # --- Compare with the current rollups, for minutes closed at the snapshot ---
+        current = read_rollups(cur, start, end)
+        closed = {device: datetime.fromisoformat(at) for device, at in saved["closed_before"].items()}
+        stale = []
+        for key in set(cache) | set(current):
+            device, minute = key
+            limit = closed.get(device)
+            if limit is None or datetime.fromisoformat(minute) > limit:
+                continue
+            if cache.get(key, 0) != current.get(key, 0):
+                stale.append((device, minute, cache.get(key, 0), current.get(key, 0)))
+        if stale:
+            ok = False
+            logger.error(f"{len(stale)} closed bucket(s) changed without an invalidation, e.g.:")
+            for device, minute, cached, actual in sorted(stale)[:10]:
+                logger.error(f"  {device} {minute}: cached {cached}, now {actual}")
+        else:
+            logger.info("Cache kept current by invalidations alone: OK")
+
+        # --- Compare the rollups with a recount of the raw counts ---
+        cur.execute(
+            """
+            SELECT COUNT(*), COALESCE(SUM(ABS(COALESCE(r.counts, 0) - COALESCE(p.counts, 0))), 0)
+            FROM (SELECT * FROM count_rollups WHERE minute >= %(start)s) r
+            FULL JOIN (
+                SELECT DATE_TRUNC('minute', "timestamp") AS minute, COALESCE(device_id, '') AS device_id,
+                       COUNT(*) AS counts
+                FROM pizza_counts
+                WHERE "timestamp" >= %(start)s
+                GROUP BY 1, 2
+            ) p USING (minute, device_id)
+            WHERE COALESCE(r.counts, 0) <> COALESCE(p.counts, 0)
+            """,
+            {"start": start}
+        )
+        buckets, difference = cur.fetchone()
+        if buckets:
+            ok = False
+            logger.error(f"Rollups differ from the raw counts in {buckets} bucket(s) ({difference} counts)")
+        else:
+            logger.info(f"Rollups match the raw counts ({len(current)} buckets): OK")
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check the minute rollups and their invalidations.")
+    parser.add_argument("command", choices=["snapshot", "verify"])
+    parser.add_argument("--hours", type=float, default=24, help="Range saved by snapshot")
+    parser.add_argument("--file", default="rollup_snapshot.json")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+    if args.command == "snapshot":
+        snapshot(args)
+    elif not verify(args):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
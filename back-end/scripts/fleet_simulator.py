@@ -0,0 +1,369 @@
+# back-end/scripts/fleet_simulator.py
+"""
+Simulates a fleet of Terelina barrier devices publishing over MQTT.
+
+Each simulated device behaves like the firmware: it publishes "interrupted" /
+"clear" JSON states to the state topic (QoS 0), a heartbeat retained on
+<heartbeat topic>/<id> on connect, and registers an "offline" Last Will there.
+Like the firmware, states produced while the device is disconnected are
+dropped, not queued.
+
+Usage:
+    python back-end/scripts/fleet_simulator.py --devices 1 --period 1.0 --duration 60
+
+With --transport mqttsn the devices publish like a firmware built with
+TERELINA_USE_MQTTSN: compact "<id>,<i|c>,<rssi>,<uptime_s>,<seq>" payloads over
+UDP to the MQTT-SN gateway (default port 10000), without a Last Will.
+Their heartbeats (topic id 2) only reach the broker for the devices listed in
+mosquitto/mqttsn/predefinedTopic.conf.
+
+Replay mode feeds a raw edge trace captured on a real device (GET /v1/traces/{id})
+through the firmware's debounce and publishes the resulting states with the
+original timing:
+    python back-end/scripts/fleet_simulator.py --trace trace.json --debounce-ms 50
+
+Backlog mode publishes products on the backlog topic as devices replaying an
+outage would, but spread over the last N hours and shuffled across devices,
+so they reach the backend heavily out of order (check the minute rollups
+afterwards with check_rollups.py):
+    python back-end/scripts/fleet_simulator.py --devices 3 --backlog 2000 --backlog-hours 12
+"""
+
+import argparse
+import json
+import logging
+import random
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+from mqttsn_client import MqttSnClient, TOPIC_ID_STATE, TOPIC_ID_HEARTBEAT
+
+logger = logging.getLogger("fleet_simulator")
+
+DEFAULT_TOPIC_STATE = "sensors/barrier/state"
+DEFAULT_TOPIC_HEARTBEAT = "sensors/barrier/heartbeat"
+DEFAULT_TOPIC_BACKLOG_PREFIX = "sensors/barrier/backlog"
+
+
+class SimulatedDevice:
+    """One simulated ESP32: its own MQTT session and product timeline."""
+
+    def __init__(self, device_id: str, host: str, port: int, period_s: float,
+                 dwell_s: float, jitter: float, topic_state: str, topic_heartbeat: str,
+                 transport: str = "tcp", on_sent=None, log_epoch: int | None = None):
+        self.device_id = device_id
+        self.period_s = period_s
+        self.dwell_s = dwell_s
+        self.jitter = jitter
+        self.topic_state = topic_state
+        self.topic_heartbeat = topic_heartbeat
+        self.started_at = time.time()
+
+        # Counters read by the chaos harness (only ever incremented)
+        self.products_generated = 0   # Products that passed the beam
+        self.products_published = 0   # Products whose "clear" was handed to the broker
+        self.messages_dropped = 0     # States dropped because the device was offline
+        self.disconnects = 0
+
+        # Every state carries a per-device sequence number; on_sent(device_id, seq)
+        # lets the transport benchmark match publishes to deliveries.
+        self.seq = 0
+        self.on_sent = on_sent
+
+        # With a log epoch, each "clear" carries the product's durable-log number
+        # (epoch, n = products_generated), so every stored product can be traced
+        # back to the one generated.
+        self.log_epoch = log_epoch
+
+        self._stop = threading.Event()
+        self._thread = None
+
+        self.transport = transport
+        self.host = host
+        self.port = port
+        if transport == "mqttsn":
+            # MQTT-SN has no Last Will here; the heartbeat stays "online" after a crash
+            self.client = MqttSnClient(device_id, host, port, keepalive_s=30)
+            self.client.on_connect = self._on_connect_sn
+        else:
+            self.client = mqtt.Client(client_id=device_id, protocol=mqtt.MQTTv311)
+            self.client.will_set(f"{topic_heartbeat}/{device_id}", "offline", qos=1, retain=True)
+            self.client.reconnect_delay_set(min_delay=1, max_delay=5)
+            self.client.on_connect = self._on_connect
+            self.client.on_disconnect = self._on_disconnect
+
+    # --- MQTT callbacks ---
+
+    def _heartbeat(self) -> dict:
+        return {"id": self.device_id, "status": "online", "rssi": random.randint(-75, -45),
+                "uptime_s": int(time.time() - self.started_at), "heap": random.randint(150000, 200000),
+                "cfg": 1, "queue": 0}
+
+    def _on_connect(self, client, userdata, flags, rc, properties=None):
+        if rc == 0:
+            client.publish(f"{self.topic_heartbeat}/{self.device_id}", json.dumps(self._heartbeat()),
+                           qos=0, retain=True)
+
+    def _on_disconnect(self, client, userdata, rc, properties=None):
+        if rc != 0:
+            self.disconnects += 1
+
+    def _on_connect_sn(self):
+        self.client.publish(TOPIC_ID_HEARTBEAT, ",".join(str(v) for v in self._heartbeat().values()), retain=True)
+
+    # --- Publishing ---
+
+    def _publish_state(self, interrupted: bool, log_n: int | None = None) -> bool:
+        if not self.client.is_connected():
+            self.messages_dropped += 1
+            return False
+
+        self.seq += 1
+        rssi = random.randint(-75, -45)
+        uptime_s = int(time.time() - self.started_at)
+
+        if self.transport == "mqttsn":
+            payload = f"{self.device_id},{'i' if interrupted else 'c'},{rssi},{uptime_s},{self.seq}"
+            if log_n:
+                payload += f";;;{self.log_epoch},{log_n}"
+            sent = self.client.publish(TOPIC_ID_STATE, payload)
+        else:
+            data = {
+                "id": self.device_id,
+                "state": "interrupted" if interrupted else "clear",
+                "rssi": rssi,
+                "uptime_s": uptime_s,
+                "seq": self.seq,
+            }
+            if log_n:
+                data["log"] = {"epoch": self.log_epoch, "n": log_n}
+            payload = json.dumps(data)
+            sent = self.client.publish(self.topic_state, payload, qos=0).rc == mqtt.MQTT_ERR_SUCCESS
+
+        if not sent:
+            self.messages_dropped += 1
+            return False
+        if self.on_sent:
+            self.on_sent(self.device_id, self.seq)
+        return True
+
+    def _sleep(self, seconds: float) -> bool:
+        """Sleeps unless stopped. Returns False if the device was stopped."""
+        return not self._stop.wait(max(0.0, seconds))
+
+    def _run(self):
+        # Stagger devices so they do not all fire on the same tick
+        if not self._sleep(random.uniform(0, self.period_s)):
+            return
+        while not self._stop.is_set():
+            gap = self.period_s * random.uniform(1 - self.jitter, 1 + self.jitter)
+            dwell = min(self.dwell_s, gap / 2)
+
+            self._publish_state(True)
+            if not self._sleep(dwell):
+                return  # Stopped with the product still in the beam: it never passed
+            self.products_generated += 1
+            if self._publish_state(False, self.products_generated if self.log_epoch else None):
+                self.products_published += 1
+            if not self._sleep(gap - dwell):
+                return
+
+    # --- Lifecycle ---
+
+    def start(self):
+        if self.transport == "mqttsn":
+            self.client.start()
+        else:
+            self.client.connect_async(self.host, self.port, keepalive=30)
+            self.client.loop_start()
+        self._thread = threading.Thread(target=self._run, name=f"sim-{self.device_id}", daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        if self._thread:
+            self._thread.join()
+        if self.transport == "mqttsn":
+            self.client.stop()
+        else:
+            self.client.disconnect()
+            self.client.loop_stop()
+
+
+def debounce_trace(doc: dict, debounce_ms: float) -> list:
+    """
+    Applies the firmware's handleSensor() debounce to a raw edge trace.
+    A raw level becomes the stable state once it has been held for debounce_ms.
+    Returns [(t_us, interrupted)] for each confirmed state change.
+    """
+    if doc.get("format") != "terelina-edge-trace/1":
+        raise ValueError(f"unsupported trace format: {doc.get('format')!r}")
+
+    debounce_us = debounce_ms * 1000
+    end_us = doc["duration_ms"] * 1000
+    stable = bool(doc["initial_interrupted"])
+    edges = doc["edges"]
+    changes = []
+
+    for i, (t_us, level) in enumerate(edges):
+        held_until = edges[i + 1][0] if i + 1 < len(edges) else max(end_us, t_us + debounce_us)
+        if bool(level) != stable and held_until - t_us >= debounce_us:
+            stable = bool(level)
+            changes.append((t_us + debounce_us, stable))
+    return changes
+
+
+def replay_trace(path: str, host: str, port: int, debounce_ms: float, speed: float,
+                 topic_state: str = DEFAULT_TOPIC_STATE, device_id: str | None = None):
+    """Publishes the debounced states of a recorded trace with the original timing."""
+    with open(path, encoding="utf-8") as f:
+        doc = json.load(f)
+
+    changes = debounce_trace(doc, debounce_ms)
+    products = sum(1 for _, interrupted in changes if not interrupted)
+    device_id = device_id or doc["device_id"]
+    logger.info(f"Trace {doc['trace_id']} from {doc['device_id']}: {len(doc['edges'])} raw edges, "
+                f"{len(changes)} debounced changes, {products} products "
+                f"(complete={doc['complete']}, overflowed={doc['overflowed']})")
+
+    client = mqtt.Client(client_id=f"{device_id}_replay", protocol=mqtt.MQTTv311)
+    client.connect(host, port, keepalive=30)
+    client.loop_start()
+
+    started = time.monotonic()
+    for t_us, interrupted in changes:
+        delay = t_us / 1e6 / speed - (time.monotonic() - started)
+        if delay > 0:
+            time.sleep(delay)
+        payload = json.dumps({"id": device_id, "state": "interrupted" if interrupted else "clear"})
+        client.publish(topic_state, payload, qos=0).wait_for_publish()
+
+    client.disconnect()
+    client.loop_stop()
+    logger.info(f"Replay finished: {len(changes)} states published.")
+
+
+def replay_backlog(host: str, port: int, devices: int, products: int, hours: float,
+                   id_prefix: str = "SIM_Barrier", topic_prefix: str = DEFAULT_TOPIC_BACKLOG_PREFIX,
+                   dwell_s: float = 0.3) -> dict:
+    """
+    Publishes products of the last `hours` as backlog messages (QoS 1), in a
+    random order across devices and time. age_ms is computed when each one is
+    sent, so the stored timestamps are the generated ones.
+    Returns {device_id: products published}.
+    """
+    now = time.time()
+    events = [(f"{id_prefix}_{d:03d}", now - random.uniform(0, hours * 3600))
+              for d in range(1, devices + 1) for _ in range(products)]
+    random.shuffle(events)
+
+    client = mqtt.Client(client_id=f"{id_prefix}_backlog", protocol=mqtt.MQTTv311)
+    client.connect(host, port, keepalive=30)
+    client.loop_start()
+
+    published = {}
+    for seq, (device_id, event_s) in enumerate(events, start=1):
+        payload = json.dumps({
+            "id": device_id,
+            "seq": seq,
+            "age_ms": int((time.time() - event_s) * 1000),
+            "dwell_ms": int(dwell_s * 1000),
+        })
+        client.publish(f"{topic_prefix}/{device_id}", payload, qos=1).wait_for_publish()
+        published[device_id] = published.get(device_id, 0) + 1
+        if seq % 1000 == 0:
+            logger.info(f"Backlog: {seq}/{len(events)} products published")
+
+    client.disconnect()
+    client.loop_stop()
+    logger.info(f"Backlog replay finished: {len(events)} products over {hours} h from {devices} device(s).")
+    return published
+
+
+class Fleet:
+    """A group of simulated devices with aggregated counters."""
+
+    def __init__(self, devices: int, host: str, port: int, period_s: float = 1.0,
+                 dwell_s: float = 0.3, jitter: float = 0.2, id_prefix: str = "SIM_Barrier",
+                 topic_state: str = DEFAULT_TOPIC_STATE,
+                 topic_heartbeat: str = DEFAULT_TOPIC_HEARTBEAT,
+                 transport: str = "tcp", on_sent=None, log_epoch: int | None = None):
+        self.devices = [
+            SimulatedDevice(f"{id_prefix}_{i:03d}", host, port, period_s, dwell_s, jitter,
+                            topic_state, topic_heartbeat, transport, on_sent, log_epoch)
+            for i in range(1, devices + 1)
+        ]
+
+    def start(self):
+        for device in self.devices:
+            device.start()
+
+    def stop(self):
+        for device in self.devices:
+            device.stop()
+
+    def totals(self) -> dict:
+        return {
+            "products_generated": sum(d.products_generated for d in self.devices),
+            "products_published": sum(d.products_published for d in self.devices),
+            "messages_dropped": sum(d.messages_dropped for d in self.devices),
+            "disconnects": sum(d.disconnects for d in self.devices),
+        }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate Terelina barrier devices over MQTT.")
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=None,
+                        help="Broker port (default 1883, or 10000 for the MQTT-SN gateway)")
+    parser.add_argument("--transport", choices=["tcp", "mqttsn"], default="tcp",
+                        help="Device transport (--trace and --backlog replays always use TCP)")
+    parser.add_argument("--devices", type=int, default=1)
+    parser.add_argument("--period", type=float, default=1.0, help="Mean seconds between products")
+    parser.add_argument("--dwell", type=float, default=0.3, help="Seconds the beam stays interrupted")
+    parser.add_argument("--jitter", type=float, default=0.2, help="Relative jitter on the period")
+    parser.add_argument("--duration", type=float, default=0, help="Seconds to run (0 = until Ctrl+C)")
+    parser.add_argument("--topic-state", default=DEFAULT_TOPIC_STATE)
+    parser.add_argument("--topic-heartbeat", default=DEFAULT_TOPIC_HEARTBEAT)
+    parser.add_argument("--trace", default=None, help="Replay a raw edge trace document instead of simulating")
+    parser.add_argument("--debounce-ms", type=float, default=50, help="Firmware debounce applied to --trace")
+    parser.add_argument("--speed", type=float, default=1.0, help="Time compression for --trace")
+    parser.add_argument("--backlog", type=int, default=0,
+                        help="Publish this many out-of-order backlog products per device, then exit")
+    parser.add_argument("--backlog-hours", type=float, default=6.0, help="Time span of --backlog products")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+    if args.port is None:
+        args.port = 10000 if args.transport == "mqttsn" and not (args.trace or args.backlog) else 1883
+
+    if args.trace:
+        replay_trace(args.trace, args.host, args.port, args.debounce_ms, args.speed, args.topic_state)
+        return
+
+    if args.backlog:
+        replay_backlog(args.host, args.port, args.devices, args.backlog, args.backlog_hours)
+        return
+
+    fleet = Fleet(args.devices, args.host, args.port, args.period, args.dwell, args.jitter,
+                  topic_state=args.topic_state, topic_heartbeat=args.topic_heartbeat,
+                  transport=args.transport)
+    fleet.start()
+    logger.info(f"Simulating {args.devices} device(s) against {args.host}:{args.port} ({args.transport})")
+
+    started = time.time()
+    try:
+        while args.duration <= 0 or time.time() - started < args.duration:
+            time.sleep(5)
+            logger.info(f"Totals: {fleet.totals()}")
+    except KeyboardInterrupt:
+        pass
+    finally:
+        fleet.stop()
+        logger.info(f"Final totals: {fleet.totals()}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,454 @@
+# back-end/scripts/mqtt_replay.py
+"""
+Records real MQTT traffic and replays it, faster if needed, into a local
+broker, to compare backend versions on the same input and benchmark ingest.
+
+record subscribes to the device topics and appends every message (topic,
+payload, QoS, retain, receive time) to a compact gzip file. Messages the
+backend publishes itself (acks, clock-sync replies, commands) are left out,
+and so are the retained ones the broker replays on subscribe, which are not
+traffic of the recording period (--include-retained keeps them).
+
+    python back-end/scripts/mqtt_replay.py record --host 192.168.1.10 --out line.mqr --duration 3600
+
+replay publishes a recording with its original timing (--speed 1), compressed
+(--speed 10) or as fast as the broker takes it (--speed 0). The messages of a
+device always go through the same connection in their recorded order, so
+per-device ordering is kept with several --connections. It then waits until
+pizza_counts stops growing and reports the publish and ingest rates: at
+--speed 0 that is the backend's sustained ingest throughput.
+
+    python back-end/scripts/mqtt_replay.py replay line.mqr --speed 0 --connections 4 --snapshot v1.json
+
+snapshot dumps what the backend stored (counts per device, log numbers,
+rollups, transitions, acks, flow and alert totals) to JSON, and diff compares
+two snapshots, e.g. from the same replay against two backend versions, each
+started on an emptied test database. It exits with 1 if they differ.
+
+    python back-end/scripts/mqtt_replay.py diff v1.json v2.json
+
+Counts of devices without a synced clock are stored at NOW() minus their
+age, and flow, alerts and transitions depend on timing, so --timeline (per
+minute counts) and those totals only match between replays at --speed 1.
+Replay against a test database and a local broker only.
+"""
+
+import argparse
+import gzip
+import json
+import logging
+import multiprocessing
+import os
+import queue
+import struct
+import sys
+import time
+import zlib
+
+import paho.mqtt.client as mqtt
+
+logger = logging.getLogger("mqtt_replay")
+
+DEFAULT_TOPICS = "sensors/barrier/#"
+DEFAULT_EXCLUDE = "sensors/barrier/ack/,sensors/barrier/time/resp/,sensors/barrier/cmd/"
+# Topics shared by all devices: the device id is in the payload, not the topic
+DEFAULT_SHARED = "sensors/barrier/state"
+
+# =====================================================================
+# Recording file
+# =====================================================================
+#
+# MAGIC, one JSON line of metadata, then records. A topic is written once,
+# the first time it appears, and takes the next topic id; a message carries
+# the microseconds since the previous message (a clock record resets the time
+# after gaps over ~71 minutes) and its payload. About 12 bytes per message on
+# top of the payload, before compression.
+
+MAGIC = b"TRLMQR1\n"
+KIND_TOPIC, KIND_MSG, KIND_CLOCK = 0, 1, 2
+_TOPIC = struct.Struct("<BH")      # kind, topic length
+_MSG = struct.Struct("<BIHBI")     # kind, us since the previous message, topic id, qos | retain << 2, payload length
+_CLOCK = struct.Struct("<BQ")      # kind, us since the start
+
+
+class Writer:
+    def __init__(self, path: str, meta: dict):
+        self.f = gzip.open(path, "wb", compresslevel=6)
+        self.f.write(MAGIC + json.dumps(meta).encode() + b"\n")
+        self.topics: dict[str, int] = {}
+        self.last_us = 0
+        self.messages = 0
+        self.bytes = 0
+
+    def write(self, t_us: int, topic: str, payload: bytes, qos: int, retain: bool):
+        tid = self.topics.get(topic)
+        if tid is None:
+            raw = topic.encode()
+            tid = self.topics[topic] = len(self.topics)
+            self.f.write(_TOPIC.pack(KIND_TOPIC, len(raw)) + raw)
+        dt = max(0, t_us - self.last_us)
+        if dt >= 1 << 32:
+            self.f.write(_CLOCK.pack(KIND_CLOCK, t_us))
+            self.last_us, dt = t_us, 0
+        self.last_us += dt
+        self.f.write(_MSG.pack(KIND_MSG, dt, tid, qos | (int(retain) << 2), len(payload)) + payload)
+        self.messages += 1
+        self.bytes += len(payload)
+
+    def close(self):
+        self.f.close()
+
+
+def read_meta(path: str) -> dict:
+    with gzip.open(path, "rb") as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError(f"{path} is not an MQTT recording")
+        return json.loads(f.readline())
+
+
+def read_messages(path: str):
+    """Yields (us since the start, topic, payload, qos, retain) in recorded order."""
+    with gzip.open(path, "rb") as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError(f"{path} is not an MQTT recording")
+        f.readline()
+        topics: list[str] = []
+        t_us = 0
+        while True:
+            kind = f.read(1)
+            if not kind:
+                return
+            if kind[0] == KIND_MSG:
+                _, dt, tid, flags, length = _MSG.unpack(kind + f.read(_MSG.size - 1))
+                t_us += dt
+                yield t_us, topics[tid], f.read(length), flags & 3, bool(flags & 4)
+            elif kind[0] == KIND_TOPIC:
+                _, length = _TOPIC.unpack(kind + f.read(_TOPIC.size - 1))
+                topics.append(f.read(length).decode())
+            elif kind[0] == KIND_CLOCK:
+                t_us = _CLOCK.unpack(kind + f.read(_CLOCK.size - 1))[1]
+            else:
+                raise ValueError(f"{path}: unknown record kind {kind[0]} (truncated file?)")
+
+
+def device_key(topic: str, payload: bytes, shared: set[str]) -> str:
+    """The device a message belongs to, used to keep each device on one connection."""
+    base, _, last = topic.rpartition("/")
+    if topic not in shared:
+        return last if base else topic
+    try:
+        data = json.loads(payload)
+        if isinstance(data, dict) and data.get("id"):
+            return str(data["id"])
+    except ValueError:
+        pass
+    return payload.split(b",", 1)[0].decode(errors="replace")  # Compact "<id>,..." payloads
+
+
+def _client(client_id: str) -> mqtt.Client:
+    client = mqtt.Client(client_id=client_id, protocol=mqtt.MQTTv311)
+    if os.getenv("MQTT_USERNAME"):
+        client.username_pw_set(os.getenv("MQTT_USERNAME"), os.getenv("MQTT_PASSWORD"))
+    return client
+
+# =====================================================================
+# record
+# =====================================================================
+
+def record(args) -> int:
+    exclude = tuple(p for p in args.exclude.split(",") if p)
+    writer = Writer(args.out, {"recorded_at": time.time(), "broker": f"{args.host}:{args.port}",
+                               "topics": args.topics})
+    start = time.monotonic()
+    skipped = {"excluded": 0, "retained": 0}
+
+    def on_connect(client, userdata, flags, rc, properties=None):
+        if rc != 0:
+            logger.error(f"Broker refused the connection (rc={rc}).")
+            return
+        for topic in args.topics.split(","):
+            client.subscribe(topic, qos=2)  # QoS 2: messages keep the QoS they were published with
+        logger.info(f"Recording {args.topics} from {args.host}:{args.port} to {args.out}")
+
+    def on_message(client, userdata, msg):
+        if msg.topic.startswith(exclude):
+            skipped["excluded"] += 1
+            return
+        if msg.retain and not args.include_retained:
+            skipped["retained"] += 1
+            return
+        writer.write(int((time.monotonic() - start) * 1e6), msg.topic, msg.payload, msg.qos, msg.retain)
+
+    client = _client(f"terelina_recorder_{os.getpid()}")
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.host, args.port, keepalive=30)
+    client.loop_start()
+    deadline = start + args.duration if args.duration else None
+    try:
+        while deadline is None or time.monotonic() < deadline:
+            time.sleep(10 if deadline is None else max(0.0, min(10.0, deadline - time.monotonic())))
+            elapsed = time.monotonic() - start
+            logger.info(f"{writer.messages} messages ({writer.messages / elapsed:.1f}/s), "
+                        f"{len(writer.topics)} topics, {writer.bytes / 1024:.0f} KiB of payload")
+    except KeyboardInterrupt:
+        pass
+    finally:
+        client.disconnect()
+        client.loop_stop()
+        writer.close()
+    logger.info(f"Recorded {writer.messages} messages in {time.monotonic() - start:.0f} s "
+                f"({os.path.getsize(args.out) / 1024:.0f} KiB); left out {skipped['excluded']} "
+                f"backend message(s) and {skipped['retained']} retained one(s).")
+    return 0
+
+# =====================================================================
+# replay
+# =====================================================================
+
+def _publisher(path: str, part: int, parts: int, args, start_at: float, results):
+    """Publishes this connection's share of the devices, in recorded order."""
+    shared = set(args.shared.split(","))
+    client = _client(f"terelina_replay_{os.getpid()}_{part}")
+    client.max_inflight_messages_set(100)
+    client.connect(args.host, args.port, keepalive=30)
+    client.loop_start()
+    sent, behind_max = 0, 0.0
+    while time.time() < start_at:
+        time.sleep(start_at - time.time())
+    for t_us, topic, payload, qos, retain in read_messages(path):
+        if parts > 1 and zlib.crc32(device_key(topic, payload, shared).encode()) % parts != part:
+            continue
+        if args.speed > 0:
+            due = start_at + t_us / 1e6 / args.speed
+            wait = due - time.time()
+            if wait > 0:
+                time.sleep(wait)
+            else:
+                behind_max = max(behind_max, -wait)
+        info = client.publish(topic, payload, qos=qos if args.qos is None else args.qos,
+                              retain=retain and args.retain)
+        if info.rc == mqtt.MQTT_ERR_NO_CONN:
+            logger.error(f"Connection {part}: lost the broker after {sent} message(s).")
+            break
+        sent += 1
+    client.disconnect()  # Sent after everything still queued
+    client.loop_stop()
+    results.put((part, sent, time.time() - start_at, behind_max))
+
+
+def _stored_counts(cur, after_id: int) -> int:
+    cur.execute("SELECT COUNT(*) FROM pizza_counts WHERE id > %s", (after_id,))
+    return cur.fetchone()[0]
+
+
+def replay(args) -> int:
+    meta = read_meta(args.file)
+    total = sum(1 for _ in read_messages(args.file))
+    logger.info(f"{args.file}: {total} messages recorded at {meta.get('broker')}, "
+                f"replaying at {'max speed' if args.speed <= 0 else f'{args.speed:g}x'} "
+                f"over {args.connections} connection(s)")
+
+    conn = None
+    if not args.no_db:
+        conn = connect()
+        conn.autocommit = True
+        cur = conn.cursor()
+        cur.execute("SELECT COALESCE(MAX(id), 0) FROM pizza_counts")
+        before_id = cur.fetchone()[0]
+
+    ctx = multiprocessing.get_context("spawn")
+    results = ctx.Queue()
+    start_at = time.time() + 2.0  # Time for every connection to be up
+    workers = [ctx.Process(target=_publisher, args=(args.file, k, args.connections, args, start_at, results))
+               for k in range(args.connections)]
+    for w in workers:
+        w.start()
+    parts = []
+    while len(parts) < len(workers):
+        try:
+            parts.append(results.get(timeout=1))
+        except queue.Empty:
+            if not any(w.is_alive() for w in workers):
+                logger.error(f"{len(workers) - len(parts)} connection(s) failed.")
+                break
+    for w in workers:
+        w.join()
+    published = time.time() - start_at
+    sent = sum(p[1] for p in parts)
+    report = {"messages": total, "sent": sent, "speed": args.speed, "connections": args.connections,
+              "publish_s": round(published, 3), "publish_rate": round(sent / published, 1),
+              "behind_max_s": round(max((p[3] for p in parts), default=0.0), 3)}
+    logger.info(f"Published {sent}/{total} messages in {published:.1f} s ({report['publish_rate']}/s), "
+                f"at most {report['behind_max_s']} s behind schedule")
+
+    if conn is not None:
+        # Ingest ends at the last new count, once none arrived for --settle seconds
+        stored, last_change = _stored_counts(cur, before_id), time.time()
+        while time.time() - last_change < args.settle:
+            time.sleep(args.poll)
+            now = _stored_counts(cur, before_id)
+            if now != stored:
+                stored, last_change = now, time.time()
+        ingest = max(last_change - start_at, 1e-3)
+        report.update({"counts_stored": stored, "ingest_s": round(ingest, 3),
+                       "ingest_counts_rate": round(stored / ingest, 1),
+                       "ingest_messages_rate": round(sent / ingest, 1)})
+        logger.info(f"Stored {stored} count(s) in {ingest:.1f} s: {report['ingest_counts_rate']} counts/s, "
+                    f"{report['ingest_messages_rate']} messages/s end to end")
+        if args.snapshot:
+            write_snapshot(cur, args.snapshot, args.timeline)
+        conn.close()
+    if args.report:
+        with open(args.report, "w", encoding="utf-8") as f:
+            json.dump(report, f, indent=2)
+    print(json.dumps(report))
+    return 0 if sent == total else 1
+
+# =====================================================================
+# snapshot / diff
+# =====================================================================
+
+def connect():
+    import psycopg2
+    return psycopg2.connect(
+        host=os.getenv("DB_HOST_EXTERNAL", "localhost"),
+        port=int(os.getenv("DB_PORT", "5432")),
+        dbname=os.getenv("DB_NAME", "terelina_db"),
+        user=os.getenv("DB_USER", "postgres"),
+        password=os.getenv("DB_PASSWORD", "postgres"),
+    )
+
+
+def take_snapshot(cur, timeline: bool = False) -> dict:
+    """What the backend stored, keyed so that two runs on the same input compare field by field."""
+    snap = {"counts": {}, "rollups": {}, "transitions": {}, "acks": {}, "flow": {}, "alerts": {}}
+    cur.execute("""
+        SELECT COALESCE(device_id, ''), COUNT(*)::BIGINT, COUNT(log_n)::BIGINT, COUNT(shape)::BIGINT,
+               COUNT(length_mm)::BIGINT,
+               md5(COALESCE(string_agg(log_epoch || ':' || log_n, ',' ORDER BY log_epoch, log_n), ''))
+        FROM pizza_counts GROUP BY 1
+    """)
+    for device, rows, logged, shapes, lengths, digest in cur.fetchall():
+        snap["counts"][device] = {"rows": rows, "logged": logged, "shapes": shapes,
+                                  "lengths": lengths, "log_digest": digest}
+    cur.execute("SELECT device_id, SUM(counts)::BIGINT, COUNT(*)::BIGINT FROM count_rollups GROUP BY 1")
+    for device, counts, minutes in cur.fetchall():
+        snap["rollups"][device] = {"counts": counts, "minutes": minutes}
+    cur.execute("SELECT device_id, SUM(n)::BIGINT FROM transition_blocks GROUP BY 1")
+    snap["transitions"] = {device: n for device, n in cur.fetchall()}
+    cur.execute("SELECT device_id, log_epoch, acked_n FROM device_acks")
+    snap["acks"] = {device: f"{epoch},{n}" for device, epoch, n in cur.fetchall()}
+    cur.execute("""
+        SELECT upstream || '>' || downstream, SUM(upstream_count)::BIGINT, SUM(downstream_count)::BIGINT,
+               SUM(matched)::BIGINT, SUM(lost)::BIGINT, SUM(unmatched)::BIGINT
+        FROM flow_minutes GROUP BY 1
+    """)
+    for link, up, down, matched, lost, unmatched in cur.fetchall():
+        snap["flow"][link] = {"upstream": up, "downstream": down, "matched": matched,
+                              "lost": lost, "unmatched": unmatched}
+    cur.execute("SELECT rule_id::TEXT || ':' || status, COUNT(*)::BIGINT FROM alert_events GROUP BY 1")
+    snap["alerts"] = {key: n for key, n in cur.fetchall()}
+    if timeline:
+        # Per-minute counts, from the first count's minute: only stable between 1x replays
+        cur.execute("""
+            WITH first AS (SELECT date_trunc('minute', MIN("timestamp")) AS minute FROM pizza_counts)
+            SELECT COALESCE(device_id, ''),
+                   (EXTRACT(EPOCH FROM date_trunc('minute', "timestamp") - first.minute) / 60)::INTEGER,
+                   COUNT(*)::BIGINT
+            FROM pizza_counts, first GROUP BY 1, 2
+        """)
+        snap["timeline"] = {}
+        for device, minute, counts in cur.fetchall():
+            snap["timeline"].setdefault(device, {})[str(minute)] = counts
+    return snap
+
+
+def write_snapshot(cur, path: str, timeline: bool = False):
+    snap = take_snapshot(cur, timeline)
+    with open(path, "w", encoding="utf-8") as f:
+        json.dump(snap, f, indent=2, sort_keys=True)
+    logger.info(f"Snapshot of {sum(c['rows'] for c in snap['counts'].values())} count(s) "
+                f"from {len(snap['counts'])} device(s) written to {path}")
+
+
+def snapshot(args) -> int:
+    with connect() as conn:
+        write_snapshot(conn.cursor(), args.out, args.timeline)
+    return 0
+
+
+def _flatten(value, prefix: str = "") -> dict:
+    if not isinstance(value, dict):
+        return {prefix: value}
+    flat = {}
+    for key, item in value.items():
+        flat.update(_flatten(item, f"{prefix}.{key}" if prefix else str(key)))
+    return flat
+
+
+def diff(args) -> int:
+    with open(args.a, encoding="utf-8") as f:
+        a = _flatten(json.load(f))
+    with open(args.b, encoding="utf-8") as f:
+        b = _flatten(json.load(f))
+    keys = sorted(k for k in a.keys() | b.keys() if a.get(k) != b.get(k))
+    for key in keys[:args.max_lines]:
+        print(f"{key}: {a.get(key, '-')} -> {b.get(key, '-')}")
+    if len(keys) > args.max_lines:
+        print(f"... and {len(keys) - args.max_lines} more")
+    logger.info(f"{len(keys)} difference(s) between {args.a} and {args.b}" if keys
+                else f"{args.a} and {args.b} match")
+    return 1 if keys else 0
+
+# =====================================================================
+# Command line
+# =====================================================================
+
+def main():
+    parser = argparse.ArgumentParser(description="Record, replay and compare MQTT traffic of the Terelina backend.")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    rec = sub.add_parser("record", help="Record broker traffic to a file")
+    rec.add_argument("--host", default="localhost")
+    rec.add_argument("--port", type=int, default=1883)
+    rec.add_argument("--out", required=True)
+    rec.add_argument("--duration", type=float, default=0, help="Seconds to record (0 = until Ctrl+C)")
+    rec.add_argument("--topics", default=DEFAULT_TOPICS, help="Comma-separated subscriptions")
+    rec.add_argument("--exclude", default=DEFAULT_EXCLUDE, help="Comma-separated topic prefixes left out")
+    rec.add_argument("--include-retained", action="store_true",
+                     help="Also record the retained messages replayed on subscribe")
+
+    rep = sub.add_parser("replay", help="Replay a recording into a broker")
+    rep.add_argument("file")
+    rep.add_argument("--host", default="localhost")
+    rep.add_argument("--port", type=int, default=1883)
+    rep.add_argument("--speed", type=float, default=1.0, help="Time compression (0 = as fast as possible)")
+    rep.add_argument("--connections", type=int, default=1, help="Publishing connections (devices are split among them)")
+    rep.add_argument("--shared", default=DEFAULT_SHARED,
+                     help="Comma-separated topics whose device id is in the payload")
+    rep.add_argument("--qos", type=int, choices=[0, 1, 2], default=None, help="Publish every message with this QoS")
+    rep.add_argument("--retain", action="store_true", help="Keep the retain flag of recorded messages")
+    rep.add_argument("--no-db", action="store_true", help="Only publish: no ingest measurement")
+    rep.add_argument("--settle", type=float, default=5, help="Seconds without new counts that end the ingest")
+    rep.add_argument("--poll", type=float, default=0.2)
+    rep.add_argument("--snapshot", default=None, help="Write a snapshot of the database here afterwards")
+    rep.add_argument("--timeline", action="store_true", help="Include per-minute counts in the snapshot")
+    rep.add_argument("--report", default=None, help="Write the rates to this JSON file")
+
+    snap = sub.add_parser("snapshot", help="Dump what the backend stored")
+    snap.add_argument("--out", required=True)
+    snap.add_argument("--timeline", action="store_true", help="Include per-minute counts")
+
+    cmp_ = sub.add_parser("diff", help="Compare two snapshots")
+    cmp_.add_argument("a")
+    cmp_.add_argument("b")
+    cmp_.add_argument("--max-lines", type=int, default=200)
+
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+    sys.exit({"record": record, "replay": replay, "snapshot": snapshot, "diff": diff}[args.command](args))
+
+
+if __name__ == "__main__":
+    main()
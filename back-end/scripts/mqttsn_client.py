@@ -0,0 +1,140 @@
+# back-end/scripts/mqttsn_client.py
+"""
+Minimal MQTT-SN 1.2 client over UDP, mirroring firmware_esp32/src/mqttsn.cpp:
+CONNECT/CONNACK, QoS 0 PUBLISH to predefined topic ids and PINGREQ keep-alive.
+Used by fleet_simulator.py --transport mqttsn and transport_benchmark.py.
+"""
+
+import socket
+import struct
+import threading
+import time
+
+# Predefined topic ids, see mosquitto/mqttsn/predefinedTopic.conf
+TOPIC_ID_STATE = 1
+TOPIC_ID_HEARTBEAT = 2
+
+_CONNECT = 0x04
+_CONNACK = 0x05
+_PUBLISH = 0x0C
+_PINGREQ = 0x16
+_PINGRESP = 0x17
+_DISCONNECT = 0x18
+
+_FLAG_RETAIN = 0x10
+_FLAG_CLEAN_SESSION = 0x04
+_TOPIC_PREDEFINED = 0x01
+
+
+def _packet(body: bytes) -> bytes:
+    """Prefixes the MQTT-SN length field (1 or 3 bytes)."""
+    if len(body) + 1 <= 255:
+        return bytes([len(body) + 1]) + body
+    return b"\x01" + struct.pack(">H", len(body) + 3) + body
+
+
+class MqttSnClient:
+    """A QoS 0 MQTT-SN session with a gateway. Thread-safe for publish()."""
+
+    def __init__(self, client_id: str, host: str, port: int, keepalive_s: int = 30,
+                 reconnect_s: float = 5.0):
+        self.client_id = client_id[:23]  # MQTT-SN client ids are limited to 23 characters
+        self.gateway = (host, port)
+        self.keepalive_s = keepalive_s
+        self.reconnect_s = reconnect_s
+        self.bytes_sent = 0
+        self.on_connect = None  # Called with no arguments after every CONNACK
+
+        self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._sock.settimeout(0.5)
+        self._connected = threading.Event()
+        self._stop = threading.Event()
+        self._lock = threading.Lock()
+        self._last_send = 0.0
+        self._ping_sent_at = None
+        self._thread = None
+
+    # --- Sending ---
+
+    def _send(self, body: bytes) -> bool:
+        data = _packet(body)
+        try:
+            with self._lock:
+                self._sock.sendto(data, self.gateway)
+                self.bytes_sent += len(data)
+                self._last_send = time.monotonic()
+            return True
+        except OSError:
+            return False
+
+    def _send_connect(self):
+        body = struct.pack(">BBBH", _CONNECT, _FLAG_CLEAN_SESSION, 0x01, self.keepalive_s)
+        self._send(body + self.client_id.encode())
+
+    def publish(self, topic_id: int, payload: bytes | str, retain: bool = False) -> bool:
+        if not self._connected.is_set():
+            return False
+        if isinstance(payload, str):
+            payload = payload.encode()
+        flags = (_FLAG_RETAIN if retain else 0) | _TOPIC_PREDEFINED  # QoS 0
+        return self._send(struct.pack(">BBHH", _PUBLISH, flags, topic_id, 0) + payload)
+
+    # --- Session loop ---
+
+    def _handle(self, data: bytes):
+        offset = 3 if len(data) >= 3 and data[0] == 0x01 else 1
+        if len(data) <= offset:
+            return
+        kind = data[offset]
+        if kind == _CONNACK and len(data) > offset + 1 and data[offset + 1] == 0:
+            self._ping_sent_at = None
+            self._connected.set()
+            if self.on_connect:
+                self.on_connect()
+        elif kind == _PINGRESP:
+            self._ping_sent_at = None
+        elif kind == _DISCONNECT:
+            self._connected.clear()
+
+    def _run(self):
+        last_attempt = 0.0
+        while not self._stop.is_set():
+            now = time.monotonic()
+            if not self._connected.is_set():
+                if now - last_attempt >= self.reconnect_s:
+                    last_attempt = now
+                    self._send_connect()
+            elif self._ping_sent_at is not None and now - self._ping_sent_at > self.keepalive_s:
+                self._connected.clear()  # Gateway stopped answering
+            elif self._ping_sent_at is None and now - self._last_send > self.keepalive_s / 2:
+                self._ping_sent_at = now
+                self._send(bytes([_PINGREQ]))
+
+            try:
+                data, _ = self._sock.recvfrom(512)
+            except socket.timeout:
+                continue
+            except OSError:
+                if self._stop.is_set():
+                    return
+                time.sleep(0.5)
+                continue
+            self._handle(data)
+
+    # --- Lifecycle ---
+
+    def is_connected(self) -> bool:
+        return self._connected.is_set()
+
+    def start(self):
+        self._thread = threading.Thread(target=self._run, name=f"mqttsn-{self.client_id}", daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        if self._connected.is_set():
+            self._send(bytes([_DISCONNECT]))
+        self._connected.clear()
+        self._stop.set()
+        if self._thread:
+            self._thread.join()
+        self._sock.close()
@@ -0,0 +1,338 @@
+# back-end/scripts/rebuild_rollups.py
+"""
+Rebuilds the minute rollups (count_rollups) over a long time range, e.g. after
+a debounce fix or a data correction, without one hours-long statement.
+
+The range is split into chunks of one device x one time slice (--chunk-hours,
+a day by default). Worker processes recount the chunks in parallel; at most
+--db-concurrency of them talk to the database at a time. Each chunk commits
+its rollups to rollup_rebuild_staging together with its progress row, so an
+interrupted job resumes where it stopped (run it again with the same --job).
+
+When every chunk is done, the swap replaces count_rollups over the range in
+one transaction, so readers see the old or the new rollups, never a mix.
+Counts are briefly blocked during the swap; chunks that live or late counts
+may have changed since they were built are recounted under the same lock.
+The swap records an invalidation per device for the whole range. Ranges
+whose raw counts were deleted by the retention job are refused.
+
+Usage (from the repository root):
+    python back-end/scripts/rebuild_rollups.py --job fix-2024 --start 2024-01-01 --end 2024-07-01
+    python back-end/scripts/rebuild_rollups.py --job fix-2024 --start 2024-01-01 --end 2024-07-01  # Resumes
+    python back-end/scripts/rebuild_rollups.py --job try --start 2024-06-01 --end 2024-06-08 --no-swap
+    python back-end/scripts/rebuild_rollups.py --job debounce-80 --start 2024-06-01 --end 2024-07-01 \\
+        --source transitions --params '{"debounce_ms": 80}'
+
+The database is reached at localhost:DB_PORT (override with DB_HOST_EXTERNAL),
+using the DB_* credentials from the environment.
+"""
+
+import argparse
+import json
+import logging
+import multiprocessing
+import os
+import sys
+import time
+from datetime import datetime, timedelta, timezone
+
+import psycopg2
+from psycopg2.extras import Json, execute_values
+
+logger = logging.getLogger("rebuild_rollups")
+
+
+def connect():
+    return psycopg2.connect(
+        host=os.getenv("DB_HOST_EXTERNAL", "localhost"),
+        port=int(os.getenv("DB_PORT", "5432")),
+        dbname=os.getenv("DB_NAME", "terelina_db"),
+        user=os.getenv("DB_USER", "postgres"),
+        password=os.getenv("DB_PASSWORD", "postgres"),
+    )
+
+
+# =====================================================================
+# Recount Sources
+# =====================================================================
+# A source recounts one chunk: source(cur, device_id, start, end, params)
+# returns [(minute, counts)]. Device '' stands for counts without a device.
+
+def recount_from_counts(cur, device_id: str, start: datetime, end: datetime, params: dict) -> list:
+    """Regroups the stored counts (pizza_counts) of the chunk per minute."""
+    cur.execute(
+        'SELECT DATE_TRUNC(\'minute\', "timestamp"), COUNT(*) FROM pizza_counts '
+        'WHERE "timestamp" >= %s AND "timestamp" < %s '
+        "AND (device_id = %s OR (%s = '' AND device_id IS NULL)) "
+        "GROUP BY 1",
+        (start, end, device_id, device_id)
+    )
+    return cur.fetchall()
+
+
+def recount_from_transitions(cur, device_id: str, start: datetime, end: datetime, params: dict) -> list:
+    """
+    Replays the stored raw transitions with other filter parameters
+    (recount_transitions.py, needs numpy), e.g. {"debounce_ms": 80}.
+    """
+    from recount_transitions import recount_chunk
+    return recount_chunk(cur, device_id, start, end, params)
+
+
+SOURCES = {
+    "counts": recount_from_counts,
+    "transitions": recount_from_transitions,
+}
+
+
+# =====================================================================
+# Workers
+# =====================================================================
+
+_worker = {}
+
+
+def _init_worker(db_slots, source: str, params: dict):
+    _worker["db_slots"] = db_slots
+    _worker["source"] = SOURCES[source]
+    _worker["params"] = params
+    _worker["conn"] = None
+
+
+def _connection():
+    conn = _worker["conn"]
+    if conn is None or conn.closed:
+        conn = _worker["conn"] = connect()
+    return conn
+
+
+def build_chunk(cur, job: str, source, params: dict, device_id: str, start: datetime, end: datetime) -> tuple:
+    """Recounts a chunk into the staging table. Returns (buckets, counts)."""
+    rows = [(minute, n) for minute, n in source(cur, device_id, start, end, params) if n]
+    cur.execute(
+        "DELETE FROM rollup_rebuild_staging WHERE job = %s AND device_id = %s AND minute >= %s AND minute < %s",
+        (job, device_id, start, end)
+    )
+    execute_values(
+        cur,
+        "INSERT INTO rollup_rebuild_staging (job, minute, device_id, counts) VALUES %s",
+        [(job, minute, device_id, n) for minute, n in rows],
+        page_size=1000
+    )
+    return len(rows), sum(n for _, n in rows)
+
+
+def _run_chunk(chunk: tuple) -> tuple:
+    """Builds one chunk and records it as done, in one transaction (under a DB slot)."""
+    job, device_id, start, end = chunk
+    started = time.monotonic()
+    with _worker["db_slots"]:
+        conn = _connection()
+        try:
+            with conn.cursor() as cur:
+                buckets, counts = build_chunk(cur, job, _worker["source"], _worker["params"], device_id, start, end)
+                cur.execute(
+                    "INSERT INTO rollup_rebuild_chunks (job, device_id, chunk_start, chunk_end, buckets, counts, seconds) "
+                    "VALUES (%s, %s, %s, %s, %s, %s, %s)",
+                    (job, device_id, start, end, buckets, counts, time.monotonic() - started)
+                )
+            conn.commit()
+        except Exception:
+            conn.rollback()
+            raise
+    return device_id, start, buckets, counts
+
+
+# =====================================================================
+# Job Control
+# =====================================================================
+
+def plan_job(conn, args) -> tuple:
+    """Creates or resumes the job. Returns (chunks still to build, devices, source params)."""
+    params = json.loads(args.params) if args.params else {}
+    with conn.cursor() as cur:
+        # Before raw_before only the rollups remain (app/services/retention.py): a rebuild would zero them
+        cur.execute("SELECT MAX(raw_before) FROM retention_runs")
+        raw_before = cur.fetchone()[0]
+        if raw_before and args.start < raw_before:
+            sys.exit(f"The raw counts before {raw_before:%Y-%m-%d %H:%M} were deleted by the retention job; "
+                     f"start the rebuild there or later.")
+
+        cur.execute("SELECT range_start, range_end, source, params, swapped_at FROM rollup_rebuild_jobs "
+                    "WHERE job = %s", (args.job,))
+        row = cur.fetchone()
+        if row is None:
+            cur.execute(
+                "INSERT INTO rollup_rebuild_jobs (job, range_start, range_end, source, params) "
+                "VALUES (%s, %s, %s, %s, %s)",
+                (args.job, args.start, args.end, args.source, Json(params))
+            )
+        else:
+            range_start, range_end, source, saved_params, swapped_at = row
+            if (range_start, range_end, source, saved_params or {}) != (args.start, args.end, args.source, params):
+                sys.exit(f"Job '{args.job}' exists with different parameters "
+                         f"({range_start:%Y-%m-%d} .. {range_end:%Y-%m-%d}, {source}, {saved_params}).")
+            if swapped_at:
+                sys.exit(f"Job '{args.job}' was already swapped in at {swapped_at}.")
+            logger.info(f"Resuming job '{args.job}'.")
+
+        if args.devices:
+            devices = args.devices.split(",")
+        else:
+            # Devices with rollups in the range, or with counts (the rollups may be what is wrong)
+            cur.execute(
+                "SELECT device_id FROM count_rollups WHERE minute >= %s AND minute < %s "
+                "UNION SELECT COALESCE(device_id, '') FROM pizza_counts WHERE \"timestamp\" >= %s "
+                "AND \"timestamp\" < %s GROUP BY 1",
+                (args.start, args.end, args.start, args.end)
+            )
+            devices = sorted(device for (device,) in cur.fetchall())
+
+        cur.execute("SELECT device_id, chunk_start FROM rollup_rebuild_chunks WHERE job = %s", (args.job,))
+        done = set(cur.fetchall())
+    conn.commit()
+
+    chunks = []
+    step = timedelta(hours=args.chunk_hours)
+    for device_id in devices:
+        start = args.start
+        while start < args.end:
+            end = min(start + step, args.end)
+            if (device_id, start) not in done:
+                chunks.append((args.job, device_id, start, end))
+            start = end
+    logger.info(f"Job '{args.job}': {len(devices)} device(s), {len(chunks)} chunk(s) to build, "
+                f"{len(done)} already done.")
+    return chunks, devices, params
+
+
+def run_chunks(chunks: list, args, params: dict):
+    """Builds the chunks in worker processes and reports progress and throughput."""
+    if not chunks:
+        return
+    db_slots = multiprocessing.BoundedSemaphore(args.db_concurrency)
+    started = time.monotonic()
+    last_report = 0.0
+    built = buckets_total = counts_total = 0
+    with multiprocessing.Pool(args.workers, initializer=_init_worker,
+                              initargs=(db_slots, args.source, params)) as pool:
+        for _, _, buckets, counts in pool.imap_unordered(_run_chunk, chunks):
+            built += 1
+            buckets_total += buckets
+            counts_total += counts
+            elapsed = time.monotonic() - started
+            if elapsed - last_report >= args.report_every or built == len(chunks):
+                last_report = elapsed
+                rate = built / elapsed
+                eta = (len(chunks) - built) / rate if rate else 0
+                logger.info(f"[{built}/{len(chunks)}] {100 * built / len(chunks):5.1f} %  "
+                            f"{rate:.1f} chunks/s  {counts_total / elapsed:,.0f} counts/s  "
+                            f"{buckets_total / elapsed:,.0f} buckets/s  ETA {eta:.0f} s")
+    logger.info(f"Built {built} chunk(s) in {time.monotonic() - started:.1f} s: "
+                f"{counts_total:,} counts in {buckets_total:,} minute buckets.")
+
+
+def swap(conn, args, devices: list, params: dict):
+    """Replaces count_rollups over the job's range with the rebuilt rollups, atomically."""
+    source = SOURCES[args.source]
+    started = time.monotonic()
+    with conn.cursor() as cur:
+        # No counts are stored (and no rollups patched) until the swap commits
+        cur.execute("LOCK TABLE pizza_counts IN SHARE MODE")
+
+        # Chunks built before a late count patched their range (see rollup_invalidations),
+        # or before their minutes closed (recent chunks), may miss counts: recount them now
+        cur.execute(
+            """
+            SELECT c.device_id, c.chunk_start, c.chunk_end
+            FROM rollup_rebuild_chunks c
+            WHERE c.job = %(job)s AND (
+                c.chunk_end > c.done_at - INTERVAL '1 minute' - (COALESCE(
+                    (SELECT value FROM system_settings WHERE key = 'rollup_allowed_lateness_s'), '120')
+                    || ' seconds')::INTERVAL
+                OR EXISTS (
+                    SELECT 1 FROM rollup_invalidations i
+                    WHERE i.created_at >= c.done_at AND i.device_id IN (c.device_id, '*')
+                      AND i.range_start < c.chunk_end AND i.range_end > c.chunk_start))
+            """,
+            {"job": args.job}
+        )
+        stale = cur.fetchall()
+        for device_id, start, end in stale:
+            build_chunk(cur, args.job, source, params, device_id, start, end)
+        if stale:
+            logger.info(f"Recounted {len(stale)} chunk(s) changed since they were built.")
+
+        cur.execute(
+            "SELECT device_id, SUM(counts) FROM count_rollups "
+            "WHERE minute >= %s AND minute < %s AND device_id = ANY(%s) GROUP BY 1",
+            (args.start, args.end, devices)
+        )
+        before = dict(cur.fetchall())
+        cur.execute(
+            "DELETE FROM count_rollups WHERE minute >= %s AND minute < %s AND device_id = ANY(%s)",
+            (args.start, args.end, devices)
+        )
+        cur.execute(
+            "INSERT INTO count_rollups (minute, device_id, counts) "
+            "SELECT minute, device_id, counts FROM rollup_rebuild_staging WHERE job = %s AND device_id = ANY(%s)",
+            (args.job, devices)
+        )
+        cur.execute("SELECT device_id, SUM(counts) FROM rollup_rebuild_staging "
+                    "WHERE job = %s AND device_id = ANY(%s) GROUP BY 1", (args.job, devices))
+        after = dict(cur.fetchall())
+        execute_values(
+            cur,
+            "INSERT INTO rollup_invalidations (device_id, range_start, range_end, counts_delta) VALUES %s",
+            [(device_id, args.start, args.end, int(after.get(device_id, 0) - before.get(device_id, 0)))
+             for device_id in devices]
+        )
+        cur.execute("DELETE FROM rollup_rebuild_staging WHERE job = %s", (args.job,))
+        cur.execute("UPDATE rollup_rebuild_jobs SET swapped_at = NOW() WHERE job = %s", (args.job,))
+    conn.commit()
+
+    for device_id in devices:
+        delta = after.get(device_id, 0) - before.get(device_id, 0)
+        logger.info(f"  {device_id or '(no device)'}: {before.get(device_id, 0)} -> {after.get(device_id, 0)} "
+                    f"({delta:+d})")
+    logger.info(f"Swapped in the rebuilt rollups in {time.monotonic() - started:.1f} s.")
+
+
+def _day(value: str) -> datetime:
+    moment = datetime.fromisoformat(value)
+    return moment if moment.tzinfo else moment.replace(tzinfo=timezone.utc)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Rebuild the minute rollups in parallel, resumably.")
+    parser.add_argument("--job", required=True, help="Job name; run again with the same name to resume")
+    parser.add_argument("--start", required=True, type=_day, help="Range start (ISO date or time, UTC by default)")
+    parser.add_argument("--end", required=True, type=_day, help="Range end, exclusive")
+    parser.add_argument("--source", choices=sorted(SOURCES), default="counts", help="What chunks are recounted from")
+    parser.add_argument("--params", default=None, help="JSON parameters of the source")
+    parser.add_argument("--devices", default=None, help="Comma-separated device ids (default: all in the range)")
+    parser.add_argument("--chunk-hours", type=float, default=24, help="Time slice of a chunk")
+    parser.add_argument("--workers", type=int, default=os.cpu_count() or 2, help="Worker processes")
+    parser.add_argument("--db-concurrency", type=int, default=4, help="Chunks talking to the database at once")
+    parser.add_argument("--report-every", type=float, default=5, help="Seconds between progress lines")
+    parser.add_argument("--no-swap", action="store_true", help="Build (or finish building) without swapping in")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+    if args.start >= args.end:
+        parser.error("--start must be before --end")
+
+    conn = connect()
+    try:
+        chunks, devices, params = plan_job(conn, args)
+        run_chunks(chunks, args, params)
+        if args.no_swap:
+            logger.info(f"Job '{args.job}' built; run again without --no-swap to swap it in.")
+            return
+        swap(conn, args, devices, params)
+    finally:
+        conn.close()
+
+
+if __name__ == "__main__":
+    main()
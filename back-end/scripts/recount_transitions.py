@@ -0,0 +1,283 @@
+# back-end/scripts/recount_transitions.py
+"""
+Recomputes counts from the raw state transitions (transition_blocks) with other
+filter parameters than the live state machine used, e.g. after finding that a
+debounce value was wrong.
+
+The recount replays the state machine of app/services/mqtt_client.py with
+numpy, per device and in arrival order:
+  - debounce_ms: a transition less than this after the last accepted one is
+    ignored (live: _DEBOUNCE_MS = 100);
+  - min_dwell_ms: a product (interrupted -> clear) needs the beam interrupted
+    at least this long (live: 0).
+Clears numbered by a device's durable log are counted by their number (the
+logged rows of pizza_counts), like live, and are never debounced; unlogged
+backlog products bypass the state machine.
+
+"compare" prints the stored and recomputed counts per hour. The corrected
+rollups are written by rebuild_rollups.py with the "transitions" source:
+    python back-end/scripts/rebuild_rollups.py --job debounce-80 --start 2024-06-01 --end 2024-07-01 \\
+        --source transitions --params '{"debounce_ms": 80}'
+Minutes before a device's first stored transition keep their stored counts.
+
+Usage (from the repository root):
+    python back-end/scripts/recount_transitions.py compare --device ESP32_Barrier_001 \\
+        --start 2024-06-01 --end 2024-06-02 --debounce-ms 80
+    python back-end/scripts/recount_transitions.py benchmark --transitions 20000000
+
+The database is reached at localhost:DB_PORT (override with DB_HOST_EXTERNAL),
+using the DB_* credentials from the environment.
+"""
+
+import argparse
+import logging
+import os
+import time
+from datetime import datetime, timedelta, timezone
+
+import numpy as np
+
+logger = logging.getLogger("recount_transitions")
+
+# Transition kinds (app/services/transitions.py)
+INTERRUPTED = 0
+CLEAR = 1
+LOGGED_CLEAR = 2
+BACKLOG_PRODUCT = 3
+
+DEFAULT_PARAMS = {"debounce_ms": 100, "min_dwell_ms": 0}
+WARMUP = timedelta(days=1)  # Blocks read before a range to know the beam state at its start
+
+
+def connect():
+    import psycopg2
+    return psycopg2.connect(
+        host=os.getenv("DB_HOST_EXTERNAL", "localhost"),
+        port=int(os.getenv("DB_PORT", "5432")),
+        dbname=os.getenv("DB_NAME", "terelina_db"),
+        user=os.getenv("DB_USER", "postgres"),
+        password=os.getenv("DB_PASSWORD", "postgres"),
+    )
+
+
+# =====================================================================
+# Recount Engine
+# =====================================================================
+
+def decode_blocks(blocks) -> tuple:
+    """[(first_ms, t_deltas, kinds)] -> (times in Unix ms as int64, kinds as uint8), in block order."""
+    times, kinds = [], []
+    for first_ms, t_deltas, block_kinds in blocks:
+        times.append(first_ms + np.cumsum(np.frombuffer(t_deltas, dtype="<i4"), dtype=np.int64))
+        kinds.append(np.frombuffer(block_kinds, dtype=np.uint8))
+    if not times:
+        return np.empty(0, np.int64), np.empty(0, np.uint8)
+    return np.concatenate(times), np.concatenate(kinds)
+
+
+def accepted_transitions(t: np.ndarray, debounce_ms: int, always: np.ndarray | None = None) -> np.ndarray:
+    """
+    Mask of the transitions the debounce keeps: those at least debounce_ms after
+    the last kept one, plus those in always (logged clears). That is sequential,
+    but a transition at least debounce_ms after every earlier one is kept
+    whatever was kept before; only the rest (flicker bursts) are decided one by one.
+    """
+    n = len(t)
+    keep = np.ones(n, bool)
+    if n < 2:
+        return keep
+    keep[1:] = t[1:] - np.maximum.accumulate(t)[:-1] >= debounce_ms
+    if always is not None:
+        keep |= always
+    undecided = np.flatnonzero(~keep)
+    if not len(undecided):
+        return keep
+    # Per undecided transition: its time, and the index and time of the last sure one before it
+    last_sure = np.maximum.accumulate(np.where(keep, np.arange(n), 0))[undecided]
+    last, last_t = 0, 0
+    for i, t_i, sure, sure_t in zip(undecided.tolist(), t[undecided].tolist(), last_sure.tolist(),
+                                    t[last_sure].tolist()):
+        if t_i - (sure_t if sure >= last else last_t) >= debounce_ms:
+            keep[i] = True
+            last, last_t = i, t_i
+    return keep
+
+
+def recount(t: np.ndarray, kinds: np.ndarray, debounce_ms: int = 100, min_dwell_ms: int = 0) -> np.ndarray:
+    """Times (Unix ms) of the products the state machine counts; logged clears are left out."""
+    backlog = kinds == BACKLOG_PRODUCT
+    machine_t, machine_kinds = t[~backlog], kinds[~backlog]
+    keep = accepted_transitions(machine_t, debounce_ms, machine_kinds == LOGGED_CLEAR)
+    kept_t, kept_kinds = machine_t[keep], machine_kinds[keep]
+
+    products = np.zeros(len(kept_kinds), bool)
+    products[1:] = (kept_kinds[1:] == CLEAR) & (kept_kinds[:-1] == INTERRUPTED)
+    if min_dwell_ms > 0:
+        products[1:] &= kept_t[1:] - kept_t[:-1] >= min_dwell_ms
+    return np.concatenate([kept_t[products], t[backlog]])
+
+
+def per_minute(product_ms: np.ndarray, start: datetime, end: datetime) -> list:
+    """[(minute, counts)] of the products in [start, end)."""
+    start_ms, end_ms = int(start.timestamp() * 1000), int(end.timestamp() * 1000)
+    inside = product_ms[(product_ms >= start_ms) & (product_ms < end_ms)]
+    minutes, counts = np.unique(inside // 60000, return_counts=True)
+    return [(datetime.fromtimestamp(int(m) * 60, timezone.utc), int(c)) for m, c in zip(minutes, counts)]
+
+
+def source_params(params: dict) -> dict:
+    unknown = set(params) - set(DEFAULT_PARAMS)
+    if unknown:
+        raise ValueError(f"Unknown recount parameter(s): {', '.join(sorted(unknown))}")
+    return {**DEFAULT_PARAMS, **{key: int(value) for key, value in params.items()}}
+
+
+# =====================================================================
+# Database
+# =====================================================================
+
+def read_transitions(cur, device_id: str, start: datetime, end: datetime) -> tuple:
+    """Decoded transitions of the device's blocks overlapping [start, end), after a warm-up block."""
+    cur.execute(
+        "SELECT first_ms, t_deltas, kinds, block_end FROM transition_blocks "
+        "WHERE device_id = %s AND block_start >= %s AND block_start < %s ORDER BY first_ms",
+        (device_id, start - WARMUP, end)
+    )
+    rows = cur.fetchall()
+    # The last block ending before the range only sets the beam state at its start
+    first = max((i for i, row in enumerate(rows) if row[3] < start), default=-1)
+    return decode_blocks((r[0], bytes(r[1]), bytes(r[2])) for r in rows[max(first, 0):])
+
+
+def covered_from(cur, device_id: str) -> datetime | None:
+    """First minute fully covered by the device's stored transitions."""
+    cur.execute("SELECT MIN(block_start) FROM transition_blocks WHERE device_id = %s", (device_id,))
+    first = cur.fetchone()[0]
+    if first is None:
+        return None
+    return first.replace(second=0, microsecond=0) + timedelta(minutes=1)
+
+
+def stored_per_minute(cur, device_id: str, start: datetime, end: datetime, logged_only: bool) -> list:
+    cur.execute(
+        'SELECT DATE_TRUNC(\'minute\', "timestamp"), COUNT(*) FROM pizza_counts '
+        'WHERE "timestamp" >= %s AND "timestamp" < %s '
+        "AND (device_id = %s OR (%s = '' AND device_id IS NULL)) "
+        "AND (NOT %s OR log_n IS NOT NULL) GROUP BY 1",
+        (start, end, device_id, device_id, logged_only)
+    )
+    return cur.fetchall()
+
+
+def recount_chunk(cur, device_id: str, start: datetime, end: datetime, params: dict) -> list:
+    """
+    Source "transitions" of rebuild_rollups.py: [(minute, counts)] of a device
+    recomputed from its transitions, plus its logged products. Minutes before
+    its first stored transition keep the stored counts.
+    """
+    params = source_params(params)
+    covered = covered_from(cur, device_id) if device_id else None
+    if covered is None or covered >= end:
+        return stored_per_minute(cur, device_id, start, end, logged_only=False)
+
+    minutes = {}
+    if covered > start:
+        minutes.update(stored_per_minute(cur, device_id, start, covered, logged_only=False))
+        start = covered
+    t, kinds = read_transitions(cur, device_id, start, end)
+    for minute, n in per_minute(recount(t, kinds, params["debounce_ms"], params["min_dwell_ms"]), start, end):
+        minutes[minute] = minutes.get(minute, 0) + n
+    for minute, n in stored_per_minute(cur, device_id, start, end, logged_only=True):
+        minutes[minute] = minutes.get(minute, 0) + n
+    return sorted(minutes.items())
+
+
+# =====================================================================
+# Commands
+# =====================================================================
+
+def compare(args):
+    params = {"debounce_ms": args.debounce_ms, "min_dwell_ms": args.min_dwell_ms}
+    with connect() as conn, conn.cursor() as cur:
+        started = time.monotonic()
+        t, kinds = read_transitions(cur, args.device, args.start, args.end)
+        read_s = time.monotonic() - started
+        started = time.monotonic()
+        recounted = recount_chunk(cur, args.device, args.start, args.end, params)
+        recount_s = time.monotonic() - started
+        stored = stored_per_minute(cur, args.device, args.start, args.end, logged_only=False)
+
+    hours = {}
+    for column, rows in ((0, stored), (1, recounted)):
+        for minute, n in rows:
+            hour = minute.replace(minute=0)
+            hours.setdefault(hour, [0, 0])[column] += n
+    print(f"{'hour (UTC)':<17} {'stored':>8} {'recount':>8} {'diff':>7}")
+    for hour, (before, after) in sorted(hours.items()):
+        print(f"{hour:%Y-%m-%d %H:%M} {before:>8} {after:>8} {after - before:>+7}")
+    total_before = sum(v[0] for v in hours.values())
+    total_after = sum(v[1] for v in hours.values())
+    print(f"{'total':<17} {total_before:>8} {total_after:>8} {total_after - total_before:>+7}")
+    logger.info(f"{len(t):,} transitions read in {read_s:.2f} s; recount with {params} took {recount_s:.2f} s.")
+
+
+def synthetic_transitions(n: int, flicker: float, seed: int = 1) -> tuple:
+    """A belt of products (~1.2 s each) whose beam flickers at a fraction of the edges."""
+    rng = np.random.default_rng(seed)
+    gaps = rng.integers(300, 900, n).astype(np.int64)
+    bursts = rng.random(n) < flicker
+    gaps[bursts] = rng.integers(1, 60, int(bursts.sum()))  # Bounces within the debounce
+    kinds = (np.arange(n) % 2).astype(np.uint8)           # interrupted, clear, interrupted...
+    return 1_700_000_000_000 + np.cumsum(gaps), kinds
+
+
+def benchmark(args):
+    t, kinds = synthetic_transitions(args.transitions, args.flicker)
+    blocks = []
+    for i in range(0, len(t), args.block):
+        block_t = t[i:i + args.block]
+        blocks.append((int(block_t[0]), np.diff(block_t, prepend=block_t[0]).astype("<i4").tobytes(),
+                       kinds[i:i + args.block].tobytes()))
+
+    started = time.monotonic()
+    decoded_t, decoded_kinds = decode_blocks(blocks)
+    decode_s = time.monotonic() - started
+    assert np.array_equal(decoded_t, t) and np.array_equal(decoded_kinds, kinds)
+    started = time.monotonic()
+    products = recount(decoded_t, decoded_kinds, args.debounce_ms)
+    recount_s = time.monotonic() - started
+    print(f"{len(t):,} transitions in {len(blocks):,} blocks, {args.flicker:.1%} flicker: {len(products):,} products")
+    print(f"decode  {decode_s:6.3f} s  {len(t) / decode_s / 1e6:6.1f} M transitions/s")
+    print(f"recount {recount_s:6.3f} s  {len(t) / recount_s / 1e6:6.1f} M transitions/s")
+
+
+def _day(value: str) -> datetime:
+    moment = datetime.fromisoformat(value)
+    return moment if moment.tzinfo else moment.replace(tzinfo=timezone.utc)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Recompute counts from the stored raw state transitions.")
+    sub = parser.add_subparsers(dest="command", required=True)
+    cmp_parser = sub.add_parser("compare", help="Stored vs recomputed counts per hour for one device")
+    cmp_parser.add_argument("--device", required=True)
+    cmp_parser.add_argument("--start", required=True, type=_day, help="Range start (ISO date or time, UTC by default)")
+    cmp_parser.add_argument("--end", required=True, type=_day, help="Range end, exclusive")
+    cmp_parser.add_argument("--debounce-ms", type=int, default=DEFAULT_PARAMS["debounce_ms"])
+    cmp_parser.add_argument("--min-dwell-ms", type=int, default=DEFAULT_PARAMS["min_dwell_ms"])
+    bench_parser = sub.add_parser("benchmark", help="Decode and recount synthetic transitions")
+    bench_parser.add_argument("--transitions", type=int, default=10_000_000)
+    bench_parser.add_argument("--flicker", type=float, default=0.01, help="Fraction of edges that bounce")
+    bench_parser.add_argument("--block", type=int, default=4096, help="Transitions per stored block")
+    bench_parser.add_argument("--debounce-ms", type=int, default=DEFAULT_PARAMS["debounce_ms"])
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+    if args.command == "compare":
+        compare(args)
+    else:
+        benchmark(args)
+
+
+if __name__ == "__main__":
+    main()
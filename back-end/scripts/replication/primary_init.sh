@@ -0,0 +1,21 @@
+#!/bin/sh
+# back-end/scripts/replication/primary_init.sh
+# Prepares the primary for streaming replication. Mounted into
+# /docker-entrypoint-initdb.d, so it runs once when the data volume is created.
+# For an existing volume, run it by hand:
+#   docker compose exec db sh /docker-entrypoint-initdb.d/zz_replication.sh
+set -e
+
+PGDATA="${PGDATA:-/var/lib/postgresql/data}"
+
+# Allow replication connections with the same password auth used by clients
+if ! grep -q "^host replication" "$PGDATA/pg_hba.conf"; then
+    echo "host replication all all scram-sha-256" >> "$PGDATA/pg_hba.conf"
+fi
+
+# Keep enough WAL for a replica that was briefly down to catch up without a
+# replication slot (a slot would retain WAL forever if the replica is removed).
+psql -v ON_ERROR_STOP=1 --username "$POSTGRES_USER" --dbname "$POSTGRES_DB" <<-EOSQL
+    ALTER SYSTEM SET wal_keep_size = '256MB';
+    SELECT pg_reload_conf();
+EOSQL
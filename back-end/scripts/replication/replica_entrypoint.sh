@@ -0,0 +1,26 @@
+#!/bin/sh
+# back-end/scripts/replication/replica_entrypoint.sh
+# Entrypoint for the optional read replica container. On first start it clones
+# the primary with pg_basebackup (-R writes standby.signal and primary_conninfo),
+# then runs Postgres as a hot standby.
+set -e
+
+PGDATA="${PGDATA:-/var/lib/postgresql/data}"
+
+if [ ! -s "$PGDATA/PG_VERSION" ]; then
+    echo "[replica] Cloning primary ${PRIMARY_HOST}:${PRIMARY_PORT}..."
+    until pg_basebackup -h "$PRIMARY_HOST" -p "$PRIMARY_PORT" -U "$PGUSER" \
+            -D "$PGDATA" -R -X stream; do
+        echo "[replica] Base backup failed, retrying in 5 seconds."
+        rm -rf "${PGDATA:?}"/*
+        sleep 5
+    done
+    chown -R postgres:postgres "$PGDATA"
+    chmod 700 "$PGDATA"
+fi
+
+# hot_standby_feedback prevents long dashboard queries from being cancelled by
+# vacuum on the primary.
+exec su-exec postgres postgres \
+    -c hot_standby=on \
+    -c hot_standby_feedback=on
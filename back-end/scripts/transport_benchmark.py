@@ -0,0 +1,303 @@
+# back-end/scripts/transport_benchmark.py
+"""
+Compares the TCP MQTT and MQTT-SN (UDP) device transports using the fleet simulator.
+
+For each transport the simulated devices talk to the broker (or MQTT-SN gateway)
+through a local relay that plays the role of the WiFi link: it counts every
+byte and packet in both directions and can lose packets with a given
+probability. A subscriber on Mosquitto matches each delivered state to its
+publish by (device id, seq) to measure end-to-end latency and loss.
+
+Loss model: UDP datagrams are simply dropped. TCP cannot lose data, so a lost
+segment is modelled as a retransmission stall of --rto-ms during which the
+whole connection is blocked (head-of-line blocking).
+
+Usage (with the stack running and the gateway started via
+`docker compose --profile mqttsn up -d`):
+    python back-end/scripts/transport_benchmark.py --devices 5 --duration 60 --loss 0.02
+
+"On-air" bytes add an estimated 40 bytes (IPv4 + TCP) or 28 bytes (IPv4 + UDP)
+per packet to the application bytes seen by the relay; TCP ACKs sent by the
+kernels are not visible to the relay and are not included.
+"""
+
+import argparse
+import json
+import logging
+import random
+import socket
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+from fleet_simulator import Fleet, DEFAULT_TOPIC_STATE
+
+logger = logging.getLogger("transport_benchmark")
+
+TCP_OVERHEAD_BYTES = 40
+UDP_OVERHEAD_BYTES = 28
+
+# =====================================================================
+# Link Relays
+# =====================================================================
+
+class LinkStats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.bytes = 0
+        self.packets = 0
+        self.lost = 0
+
+    def add(self, size: int):
+        with self.lock:
+            self.bytes += size
+            self.packets += 1
+
+
+class TcpLinkRelay:
+    """Forwards TCP connections, counting bytes and stalling on simulated loss."""
+
+    def __init__(self, listen_port: int, target: tuple, loss: float, rto_s: float):
+        self.target = target
+        self.loss = loss
+        self.rto_s = rto_s
+        self.stats = LinkStats()
+        self._server = socket.create_server(("127.0.0.1", listen_port))
+        threading.Thread(target=self._accept_loop, name="tcp-relay", daemon=True).start()
+
+    def _accept_loop(self):
+        while True:
+            try:
+                client, _ = self._server.accept()
+                upstream = socket.create_connection(self.target, timeout=5)
+                upstream.settimeout(None)
+            except OSError:
+                continue
+            for src, dst in ((client, upstream), (upstream, client)):
+                threading.Thread(target=self._pump, args=(src, dst), daemon=True).start()
+
+    def _pump(self, src, dst):
+        try:
+            while True:
+                data = src.recv(4096)
+                if not data:
+                    break
+                self.stats.add(len(data))
+                if random.random() < self.loss:
+                    self.stats.lost += 1
+                    time.sleep(self.rto_s)  # Retransmission: everything behind it waits
+                dst.sendall(data)
+        except OSError:
+            pass
+        finally:
+            for sock in (src, dst):
+                try:
+                    sock.close()
+                except OSError:
+                    pass
+
+    def close(self):
+        self._server.close()
+
+
+class UdpLinkRelay:
+    """Forwards datagrams to the gateway per client address, dropping some of them."""
+
+    def __init__(self, listen_port: int, target: tuple, loss: float):
+        self.target = target
+        self.loss = loss
+        self.stats = LinkStats()
+        self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._sock.bind(("127.0.0.1", listen_port))
+        self._upstreams = {}
+        self._lock = threading.Lock()
+        threading.Thread(target=self._downlink_loop, name="udp-relay", daemon=True).start()
+
+    def _forward(self, data: bytes, send):
+        self.stats.add(len(data))
+        if random.random() < self.loss:
+            self.stats.lost += 1
+            return
+        send(data)
+
+    def _upstream_for(self, client_addr):
+        with self._lock:
+            upstream = self._upstreams.get(client_addr)
+            if upstream is None:
+                # One upstream socket per device so the gateway sees distinct clients
+                upstream = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+                upstream.connect(self.target)
+                self._upstreams[client_addr] = upstream
+                threading.Thread(target=self._uplink_reply_loop, args=(upstream, client_addr),
+                                 daemon=True).start()
+            return upstream
+
+    def _downlink_loop(self):
+        while True:
+            try:
+                data, addr = self._sock.recvfrom(2048)
+            except OSError:
+                return
+            upstream = self._upstream_for(addr)
+            self._forward(data, upstream.send)
+
+    def _uplink_reply_loop(self, upstream, client_addr):
+        while True:
+            try:
+                data = upstream.recv(2048)
+            except OSError:
+                return
+            self._forward(data, lambda d: self._sock.sendto(d, client_addr))
+
+    def close(self):
+        self._sock.close()
+        with self._lock:
+            for upstream in self._upstreams.values():
+                upstream.close()
+
+# =====================================================================
+# Delivery Probe
+# =====================================================================
+
+def _parse_state(payload: bytes):
+    """Returns (device_id, seq) from a JSON or compact state payload."""
+    text = payload.decode(errors="ignore")
+    try:
+        if text.startswith("{"):
+            data = json.loads(text)
+            return data.get("id"), data.get("seq")
+        fields = text.split(",")
+        return fields[0], int(fields[4])
+    except (ValueError, IndexError):
+        return None, None
+
+
+class DeliveryProbe:
+    """Records publish times and the matching deliveries on the broker."""
+
+    def __init__(self, host: str, port: int, topic_state: str):
+        self.sent = {}
+        self.latencies_ms = []
+        self.duplicates = 0
+        self._delivered = set()
+        self._lock = threading.Lock()
+        self.client = mqtt.Client(client_id=f"transport_bench_{int(time.time())}", protocol=mqtt.MQTTv311)
+        self.client.on_connect = lambda c, u, f, rc, p=None: c.subscribe(topic_state, qos=0)
+        self.client.on_message = self._on_message
+        self.client.connect(host, port, keepalive=30)
+        self.client.loop_start()
+
+    def on_sent(self, device_id: str, seq: int):
+        with self._lock:
+            self.sent[(device_id, seq)] = time.monotonic()
+
+    def _on_message(self, client, userdata, msg):
+        now = time.monotonic()
+        key = _parse_state(msg.payload)
+        with self._lock:
+            sent_at = self.sent.get(key)
+            if sent_at is None:
+                return
+            if key in self._delivered:
+                self.duplicates += 1
+                return
+            self._delivered.add(key)
+            self.latencies_ms.append((now - sent_at) * 1000)
+
+    def delivered(self) -> int:
+        with self._lock:
+            return len(self._delivered)
+
+    def stop(self):
+        self.client.disconnect()
+        self.client.loop_stop()
+
+# =====================================================================
+# Benchmark
+# =====================================================================
+
+def _percentile(values: list, pct: float) -> float:
+    if not values:
+        return float("nan")
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def run_transport(transport: str, args) -> dict:
+    if transport == "mqttsn":
+        relay = UdpLinkRelay(args.relay_port, (args.gateway_host, args.gateway_port), args.loss)
+        overhead = UDP_OVERHEAD_BYTES
+    else:
+        relay = TcpLinkRelay(args.relay_port, (args.broker_host, args.broker_port), args.loss,
+                             args.rto_ms / 1000)
+        overhead = TCP_OVERHEAD_BYTES
+
+    probe = DeliveryProbe(args.broker_host, args.broker_port, args.topic_state)
+    fleet = Fleet(args.devices, "127.0.0.1", args.relay_port, args.period, args.dwell, args.jitter,
+                  id_prefix=f"BENCH_{transport.upper()}", topic_state=args.topic_state,
+                  transport=transport, on_sent=probe.on_sent)
+    logger.info(f"Running {transport} for {args.duration}s with {args.devices} device(s), loss={args.loss}")
+    fleet.start()
+    time.sleep(args.duration)
+    fleet.stop()
+    time.sleep(args.drain)  # Let stalled TCP segments reach the broker
+    probe.stop()
+    relay.close()
+
+    sent = len(probe.sent)
+    delivered = probe.delivered()
+    stats = relay.stats
+    return {
+        "transport": transport,
+        "events_sent": sent,
+        "events_delivered": delivered,
+        "loss_pct": round(100 * (sent - delivered) / sent, 2) if sent else None,
+        "duplicates": probe.duplicates,
+        "latency_p50_ms": round(_percentile(probe.latencies_ms, 50), 2),
+        "latency_p99_ms": round(_percentile(probe.latencies_ms, 99), 2),
+        "latency_max_ms": round(max(probe.latencies_ms), 2) if probe.latencies_ms else None,
+        "link_packets": stats.packets,
+        "link_packets_lost": stats.lost,
+        "app_bytes_per_event": round(stats.bytes / sent, 1) if sent else None,
+        "on_air_bytes_per_event": round((stats.bytes + overhead * stats.packets) / sent, 1) if sent else None,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare TCP MQTT and MQTT-SN device transports.")
+    parser.add_argument("--broker-host", default="localhost")
+    parser.add_argument("--broker-port", type=int, default=1883)
+    parser.add_argument("--gateway-host", default="localhost")
+    parser.add_argument("--gateway-port", type=int, default=10000)
+    parser.add_argument("--relay-port", type=int, default=18830, help="Local port of the simulated link")
+    parser.add_argument("--transports", default="tcp,mqttsn")
+    parser.add_argument("--devices", type=int, default=5)
+    parser.add_argument("--period", type=float, default=1.0)
+    parser.add_argument("--dwell", type=float, default=0.3)
+    parser.add_argument("--jitter", type=float, default=0.2)
+    parser.add_argument("--duration", type=float, default=60)
+    parser.add_argument("--drain", type=float, default=5, help="Seconds to wait for late deliveries")
+    parser.add_argument("--loss", type=float, default=0.0, help="Packet loss probability on the link")
+    parser.add_argument("--rto-ms", type=float, default=200, help="TCP retransmission stall per lost segment")
+    parser.add_argument("--topic-state", default=DEFAULT_TOPIC_STATE)
+    parser.add_argument("--output", default=None, help="Write the results as JSON to this file")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+
+    results = [run_transport(t.strip(), args) for t in args.transports.split(",") if t.strip()]
+
+    columns = list(results[0].keys())
+    print("| " + " | ".join(columns) + " |")
+    print("|" + "---|" * len(columns))
+    for row in results:
+        print("| " + " | ".join(str(row[c]) for c in columns) + " |")
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            json.dump({"args": vars(args), "results": results}, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
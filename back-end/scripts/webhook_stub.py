@@ -0,0 +1,93 @@
+# back-end/scripts/webhook_stub.py
+"""
+Local HTTP endpoint for testing alert webhooks (alert_rules.webhook_url).
+
+Prints every notification it receives and flags duplicates: the same
+dedup_key and status received twice (the backend retried a delivery it
+thought had failed). --fail N answers the first N requests with HTTP 500 to
+exercise the retries; --out appends the notifications to a JSON-lines file.
+
+Usage:
+    python back-end/scripts/webhook_stub.py --port 9009
+    python back-end/scripts/webhook_stub.py --port 9009 --fail 2 --out alerts.jsonl
+
+Then, with a rule whose webhook_url is http://<this host>:9009/ (the backend
+container reaches the host as host.docker.internal on Docker Desktop):
+    curl -X POST -H "Authorization: Bearer $ADMIN_TOKEN" http://localhost:8000/admin/alerts/reload
+    curl -X POST -H "Authorization: Bearer $ADMIN_TOKEN" http://localhost:8000/admin/alerts/rules/1/test
+"""
+
+import argparse
+import json
+import logging
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+logger = logging.getLogger("webhook_stub")
+
+
+class Stub:
+    def __init__(self, fail: int, out: str | None):
+        self.fail = fail
+        self.out = out
+        self.seen = set()
+        self.received = 0
+        self.lock = threading.Lock()
+
+
+def make_handler(stub: Stub):
+    class Handler(BaseHTTPRequestHandler):
+        def do_POST(self):
+            body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            with stub.lock:
+                stub.received += 1
+                if stub.fail > 0:
+                    stub.fail -= 1
+                    logger.info(f"#{stub.received}: answering 500 ({stub.fail} more failure(s) to go)")
+                    self.send_response(500)
+                    self.end_headers()
+                    return
+                try:
+                    alert = json.loads(body)
+                except json.JSONDecodeError:
+                    logger.warning(f"#{stub.received}: not JSON: {body[:200]!r}")
+                    self.send_response(400)
+                    self.end_headers()
+                    return
+                key = (alert.get("dedup_key"), alert.get("status"))
+                duplicate = key in stub.seen
+                stub.seen.add(key)
+                logger.info(f"#{stub.received}: {alert.get('status', '?').upper():<8} "
+                            f"{alert.get('rule', {}).get('name')} / {alert.get('device_id')}: {alert.get('message')}"
+                            + ("  [DUPLICATE]" if duplicate else ""))
+                if stub.out:
+                    with open(stub.out, "a", encoding="utf-8") as f:
+                        f.write(json.dumps(alert) + "\n")
+            self.send_response(204)
+            self.end_headers()
+
+        def log_message(self, *args):
+            pass  # One line per notification is printed above
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Receive and print alert webhook notifications.")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=9009)
+    parser.add_argument("--fail", type=int, default=0, help="Answer the first N requests with HTTP 500")
+    parser.add_argument("--out", default=None, help="Append notifications to this JSON-lines file")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s")
+    server = ThreadingHTTPServer((args.host, args.port), make_handler(Stub(args.fail, args.out)))
+    logger.info(f"Listening on http://{args.host}:{args.port}/")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
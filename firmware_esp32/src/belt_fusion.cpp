@@ -0,0 +1,97 @@
+/**
+ * @file belt_fusion.cpp
+ * @brief Encoder position for beam events: speed-independent length and spacing (see belt_fusion.h).
+ */
+
+#include "belt_fusion.h"
+
+// =====================================================================
+// Settings
+// =====================================================================
+static const uint64_t BELT_SAMPLE_SPACING_US = 5000;    // 64 samples cover >= 320 ms (debounce is 50 ms)
+static const uint64_t BELT_SPEED_WINDOW_US   = 200000;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+uint32_t BeltTracker::distanceMm(int64_t fromCounts, int64_t toCounts) const {
+    float mm = (float)(toCounts - fromCounts) * mmPerCount_;
+    return mm > 0 ? (uint32_t)(mm + 0.5f) : 0;
+}
+
+// =====================================================================
+// Public Functions (defined in belt_fusion.h)
+// =====================================================================
+
+BeltTracker::BeltTracker(float mmPerCount) : mmPerCount_(mmPerCount) {}
+
+void BeltTracker::sample(uint64_t tUs, int64_t counts) {
+    if (count_ >= 2 && tUs - at(count_ - 2).tUs < BELT_SAMPLE_SPACING_US) {
+        history_[(head_ + count_ - 1) % BELT_HISTORY] = {tUs, counts};
+    } else if (count_ < BELT_HISTORY) {
+        history_[(head_ + count_) % BELT_HISTORY] = {tUs, counts};
+        count_++;
+    } else {
+        history_[head_] = {tUs, counts};
+        head_ = (head_ + 1) % BELT_HISTORY;
+    }
+
+    uint64_t from = tUs > BELT_SPEED_WINDOW_US ? tUs - BELT_SPEED_WINDOW_US : 0;
+    if (from < at(0).tUs) {
+        from = at(0).tUs;
+    }
+    if (tUs > from) {
+        speedMmPerS_ = (float)(counts - countsAt(from)) * mmPerCount_ * 1e6f / (float)(tUs - from);
+    }
+}
+
+int64_t BeltTracker::counts() const {
+    return count_ ? at(count_ - 1).counts : 0;
+}
+
+int64_t BeltTracker::countsAt(uint64_t tUs) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    if (tUs <= at(0).tUs) {
+        return at(0).counts;
+    }
+    // Newest first: events are at most a debounce old
+    for (size_t i = count_ - 1; i > 0; i--) {
+        const Sample& hi = at(i);
+        const Sample& lo = at(i - 1);
+        if (tUs >= hi.tUs) {
+            return hi.counts;
+        }
+        if (tUs >= lo.tUs) {
+            int64_t dc = hi.counts - lo.counts;
+            uint64_t dt = hi.tUs - lo.tUs;
+            return lo.counts + dc * (int64_t)(tUs - lo.tUs) / (int64_t)dt;
+        }
+    }
+    return at(0).counts;
+}
+
+void BeltTracker::stamp(const PulseEvent& event, BeltStamp& out) {
+    int64_t edge = countsAt(event.edgeUs);
+    out.posMm = (uint32_t)(int64_t)((double)edge * mmPerCount_);
+    out.speedMmPerS = (int16_t)speedMmPerS_;
+
+    if (event.interrupted) {
+        gapMm_ = haveEnd_ ? distanceMm(endCounts_, edge) : 0;
+        startCounts_ = edge;
+        inProduct_ = true;
+        out.lengthMm = 0;
+        out.gapMm = gapMm_;
+        return;
+    }
+
+    // A product already in the beam at boot has no known start
+    uint32_t length = inProduct_ ? distanceMm(startCounts_, edge) : 0;
+    out.lengthMm = length > UINT16_MAX ? UINT16_MAX : (uint16_t)length;
+    out.gapMm = inProduct_ ? gapMm_ : 0;
+    inProduct_ = false;
+    endCounts_ = edge;
+    haveEnd_ = true;
+}
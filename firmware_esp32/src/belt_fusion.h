@@ -0,0 +1,82 @@
+#ifndef BELT_FUSION_H
+#define BELT_FUSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pulse_decoder.h"
+
+// Plain C++ only (no Arduino headers): this module is also compiled on the
+// host by tools/belt_sim.cpp against synthetic encoder and beam traces.
+
+/**
+ * @brief Belt position and product measures attached to a confirmed change.
+ * Distances come from the encoder, so they do not depend on belt speed.
+ */
+struct BeltStamp {
+    uint32_t posMm;        // Belt position at the first edge of the change (wraps after ~4295 km)
+    int16_t  speedMmPerS;  // Belt speed when the change was confirmed (negative when reversing)
+    uint16_t lengthMm;     // On "clear": belt travel while interrupted (0 = unknown)
+    uint32_t gapMm;        // Belt travel from the previous product's end to this one's start (0 = unknown)
+};
+
+/**
+ * @brief Fuses encoder counts with beam events.
+ *
+ * Encoder counts are sampled periodically with their time (sample()). A
+ * beam change is confirmed only after its debounce, so stamp() interpolates
+ * the count at the change's first edge from the recent samples, then turns
+ * the counts between edges into product length and spacing.
+ */
+class BeltTracker {
+public:
+    explicit BeltTracker(float mmPerCount);
+
+    /**
+     * @brief Records the encoder count at time tUs (times must not go back).
+     * Samples closer than BELT_SAMPLE_SPACING_US replace the newest one, so
+     * the history always spans at least BELT_HISTORY x spacing.
+     */
+    void sample(uint64_t tUs, int64_t counts);
+
+    /**
+     * @brief Encoder count at time tUs, interpolated between samples.
+     * Times outside the history are clamped to its oldest or newest sample.
+     */
+    int64_t countsAt(uint64_t tUs) const;
+
+    /**
+     * @brief Stamps a confirmed change with the belt position at its edge.
+     * "interrupted" gets the gap since the previous product; "clear" gets the
+     * product length and repeats that gap.
+     */
+    void stamp(const PulseEvent& event, BeltStamp& out);
+
+    bool    valid() const { return count_ > 0; }
+    float   speedMmPerS() const { return speedMmPerS_; }
+    int64_t counts() const;
+    float   mmPerCount() const { return mmPerCount_; }
+
+private:
+    struct Sample {
+        uint64_t tUs;
+        int64_t  counts;
+    };
+    static const size_t BELT_HISTORY = 64;
+
+    const Sample& at(size_t i) const { return history_[(head_ + i) % BELT_HISTORY]; }
+    uint32_t distanceMm(int64_t fromCounts, int64_t toCounts) const;
+
+    float    mmPerCount_;
+    Sample   history_[BELT_HISTORY];
+    size_t   head_ = 0;
+    size_t   count_ = 0;
+    float    speedMmPerS_ = 0;
+
+    bool     inProduct_ = false;
+    int64_t  startCounts_ = 0;
+    bool     haveEnd_ = false;
+    int64_t  endCounts_ = 0;
+    uint32_t gapMm_ = 0;
+};
+
+#endif // BELT_FUSION_H
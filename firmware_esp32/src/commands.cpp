@@ -0,0 +1,198 @@
+/**
+ * @file commands.cpp
+ * @brief Text command interpreter shared by the Serial console and MQTT.
+ *
+ * Commands are short text lines ("prof start 10", "prof dump"). The same
+ * handler serves the Serial Monitor and the MQTT command topic, so any
+ * diagnostic available on the bench is also available in the field.
+ */
+
+#include "commands.h"
+#include "profiler.h"
+#include "edge_trace.h"
+#include "wifi_manager.h"
+#include "outbound.h"
+#include "timesync.h"
+#include "sensing.h"
+#include "ulp_counter.h"
+#include "modbus_server.h"
+#include "product_log.h"
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static const char* skipSpaces(const char* s) {
+    while (*s == ' ') {
+        s++;
+    }
+    return s;
+}
+
+static void serialReply(const char* line) {
+    Serial.println(line);
+}
+
+static void handleProfilerCommand(const char* args, CommandReplyFn reply) {
+    char buf[64];
+
+    if (strncmp(args, "start", 5) == 0) {
+        // Optional argument: sample every N ticks (1 tick = 1 ms)
+        long divider = atol(args + 5);
+        if (divider <= 0) {
+            divider = 1;
+        }
+        if (profilerStart((uint32_t)divider)) {
+            snprintf(buf, sizeof(buf), "PROF started (every %ld tick(s))", divider);
+        } else {
+            snprintf(buf, sizeof(buf), "PROF failed to start");
+        }
+        reply(buf);
+    } else if (strcmp(args, "stop") == 0) {
+        profilerStop();
+        reply("PROF stopped");
+    } else if (strcmp(args, "clear") == 0) {
+        profilerClear();
+        reply("PROF cleared");
+    } else if (strcmp(args, "dump") == 0) {
+        profilerDump(reply);
+    } else if (strcmp(args, "status") == 0) {
+        profilerStatus(reply);
+    } else {
+        reply("PROF usage: prof start [ticks] | stop | clear | dump | status");
+    }
+}
+
+static void handleTraceCommand(const char* args, CommandReplyFn reply) {
+    if (strncmp(args, "start", 5) == 0) {
+        // Optional argument: capture duration in seconds
+        long seconds = atol(args + 5);
+        if (seconds <= 0) {
+            seconds = 10;
+        }
+        if (traceStart((uint32_t)seconds * 1000UL)) {
+            traceStatus(reply);
+        } else {
+            reply("TRACE busy: a capture or upload is in progress");
+        }
+    } else if (strcmp(args, "status") == 0) {
+        traceStatus(reply);
+    } else {
+        reply("TRACE usage: trace start [seconds] | status");
+    }
+}
+
+static void handleWifiCommand(const char* args, CommandReplyFn reply) {
+    if (strcmp(args, "status") == 0) {
+        wifiStatus(reply);
+    } else {
+        reply("WIFI usage: wifi status");
+    }
+}
+
+static void handleTxCommand(const char* args, CommandReplyFn reply) {
+    if (strcmp(args, "status") == 0) {
+        outboundStatus(reply);
+    } else {
+        reply("TX usage: tx status");
+    }
+}
+
+static void handleTimeCommand(const char* args, CommandReplyFn reply) {
+    if (strcmp(args, "status") == 0) {
+        timesyncStatus(reply);
+    } else {
+        reply("TIME usage: time status");
+    }
+}
+
+static void handleSenseCommand(const char* args, CommandReplyFn reply) {
+    if (strcmp(args, "status") == 0) {
+        sensingStatus(reply);
+    } else if (strncmp(args, "record", 6) == 0) {
+        // Optional argument: number of RMT blocks to capture
+        long blocks = atol(args + 6);
+        if (sensingRecord(blocks > 0 ? (size_t)blocks : 0)) {
+            reply("SENSE recording armed; read it with: sense dump");
+        } else {
+            reply("SENSE raw recording needs the RMT backend (TERELINA_USE_RMT)");
+        }
+    } else if (strcmp(args, "dump") == 0) {
+        sensingDump(reply);
+    } else {
+        reply("SENSE usage: sense status | record [blocks] | dump");
+    }
+}
+
+static void handleUlpCommand(const char* args, CommandReplyFn reply) {
+    if (strcmp(args, "status") == 0) {
+        ulpCounterStatus(reply);
+    } else {
+        reply("ULP usage: ulp status");
+    }
+}
+
+static void handleModbusCommand(const char* args, CommandReplyFn reply) {
+    if (strcmp(args, "status") == 0) {
+        modbusStatus(reply);
+    } else {
+        reply("MODBUS usage: modbus status");
+    }
+}
+
+static void handleLogCommand(const char* args, CommandReplyFn reply) {
+    if (strcmp(args, "status") == 0) {
+        productLogStatus(reply);
+    } else {
+        reply("LOG usage: log status");
+    }
+}
+
+// =====================================================================
+// Public Functions (defined in commands.h)
+// =====================================================================
+
+void handleCommandLine(const char* line, CommandReplyFn reply) {
+    line = skipSpaces(line);
+
+    if (strncmp(line, "prof", 4) == 0) {
+        handleProfilerCommand(skipSpaces(line + 4), reply);
+    } else if (strncmp(line, "trace", 5) == 0) {
+        handleTraceCommand(skipSpaces(line + 5), reply);
+    } else if (strncmp(line, "wifi", 4) == 0) {
+        handleWifiCommand(skipSpaces(line + 4), reply);
+    } else if (strncmp(line, "tx", 2) == 0) {
+        handleTxCommand(skipSpaces(line + 2), reply);
+    } else if (strncmp(line, "time", 4) == 0) {
+        handleTimeCommand(skipSpaces(line + 4), reply);
+    } else if (strncmp(line, "sense", 5) == 0) {
+        handleSenseCommand(skipSpaces(line + 5), reply);
+    } else if (strncmp(line, "ulp", 3) == 0) {
+        handleUlpCommand(skipSpaces(line + 3), reply);
+    } else if (strncmp(line, "modbus", 6) == 0) {
+        handleModbusCommand(skipSpaces(line + 6), reply);
+    } else if (strncmp(line, "log", 3) == 0) {
+        handleLogCommand(skipSpaces(line + 3), reply);
+    } else if (*line != '\0') {
+        reply("ERR unknown command");
+    }
+}
+
+void handleSerialCommands() {
+    static char lineBuffer[64];
+    static size_t lineLength = 0;
+
+    while (Serial.available() > 0) {
+        char c = (char)Serial.read();
+        if (c == '\r') {
+            continue;
+        }
+        if (c == '\n') {
+            lineBuffer[lineLength] = '\0';
+            handleCommandLine(lineBuffer, serialReply);
+            lineLength = 0;
+        } else if (lineLength < sizeof(lineBuffer) - 1) {
+            lineBuffer[lineLength++] = c;
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Sink for command output. Each call receives one line (no newline).
+ * Serial prints it directly; MQTT batches lines into diagnostic messages.
+ */
+typedef void (*CommandReplyFn)(const char* line);
+
+/**
+ * @brief Parses and executes a single text command, e.g. "prof start".
+ * Used by both the Serial console and the MQTT command topic.
+ * @param line  Null-terminated command line.
+ * @param reply Function that receives the command's output lines.
+ */
+void handleCommandLine(const char* line, CommandReplyFn reply);
+
+/**
+ * @brief Reads command lines typed on the Serial Monitor (non-blocking).
+ * Call this in every main loop() iteration.
+ */
+void handleSerialCommands();
+
+#endif // COMMANDS_H
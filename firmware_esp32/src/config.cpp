@@ -21,8 +21,39 @@ const char* MQTT_PASSWORD      = "";                  // MQTT password (leave bl
 // --- TOPIC CONFIGURATION ---
 // IMPORTANT: These topics MUST match what the backend is subscribed to.
 const char* MQTT_TOPIC_STATE     = "sensors/barrier/state";
-const char* MQTT_TOPIC_HEARTBEAT = "sensors/barrier/heartbeat";
+const char* MQTT_TOPIC_HEARTBEAT = "sensors/barrier/heartbeat/ESP32_Barrier_001";  // Per-device: its Last Will names it
 const char* MQTT_CLIENT_ID       = "ESP32_Barrier_001"; // Unique device identifier
+const char* MQTT_TOPIC_COMMAND   = "sensors/barrier/cmd/ESP32_Barrier_001";  // Per-device: must end with the client ID
+const char* MQTT_TOPIC_DIAG      = "sensors/barrier/diag/ESP32_Barrier_001";
+const char* MQTT_TOPIC_TRACE     = "sensors/barrier/trace/ESP32_Barrier_001";
+const char* MQTT_TOPIC_ALARM     = "sensors/barrier/alarm/ESP32_Barrier_001";
+const char* MQTT_TOPIC_BACKLOG   = "sensors/barrier/backlog/ESP32_Barrier_001";
+const char* MQTT_TOPIC_TIME_REQ  = "sensors/barrier/time/req/ESP32_Barrier_001";
+const char* MQTT_TOPIC_TIME_RESP = "sensors/barrier/time/resp/ESP32_Barrier_001";
+const char* MQTT_TOPIC_ACK       = "sensors/barrier/ack/ESP32_Barrier_001";
+
+// Reported in every heartbeat ("cfg"): bump it when a setting in this file
+// changes, so the backend's /v1/devices shows devices still on an older one.
+const uint16_t CONFIG_VERSION = 1;
+
+// =====================================================================
+// MQTT-SN Transport (only used when built with -DTERELINA_USE_MQTTSN)
+// =====================================================================
+// The gateway maps these predefined ids to the topic names above; see
+// mosquitto/mqttsn/predefinedTopic.conf.
+const char*    MQTTSN_GATEWAY_HOST       = "10.0.1.62"; // Usually the same PC as the broker
+const uint16_t MQTTSN_GATEWAY_PORT       = 10000;
+const uint16_t MQTTSN_LOCAL_PORT         = 10001;
+const uint16_t MQTTSN_TOPIC_ID_STATE     = 1;
+const uint16_t MQTTSN_TOPIC_ID_HEARTBEAT = 2;
+const uint16_t MQTTSN_TOPIC_ID_COMMAND   = 3;
+const uint16_t MQTTSN_TOPIC_ID_DIAG      = 4;
+const uint16_t MQTTSN_TOPIC_ID_TRACE     = 5;
+const uint16_t MQTTSN_TOPIC_ID_ALARM     = 6;
+const uint16_t MQTTSN_TOPIC_ID_BACKLOG   = 7;
+const uint16_t MQTTSN_TOPIC_ID_TIME_REQ  = 8;
+const uint16_t MQTTSN_TOPIC_ID_TIME_RESP = 9;
+const uint16_t MQTTSN_TOPIC_ID_ACK       = 10;
 
 // =====================================================================
 // Hardware Pinout & Behavior
@@ -31,8 +62,50 @@ const int  SENSOR_PIN        = 27;   // GPIO pin connected to the sensor's outpu
 const bool SENSOR_USE_PULLUP = true; // Use true if the sensor is a simple switch/contact to GND
 const bool SENSOR_ACTIVE_LOW = true; // Use true if the sensor outputs a LOW signal when the beam is broken
 
+// =====================================================================
+// Light Curtain (only used when built with -DTERELINA_USE_CURTAIN)
+// =====================================================================
+// Input-capable GPIOs only; 34..39 have no internal pull-ups (use external ones).
+const uint8_t  CURTAIN_BEAM_COUNT    = 16;
+const uint8_t  CURTAIN_PINS[]        = {4, 5, 13, 14, 16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 32, 33};
+const uint16_t CURTAIN_BEAM_PITCH_MM = 30;   // 16 beams cover a 480 mm belt
+const uint16_t CURTAIN_BELT_MM_S     = 200;
+
+// =====================================================================
+// Belt Encoder (only used when built with -DTERELINA_USE_ENCODER)
+// =====================================================================
+// 34/35 are input-only and have no pull-ups: open-collector encoders need external ones.
+const int   ENCODER_PIN_A        = 34;
+const int   ENCODER_PIN_B        = 35;
+const float ENCODER_MM_PER_COUNT = 0.0654f;  // 600-line encoder on a 50 mm roller: 157 mm / 2400 counts
+
+// =====================================================================
+// ULP Counter (only used when built with -DTERELINA_USE_ULP)
+// =====================================================================
+// The debounce becomes SENSOR_DEBOUNCE_DELAY_MS / period samples (25 at 2 ms).
+// Products wake the cores before the 16-entry timestamp ring can wrap.
+const uint32_t ULP_SAMPLE_PERIOD_US   = 2000;
+const uint16_t ULP_WAKE_PRODUCTS      = 12;
+const uint32_t ULP_PUBLISH_INTERVAL_S = 300;
+const uint32_t ULP_AWAKE_MAX_MS       = 30000;
+
+// =====================================================================
+// Modbus TCP Server (only used when built with -DTERELINA_USE_MODBUS)
+// =====================================================================
+const uint16_t MODBUS_TCP_PORT        = 502;
+const uint32_t MODBUS_IDLE_TIMEOUT_MS = 60000;  // Frees the slot of a PLC that vanished without closing
+
+// =====================================================================
+// Durable Product Log (only used when built with -DTERELINA_USE_PRODUCT_LOG)
+// =====================================================================
+// The backend acknowledges about once a second; this only fires when
+// products were lost on the way (QoS 0) or the backend restarted.
+const uint32_t LOG_RESEND_AFTER_MS = 30000;
+
 // =====================================================================
 // Timing Configuration
 // =====================================================================
 const unsigned long HEARTBEAT_INTERVAL_MS    = 60000; // 60 seconds
-const unsigned long SENSOR_DEBOUNCE_DELAY_MS = 50;    // 50 milliseconds
\ No newline at end of file
+const unsigned long SENSOR_DEBOUNCE_DELAY_MS = 50;    // 50 milliseconds
+const unsigned long ROAM_QUIET_MS            = 2000;  // Beam clear this long before a background scan
+const unsigned long JAM_ALARM_MS             = 10000; // Beam interrupted this long raises a jam alarm
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdint.h>
+
 // =====================================================================
 // WiFi Settings
 // =====================================================================
@@ -16,8 +18,35 @@ extern const int   MQTT_BROKER_PORT;
 extern const char* MQTT_USER;
 extern const char* MQTT_PASSWORD;
 extern const char* MQTT_TOPIC_STATE;     // Topic to publish sensor state, e.g., "sensors/barrier/state"
-extern const char* MQTT_TOPIC_HEARTBEAT; // Topic for device status heartbeat, e.g., "sensors/barrier/heartbeat"
+extern const char* MQTT_TOPIC_HEARTBEAT; // Per-device topic for the status heartbeat and the "offline" Last Will
 extern const char* MQTT_CLIENT_ID;       // Unique client ID, also used as device_id in the payload
+extern const char* MQTT_TOPIC_COMMAND;   // Topic the device listens on for text commands (e.g. "prof dump")
+extern const char* MQTT_TOPIC_DIAG;      // Topic where command output (diagnostics) is published
+extern const char* MQTT_TOPIC_TRACE;     // Topic for raw edge trace chunks (binary)
+extern const char* MQTT_TOPIC_ALARM;     // Topic for alarms (e.g. line jam), highest priority
+extern const char* MQTT_TOPIC_BACKLOG;   // Topic for products replayed after an outage
+extern const char* MQTT_TOPIC_TIME_REQ;  // Topic for clock-sync pings to the backend
+extern const char* MQTT_TOPIC_TIME_RESP; // Topic where the backend answers clock-sync pings
+extern const char* MQTT_TOPIC_ACK;       // Retained topic where the backend acknowledges committed products
+extern const uint16_t CONFIG_VERSION;    // Version of these settings, reported in heartbeats
+
+// =====================================================================
+// MQTT-SN Transport (only used when built with -DTERELINA_USE_MQTTSN)
+// =====================================================================
+extern const char*    MQTTSN_GATEWAY_HOST;        // IP of the MQTT-SN gateway (UDP)
+extern const uint16_t MQTTSN_GATEWAY_PORT;
+extern const uint16_t MQTTSN_LOCAL_PORT;          // Local UDP port for gateway replies
+// Predefined topic ids; must match the gateway's predefinedTopic.conf
+extern const uint16_t MQTTSN_TOPIC_ID_STATE;
+extern const uint16_t MQTTSN_TOPIC_ID_HEARTBEAT;
+extern const uint16_t MQTTSN_TOPIC_ID_COMMAND;
+extern const uint16_t MQTTSN_TOPIC_ID_DIAG;
+extern const uint16_t MQTTSN_TOPIC_ID_TRACE;
+extern const uint16_t MQTTSN_TOPIC_ID_ALARM;
+extern const uint16_t MQTTSN_TOPIC_ID_BACKLOG;
+extern const uint16_t MQTTSN_TOPIC_ID_TIME_REQ;
+extern const uint16_t MQTTSN_TOPIC_ID_TIME_RESP;
+extern const uint16_t MQTTSN_TOPIC_ID_ACK;
 
 // =====================================================================
 // Hardware Pinout & Behavior
@@ -26,10 +55,46 @@ extern const int  SENSOR_PIN;        // GPIO pin connected to the barrier sensor
 extern const bool SENSOR_USE_PULLUP; // If true, enables the internal pull-up resistor (INPUT_PULLUP)
 extern const bool SENSOR_ACTIVE_LOW; // If true, a LOW signal means the beam is interrupted (active state)
 
+// =====================================================================
+// Light Curtain (only used when built with -DTERELINA_USE_CURTAIN)
+// =====================================================================
+extern const uint8_t  CURTAIN_BEAM_COUNT;    // Beams across the belt (8..20 on direct GPIOs)
+extern const uint8_t  CURTAIN_PINS[];        // GPIO of each beam, beam 0 first; same polarity as SENSOR_ACTIVE_LOW
+extern const uint16_t CURTAIN_BEAM_PITCH_MM; // Distance between neighbouring beams
+extern const uint16_t CURTAIN_BELT_MM_S;     // Belt speed, to turn dwell into product length (encoder builds measure it)
+
+// =====================================================================
+// Belt Encoder (only used when built with -DTERELINA_USE_ENCODER)
+// =====================================================================
+extern const int   ENCODER_PIN_A;        // Quadrature channel A
+extern const int   ENCODER_PIN_B;        // Quadrature channel B (swap A/B if the belt counts backwards)
+extern const float ENCODER_MM_PER_COUNT; // Belt travel per count (4 counts per encoder line)
+
+// =====================================================================
+// ULP Counter (only used when built with -DTERELINA_USE_ULP)
+// =====================================================================
+extern const uint32_t ULP_SAMPLE_PERIOD_US;   // ULP sampling period of SENSOR_PIN (must be an RTC GPIO)
+extern const uint16_t ULP_WAKE_PRODUCTS;      // Products that wake the main cores early (at most 16)
+extern const uint32_t ULP_PUBLISH_INTERVAL_S; // Deep-sleep timer: publish at least this often
+extern const uint32_t ULP_AWAKE_MAX_MS;       // Give up on the network and sleep again after this
+
+// =====================================================================
+// Modbus TCP Server (only used when built with -DTERELINA_USE_MODBUS)
+// =====================================================================
+extern const uint16_t MODBUS_TCP_PORT;        // 502 is the standard Modbus TCP port
+extern const uint32_t MODBUS_IDLE_TIMEOUT_MS; // Close a connection with no request for this long
+
+// =====================================================================
+// Durable Product Log (only used when built with -DTERELINA_USE_PRODUCT_LOG)
+// =====================================================================
+extern const uint32_t LOG_RESEND_AFTER_MS;    // Replay logged products not acknowledged within this time
+
 // =====================================================================
 // Timing Configuration
 // =====================================================================
 extern const unsigned long HEARTBEAT_INTERVAL_MS;   // Interval for sending MQTT heartbeat messages (in milliseconds)
 extern const unsigned long SENSOR_DEBOUNCE_DELAY_MS; // Debounce delay to prevent false readings (in milliseconds)
+extern const unsigned long ROAM_QUIET_MS;            // Sensor idle time that opens a window for a roaming scan
+extern const unsigned long JAM_ALARM_MS;             // Continuous interruption that raises a jam alarm
 
 #endif // CONFIG_H
\ No newline at end of file
@@ -0,0 +1,148 @@
+/**
+ * @file curtain.cpp
+ * @brief Bit-parallel product segmentation for a light curtain (see curtain.h).
+ */
+
+#include "curtain.h"
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static inline uint8_t popcount32(uint32_t v) { return (uint8_t)__builtin_popcount(v); }
+static inline uint8_t lowestBit(uint32_t v) { return (uint8_t)__builtin_ctz(v); }
+static inline uint8_t highestBit(uint32_t v) { return (uint8_t)(31 - __builtin_clz(v)); }
+
+// Shorter splits or trailing pieces are flicker of single beams
+static const uint32_t BROKEN_MIN_TICKS = 5;
+
+void CurtainSegmenter::startProduct(uint64_t nowUs) {
+    active_ = true;
+    confirmed_ = false;
+    startUs_ = nowUs;
+    clearRun_ = 0;
+    blockedTicks_ = 0;
+    sawHole_ = false;
+    afterHoleTicks_ = 0;
+    splitRun_ = 0;
+    maxSplitRun_ = 0;
+    area_ = 0;
+    centerSum2_ = 0;
+    maxWidth_ = 0;
+    maxRuns_ = 0;
+    left_ = 31;
+    right_ = 0;
+    peakFirst_ = 0;
+    peakLast_ = 0;
+}
+
+void CurtainSegmenter::finishShape(ProductShape& shape, uint64_t endUs) const {
+    uint32_t ticks = blockedTicks_ ? blockedTicks_ : 1;
+    uint64_t dwellUs = endUs - startUs_;
+
+    shape.widthMm = (uint16_t)(maxWidth_ * config_.pitchMm);
+    shape.lengthMm = (uint16_t)(dwellUs * config_.beltMmPerS / 1000000);
+    shape.centerMm = (int16_t)(centerSum2_ * config_.pitchMm / (2 * ticks));
+    shape.pieces = maxRuns_;
+    shape.fillPct = maxWidth_ ? (uint8_t)(area_ * 100 / ((uint32_t)maxWidth_ * ticks)) : 0;
+    // Middle of the widest plateau: a disc is widest halfway through
+    shape.peakPct = (uint8_t)((peakFirst_ + peakLast_) * 50 / ticks);
+
+    shape.flags = 0;
+    // Pieces side by side for a while, or a second piece after an all-clear hole
+    if (maxSplitRun_ >= BROKEN_MIN_TICKS || afterHoleTicks_ >= BROKEN_MIN_TICKS) {
+        shape.flags |= SHAPE_BROKEN;
+    }
+    uint32_t aspectPct = shape.lengthMm ? (uint32_t)shape.widthMm * 100 / shape.lengthMm : 100;
+    if (shape.peakPct < 25 || shape.peakPct > 75 || aspectPct < 60 || aspectPct > 150) {
+        shape.flags |= SHAPE_FOLDED;
+    }
+    if (left_ == 0 || right_ == config_.beams - 1) {
+        shape.flags |= SHAPE_EDGE;
+    }
+}
+
+// =====================================================================
+// Public Functions (defined in curtain.h)
+// =====================================================================
+
+CurtainSegmenter::CurtainSegmenter(const CurtainConfig& config, uint64_t startUs)
+    : config_(config),
+      beamMask_(config.beams >= 32 ? 0xFFFFFFFFu : ((1u << config.beams) - 1)),
+      lastEndUs_(startUs) {}
+
+bool CurtainSegmenter::tick(uint32_t mask, uint64_t nowUs, PulseEvent& out, ProductShape& shape) {
+    mask &= beamMask_;
+
+    // Two-tick hysteresis on every beam at once: set after two blocked ticks,
+    // cleared after two clear ticks
+    uint32_t filtered = (mask & prev_) | (stable_ & (mask | prev_));
+    prev_ = mask;
+    stable_ = filtered;
+
+    if (filtered) {
+        if (!active_) {
+            startProduct(nowUs);
+        }
+        if (clearRun_ > 0) {
+            sawHole_ = true;
+            afterHoleTicks_ = 0;
+            clearRun_ = 0;
+        }
+        if (sawHole_) afterHoleTicks_++;
+        lastBlockedUs_ = nowUs;
+
+        uint8_t runs = popcount32(filtered & ~(filtered << 1));  // Rising edges across the array
+        uint8_t lo = lowestBit(filtered);
+        uint8_t hi = highestBit(filtered);
+        uint8_t extent = hi - lo + 1;                                // Cracks do not narrow the product
+
+        if (extent > maxWidth_) {
+            maxWidth_ = extent;
+            peakFirst_ = blockedTicks_;
+        }
+        if (extent == maxWidth_) {
+            peakLast_ = blockedTicks_;
+        }
+        blockedTicks_++;
+        area_ += popcount32(filtered);
+        centerSum2_ += lo + hi;
+        splitRun_ = runs > 1 ? splitRun_ + 1 : 0;
+        if (splitRun_ > maxSplitRun_) maxSplitRun_ = splitRun_;
+        if (runs > maxRuns_) maxRuns_ = runs;
+        if (lo < left_) left_ = lo;
+        if (hi > right_) right_ = hi;
+
+        if (!confirmed_ && nowUs - startUs_ >= config_.confirmUs) {
+            confirmed_ = true;
+            out.interrupted = true;
+            out.edgeUs = startUs_;
+            out.widthUs = (uint32_t)(startUs_ - lastEndUs_);
+            return true;
+        }
+        return false;
+    }
+
+    if (!active_) {
+        return false;
+    }
+    if (clearRun_++ == 0) {
+        firstClearUs_ = nowUs;
+    }
+    if (nowUs - lastBlockedUs_ < config_.endGapUs) {
+        return false;
+    }
+
+    active_ = false;
+    if (!confirmed_) {
+        glitches_++;
+        return false;
+    }
+    confirmed_ = false;
+    out.interrupted = false;
+    out.edgeUs = firstClearUs_;
+    out.widthUs = (uint32_t)(firstClearUs_ - startUs_);
+    finishShape(shape, firstClearUs_);
+    lastEndUs_ = firstClearUs_;
+    return true;
+}
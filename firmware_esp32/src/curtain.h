@@ -0,0 +1,104 @@
+#ifndef CURTAIN_H
+#define CURTAIN_H
+
+#include <stdint.h>
+#include "pulse_decoder.h"
+
+// Plain C++ only (no Arduino headers): this module is also compiled on the
+// host by tools/curtain_bench.cpp.
+
+/**
+ * @brief Shape flags of a product seen by the light curtain.
+ */
+enum ShapeFlags : uint8_t {
+    SHAPE_BROKEN = 1 << 0,  // Several pieces side by side, or a hole along the product
+    SHAPE_FOLDED = 1 << 1,  // Widest point near one end, or much narrower than long
+    SHAPE_EDGE   = 1 << 2,  // Touches the outermost beam: may extend past the curtain
+};
+
+/**
+ * @brief 1-D profile features of one product (10 bytes, kept in the event record).
+ */
+struct ProductShape {
+    uint16_t widthMm;   // Widest extent across the belt (outermost blocked beams)
+    uint16_t lengthMm;  // Extent along the belt (dwell x belt speed)
+    int16_t  centerMm;  // Mean centre across the belt, from beam 0
+    uint8_t  pieces;    // Most separate runs of blocked beams in one tick
+    uint8_t  fillPct;   // Blocked beam-ticks / (max extent x blocked ticks); a disc gives ~78
+    uint8_t  peakPct;   // Where along the product the widest tick is (0 = leading edge)
+    uint8_t  flags;     // ShapeFlags
+};
+
+/**
+ * @brief Light-curtain geometry and segmentation thresholds.
+ */
+struct CurtainConfig {
+    uint8_t  beams;          // 1..32, bit i of a mask is beam i
+    uint16_t pitchMm;        // Distance between neighbouring beams
+    uint16_t beltMmPerS;     // Belt speed, to turn dwell into length
+    uint32_t confirmUs;      // A product must stay this long to be confirmed
+    uint32_t endGapUs;       // All beams clear this long ends the product
+};
+
+/**
+ * @brief Segments products from one beam bitmask per tick.
+ *
+ * Every step works on the whole array at once: a two-tick hysteresis per
+ * beam ((m & prev) | (stable & (m | prev))) removes single-tick flicker,
+ * popcount gives the covered area, m & ~(m << 1) marks the start of each
+ * run of blocked beams, and count-trailing/leading-zeros give the extent. Emits a
+ * PulseEvent when a product is confirmed (interrupted) and when it has left
+ * (clear, with its ProductShape), so it can replace the single-beam
+ * debouncer in the sensing task.
+ */
+class CurtainSegmenter {
+public:
+    CurtainSegmenter(const CurtainConfig& config, uint64_t startUs);
+
+    /**
+     * @brief Processes one sample of the beam array.
+     * @param mask Bit i set when beam i is blocked.
+     * @return True if a change was confirmed (written to out; shape is valid
+     * when out.interrupted is false).
+     */
+    bool tick(uint32_t mask, uint64_t nowUs, PulseEvent& out, ProductShape& shape);
+
+    bool     present() const { return confirmed_; }
+    uint32_t lastMask() const { return stable_; }
+    uint32_t glitches() const { return glitches_; }
+
+private:
+    void startProduct(uint64_t nowUs);
+    void finishShape(ProductShape& shape, uint64_t endUs) const;
+
+    CurtainConfig config_;
+    uint32_t beamMask_;
+    uint32_t prev_ = 0;
+    uint32_t stable_ = 0;
+
+    bool     active_ = false;     // Something is in the curtain (maybe not yet confirmed)
+    bool     confirmed_ = false;
+    uint64_t startUs_ = 0;
+    uint64_t lastBlockedUs_ = 0;
+    uint64_t firstClearUs_ = 0;   // First all-clear tick of the current clear run
+    uint32_t clearRun_ = 0;
+    uint64_t lastEndUs_;
+    uint32_t glitches_ = 0;
+
+    // Per-product accumulators
+    uint32_t blockedTicks_ = 0;
+    bool     sawHole_ = false;     // All beams cleared inside the product
+    uint32_t afterHoleTicks_ = 0;  // Blocked ticks since the last hole
+    uint32_t splitRun_ = 0;        // Consecutive ticks with more than one run
+    uint32_t maxSplitRun_ = 0;
+    uint32_t area_ = 0;            // Blocked beam-ticks
+    uint32_t centerSum2_ = 0;      // Sum of (left + right) beam indexes
+    uint8_t  maxWidth_ = 0;        // Widest extent (lowest to highest blocked beam)
+    uint8_t  maxRuns_ = 0;
+    uint8_t  left_ = 0;
+    uint8_t  right_ = 0;
+    uint32_t peakFirst_ = 0;       // First and last tick at maxWidth_
+    uint32_t peakLast_ = 0;
+};
+
+#endif // CURTAIN_H
@@ -0,0 +1,202 @@
+/**
+ * @file edge_trace.cpp
+ * @brief On-demand capture of raw beam edges for offline replay.
+ *
+ * The debounced states published by publishSensorState() hide what the beam
+ * actually did. A trace records every raw edge (microsecond timestamp and
+ * beam state) from a GPIO interrupt, then uploads it over MQTT in small,
+ * self-contained binary chunks:
+ *
+ *   Offset  Size  Field
+ *   0       1     Magic 'T'
+ *   1       1     Format version (1)
+ *   2       2     Trace id (little endian)
+ *   4       2     Chunk index
+ *   6       1     Flags: bit0 last chunk, bit1 buffer overflowed, bit2 beam interrupted at start
+ *   7       1     Number of edges in this chunk
+ *   8       4     Timestamp of the chunk's first edge (us since capture start)
+ *   12      4     Capture duration (ms)
+ *   16      ...   One LEB128 varint per edge: (delta_us << 1) | interrupted
+ *
+ * The first edge of each chunk has delta 0, so a lost chunk leaves a gap
+ * instead of corrupting the rest of the trace.
+ */
+
+#include "edge_trace.h"
+#include "config.h"
+#include "mqtt.h"
+#include "outbound.h"
+
+// =====================================================================
+// Capture Buffer
+// =====================================================================
+static constexpr size_t   TRACE_CAPACITY          = 4096;  // Edges (16 KB of RAM)
+static constexpr size_t   TRACE_CHUNK_MAX_BYTES   = 192;   // Fits PubSubClient's 256-byte buffer with the topic
+static constexpr size_t   TRACE_HEADER_BYTES      = 16;
+static constexpr uint32_t TRACE_MAX_DURATION_MS   = 600000;
+
+enum TraceState { TRACE_IDLE, TRACE_CAPTURING, TRACE_UPLOADING };
+
+// Each entry: (us since capture start << 1) | interrupted
+static uint32_t traceBuffer[TRACE_CAPACITY];
+static volatile size_t traceCount = 0;
+static volatile bool   traceOverflow = false;
+static volatile uint32_t traceStartMicros = 0;
+
+static TraceState traceState = TRACE_IDLE;
+static uint16_t   traceId = 0;
+static bool       traceInitialInterrupted = false;
+static uint32_t   traceStartMillis = 0;
+static uint32_t   traceDurationMs = 0;
+static size_t     traceUploadIndex = 0;
+static uint16_t   traceChunkIndex = 0;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static inline bool IRAM_ATTR readBeamInterrupted() {
+    return digitalRead(SENSOR_PIN) == (SENSOR_ACTIVE_LOW ? LOW : HIGH);
+}
+
+static void IRAM_ATTR onSensorEdge() {
+    size_t n = traceCount;
+    if (n >= TRACE_CAPACITY) {
+        traceOverflow = true;
+        return;
+    }
+    uint32_t t = micros() - traceStartMicros;
+    traceBuffer[n] = (t << 1) | (readBeamInterrupted() ? 1u : 0u);
+    traceCount = n + 1;
+}
+
+static size_t writeVarint(uint8_t* out, uint32_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    return len;
+}
+
+static void writeU16(uint8_t* out, uint16_t v) {
+    out[0] = (uint8_t)v;
+    out[1] = (uint8_t)(v >> 8);
+}
+
+static void writeU32(uint8_t* out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+/**
+ * @brief Encodes the next chunk starting at traceUploadIndex.
+ * @return Chunk length in bytes; *edgesUsed receives the number of edges consumed.
+ */
+static size_t encodeChunk(uint8_t* chunk, size_t* edgesUsed) {
+    size_t len = TRACE_HEADER_BYTES;
+    size_t index = traceUploadIndex;
+    size_t edges = 0;
+    uint32_t previous = index < traceCount ? (traceBuffer[index] >> 1) : 0;
+    uint32_t first = previous;
+
+    while (index < traceCount && edges < 255) {
+        uint32_t t = traceBuffer[index] >> 1;
+        uint32_t value = ((t - previous) << 1) | (traceBuffer[index] & 1u);
+        uint8_t encoded[5];
+        size_t n = writeVarint(encoded, value);
+        if (len + n > TRACE_CHUNK_MAX_BYTES) {
+            break;
+        }
+        memcpy(chunk + len, encoded, n);
+        len += n;
+        previous = t;
+        index++;
+        edges++;
+    }
+
+    bool last = index >= traceCount;
+    chunk[0] = 'T';
+    chunk[1] = 1;
+    writeU16(chunk + 2, traceId);
+    writeU16(chunk + 4, traceChunkIndex);
+    chunk[6] = (last ? 0x01 : 0) | (traceOverflow ? 0x02 : 0) | (traceInitialInterrupted ? 0x04 : 0);
+    chunk[7] = (uint8_t)edges;
+    writeU32(chunk + 8, first);
+    writeU32(chunk + 12, traceDurationMs);
+
+    *edgesUsed = edges;
+    return len;
+}
+
+// =====================================================================
+// Public Functions (defined in edge_trace.h)
+// =====================================================================
+
+bool traceStart(uint32_t durationMs) {
+    if (traceState != TRACE_IDLE) {
+        return false;
+    }
+    if (durationMs == 0 || durationMs > TRACE_MAX_DURATION_MS) {
+        durationMs = durationMs == 0 ? 10000 : TRACE_MAX_DURATION_MS;
+    }
+
+    traceId++;
+    traceCount = 0;
+    traceOverflow = false;
+    traceUploadIndex = 0;
+    traceChunkIndex = 0;
+    traceDurationMs = durationMs;
+    traceInitialInterrupted = readBeamInterrupted();
+    traceStartMillis = millis();
+    traceStartMicros = micros();
+    traceState = TRACE_CAPTURING;
+    attachInterrupt(digitalPinToInterrupt(SENSOR_PIN), onSensorEdge, CHANGE);
+
+    Serial.printf("[Trace] Capture #%u started for %lu ms.\n", traceId, (unsigned long)durationMs);
+    return true;
+}
+
+void handleTraceTasks() {
+    if (traceState == TRACE_CAPTURING) {
+        if (millis() - traceStartMillis < traceDurationMs && !traceOverflow) {
+            return;
+        }
+        detachInterrupt(digitalPinToInterrupt(SENSOR_PIN));
+        traceState = TRACE_UPLOADING;
+        Serial.printf("[Trace] Capture #%u finished: %u edges%s.\n", traceId, (unsigned)traceCount,
+                      traceOverflow ? " (buffer full)" : "");
+        return;
+    }
+
+    // Chunks go through the trace class of the outbound scheduler, which
+    // paces them with its byte budget behind all other traffic.
+    if (traceState != TRACE_UPLOADING || !isMqttConnected() || !outboundHasSpace(CLASS_TRACE)) {
+        return;
+    }
+
+    uint8_t chunk[TRACE_CHUNK_MAX_BYTES];
+    size_t edgesUsed = 0;
+    size_t len = encodeChunk(chunk, &edgesUsed);
+    if (!outboundEnqueue(CLASS_TRACE, TOPIC_TRACE, chunk, len)) {
+        return; // Retry the same chunk on the next call
+    }
+
+    traceUploadIndex += edgesUsed;
+    traceChunkIndex++;
+    if (traceUploadIndex >= traceCount) {
+        Serial.printf("[Trace] Upload #%u complete (%u chunks).\n", traceId, traceChunkIndex);
+        traceState = TRACE_IDLE;
+    }
+}
+
+void traceStatus(CommandReplyFn reply) {
+    static const char* names[] = {"idle", "capturing", "uploading"};
+    char line[96];
+    snprintf(line, sizeof(line), "TRACE id=%u state=%s edges=%u uploaded=%u overflow=%d",
+             traceId, names[traceState], (unsigned)traceCount, (unsigned)traceUploadIndex,
+             traceOverflow ? 1 : 0);
+    reply(line);
+}
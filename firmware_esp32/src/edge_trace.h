@@ -0,0 +1,28 @@
+#ifndef EDGE_TRACE_H
+#define EDGE_TRACE_H
+
+#include <Arduino.h>
+#include "commands.h"
+
+/**
+ * @brief Starts recording every raw edge on SENSOR_PIN for the given duration.
+ * Edges are timestamped in microseconds by a GPIO interrupt into a RAM buffer;
+ * the sensing task (sensing.cpp) is not affected.
+ * @param durationMs Capture window in milliseconds.
+ * @return False if a capture or upload is already in progress.
+ */
+bool traceStart(uint32_t durationMs);
+
+/**
+ * @brief Ends the capture window and uploads the trace in chunks.
+ * Call this in every main loop() iteration. Chunks are queued in the trace
+ * class of the outbound scheduler, only while MQTT is connected.
+ */
+void handleTraceTasks();
+
+/**
+ * @brief Writes the current capture/upload state as a single line.
+ */
+void traceStatus(CommandReplyFn reply);
+
+#endif // EDGE_TRACE_H
@@ -0,0 +1,103 @@
+/**
+ * @file encoder.cpp
+ * @brief Quadrature belt encoder counted by the PCNT peripheral (see encoder.h).
+ *
+ * PCNT counts in hardware with no CPU cost per edge, but its counter is only
+ * 16 bits. The unit is set to wrap at +/-ENCODER_LIMIT and an interrupt adds
+ * each wrap to a 64-bit total, so encoderCount() reads total + counter.
+ */
+
+#include "encoder.h"
+
+#ifdef TERELINA_USE_ENCODER
+
+#include "config.h"
+#include <driver/pcnt.h>
+
+// =====================================================================
+// Settings and State
+// =====================================================================
+static constexpr pcnt_unit_t ENCODER_UNIT     = PCNT_UNIT_0;
+static constexpr int16_t     ENCODER_LIMIT    = 30000;
+static constexpr uint16_t    ENCODER_FILTER   = 100;    // APB cycles: ignore glitches under 1.25 us
+
+static volatile int64_t wrapped = 0;
+static bool started = false;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static void IRAM_ATTR onEncoderLimit(void* arg) {
+    (void)arg;
+    uint32_t status = 0;
+    pcnt_get_event_status(ENCODER_UNIT, &status);
+    // The counter is reset to 0 by hardware when it reaches a limit
+    if (status & PCNT_EVT_H_LIM) {
+        wrapped += ENCODER_LIMIT;
+    } else if (status & PCNT_EVT_L_LIM) {
+        wrapped -= ENCODER_LIMIT;
+    }
+}
+
+static bool configureChannel(pcnt_channel_t channel, int pulsePin, int ctrlPin, pcnt_count_mode_t rising,
+                             pcnt_count_mode_t falling) {
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = pulsePin;
+    config.ctrl_gpio_num = ctrlPin;
+    config.lctrl_mode = PCNT_MODE_REVERSE;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.pos_mode = rising;
+    config.neg_mode = falling;
+    config.counter_h_lim = ENCODER_LIMIT;
+    config.counter_l_lim = -ENCODER_LIMIT;
+    config.unit = ENCODER_UNIT;
+    config.channel = channel;
+    return pcnt_unit_config(&config) == ESP_OK;
+}
+
+// =====================================================================
+// Public Functions (defined in encoder.h)
+// =====================================================================
+
+bool setupEncoder() {
+    // Both channels together count every edge of A and B (x4 decoding)
+    if (!configureChannel(PCNT_CHANNEL_0, ENCODER_PIN_A, ENCODER_PIN_B, PCNT_COUNT_DEC, PCNT_COUNT_INC) ||
+        !configureChannel(PCNT_CHANNEL_1, ENCODER_PIN_B, ENCODER_PIN_A, PCNT_COUNT_INC, PCNT_COUNT_DEC)) {
+        return false;
+    }
+    pcnt_set_filter_value(ENCODER_UNIT, ENCODER_FILTER);
+    pcnt_filter_enable(ENCODER_UNIT);
+
+    pcnt_event_enable(ENCODER_UNIT, PCNT_EVT_H_LIM);
+    pcnt_event_enable(ENCODER_UNIT, PCNT_EVT_L_LIM);
+    pcnt_counter_pause(ENCODER_UNIT);
+    pcnt_counter_clear(ENCODER_UNIT);
+
+    esp_err_t err = pcnt_isr_service_install(0);
+    if ((err != ESP_OK && err != ESP_ERR_INVALID_STATE) ||
+        pcnt_isr_handler_add(ENCODER_UNIT, onEncoderLimit, nullptr) != ESP_OK) {
+        return false;
+    }
+    pcnt_intr_enable(ENCODER_UNIT);
+    pcnt_counter_resume(ENCODER_UNIT);
+    started = true;
+    return true;
+}
+
+int64_t encoderCount() {
+    if (!started) {
+        return 0;
+    }
+    // Retry if a wrap was accounted while reading the counter
+    int64_t before, after;
+    int16_t count = 0;
+    do {
+        before = wrapped;
+        pcnt_get_counter_value(ENCODER_UNIT, &count);
+        after = wrapped;
+    } while (before != after);
+    return after + count;
+}
+
+#endif // TERELINA_USE_ENCODER
@@ -0,0 +1,21 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Starts counting a quadrature belt encoder on ENCODER_PIN_A/B with
+ * the PCNT peripheral (all four edges, so 4 counts per encoder line).
+ * Counter overflows are accumulated in an interrupt installed on the calling
+ * core; call from the core that reads encoderCount().
+ * @return False if the PCNT unit could not be configured.
+ */
+bool setupEncoder();
+
+/**
+ * @brief Encoder position in counts since setupEncoder() (negative when the
+ * belt runs backwards). Never wraps in practice.
+ */
+int64_t encoderCount();
+
+#endif // ENCODER_H
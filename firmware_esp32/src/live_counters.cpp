@@ -0,0 +1,58 @@
+/**
+ * @file live_counters.cpp
+ * @brief Sequence-locked counter snapshot (see live_counters.h).
+ */
+
+#include "live_counters.h"
+
+#include <string.h>
+
+static_assert(sizeof(LiveCounters) % sizeof(uint32_t) == 0, "LiveCounters must be whole words");
+
+// =====================================================================
+// Public Functions (defined in live_counters.h)
+// =====================================================================
+
+LiveCountersSeqlock::LiveCountersSeqlock() : seq_(0) {
+    for (size_t i = 0; i < WORDS; i++) {
+        words_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void LiveCountersSeqlock::publish(const LiveCounters& counters) {
+    uint32_t words[WORDS];
+    memcpy(words, &counters, sizeof(words));
+
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; i++) {
+        words_[i].store(words[i], std::memory_order_relaxed);
+    }
+    seq_.store(seq + 2, std::memory_order_release);
+}
+
+bool LiveCountersSeqlock::tryRead(LiveCounters& out) const {
+    uint32_t before = seq_.load(std::memory_order_acquire);
+    if (before & 1) {
+        return false;
+    }
+    uint32_t words[WORDS];
+    for (size_t i = 0; i < WORDS; i++) {
+        words[i] = words_[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq_.load(std::memory_order_relaxed) != before) {
+        return false;
+    }
+    memcpy(&out, words, sizeof(words));
+    return true;
+}
+
+uint32_t LiveCountersSeqlock::read(LiveCounters& out) const {
+    uint32_t retries = 0;
+    while (!tryRead(out)) {
+        retries++;
+    }
+    return retries;
+}
@@ -0,0 +1,62 @@
+#ifndef LIVE_COUNTERS_H
+#define LIVE_COUNTERS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Plain C++ only (no Arduino headers): this module is also compiled on the
+// host by tools/modbus_host.cpp.
+
+/**
+ * @brief Counters of the sensing task, as seen by readers outside it.
+ */
+struct LiveCounters {
+    uint32_t products;      // interrupted -> clear changes since boot
+    uint32_t glitches;      // Excursions shorter than the debounce, as of the last change
+    uint32_t dropped;       // Changes lost to a full event queue
+    uint32_t lastChangeMs;  // millis() at the first edge of the last change
+    uint32_t lastDwellMs;
+    uint32_t lastGapMs;
+    uint32_t updates;       // +1 on every publish()
+    uint32_t interrupted;   // Debounced state: 1 interrupted
+};
+
+/**
+ * @brief Single-writer snapshot of LiveCounters (sequence lock).
+ *
+ * The writer never waits: publish() bumps the sequence to odd, stores the
+ * words and bumps it to even again. A reader copies the words between two
+ * loads of the sequence and retries if they differ or the first was odd, so
+ * a reader preempted or running on the other core never sees a torn copy and
+ * never holds up the writer.
+ */
+class LiveCountersSeqlock {
+public:
+    LiveCountersSeqlock();
+
+    /**
+     * @brief Stores a new snapshot. Only one task may call this.
+     */
+    void publish(const LiveCounters& counters);
+
+    /**
+     * @brief One read attempt.
+     * @return False if a publish() overlapped it (out is then unchanged).
+     */
+    bool tryRead(LiveCounters& out) const;
+
+    /**
+     * @brief Reads a consistent snapshot, retrying while publish() overlaps.
+     * @return The number of retries.
+     */
+    uint32_t read(LiveCounters& out) const;
+
+private:
+    static constexpr size_t WORDS = sizeof(LiveCounters) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> seq_;
+    std::atomic<uint32_t> words_[WORDS];
+};
+
+#endif // LIVE_COUNTERS_H
@@ -0,0 +1,216 @@
+/**
+ * @file modbus_server.cpp
+ * @brief Modbus TCP server for the line PLCs (see modbus_server.h).
+ *
+ * Enabled with -DTERELINA_USE_MODBUS. Runs in the main loop next to MQTT:
+ * each call reads whatever bytes have arrived, answers every complete frame
+ * from a fresh counter snapshot, and returns. Nothing here takes a lock the
+ * sensing task could wait on; the snapshot is a sequence lock that only the
+ * reader ever retries. A PLC talking to the device directly sees the count
+ * within one loop iteration, without the broker and backend in between.
+ */
+
+#include "modbus_server.h"
+
+#ifdef TERELINA_USE_MODBUS
+
+#include "config.h"
+#include "modbus_tcp.h"
+#include "mqtt.h"
+#include "sensing.h"
+#include "timesync.h"
+#include "wifi_manager.h"
+#include <WiFi.h>
+#include <WiFiClient.h>
+#include <WiFiServer.h>
+
+// =====================================================================
+// Settings and State
+// =====================================================================
+static constexpr size_t MODBUS_MAX_CLIENTS = 3;
+
+struct ModbusConnection {
+    WiFiClient socket;
+    bool       open;
+    uint8_t    rx[MODBUS_MAX_ADU];
+    size_t     rxLength;
+    uint32_t   lastRequestMs;
+};
+
+struct ModbusStats {
+    uint32_t requests;
+    uint32_t exceptions;
+    uint32_t malformed;      // Bad MBAP headers (connection closed)
+    uint32_t rejected;       // Connections refused: all slots busy
+    uint32_t timeouts;       // Connections closed after MODBUS_IDLE_TIMEOUT_MS
+    uint32_t retries;        // Snapshot reads that overlapped a publish
+    uint32_t lastServiceUs;  // Frame received -> response written
+    uint32_t maxServiceUs;
+};
+
+static WiFiServer server(MODBUS_TCP_PORT);
+static bool listening = false;
+static ModbusConnection connections[MODBUS_MAX_CLIENTS];
+static ModbusStats stats = {};
+static ThroughputWindow throughput;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static void buildRegisters(uint16_t* regs) {
+    LiveCounters counters;
+    stats.retries += sensingCounters(counters);
+
+    ModbusHealth health;
+    health.flags = 0;
+    if (isWifiConnected()) health.flags |= MB_HEALTH_WIFI;
+    if (isMqttConnected()) health.flags |= MB_HEALTH_MQTT;
+    if (timesyncIsSynced()) health.flags |= MB_HEALTH_CLOCK;
+    health.rssi = isWifiConnected() ? (int8_t)WiFi.RSSI() : 0;
+    health.uptimeS = millis() / 1000;
+
+    modbusFillRegisters(regs, counters, throughput.perMinuteX10(), health, millis());
+}
+
+static void closeConnection(ModbusConnection& c) {
+    c.socket.stop();
+    c.open = false;
+    c.rxLength = 0;
+}
+
+static void acceptConnections() {
+    while (server.hasClient()) {
+        WiFiClient incoming = server.available();
+        ModbusConnection* slot = nullptr;
+        for (ModbusConnection& c : connections) {
+            if (!c.open) {
+                slot = &c;
+                break;
+            }
+        }
+        if (!slot) {
+            stats.rejected++;
+            incoming.stop();
+            continue;
+        }
+        slot->socket = incoming;
+        slot->socket.setNoDelay(true);  // One small response per request: do not wait for Nagle
+        slot->open = true;
+        slot->rxLength = 0;
+        slot->lastRequestMs = millis();
+    }
+}
+
+/**
+ * @brief Reads what has arrived on a connection and answers complete frames.
+ */
+static void serveConnection(ModbusConnection& c) {
+    if (!c.socket.connected()) {
+        closeConnection(c);
+        return;
+    }
+    int available = c.socket.available();
+    while (available > 0) {
+        size_t room = sizeof(c.rx) - c.rxLength;
+        int n = c.socket.read(c.rx + c.rxLength, (size_t)available < room ? (size_t)available : room);
+        if (n <= 0) {
+            break;
+        }
+        c.rxLength += n;
+        available -= n;
+
+        for (;;) {
+            size_t frame = modbusFrameLength(c.rx, c.rxLength);
+            if (frame == 0) {
+                break;
+            }
+            if (frame == SIZE_MAX) {
+                stats.malformed++;
+                closeConnection(c);
+                return;
+            }
+            uint32_t start = micros();
+            uint16_t regs[MB_REG_COUNT];
+            uint8_t response[MODBUS_MAX_ADU];
+            buildRegisters(regs);
+            size_t length = modbusHandleFrame(c.rx, frame, regs, MB_REG_COUNT, response);
+            if (length == 0) {
+                stats.malformed++;
+                closeConnection(c);
+                return;
+            }
+            c.socket.write(response, length);
+            stats.requests++;
+            if (response[7] & 0x80) {
+                stats.exceptions++;
+            }
+            stats.lastServiceUs = micros() - start;
+            if (stats.lastServiceUs > stats.maxServiceUs) stats.maxServiceUs = stats.lastServiceUs;
+            c.lastRequestMs = millis();
+
+            memmove(c.rx, c.rx + frame, c.rxLength - frame);
+            c.rxLength -= frame;
+        }
+    }
+    if (millis() - c.lastRequestMs > MODBUS_IDLE_TIMEOUT_MS) {
+        stats.timeouts++;
+        closeConnection(c);
+    }
+}
+
+// =====================================================================
+// Public Functions (defined in modbus_server.h)
+// =====================================================================
+
+void setupModbus() {
+    Serial.printf("[Modbus] TCP server on port %u (starts with WiFi).\n", (unsigned)MODBUS_TCP_PORT);
+}
+
+void handleModbus() {
+    // Throughput from the sensing snapshot, whether or not anyone polls
+    LiveCounters counters;
+    sensingCounters(counters);
+    throughput.sample(millis(), counters.products);
+
+    if (!isWifiConnected()) {
+        return;
+    }
+    if (!listening) {
+        server.begin();
+        server.setNoDelay(true);
+        listening = true;
+    }
+    acceptConnections();
+    for (ModbusConnection& c : connections) {
+        if (c.open) {
+            serveConnection(c);
+        }
+    }
+}
+
+void modbusStatus(CommandReplyFn reply) {
+    char line[160];
+    size_t open = 0;
+    for (const ModbusConnection& c : connections) {
+        if (c.open) open++;
+    }
+    snprintf(line, sizeof(line),
+             "MODBUS port=%u clients=%u requests=%lu exceptions=%lu malformed=%lu rejected=%lu timeouts=%lu",
+             (unsigned)MODBUS_TCP_PORT, (unsigned)open, (unsigned long)stats.requests,
+             (unsigned long)stats.exceptions, (unsigned long)stats.malformed, (unsigned long)stats.rejected,
+             (unsigned long)stats.timeouts);
+    reply(line);
+    snprintf(line, sizeof(line), "MODBUS service_us last=%lu max=%lu snapshot_retries=%lu throughput_x10=%u",
+             (unsigned long)stats.lastServiceUs, (unsigned long)stats.maxServiceUs, (unsigned long)stats.retries,
+             (unsigned)throughput.perMinuteX10());
+    reply(line);
+}
+
+#else
+
+void modbusStatus(CommandReplyFn reply) {
+    reply("MODBUS server needs a build with TERELINA_USE_MODBUS");
+}
+
+#endif // TERELINA_USE_MODBUS
@@ -0,0 +1,26 @@
+#ifndef MODBUS_SERVER_H
+#define MODBUS_SERVER_H
+
+#include <Arduino.h>
+#include "commands.h"
+
+/**
+ * @brief Serves the live counters to PLCs over Modbus TCP on MODBUS_TCP_PORT
+ * (register map in modbus_tcp.h). Registers come from the sensing task's
+ * snapshot, so polling never waits on, or delays, sensing.
+ * Only built with TERELINA_USE_MODBUS.
+ */
+void setupModbus();
+
+/**
+ * @brief Accepts connections and answers complete requests. Non-blocking.
+ * Starts listening once WiFi is up. Call this in every main loop() iteration.
+ */
+void handleModbus();
+
+/**
+ * @brief Writes clients, request and exception counts, and service times.
+ */
+void modbusStatus(CommandReplyFn reply);
+
+#endif // MODBUS_SERVER_H
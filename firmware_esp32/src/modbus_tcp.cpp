@@ -0,0 +1,147 @@
+/**
+ * @file modbus_tcp.cpp
+ * @brief Modbus TCP framing and the counter register map (see modbus_tcp.h).
+ *
+ * A frame is the 7-byte MBAP header (transaction id, protocol id 0, length
+ * of what follows, unit id) and the PDU (function code and data). Only the
+ * two read functions are implemented; the register image is built once per
+ * request from a snapshot, so a PLC never sees a product count and a state
+ * from two different moments.
+ */
+
+#include "modbus_tcp.h"
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+static const size_t   MBAP_BYTES    = 7;
+static const uint16_t MAX_READ_REGS = 125;
+
+static inline uint16_t be16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void putBe16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void putU32(uint16_t* regs, uint16_t hi, uint32_t v) {
+    regs[hi] = (uint16_t)(v >> 16);
+    regs[hi + 1] = (uint16_t)v;
+}
+
+static inline uint16_t saturate16(uint32_t v) {
+    return v > 0xFFFF ? 0xFFFF : (uint16_t)v;
+}
+
+/**
+ * @brief Writes the MBAP header for a PDU of pduBytes; returns the frame length.
+ */
+static size_t finishFrame(const uint8_t* request, uint8_t* response, size_t pduBytes) {
+    response[0] = request[0];  // Transaction id
+    response[1] = request[1];
+    putBe16(response + 2, 0);
+    putBe16(response + 4, (uint16_t)(pduBytes + 1));
+    response[6] = request[6];  // Unit id
+    return MBAP_BYTES + pduBytes;
+}
+
+static size_t exceptionFrame(const uint8_t* request, uint8_t* response, uint8_t function, uint8_t code) {
+    response[MBAP_BYTES] = (uint8_t)(function | 0x80);
+    response[MBAP_BYTES + 1] = code;
+    return finishFrame(request, response, 2);
+}
+
+// =====================================================================
+// Public Functions (defined in modbus_tcp.h)
+// =====================================================================
+
+void ThroughputWindow::sample(uint32_t nowMs, uint32_t products) {
+    lastMs_ = nowMs;
+    lastProducts_ = products;
+    if (count_ > 0 && nowMs - slotMs_[head_] < 1000) {
+        return;
+    }
+    head_ = count_ == 0 ? 0 : (uint8_t)((head_ + 1) % SLOTS);
+    slotMs_[head_] = nowMs;
+    slotProducts_[head_] = products;
+    if (count_ < SLOTS) {
+        count_++;
+    }
+}
+
+uint16_t ThroughputWindow::perMinuteX10() const {
+    if (count_ == 0) {
+        return 0;
+    }
+    uint8_t oldest = (uint8_t)((head_ + SLOTS - (count_ - 1)) % SLOTS);
+    uint32_t elapsedMs = lastMs_ - slotMs_[oldest];
+    if (elapsedMs < 1000) {
+        return 0;
+    }
+    uint64_t rate = (uint64_t)(lastProducts_ - slotProducts_[oldest]) * 600000ULL / elapsedMs;
+    return rate > 0xFFFF ? 0xFFFF : (uint16_t)rate;
+}
+
+void modbusFillRegisters(uint16_t* regs, const LiveCounters& counters, uint16_t throughputX10,
+                         const ModbusHealth& health, uint32_t nowMs) {
+    putU32(regs, MB_REG_PRODUCTS_HI, counters.products);
+    regs[MB_REG_STATE] = counters.interrupted ? 1 : 0;
+    regs[MB_REG_THROUGHPUT] = throughputX10;
+    putU32(regs, MB_REG_GLITCHES_HI, counters.glitches);
+    putU32(regs, MB_REG_SINCE_CHANGE_HI, counters.updates ? nowMs - counters.lastChangeMs : 0);
+    regs[MB_REG_LAST_DWELL_MS] = saturate16(counters.lastDwellMs);
+    regs[MB_REG_LAST_GAP_MS] = saturate16(counters.lastGapMs);
+    regs[MB_REG_HEALTH] = health.flags;
+    regs[MB_REG_RSSI] = (uint16_t)(int16_t)health.rssi;
+    putU32(regs, MB_REG_UPTIME_HI, health.uptimeS);
+    putU32(regs, MB_REG_DROPPED_HI, counters.dropped);
+    regs[MB_REG_SEQUENCE] = (uint16_t)counters.updates;
+}
+
+size_t modbusFrameLength(const uint8_t* buf, size_t length) {
+    if (length < MBAP_BYTES) {
+        return 0;
+    }
+    uint16_t following = be16(buf + 4);  // Unit id + PDU
+    if (be16(buf + 2) != 0 || following < 2 || MBAP_BYTES - 1 + following > MODBUS_MAX_ADU) {
+        return SIZE_MAX;
+    }
+    size_t frame = MBAP_BYTES - 1 + following;
+    return length >= frame ? frame : 0;
+}
+
+size_t modbusHandleFrame(const uint8_t* frame, size_t length, const uint16_t* regs, size_t regCount,
+                         uint8_t* response) {
+    size_t expected = modbusFrameLength(frame, length);
+    if (expected == 0 || expected == SIZE_MAX || expected != length) {
+        return 0;
+    }
+    const uint8_t* pdu = frame + MBAP_BYTES;
+    size_t pduBytes = length - MBAP_BYTES;
+    uint8_t function = pdu[0];
+
+    if (function != 0x03 && function != 0x04) {
+        return exceptionFrame(frame, response, function, MB_EX_ILLEGAL_FUNCTION);
+    }
+    if (pduBytes != 5) {
+        return exceptionFrame(frame, response, function, MB_EX_ILLEGAL_VALUE);
+    }
+    uint16_t address = be16(pdu + 1);
+    uint16_t quantity = be16(pdu + 3);
+    if (quantity == 0 || quantity > MAX_READ_REGS) {
+        return exceptionFrame(frame, response, function, MB_EX_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)address + quantity > regCount) {
+        return exceptionFrame(frame, response, function, MB_EX_ILLEGAL_ADDRESS);
+    }
+
+    uint8_t* out = response + MBAP_BYTES;
+    out[0] = function;
+    out[1] = (uint8_t)(quantity * 2);
+    for (uint16_t i = 0; i < quantity; i++) {
+        putBe16(out + 2 + i * 2, regs[address + i]);
+    }
+    return finishFrame(frame, response, 2 + quantity * 2);
+}
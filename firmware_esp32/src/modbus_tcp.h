@@ -0,0 +1,107 @@
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "live_counters.h"
+
+// Plain C++ only (no Arduino headers): this module is also compiled on the
+// host by tools/modbus_host.cpp, which serves the same frames over POSIX sockets.
+
+/**
+ * @brief Register map, served identically as input registers (function 04)
+ * and holding registers (function 03); all read-only. 32-bit values take two
+ * registers, high word first.
+ */
+enum ModbusRegister : uint16_t {
+    MB_REG_PRODUCTS_HI = 0,   // Products counted since boot
+    MB_REG_PRODUCTS_LO,
+    MB_REG_STATE,             // 1 = beam interrupted
+    MB_REG_THROUGHPUT,        // Products per minute x 10, over the last 60 s
+    MB_REG_GLITCHES_HI,
+    MB_REG_GLITCHES_LO,
+    MB_REG_SINCE_CHANGE_HI,   // ms since the last state change
+    MB_REG_SINCE_CHANGE_LO,
+    MB_REG_LAST_DWELL_MS,     // Saturate at 65535
+    MB_REG_LAST_GAP_MS,
+    MB_REG_HEALTH,            // ModbusHealthFlag bits
+    MB_REG_RSSI,              // dBm, signed
+    MB_REG_UPTIME_HI,         // Seconds
+    MB_REG_UPTIME_LO,
+    MB_REG_DROPPED_HI,        // Sensing events lost to a full queue
+    MB_REG_DROPPED_LO,
+    MB_REG_SEQUENCE,          // +1 on every sensor snapshot (low 16 bits)
+    MB_REG_COUNT,
+};
+
+enum ModbusHealthFlag : uint16_t {
+    MB_HEALTH_WIFI   = 1 << 0,
+    MB_HEALTH_MQTT   = 1 << 1,
+    MB_HEALTH_CLOCK  = 1 << 2,  // Clock synced with the backend
+};
+
+enum ModbusException : uint8_t {
+    MB_EX_ILLEGAL_FUNCTION = 0x01,
+    MB_EX_ILLEGAL_ADDRESS  = 0x02,
+    MB_EX_ILLEGAL_VALUE    = 0x03,
+};
+
+static const size_t MODBUS_MAX_ADU = 260;  // MBAP header (7) + PDU (253)
+
+/**
+ * @brief Device state that is not kept by the sensing task.
+ */
+struct ModbusHealth {
+    uint16_t flags;         // ModbusHealthFlag bits
+    int8_t   rssi;
+    uint32_t uptimeS;
+};
+
+/**
+ * @brief Products per minute over a sliding 60 s window of 1 s samples.
+ */
+class ThroughputWindow {
+public:
+    /**
+     * @brief Records the product count; call at least once per second.
+     */
+    void sample(uint32_t nowMs, uint32_t products);
+
+    /**
+     * @brief Products per minute x 10 (saturates at 65535); 0 before 1 s of history.
+     */
+    uint16_t perMinuteX10() const;
+
+private:
+    static const uint8_t SLOTS = 61;
+
+    uint32_t slotMs_[SLOTS];
+    uint32_t slotProducts_[SLOTS];
+    uint8_t  head_ = 0;
+    uint8_t  count_ = 0;
+    uint32_t lastMs_ = 0;
+    uint32_t lastProducts_ = 0;
+};
+
+/**
+ * @brief Fills regs[0..MB_REG_COUNT) from a counter snapshot.
+ */
+void modbusFillRegisters(uint16_t* regs, const LiveCounters& counters, uint16_t throughputX10,
+                         const ModbusHealth& health, uint32_t nowMs);
+
+/**
+ * @brief Length of the Modbus TCP frame (ADU) at the start of buf.
+ * @return 0 if more bytes are needed, SIZE_MAX if the header is invalid
+ * (the connection should be closed), otherwise the frame length.
+ */
+size_t modbusFrameLength(const uint8_t* buf, size_t length);
+
+/**
+ * @brief Answers one complete frame: functions 03 and 04 read regs, any
+ * other function gets an exception reply. The unit id is echoed.
+ * @return The response length (at most MODBUS_MAX_ADU), 0 if the frame is malformed.
+ */
+size_t modbusHandleFrame(const uint8_t* frame, size_t length, const uint16_t* regs, size_t regCount,
+                         uint8_t* response);
+
+#endif // MODBUS_TCP_H
@@ -1,37 +1,182 @@
 /**
  * @file mqtt.cpp
  * @brief Handles all MQTT communication for the Terelina project.
- * 
+ *
  * Manages connection, reconnection with Last Will and Testament (LWT),
  * and publishing of sensor data and device status.
+ *
+ * Two transports are supported. The default is MQTT over TCP (PubSubClient).
+ * Building with -DTERELINA_USE_MQTTSN switches to MQTT-SN over UDP with
+ * predefined topic ids and compact state payloads (see mqttsn.cpp).
  */
 
 #include "mqtt.h"
 #include "config.h"
+#include "commands.h"
+#include "mqttsn.h"
+#include "outbound.h"
+#include "product_log.h"
+#include "timesync.h"
 #include <Arduino.h>
 #include <WiFiClient.h>
 
 // =====================================================================
 // Global and Static Variables
 // =====================================================================
+#ifndef TERELINA_USE_MQTTSN
 WiFiClient wifiClient;
 PubSubClient mqttClient(wifiClient);
-
 static unsigned long lastMqttReconnectAttempt = 0;
 static const unsigned long RECONNECT_INTERVAL_MS = 5000; // Attempt to reconnect every 5 seconds
+#endif
+
+// Command output is batched into diagnostic messages of up to this size
+static const size_t DIAG_BATCH_SIZE = 200;
+static char diagBatch[DIAG_BATCH_SIZE + 1];
+static size_t diagBatchLength = 0;
+
+// =====================================================================
+// Transport Abstraction
+// =====================================================================
+
+#ifdef TERELINA_USE_MQTTSN
+static uint16_t topicId(MqttTopic topic) {
+  switch (topic) {
+    case TOPIC_STATE:     return MQTTSN_TOPIC_ID_STATE;
+    case TOPIC_HEARTBEAT: return MQTTSN_TOPIC_ID_HEARTBEAT;
+    case TOPIC_DIAG:      return MQTTSN_TOPIC_ID_DIAG;
+    case TOPIC_TRACE:     return MQTTSN_TOPIC_ID_TRACE;
+    case TOPIC_ALARM:     return MQTTSN_TOPIC_ID_ALARM;
+    case TOPIC_BACKLOG:   return MQTTSN_TOPIC_ID_BACKLOG;
+    case TOPIC_TIME_REQ:  return MQTTSN_TOPIC_ID_TIME_REQ;
+  }
+  return MQTTSN_TOPIC_ID_DIAG;
+}
+#else
+static const char* topicName(MqttTopic topic) {
+  switch (topic) {
+    case TOPIC_STATE:     return MQTT_TOPIC_STATE;
+    case TOPIC_HEARTBEAT: return MQTT_TOPIC_HEARTBEAT;
+    case TOPIC_DIAG:      return MQTT_TOPIC_DIAG;
+    case TOPIC_TRACE:     return MQTT_TOPIC_TRACE;
+    case TOPIC_ALARM:     return MQTT_TOPIC_ALARM;
+    case TOPIC_BACKLOG:   return MQTT_TOPIC_BACKLOG;
+    case TOPIC_TIME_REQ:  return MQTT_TOPIC_TIME_REQ;
+  }
+  return MQTT_TOPIC_DIAG;
+}
+#endif
+
+bool mqttPublish(MqttTopic topic, const uint8_t* payload, size_t length, bool retain) {
+#ifdef TERELINA_USE_MQTTSN
+  return mqttSnPublish(topicId(topic), payload, length, retain);
+#else
+  return mqttClient.publish(topicName(topic), payload, length, retain);
+#endif
+}
+
+// =====================================================================
+// Command Channel
+// =====================================================================
+
+static void flushDiagBatch() {
+  if (diagBatchLength == 0) {
+    return;
+  }
+  // Command output is telemetry: it only uses capacity left over by counts.
+  // A long output (e.g. "prof dump") that fills the queue is flushed now.
+  if (!outboundEnqueue(CLASS_TELEMETRY, TOPIC_DIAG, (const uint8_t*)diagBatch, diagBatchLength)) {
+    outboundFlush(CLASS_TELEMETRY);
+    if (!outboundEnqueue(CLASS_TELEMETRY, TOPIC_DIAG, (const uint8_t*)diagBatch, diagBatchLength)) {
+      Serial.println(F("[MQTT] Failed to queue diagnostic output."));
+    }
+  }
+  diagBatchLength = 0;
+}
+
+static void mqttReply(const char* line) {
+  size_t len = strlen(line);
+  if (diagBatchLength > 0 && diagBatchLength + 1 + len > DIAG_BATCH_SIZE) {
+    flushDiagBatch();
+  }
+  if (len > DIAG_BATCH_SIZE) {
+    len = DIAG_BATCH_SIZE; // Truncate oversized lines rather than drop them
+  }
+  if (diagBatchLength > 0) {
+    diagBatch[diagBatchLength++] = '\n';
+  }
+  memcpy(diagBatch + diagBatchLength, line, len);
+  diagBatchLength += len;
+}
+
+static void executeCommand(const uint8_t* payload, size_t length) {
+  // Copy out of the transport's receive buffer: replies are published through it.
+  char command[64];
+  size_t len = length < sizeof(command) - 1 ? length : sizeof(command) - 1;
+  memcpy(command, payload, len);
+  command[len] = '\0';
+
+  Serial.print(F("[MQTT] Command received: "));
+  Serial.println(command);
+  handleCommandLine(command, mqttReply);
+  flushDiagBatch();
+}
+
+#ifdef TERELINA_USE_MQTTSN
+static void onMqttSnMessage(uint16_t topic, const uint8_t* payload, size_t length) {
+  if (topic == MQTTSN_TOPIC_ID_TIME_RESP) {
+    timesyncHandleResponse(payload, length);
+  } else if (topic == MQTTSN_TOPIC_ID_COMMAND) {
+    executeCommand(payload, length);
+#ifdef TERELINA_USE_PRODUCT_LOG
+  } else if (topic == MQTTSN_TOPIC_ID_ACK) {
+    productLogHandleAck(payload, length);
+#endif
+  }
+}
+#else
+static void onMqttMessage(char* topic, byte* payload, unsigned int length) {
+  if (strcmp(topic, MQTT_TOPIC_TIME_RESP) == 0) {
+    timesyncHandleResponse(payload, length);
+  } else if (strcmp(topic, MQTT_TOPIC_COMMAND) == 0) {
+    executeCommand(payload, length);
+#ifdef TERELINA_USE_PRODUCT_LOG
+  } else if (strcmp(topic, MQTT_TOPIC_ACK) == 0) {
+    productLogHandleAck(payload, length);
+#endif
+  }
+}
+#endif
 
 // =====================================================================
 // Core MQTT Functions (Initialization and Loop)
 // =====================================================================
 
 void setupMqtt() {
+#ifdef TERELINA_USE_MQTTSN
+  setupMqttSn(onMqttSnMessage);
+#else
   mqttClient.setServer(MQTT_BROKER_HOST, MQTT_BROKER_PORT);
-  mqttClient.setBufferSize(256); // A buffer of 256 bytes is sufficient for our JSON payload
+  mqttClient.setBufferSize(448); // Fits the largest state payload (light-curtain shape, belt stamp and log number)
   mqttClient.setKeepAlive(30);   // More resilient to network fluctuations
   mqttClient.setSocketTimeout(5); // Prevent long blocking calls
+  mqttClient.setCallback(onMqttMessage);
+#endif
 }
 
 void handleMqttConnection() {
+#ifdef TERELINA_USE_MQTTSN
+  // Connection, keep-alive and incoming datagrams are all handled here.
+  if (handleMqttSnConnection()) {
+    mqttSnSubscribe(MQTTSN_TOPIC_ID_COMMAND);
+    mqttSnSubscribe(MQTTSN_TOPIC_ID_TIME_RESP);
+#ifdef TERELINA_USE_PRODUCT_LOG
+    mqttSnSubscribe(MQTTSN_TOPIC_ID_ACK);
+    productLogOnConnect();
+#endif
+    publishHeartbeat();
+  }
+#else
   if (mqttClient.connected()) {
     return;
   }
@@ -68,6 +213,13 @@ void handleMqttConnection() {
 
   if (connected) {
     Serial.println(F("OK!"));
+    mqttClient.subscribe(MQTT_TOPIC_COMMAND);
+    mqttClient.subscribe(MQTT_TOPIC_TIME_RESP);
+#ifdef TERELINA_USE_PRODUCT_LOG
+    // The backend's acknowledgment is retained: it arrives right after this
+    mqttClient.subscribe(MQTT_TOPIC_ACK, 1);
+    productLogOnConnect();
+#endif
     // Once connected, publish the "online" status to the same heartbeat topic
     publishHeartbeat();
   } else {
@@ -75,53 +227,236 @@ void handleMqttConnection() {
     Serial.print(mqttClient.state());
     Serial.println(F(". Retrying in 5 seconds."));
   }
+#endif
 }
 
 void loopMqtt() {
+#ifndef TERELINA_USE_MQTTSN
   mqttClient.loop();
+#endif
 }
 
 // =====================================================================
 // Data Publishing Functions
 // =====================================================================
 
-void publishSensorState(bool isInterrupted) {
-  if (!isMqttConnected()) {
-    Serial.println(F("[MQTT] Not connected. Cannot publish sensor state."));
-    return;
+void publishSensorState(bool isInterrupted, uint32_t eventMs, const ProductShape* shape, const BeltStamp* belt,
+                        uint32_t logN) {
+  int8_t rssi = WiFi.status() == WL_CONNECTED ? (int8_t)WiFi.RSSI() : 0;
+  outboundEnqueueState(isInterrupted, rssi, millis() / 1000, eventMs, shape, belt, logN);
+}
+
+#ifdef TERELINA_USE_MQTTSN
+/**
+ * @brief Appends ";<w_mm>,<len_mm>,<x_mm>,<pieces>,<fill>,<peak>,<flags>" to a compact payload.
+ */
+static int appendCompactShape(char* buffer, size_t size, int n, const ProductShape& shape) {
+  if (n < 0 || (size_t)n >= size) {
+    return n;
   }
+  return n + snprintf(buffer + n, size - n, ";%u,%u,%d,%u,%u,%u,%u", shape.widthMm, shape.lengthMm,
+                      shape.centerMm, shape.pieces, shape.fillPct, shape.peakPct, shape.flags);
+}
 
-  StaticJsonDocument<128> doc;
+/**
+ * @brief Appends ";[<shape>];<pos_mm>,<mm_s>,<len_mm>,<gap_mm>" (the shape section may be empty).
+ */
+static int appendCompactBelt(char* buffer, size_t size, int n, bool hasShape, const BeltStamp& belt) {
+  if (!hasShape && n >= 0 && (size_t)n < size) {
+    n += snprintf(buffer + n, size - n, ";");
+  }
+  if (n < 0 || (size_t)n >= size) {
+    return n;
+  }
+  return n + snprintf(buffer + n, size - n, ";%lu,%d,%u,%lu", (unsigned long)belt.posMm, belt.speedMmPerS,
+                      belt.lengthMm, (unsigned long)belt.gapMm);
+}
+
+/**
+ * @brief Appends ";[<shape>];[<belt>];<epoch>,<n>,<first>" (the shape and belt sections may be empty).
+ */
+static int appendCompactLog(char* buffer, size_t size, int n, bool hasShape, bool hasBelt, uint32_t logN) {
+  if (n < 0 || (size_t)n >= size) {
+    return n;
+  }
+  return n + snprintf(buffer + n, size - n, "%s%s;%lu,%lu,%lu", hasShape ? "" : ";", hasBelt ? "" : ";",
+                      (unsigned long)productLogEpoch(), (unsigned long)logN, (unsigned long)productLogFirst());
+}
+#else
+/**
+ * @brief Adds the light-curtain profile of a product as a nested "shape" object.
+ */
+static void addShape(JsonDocument& doc, const ProductShape& shape) {
+  JsonObject obj = doc.createNestedObject("shape");
+  obj["w_mm"] = shape.widthMm;
+  obj["len_mm"] = shape.lengthMm;
+  obj["x_mm"] = shape.centerMm;
+  obj["pieces"] = shape.pieces;
+  obj["fill"] = shape.fillPct;
+  obj["peak"] = shape.peakPct;
+  obj["flags"] = shape.flags;  // 1 broken, 2 folded, 4 at the curtain edge
+}
+
+/**
+ * @brief Adds the encoder position and measures as a nested "belt" object.
+ */
+static void addBelt(JsonDocument& doc, const BeltStamp& belt) {
+  JsonObject obj = doc.createNestedObject("belt");
+  obj["pos_mm"] = belt.posMm;
+  obj["mm_s"] = belt.speedMmPerS;
+  obj["len_mm"] = belt.lengthMm;  // 0 = unknown (and on "interrupted")
+  obj["gap_mm"] = belt.gapMm;     // 0 = unknown
+}
+
+/**
+ * @brief Adds the durable log number as a nested "log" object, acknowledged by the backend.
+ * "first" is the oldest number still in flash: older unacknowledged ones were dropped.
+ */
+static void addLog(JsonDocument& doc, uint32_t logN) {
+  JsonObject obj = doc.createNestedObject("log");
+  obj["epoch"] = productLogEpoch();
+  obj["n"] = logN;
+  obj["first"] = productLogFirst();
+}
+#endif
+
+size_t formatSensorState(char* buffer, size_t size, const StateRecord& record, uint32_t ageMs) {
+#ifdef TERELINA_USE_MQTTSN
+  // Compact payload: "<id>,<i|c>,<rssi>,<uptime_s>,<seq>,<age_ms>[,<ts>]" (~40 bytes instead of ~110)
+  int n = snprintf(buffer, size, "%s,%c,%d,%lu,%lu,%lu", MQTT_CLIENT_ID, record.interrupted ? 'i' : 'c',
+                   (int)record.rssi, (unsigned long)record.uptimeS, (unsigned long)record.seq,
+                   (unsigned long)ageMs);
+  if (n > 0 && (size_t)n < size && timesyncIsSynced()) {
+    n += snprintf(buffer + n, size - n, ",%lld", (long long)(timesyncUnixMs() - ageMs));
+  }
+  if (record.hasShape) {
+    n = appendCompactShape(buffer, size, n, record.shape);
+  }
+  if (record.hasBelt) {
+    n = appendCompactBelt(buffer, size, n, record.hasShape, record.belt);
+  }
+  if (record.logN) {
+    n = appendCompactLog(buffer, size, n, record.hasShape, record.hasBelt, record.logN);
+  }
+  return n < 0 ? 0 : ((size_t)n < size ? (size_t)n : size - 1);
+#else
+  StaticJsonDocument<512> doc;
   doc["id"] = MQTT_CLIENT_ID;
-  
+
   // --- PAYLOAD ALIGNMENT ---
   // The backend expects "interrupted" or "clear".
-  doc["state"] = isInterrupted ? "interrupted" : "clear";
-  
+  doc["state"] = record.interrupted ? "interrupted" : "clear";
+
   // Optional diagnostic data
-  doc["rssi"] = WiFi.RSSI();
-  doc["uptime_s"] = millis() / 1000;
+  doc["rssi"] = record.rssi;
+  doc["uptime_s"] = record.uptimeS;
 
-  char jsonBuffer[128];
-  serializeJson(doc, jsonBuffer);
+  // Ordering and timing: the event happened age_ms before this message was sent
+  doc["seq"] = record.seq;
+  doc["age_ms"] = ageMs;
+  // Event time on the backend's clock, once the clock sync has converged
+  if (timesyncIsSynced()) {
+    doc["ts"] = timesyncUnixMs() - ageMs;
+  }
+  if (record.hasShape) {
+    addShape(doc, record.shape);
+  }
+  if (record.hasBelt) {
+    addBelt(doc, record.belt);
+  }
+  if (record.logN) {
+    addLog(doc, record.logN);
+  }
 
-  if (mqttClient.publish(MQTT_TOPIC_STATE, jsonBuffer)) {
-    Serial.print(F("[MQTT] State published: "));
-    Serial.println(jsonBuffer);
-  } else {
-    Serial.println(F("[MQTT] Failed to publish state."));
+  return serializeJson(doc, buffer, size);
+#endif
+}
+
+size_t formatBacklogProduct(char* buffer, size_t size, const ProductRecord& record, uint32_t ageMs) {
+#ifdef TERELINA_USE_MQTTSN
+  int n = snprintf(buffer, size, "%s,%lu,%lu,%lu", MQTT_CLIENT_ID, (unsigned long)record.seq,
+                   (unsigned long)ageMs, (unsigned long)record.dwellMs);
+  if (n > 0 && (size_t)n < size && record.eventUnixMs != 0) {
+    n += snprintf(buffer + n, size - n, ",%lld", (long long)record.eventUnixMs);
+  } else if (n > 0 && (size_t)n < size && timesyncIsSynced()) {
+    n += snprintf(buffer + n, size - n, ",%lld", (long long)(timesyncUnixMs() - ageMs));
+  }
+  if (record.hasShape) {
+    n = appendCompactShape(buffer, size, n, record.shape);
+  }
+  if (record.hasBelt) {
+    n = appendCompactBelt(buffer, size, n, record.hasShape, record.belt);
+  }
+  if (record.logN) {
+    n = appendCompactLog(buffer, size, n, record.hasShape, record.hasBelt, record.logN);
+  }
+  return n < 0 ? 0 : ((size_t)n < size ? (size_t)n : size - 1);
+#else
+  StaticJsonDocument<448> doc;
+  doc["id"] = MQTT_CLIENT_ID;
+  doc["seq"] = record.seq;
+  doc["age_ms"] = ageMs;      // Time since the beam cleared
+  doc["dwell_ms"] = record.dwellMs;
+  if (record.eventUnixMs != 0) {
+    doc["ts"] = record.eventUnixMs;  // Replayed from before a reboot: age_ms is meaningless
+  } else if (timesyncIsSynced()) {
+    doc["ts"] = timesyncUnixMs() - ageMs;
   }
+  if (record.hasShape) {
+    addShape(doc, record.shape);
+  }
+  if (record.hasBelt) {
+    addBelt(doc, record.belt);
+  }
+  if (record.logN) {
+    addLog(doc, record.logN);
+  }
+  return serializeJson(doc, buffer, size);
+#endif
 }
 
 void publishHeartbeat() {
   if (!isMqttConnected()) {
     return;
   }
-  // The heartbeat is a simple "online" message, retained by the broker.
-  if (mqttClient.publish(MQTT_TOPIC_HEARTBEAT, "online", true)) {
-    Serial.println(F("[MQTT] Heartbeat 'online' published."));
+  // Retained by the broker until the next one, or until the "offline" Last Will
+  int8_t rssi = WiFi.status() == WL_CONNECTED ? (int8_t)WiFi.RSSI() : 0;
+  char payload[160];
+#ifdef TERELINA_USE_MQTTSN
+  int n = snprintf(payload, sizeof(payload), "%s,online,%d,%lu,%lu,%u,%u", MQTT_CLIENT_ID, rssi,
+                   (unsigned long)(millis() / 1000), (unsigned long)ESP.getFreeHeap(), CONFIG_VERSION,
+                   (unsigned)outboundQueuedCount());
+  size_t length = n < 0 ? 0 : ((size_t)n < sizeof(payload) ? (size_t)n : sizeof(payload) - 1);
+#else
+  StaticJsonDocument<192> doc;
+  doc["id"] = MQTT_CLIENT_ID;
+  doc["status"] = "online";
+  doc["rssi"] = rssi;
+  doc["uptime_s"] = millis() / 1000;
+  doc["heap"] = ESP.getFreeHeap();
+  doc["cfg"] = CONFIG_VERSION;
+  doc["queue"] = outboundQueuedCount();
+  size_t length = serializeJson(doc, payload, sizeof(payload));
+#endif
+  if (!outboundEnqueue(CLASS_HEARTBEAT, TOPIC_HEARTBEAT, (const uint8_t*)payload, length, true)) {
+    Serial.println(F("[MQTT] Failed to queue heartbeat."));
+  }
+}
+
+void publishAlarm(const char* kind, bool active, uint32_t durationMs) {
+  char payload[128];
+  StaticJsonDocument<128> doc;
+  doc["id"] = MQTT_CLIENT_ID;
+  doc["alarm"] = kind;
+  doc["active"] = active;
+  doc["duration_ms"] = durationMs;
+  size_t length = serializeJson(doc, payload, sizeof(payload));
+
+  if (outboundEnqueue(CLASS_ALARM, TOPIC_ALARM, (const uint8_t*)payload, length)) {
+    Serial.print(F("[MQTT] Alarm queued: "));
+    Serial.println(payload);
   } else {
-    Serial.println(F("[MQTT] Failed to publish heartbeat."));
+    Serial.println(F("[MQTT] Alarm queue full, alarm dropped."));
   }
 }
 
@@ -130,5 +465,9 @@ void publishHeartbeat() {
 // =====================================================================
 
 bool isMqttConnected() {
+#ifdef TERELINA_USE_MQTTSN
+  return isMqttSnConnected();
+#else
   return mqttClient.connected();
-}
\ No newline at end of file
+#endif
+}
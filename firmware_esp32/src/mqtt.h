@@ -5,8 +5,15 @@
 #include <WiFi.h>
 #include <ArduinoJson.h>
 
+#ifndef TERELINA_USE_MQTTSN
 // Global instance of the MQTT client, defined in mqtt.cpp
 extern PubSubClient mqttClient;
+#endif
+
+struct StateRecord;
+struct ProductRecord;
+struct ProductShape;
+struct BeltStamp;
 
 // =====================================================================
 // Core MQTT Functions (Initialization and Loop)
@@ -20,6 +27,9 @@ void setupMqtt();
 
 /**
  * @brief Handles the MQTT connection and subscription logic.
+ * On connect, subscribes to MQTT_TOPIC_COMMAND and MQTT_TOPIC_TIME_RESP
+ * (and MQTT_TOPIC_ACK with the durable product log);
+ * command output is published to MQTT_TOPIC_DIAG.
  * Call this in the main loop() to maintain the connection.
  */
 void handleMqttConnection();
@@ -29,21 +39,81 @@ void handleMqttConnection();
  */
 void loopMqtt();
 
+// =====================================================================
+// Transport Abstraction
+// =====================================================================
+
+/**
+ * @brief Logical topics published by the firmware.
+ * Mapped to MQTT_TOPIC_* names over TCP and to MQTTSN_TOPIC_ID_* predefined
+ * topic ids when built with TERELINA_USE_MQTTSN.
+ */
+enum MqttTopic {
+  TOPIC_STATE,
+  TOPIC_HEARTBEAT,
+  TOPIC_DIAG,
+  TOPIC_TRACE,
+  TOPIC_ALARM,
+  TOPIC_BACKLOG,
+  TOPIC_TIME_REQ
+};
+
+/**
+ * @brief Publishes a payload on the active transport (QoS 0).
+ * @param topic Logical topic to publish to.
+ * @param payload Bytes to publish.
+ * @param length Number of bytes in payload.
+ * @param retain Whether the broker should retain the message.
+ * @return True if the message was handed to the transport.
+ */
+bool mqttPublish(MqttTopic topic, const uint8_t* payload, size_t length, bool retain = false);
+
 // =====================================================================
 // Data Publishing Functions
 // =====================================================================
 
 /**
- * @brief Publishes the current state of the barrier sensor.
+ * @brief Queues the current state of the barrier sensor (live class of the
+ * outbound scheduler). States are kept while disconnected and sent, or
+ * replayed as backlog products, once the connection is back.
  * @param isInterrupted True if the beam is broken, false otherwise.
+ * @param eventMs When the change happened (millis), from the sensing task.
+ * @param shape Profile of the product that left (light-curtain mode), or nullptr.
+ * @param logN Durable log number of the product that left, 0 if not logged.
  */
-void publishSensorState(bool isInterrupted);
+void publishSensorState(bool isInterrupted, uint32_t eventMs, const ProductShape* shape, const BeltStamp* belt,
+                        uint32_t logN = 0);
 
 /**
- * @brief Publishes a heartbeat message to indicate the device is online.
+ * @brief Queues a retained heartbeat: the device is online, with its RSSI,
+ * uptime, free heap, CONFIG_VERSION and outbound queue depth.
  */
 void publishHeartbeat();
 
+/**
+ * @brief Queues an alarm in the highest-priority class.
+ * @param kind Alarm name, e.g. "jam".
+ * @param active True when the alarm is raised, false when it clears.
+ * @param durationMs How long the condition has lasted.
+ */
+void publishAlarm(const char* kind, bool active, uint32_t durationMs);
+
+/**
+ * @brief Serializes a queued sensor state with its queueing age.
+ * JSON over TCP; the compact "<id>,<i|c>,<rssi>,<uptime_s>,<seq>,<age_ms>[,<ts>]"
+ * form over MQTT-SN, followed by ";<shape fields>" for light-curtain products
+ * and ";<belt fields>" with an encoder, then ";<epoch>,<n>" for products in the
+ * durable log (earlier sections are then possibly empty).
+ * @return Payload length in bytes.
+ */
+size_t formatSensorState(char* buffer, size_t size, const StateRecord& record, uint32_t ageMs);
+
+/**
+ * @brief Serializes a product replayed from the backlog.
+ * @return Payload length in bytes.
+ */
+size_t formatBacklogProduct(char* buffer, size_t size, const ProductRecord& record, uint32_t ageMs);
+
 // =====================================================================
 // Status and Utility Functions
 // =====================================================================
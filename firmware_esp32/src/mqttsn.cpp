@@ -0,0 +1,284 @@
+/**
+ * @file mqttsn.cpp
+ * @brief Minimal MQTT-SN 1.2 client over UDP (QoS 0, predefined topic ids).
+ *
+ * Enabled with -DTERELINA_USE_MQTTSN. Compared with the TCP MQTT session this
+ * needs no TCP control block or PubSubClient buffer, has no head-of-line
+ * blocking on lossy links, and a state message costs a ~7-byte header plus a
+ * short text payload. A local gateway (e.g. Eclipse Paho MQTT-SN Gateway)
+ * bridges predefined topic ids to the Mosquitto broker.
+ *
+ * CONNECT sets the Will flag. The gateway then asks for the Will topic and
+ * message (WILLTOPICREQ/WILLMSGREQ) before its CONNACK, and publishes the
+ * retained "offline" heartbeat for the device when the session times out.
+ */
+
+#include "mqttsn.h"
+
+#ifdef TERELINA_USE_MQTTSN
+
+#include "config.h"
+#include <WiFi.h>
+#include <WiFiUdp.h>
+
+// =====================================================================
+// Protocol Constants
+// =====================================================================
+static constexpr uint8_t SN_CONNECT    = 0x04;
+static constexpr uint8_t SN_CONNACK    = 0x05;
+static constexpr uint8_t SN_WILLTOPICREQ = 0x06;
+static constexpr uint8_t SN_WILLTOPIC  = 0x07;
+static constexpr uint8_t SN_WILLMSGREQ = 0x08;
+static constexpr uint8_t SN_WILLMSG    = 0x09;
+static constexpr uint8_t SN_PUBLISH    = 0x0C;
+static constexpr uint8_t SN_SUBSCRIBE  = 0x12;
+static constexpr uint8_t SN_SUBACK     = 0x13;
+static constexpr uint8_t SN_PINGREQ    = 0x16;
+static constexpr uint8_t SN_PINGRESP   = 0x17;
+static constexpr uint8_t SN_DISCONNECT = 0x18;
+
+static constexpr uint8_t SN_FLAG_QOS1          = 0x20;
+static constexpr uint8_t SN_FLAG_RETAIN        = 0x10;
+static constexpr uint8_t SN_FLAG_WILL          = 0x08;
+static constexpr uint8_t SN_FLAG_CLEAN_SESSION = 0x04;
+static constexpr uint8_t SN_TOPIC_PREDEFINED   = 0x01;
+
+static constexpr uint16_t SN_KEEPALIVE_S          = 30;
+static constexpr uint32_t SN_RECONNECT_INTERVAL_MS = 5000;
+static constexpr size_t   SN_MAX_PACKET            = 256;
+
+// =====================================================================
+// Session State
+// =====================================================================
+static WiFiUDP snUdp;
+static IPAddress snGateway;
+static MqttSnMessageFn snOnMessage = nullptr;
+static bool snConnected = false;
+static bool snPingOutstanding = false;
+static uint32_t snLastConnectAttempt = 0;
+static uint32_t snLastSend = 0;
+static uint32_t snPingSentAt = 0;
+static uint16_t snNextMsgId = 1;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+/**
+ * @brief Sends one packet, prefixing the MQTT-SN length field (1 or 3 bytes).
+ */
+static bool sendPacket(const uint8_t* body, size_t bodyLength) {
+    uint8_t header[3];
+    size_t headerLength;
+    if (bodyLength + 1 <= 255) {
+        header[0] = (uint8_t)(bodyLength + 1);
+        headerLength = 1;
+    } else {
+        size_t total = bodyLength + 3;
+        header[0] = 0x01;
+        header[1] = (uint8_t)(total >> 8);
+        header[2] = (uint8_t)total;
+        headerLength = 3;
+    }
+
+    if (!snUdp.beginPacket(snGateway, MQTTSN_GATEWAY_PORT)) {
+        return false;
+    }
+    snUdp.write(header, headerLength);
+    snUdp.write(body, bodyLength);
+    bool ok = snUdp.endPacket() == 1;
+    if (ok) {
+        snLastSend = millis();
+    }
+    return ok;
+}
+
+static uint16_t nextMsgId() {
+    uint16_t id = snNextMsgId++;
+    if (snNextMsgId == 0) {
+        snNextMsgId = 1;
+    }
+    return id;
+}
+
+static void sendConnect() {
+    uint8_t body[5 + 32];
+    size_t idLength = strlen(MQTT_CLIENT_ID);
+    if (idLength > 23) {
+        idLength = 23; // MQTT-SN client ids are limited to 23 characters
+    }
+    body[0] = SN_CONNECT;
+    body[1] = SN_FLAG_CLEAN_SESSION | SN_FLAG_WILL;
+    body[2] = 0x01; // Protocol id
+    body[3] = (uint8_t)(SN_KEEPALIVE_S >> 8);
+    body[4] = (uint8_t)SN_KEEPALIVE_S;
+    memcpy(body + 5, MQTT_CLIENT_ID, idLength);
+    sendPacket(body, 5 + idLength);
+}
+
+/**
+ * @brief Answers WILLTOPICREQ: the device's own heartbeat topic, QoS 1, retained,
+ * as in the TCP build's Last Will.
+ */
+static void sendWillTopic() {
+    uint8_t body[SN_MAX_PACKET];
+    size_t topicLength = strlen(MQTT_TOPIC_HEARTBEAT);
+    if (topicLength > sizeof(body) - 2) {
+        topicLength = sizeof(body) - 2;
+    }
+    body[0] = SN_WILLTOPIC;
+    body[1] = SN_FLAG_QOS1 | SN_FLAG_RETAIN;
+    memcpy(body + 2, MQTT_TOPIC_HEARTBEAT, topicLength);
+    sendPacket(body, 2 + topicLength);
+}
+
+/**
+ * @brief Answers WILLMSGREQ with the compact "<id>,offline" heartbeat.
+ */
+static void sendWillMessage() {
+    uint8_t body[SN_MAX_PACKET];
+    body[0] = SN_WILLMSG;
+    int n = snprintf((char*)body + 1, sizeof(body) - 1, "%s,offline", MQTT_CLIENT_ID);
+    size_t length = n < 0 ? 0 : ((size_t)n < sizeof(body) - 1 ? (size_t)n : sizeof(body) - 2);
+    sendPacket(body, 1 + length);
+}
+
+static void handlePacket(const uint8_t* packet, size_t length) {
+    size_t offset = 1;
+    if (length >= 3 && packet[0] == 0x01) {
+        offset = 3;
+    }
+    if (length <= offset) {
+        return;
+    }
+    const uint8_t* body = packet + offset;
+    size_t bodyLength = length - offset;
+
+    switch (body[0]) {
+        case SN_CONNACK:
+            if (bodyLength >= 2 && body[1] == 0x00) {
+                snConnected = true;
+                snPingOutstanding = false;
+                Serial.println(F("[MQTT-SN] Connected to gateway."));
+            } else {
+                Serial.println(F("[MQTT-SN] Connection rejected by gateway."));
+            }
+            break;
+
+        case SN_WILLTOPICREQ:
+            sendWillTopic();
+            break;
+
+        case SN_WILLMSGREQ:
+            sendWillMessage();
+            break;
+
+        case SN_PUBLISH:
+            // Flags(1) TopicId(2) MsgId(2) Data
+            if (bodyLength >= 6 && snOnMessage) {
+                uint16_t topicId = ((uint16_t)body[2] << 8) | body[3];
+                snOnMessage(topicId, body + 6, bodyLength - 6);
+            }
+            break;
+
+        case SN_PINGRESP:
+            snPingOutstanding = false;
+            break;
+
+        case SN_DISCONNECT:
+            snConnected = false;
+            Serial.println(F("[MQTT-SN] Disconnected by gateway."));
+            break;
+
+        case SN_SUBACK:
+        default:
+            break;
+    }
+}
+
+// =====================================================================
+// Public Functions (defined in mqttsn.h)
+// =====================================================================
+
+void setupMqttSn(MqttSnMessageFn onMessage) {
+    snOnMessage = onMessage;
+    snGateway.fromString(MQTTSN_GATEWAY_HOST);
+    snUdp.begin(MQTTSN_LOCAL_PORT);
+}
+
+bool handleMqttSnConnection() {
+    bool wasConnected = snConnected;
+
+    uint8_t packet[SN_MAX_PACKET];
+    while (snUdp.parsePacket() > 0) {
+        int length = snUdp.read(packet, sizeof(packet));
+        if (length > 0) {
+            handlePacket(packet, (size_t)length);
+        }
+    }
+
+    uint32_t now = millis();
+    if (WiFi.status() != WL_CONNECTED) {
+        snConnected = false;
+        return false;
+    }
+
+    if (!snConnected) {
+        if (now - snLastConnectAttempt >= SN_RECONNECT_INTERVAL_MS) {
+            snLastConnectAttempt = now;
+            Serial.println(F("[MQTT-SN] Connecting to gateway..."));
+            sendConnect();
+        }
+        return false;
+    }
+
+    // Keep-alive: ping when idle, drop the session if the gateway stops answering
+    if (snPingOutstanding && now - snPingSentAt > SN_KEEPALIVE_S * 1000UL) {
+        Serial.println(F("[MQTT-SN] Gateway not responding. Reconnecting."));
+        snConnected = false;
+        return false;
+    }
+    if (!snPingOutstanding && now - snLastSend > SN_KEEPALIVE_S * 500UL) {
+        uint8_t body[1] = {SN_PINGREQ};
+        if (sendPacket(body, 1)) {
+            snPingOutstanding = true;
+            snPingSentAt = now;
+        }
+    }
+
+    return snConnected && !wasConnected;
+}
+
+bool mqttSnPublish(uint16_t topicId, const uint8_t* payload, size_t length, bool retain) {
+    if (!snConnected || length > SN_MAX_PACKET - 10) {
+        return false;
+    }
+    uint8_t body[SN_MAX_PACKET];
+    body[0] = SN_PUBLISH;
+    body[1] = (retain ? SN_FLAG_RETAIN : 0) | SN_TOPIC_PREDEFINED; // QoS 0
+    body[2] = (uint8_t)(topicId >> 8);
+    body[3] = (uint8_t)topicId;
+    body[4] = 0; // MsgId is 0 for QoS 0
+    body[5] = 0;
+    memcpy(body + 6, payload, length);
+    return sendPacket(body, 6 + length);
+}
+
+bool mqttSnSubscribe(uint16_t topicId) {
+    if (!snConnected) {
+        return false;
+    }
+    uint16_t msgId = nextMsgId();
+    uint8_t body[6] = {
+        SN_SUBSCRIBE, SN_TOPIC_PREDEFINED,
+        (uint8_t)(msgId >> 8), (uint8_t)msgId,
+        (uint8_t)(topicId >> 8), (uint8_t)topicId
+    };
+    return sendPacket(body, sizeof(body));
+}
+
+bool isMqttSnConnected() {
+    return snConnected;
+}
+
+#endif // TERELINA_USE_MQTTSN
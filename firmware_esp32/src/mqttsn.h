@@ -0,0 +1,41 @@
+#ifndef MQTTSN_H
+#define MQTTSN_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Callback for PUBLISH messages received from the gateway.
+ */
+typedef void (*MqttSnMessageFn)(uint16_t topicId, const uint8_t* payload, size_t length);
+
+/**
+ * @brief Opens the UDP socket used to talk to the MQTT-SN gateway.
+ * Must be called once in setup(), after WiFi is up.
+ */
+void setupMqttSn(MqttSnMessageFn onMessage);
+
+/**
+ * @brief Processes incoming datagrams, (re)connects and sends keep-alive pings.
+ * Non-blocking. Call this in every main loop() iteration.
+ * @return True when a new session was just established (subscribe then).
+ */
+bool handleMqttSnConnection();
+
+/**
+ * @brief Publishes to a predefined topic id with QoS 0.
+ * Predefined ids are mapped to topic names by the gateway, so no REGISTER
+ * round-trip is needed and the topic costs 2 bytes per message.
+ */
+bool mqttSnPublish(uint16_t topicId, const uint8_t* payload, size_t length, bool retain);
+
+/**
+ * @brief Subscribes to a predefined topic id (QoS 0).
+ */
+bool mqttSnSubscribe(uint16_t topicId);
+
+/**
+ * @return True while the gateway session is alive.
+ */
+bool isMqttSnConnected();
+
+#endif // MQTTSN_H
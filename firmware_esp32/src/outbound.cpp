@@ -0,0 +1,411 @@
+/**
+ * @file outbound.cpp
+ * @brief Priority scheduler for everything the device publishes.
+ *
+ * Alarms, live states, heartbeats, replayed backlog, command output and trace
+ * uploads share one MQTT client (256-byte buffer). Instead of publishing
+ * directly, modules queue messages here and handleOutbound() sends them in
+ * strict priority order. Backlog, telemetry and trace have per-class byte
+ * budgets (token buckets), so a large replay or upload can never delay an
+ * alarm or a live count by more than one message.
+ *
+ * Live states are serialized at send time with their queueing age ("age_ms"),
+ * which lets the backend reconstruct when the event actually happened.
+ */
+
+#include "outbound.h"
+#include "config.h"
+
+// =====================================================================
+// Scheduler Settings
+// =====================================================================
+static constexpr size_t   OUTBOUND_SLOT_BYTES      = 200;   // Largest opaque payload (diag batch, trace chunk)
+static constexpr size_t   LIVE_CAPACITY            = 32;
+static constexpr size_t   BACKLOG_CAPACITY         = 256;   // Products kept across an outage (~14 KB)
+static constexpr uint32_t OUTBOUND_LIVE_MAX_AGE_MS = 2000;  // Older live states are demoted to backlog
+static constexpr int      OUTBOUND_MAX_PER_PUMP    = 4;     // Messages per handleOutbound() call
+
+// Byte queues (opaque payloads) for the classes that carry them
+static constexpr size_t ALARM_SLOTS     = 4;
+static constexpr size_t HEARTBEAT_SLOTS = 1;
+static constexpr size_t TELEMETRY_SLOTS = 8;
+static constexpr size_t TRACE_SLOTS     = 4;
+
+struct ClassConfig {
+    const char* name;
+    uint32_t rateBytesPerS;  // 0 = unlimited
+    uint32_t burstBytes;
+};
+
+static const ClassConfig classConfig[CLASS_COUNT] = {
+    {"alarm",     0,    0},
+    {"live",      0,    0},
+    {"heartbeat", 0,    0},
+    {"backlog",   1024, 2048},
+    {"telemetry", 1024, 1024},
+    {"trace",     2048, 1024},
+};
+
+struct ClassStats {
+    uint32_t sent;
+    uint32_t dropped;
+    uint32_t bytes;
+    uint64_t delaySumMs;
+    uint32_t delayMaxMs;
+};
+
+struct OutboundMsg {
+    MqttTopic topic;
+    bool      retain;
+    uint16_t  length;
+    uint32_t  enqueuedMs;
+    uint8_t   data[OUTBOUND_SLOT_BYTES];
+};
+
+struct ByteQueue {
+    OutboundMsg* slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+// =====================================================================
+// Queues and State
+// =====================================================================
+static OutboundMsg alarmSlots[ALARM_SLOTS];
+static OutboundMsg heartbeatSlots[HEARTBEAT_SLOTS];
+static OutboundMsg telemetrySlots[TELEMETRY_SLOTS];
+static OutboundMsg traceSlots[TRACE_SLOTS];
+
+// Indexed by TrafficClass; live and backlog use the typed rings below
+static ByteQueue byteQueues[CLASS_COUNT] = {
+    {alarmSlots, ALARM_SLOTS, 0, 0},
+    {nullptr, 0, 0, 0},
+    {heartbeatSlots, HEARTBEAT_SLOTS, 0, 0},
+    {nullptr, 0, 0, 0},
+    {telemetrySlots, TELEMETRY_SLOTS, 0, 0},
+    {traceSlots, TRACE_SLOTS, 0, 0},
+};
+
+static StateRecord liveQueue[LIVE_CAPACITY];
+static size_t liveHead = 0;
+static size_t liveCount = 0;
+
+static ProductRecord backlogQueue[BACKLOG_CAPACITY];
+static size_t backlogHead = 0;
+static size_t backlogCount = 0;
+
+static uint32_t nextSeq = 1;
+static float tokens[CLASS_COUNT];
+static uint32_t lastRefillMs = 0;
+static ClassStats stats[CLASS_COUNT];
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static inline StateRecord& liveAt(size_t i) {
+    return liveQueue[(liveHead + i) % LIVE_CAPACITY];
+}
+
+static void recordSent(TrafficClass cls, size_t bytes, uint32_t delayMs) {
+    ClassStats& st = stats[cls];
+    st.sent++;
+    st.bytes += bytes;
+    st.delaySumMs += delayMs;
+    if (delayMs > st.delayMaxMs) {
+        st.delayMaxMs = delayMs;
+    }
+}
+
+static void pushBacklog(const ProductRecord& product) {
+    if (backlogCount == BACKLOG_CAPACITY) {
+        // Keep the newest products; the oldest are the least useful live
+        backlogHead = (backlogHead + 1) % BACKLOG_CAPACITY;
+        backlogCount--;
+        stats[CLASS_BACKLOG].dropped++;
+    }
+    backlogQueue[(backlogHead + backlogCount) % BACKLOG_CAPACITY] = product;
+    backlogCount++;
+}
+
+/**
+ * @brief Moves aged interrupted->clear pairs from the live queue to the backlog.
+ * Unpaired states stay live and keep their order.
+ */
+static void demoteAgedLiveStates(uint32_t now) {
+    if (liveCount < 2 || now - liveAt(0).enqueuedMs < OUTBOUND_LIVE_MAX_AGE_MS) {
+        return;
+    }
+
+    StateRecord kept[LIVE_CAPACITY];
+    size_t keptCount = 0;
+    size_t i = 0;
+    while (i < liveCount) {
+        StateRecord& rec = liveAt(i);
+        bool aged = now - rec.enqueuedMs >= OUTBOUND_LIVE_MAX_AGE_MS;
+        if (aged && rec.interrupted && i + 1 < liveCount && !liveAt(i + 1).interrupted) {
+            StateRecord& clear = liveAt(i + 1);
+            pushBacklog({clear.seq, clear.eventMs, clear.eventMs - rec.eventMs, clear.hasShape, clear.shape,
+                         clear.hasBelt, clear.belt, clear.logN, 0});
+            i += 2;
+            continue;
+        }
+        kept[keptCount++] = rec;
+        i++;
+    }
+
+    for (size_t k = 0; k < keptCount; k++) {
+        liveQueue[k] = kept[k];
+    }
+    liveHead = 0;
+    liveCount = keptCount;
+}
+
+static void refillTokens(uint32_t now) {
+    uint32_t elapsed = now - lastRefillMs;
+    if (elapsed == 0) {
+        return;
+    }
+    lastRefillMs = now;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        const ClassConfig& cfg = classConfig[c];
+        if (cfg.rateBytesPerS == 0) {
+            continue;
+        }
+        tokens[c] += cfg.rateBytesPerS * elapsed / 1000.0f;
+        if (tokens[c] > cfg.burstBytes) {
+            tokens[c] = cfg.burstBytes;
+        }
+    }
+}
+
+static bool hasQueued(TrafficClass cls) {
+    if (cls == CLASS_LIVE) {
+        return liveCount > 0;
+    }
+    if (cls == CLASS_BACKLOG) {
+        return backlogCount > 0;
+    }
+    return byteQueues[cls].count > 0;
+}
+
+static bool withinBudget(TrafficClass cls, size_t bytes) {
+    const ClassConfig& cfg = classConfig[cls];
+    // A message larger than the bucket may go once the bucket is full
+    return cfg.rateBytesPerS == 0 || tokens[cls] >= bytes || tokens[cls] >= cfg.burstBytes;
+}
+
+/**
+ * @brief Serializes and publishes the head of a class queue.
+ * @param enforceBudget If false, byte budgets are ignored (flush).
+ * @return True if a message was sent; false if blocked by budget or transport.
+ */
+static bool sendHead(TrafficClass cls, uint32_t now, bool enforceBudget) {
+    char text[416];  // Fits PubSubClient's 448-byte buffer with the state topic
+    const uint8_t* payload;
+    size_t length;
+    MqttTopic topic;
+    bool retain = false;
+    uint32_t delayMs;
+
+    if (cls == CLASS_LIVE) {
+        const StateRecord& rec = liveAt(0);
+        delayMs = now - rec.enqueuedMs;
+        length = formatSensorState(text, sizeof(text), rec, now - rec.eventMs);
+        payload = (const uint8_t*)text;
+        topic = TOPIC_STATE;
+    } else if (cls == CLASS_BACKLOG) {
+        const ProductRecord& rec = backlogQueue[backlogHead];
+        delayMs = now - rec.clearedMs;
+        length = formatBacklogProduct(text, sizeof(text), rec, delayMs);
+        payload = (const uint8_t*)text;
+        topic = TOPIC_BACKLOG;
+    } else {
+        ByteQueue& q = byteQueues[cls];
+        const OutboundMsg& msg = q.slots[q.head];
+        delayMs = now - msg.enqueuedMs;
+        payload = msg.data;
+        length = msg.length;
+        topic = msg.topic;
+        retain = msg.retain;
+    }
+
+    if (enforceBudget && !withinBudget(cls, length)) {
+        return false;
+    }
+    if (!mqttPublish(topic, payload, length, retain)) {
+        return false;
+    }
+
+    if (classConfig[cls].rateBytesPerS != 0) {
+        tokens[cls] -= length;
+    }
+    recordSent(cls, length, delayMs);
+
+    if (cls == CLASS_LIVE) {
+        liveHead = (liveHead + 1) % LIVE_CAPACITY;
+        liveCount--;
+    } else if (cls == CLASS_BACKLOG) {
+        backlogHead = (backlogHead + 1) % BACKLOG_CAPACITY;
+        backlogCount--;
+    } else {
+        ByteQueue& q = byteQueues[cls];
+        q.head = (q.head + 1) % q.capacity;
+        q.count--;
+    }
+    return true;
+}
+
+// =====================================================================
+// Public Functions (defined in outbound.h)
+// =====================================================================
+
+void outboundEnqueueState(bool interrupted, int8_t rssi, uint32_t uptimeS, uint32_t eventMs,
+                          const ProductShape* shape, const BeltStamp* belt, uint32_t logN) {
+    if (liveCount == LIVE_CAPACITY) {
+        // Should not happen (aged pairs are demoted); keep the newest state
+        liveHead = (liveHead + 1) % LIVE_CAPACITY;
+        liveCount--;
+        stats[CLASS_LIVE].dropped++;
+    }
+    StateRecord& rec = liveQueue[(liveHead + liveCount) % LIVE_CAPACITY];
+    rec.interrupted = interrupted;
+    rec.rssi = rssi;
+    rec.uptimeS = uptimeS;
+    rec.seq = nextSeq++;
+    rec.eventMs = eventMs;
+    rec.enqueuedMs = millis();
+    rec.hasShape = shape != nullptr;
+    if (shape) {
+        rec.shape = *shape;
+    }
+    rec.hasBelt = belt != nullptr;
+    if (belt) {
+        rec.belt = *belt;
+    }
+    rec.logN = logN;
+    liveCount++;
+}
+
+void outboundEnqueueProduct(uint32_t clearedMs, uint32_t dwellMs, uint32_t logN, int64_t eventUnixMs) {
+    ProductRecord product = {};
+    product.seq = nextSeq++;
+    product.clearedMs = clearedMs;
+    product.dwellMs = dwellMs;
+    product.logN = logN;
+    product.eventUnixMs = eventUnixMs;
+    pushBacklog(product);
+}
+
+bool outboundHasSpace(TrafficClass cls) {
+    if (cls == CLASS_LIVE) {
+        return liveCount < LIVE_CAPACITY;
+    }
+    if (cls == CLASS_BACKLOG) {
+        return backlogCount < BACKLOG_CAPACITY;
+    }
+    const ByteQueue& q = byteQueues[cls];
+    return q.slots != nullptr && q.count < q.capacity;
+}
+
+bool outboundEnqueue(TrafficClass cls, MqttTopic topic, const uint8_t* payload, size_t length, bool retain) {
+    ByteQueue& q = byteQueues[cls];
+    if (q.slots == nullptr || length > OUTBOUND_SLOT_BYTES) {
+        return false;
+    }
+    if (q.count == q.capacity) {
+        if (cls != CLASS_HEARTBEAT) {
+            stats[cls].dropped++;
+            return false;
+        }
+        // Only the latest heartbeat matters: replace the queued one
+        q.count--;
+        stats[cls].dropped++;
+    }
+
+    OutboundMsg& msg = q.slots[(q.head + q.count) % q.capacity];
+    msg.topic = topic;
+    msg.retain = retain;
+    msg.length = (uint16_t)length;
+    msg.enqueuedMs = millis();
+    memcpy(msg.data, payload, length);
+    q.count++;
+    return true;
+}
+
+bool outboundIdle() {
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (hasQueued((TrafficClass)c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t outboundSentCount(TrafficClass cls) {
+    return stats[cls].sent;
+}
+
+void handleOutbound() {
+    uint32_t now = millis();
+    demoteAgedLiveStates(now);
+    refillTokens(now);
+
+    if (!isMqttConnected()) {
+        return;
+    }
+
+    for (int sent = 0; sent < OUTBOUND_MAX_PER_PUMP; sent++) {
+        bool progressed = false;
+        // Strict priority: restart from the top after every message so a new
+        // alarm is never queued behind more than one lower-class message.
+        for (int c = 0; c < CLASS_COUNT && !progressed; c++) {
+            TrafficClass cls = (TrafficClass)c;
+            if (hasQueued(cls)) {
+                progressed = sendHead(cls, now, true);
+            }
+        }
+        if (!progressed) {
+            return;
+        }
+    }
+}
+
+void outboundFlush(TrafficClass cls) {
+    uint32_t now = millis();
+    for (int c = 0; c <= cls; c++) {
+        // Higher budgeted classes (backlog) keep their budget; only cls is forced out
+        if (c != cls && classConfig[c].rateBytesPerS != 0) {
+            continue;
+        }
+        while (isMqttConnected() && hasQueued((TrafficClass)c)) {
+            if (!sendHead((TrafficClass)c, now, false)) {
+                return;
+            }
+        }
+    }
+}
+
+size_t outboundQueuedCount() {
+    size_t queued = liveCount + backlogCount;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (c != CLASS_LIVE && c != CLASS_BACKLOG) {
+            queued += byteQueues[c].count;
+        }
+    }
+    return queued;
+}
+
+void outboundStatus(CommandReplyFn reply) {
+    char line[128];
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        const ClassStats& st = stats[c];
+        size_t queued = c == CLASS_LIVE ? liveCount : c == CLASS_BACKLOG ? backlogCount : byteQueues[c].count;
+        unsigned long avg = st.sent ? (unsigned long)(st.delaySumMs / st.sent) : 0;
+        snprintf(line, sizeof(line), "TX %s queued=%u sent=%lu dropped=%lu bytes=%lu delay_avg_ms=%lu delay_max_ms=%lu",
+                 classConfig[c].name, (unsigned)queued, (unsigned long)st.sent, (unsigned long)st.dropped,
+                 (unsigned long)st.bytes, avg, (unsigned long)st.delayMaxMs);
+        reply(line);
+    }
+}
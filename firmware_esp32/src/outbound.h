@@ -0,0 +1,121 @@
+#ifndef OUTBOUND_H
+#define OUTBOUND_H
+
+#include <Arduino.h>
+#include "commands.h"
+#include "mqtt.h"
+#include "curtain.h"
+#include "belt_fusion.h"
+
+/**
+ * @brief Traffic classes of the outbound scheduler, highest priority first.
+ * A queued message of a class is always sent before any message of a lower
+ * class, unless its class has exhausted its byte budget.
+ */
+enum TrafficClass {
+    CLASS_ALARM,      // Jam alarms: preempt everything, unlimited
+    CLASS_LIVE,       // Sensor states in real time, unlimited
+    CLASS_HEARTBEAT,  // "online" status, unlimited (at most one queued)
+    CLASS_BACKLOG,    // Products replayed after an outage, byte budget
+    CLASS_TELEMETRY,  // Command output (diag), leftover capacity only
+    CLASS_TRACE,      // Raw edge trace chunks, leftover capacity only
+    CLASS_COUNT
+};
+
+/**
+ * @brief A debounced sensor state waiting in the live queue.
+ * Serialized only when sent, so the payload carries its real queueing age.
+ */
+struct StateRecord {
+    bool     interrupted;
+    int8_t   rssi;
+    uint32_t uptimeS;
+    uint32_t seq;
+    uint32_t eventMs;     // First edge of the change (millis), reported as age_ms
+    uint32_t enqueuedMs;
+    bool     hasShape;    // Light-curtain mode: profile of the product that just left
+    ProductShape shape;
+    bool     hasBelt;     // Encoder builds: belt position, length and spacing
+    BeltStamp belt;
+    uint32_t logN;        // Durable log number of a "clear" state, 0 if not logged
+};
+
+/**
+ * @brief A complete product (interrupted -> clear) demoted from the live queue.
+ */
+struct ProductRecord {
+    uint32_t seq;        // Sequence number of the "clear" state
+    uint32_t clearedMs;  // When the beam cleared (millis)
+    uint32_t dwellMs;    // How long the beam was interrupted
+    bool     hasShape;
+    ProductShape shape;
+    bool     hasBelt;
+    BeltStamp belt;      // Of the "clear" state
+    uint32_t logN;       // Durable log number, 0 if not logged
+    int64_t  eventUnixMs;  // Replayed from a previous boot: clear time on the synced clock, 0 if unknown
+};
+
+/**
+ * @brief Queues a debounced sensor state in the live class.
+ * States that wait longer than OUTBOUND_LIVE_MAX_AGE_MS (typically while
+ * disconnected) are demoted to the backlog in complete interrupted/clear
+ * pairs, so the backend's live state machine never sees half a product.
+ */
+void outboundEnqueueState(bool interrupted, int8_t rssi, uint32_t uptimeS, uint32_t eventMs,
+                          const ProductShape* shape, const BeltStamp* belt, uint32_t logN = 0);
+
+/**
+ * @brief Queues a complete product directly in the backlog class: counted
+ * off-line (ULP mode) or replayed from the durable product log. dwellMs is
+ * 0 when unknown; eventUnixMs, when not 0, is sent as the product's time
+ * instead of its age.
+ */
+void outboundEnqueueProduct(uint32_t clearedMs, uint32_t dwellMs, uint32_t logN = 0, int64_t eventUnixMs = 0);
+
+/**
+ * @brief Queues an opaque payload in one of the byte-queue classes
+ * (alarm, heartbeat, telemetry, trace).
+ * @return False if the class queue is full or the payload is too large.
+ */
+bool outboundEnqueue(TrafficClass cls, MqttTopic topic, const uint8_t* payload, size_t length,
+                     bool retain = false);
+
+/**
+ * @brief True if the class queue can take one more message without dropping one.
+ */
+bool outboundHasSpace(TrafficClass cls);
+
+/**
+ * @brief True if no message of any class is waiting.
+ */
+bool outboundIdle();
+
+/**
+ * @brief Messages of a class sent since boot.
+ */
+uint32_t outboundSentCount(TrafficClass cls);
+
+/**
+ * @brief Messages queued in every class (the device's backlog), reported in heartbeats.
+ */
+size_t outboundQueuedCount();
+
+/**
+ * @brief Sends queued messages by priority within the per-class byte budgets.
+ * Non-blocking (a few messages per call). Call this in every main loop() iteration.
+ */
+void handleOutbound();
+
+/**
+ * @brief Sends everything queued in cls and in the unlimited higher classes
+ * now, ignoring cls's byte budget. Used when operator-requested command
+ * output fills its queue.
+ */
+void outboundFlush(TrafficClass cls);
+
+/**
+ * @brief Writes one line per class: queued, sent, dropped and queueing delay.
+ */
+void outboundStatus(CommandReplyFn reply);
+
+#endif // OUTBOUND_H
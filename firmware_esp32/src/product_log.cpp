@@ -0,0 +1,424 @@
+/**
+ * @file product_log.cpp
+ * @brief Durable store-and-forward log of counted products (see product_log.h).
+ *
+ * Enabled with -DTERELINA_USE_PRODUCT_LOG. The RAM queues of outbound.cpp
+ * lose everything on a reboot, and a QoS 0 publish (or even a broker PUBACK)
+ * does not mean the product reached the database. So every product is also
+ * appended to LittleFS with a log number, contiguous within the log's epoch.
+ * The backend publishes, retained, the highest number up to which all
+ * products of the device are committed; that acknowledgment is the trim
+ * point of the log.
+ *
+ * Records are fixed-size and stored in segment files of LOG_SEGMENT_RECORDS,
+ * named after their index, so a record is found by seeking and trimming
+ * deletes whole files. At most LOG_MAX_SEGMENTS are kept: if the backend
+ * stops acknowledging for that long, the oldest segment is dropped (and
+ * counted as lost) rather than filling the flash.
+ *
+ * LittleFS makes each synced append atomic: after a power cut a segment
+ * holds whole records only.
+ */
+
+#include "product_log.h"
+
+#ifdef TERELINA_USE_PRODUCT_LOG
+
+#include "config.h"
+#include "mqtt.h"
+#include "outbound.h"
+#include "timesync.h"
+#include <FS.h>
+#include <LittleFS.h>
+#include <esp_system.h>
+
+// =====================================================================
+// Settings and State
+// =====================================================================
+static constexpr uint32_t LOG_SEGMENT_RECORDS = 256;
+static constexpr uint32_t LOG_MAX_SEGMENTS    = 64;     // 64 x 6 KB: 16384 unacknowledged products
+static constexpr uint32_t LOG_ACK_WAIT_MS     = 5000;   // Replay without the retained ack after this
+static constexpr uint32_t LOG_META_SAVE_MS    = 60000;  // Persist the ack point at most this often
+static constexpr int      LOG_REPLAY_PER_CALL = 4;
+static constexpr uint32_t LOG_META_MAGIC      = 0x504C4F47;  // "PLOG"
+
+static const char* LOG_DIR  = "/plog";
+static const char* LOG_META = "/plog/meta";
+
+struct LogRecord {
+    uint32_t n;
+    uint32_t bootId;     // Boot that wrote it: clearedMs is only meaningful in that boot
+    uint32_t clearedMs;  // millis() when the beam cleared
+    uint32_t dwellMs;
+    int64_t  unixMs;     // When the beam cleared on the backend's clock; 0 if not synced then
+};
+
+struct LogMeta {
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t acked;   // Every product up to here is committed on the backend
+    uint32_t bootId;
+};
+
+struct LogStats {
+    uint32_t appended;
+    uint32_t failed;     // Appends that could not be written
+    uint32_t replayed;
+    uint32_t acks;
+    uint32_t trimmed;    // Segments deleted after an acknowledgment
+    uint32_t lost;       // Unacknowledged products dropped with the oldest segment
+};
+
+static bool ready = false;
+static LogMeta meta = {};
+static uint32_t firstN = 1;     // Oldest record still in flash
+static uint32_t nextN = 1;
+static uint32_t lastBootN = 0;  // Newest record written before this boot
+static LogStats stats = {};
+
+static File appendFile;
+static uint32_t appendSegment = UINT32_MAX;
+static File readFile;
+static uint32_t readSegment = UINT32_MAX;
+
+static uint32_t savedAcked = 0;
+static uint32_t savedMs = 0;
+
+// Replay of unacknowledged records [replayNext, replayEnd]
+static uint32_t replayNext = 1;
+static uint32_t replayEnd = 0;
+static bool bootReplayPending = false;
+static bool ackSeen = false;
+static uint32_t connectedMs = 0;
+static uint32_t lastAckProgressMs = 0;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static inline uint32_t segmentOf(uint32_t n) {
+    return (n - 1) / LOG_SEGMENT_RECORDS;
+}
+
+static void segmentPath(uint32_t segment, char* path, size_t size) {
+    snprintf(path, size, "%s/%08lx", LOG_DIR, (unsigned long)segment);
+}
+
+static bool saveMeta() {
+    File f = LittleFS.open(LOG_META, "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = f.write((const uint8_t*)&meta, sizeof(meta)) == sizeof(meta);
+    f.close();
+    if (ok) {
+        savedAcked = meta.acked;
+        savedMs = millis();
+    }
+    return ok;
+}
+
+static const char* baseName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void removeSegment(uint32_t segment) {
+    char path[24];
+    segmentPath(segment, path, sizeof(path));
+    if (readSegment == segment) {
+        readFile.close();
+        readSegment = UINT32_MAX;
+    }
+    LittleFS.remove(path);
+}
+
+/**
+ * @brief Finds the first and next record numbers from the segment files.
+ */
+static void scanSegments() {
+    uint32_t minSegment = UINT32_MAX;
+    uint32_t maxSegment = 0;
+    size_t maxSegmentBytes = 0;
+
+    File dir = LittleFS.open(LOG_DIR);
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+        const char* name = baseName(f.name());
+        char* end = nullptr;
+        uint32_t segment = strtoul(name, &end, 16);
+        if (end == name || *end != '\0') {
+            continue;  // The meta file
+        }
+        if (segment < minSegment) minSegment = segment;
+        if (segment >= maxSegment) {
+            maxSegment = segment;
+            maxSegmentBytes = f.size();
+        }
+    }
+
+    if (minSegment == UINT32_MAX) {
+        nextN = meta.acked + 1;
+        firstN = nextN;
+        return;
+    }
+    nextN = maxSegment * LOG_SEGMENT_RECORDS + maxSegmentBytes / sizeof(LogRecord) + 1;
+    firstN = minSegment * LOG_SEGMENT_RECORDS + 1;
+    if (nextN <= meta.acked) {
+        nextN = meta.acked + 1;  // Fully acknowledged segments were trimmed
+    }
+}
+
+static bool openAppendSegment(uint32_t segment) {
+    appendFile.close();
+    char path[24];
+    segmentPath(segment, path, sizeof(path));
+    appendFile = LittleFS.open(path, "a");
+    appendSegment = appendFile ? segment : UINT32_MAX;
+    return (bool)appendFile;
+}
+
+/**
+ * @brief Keeps at most LOG_MAX_SEGMENTS in flash, the new one included.
+ */
+static void enforceFlashBound(uint32_t newSegment) {
+    while (newSegment - segmentOf(firstN) + 1 > LOG_MAX_SEGMENTS) {
+        uint32_t oldest = segmentOf(firstN);
+        uint32_t oldestLast = (oldest + 1) * LOG_SEGMENT_RECORDS;
+        if (oldestLast > meta.acked) {
+            stats.lost += oldestLast - (meta.acked >= firstN ? meta.acked : firstN - 1);
+        }
+        removeSegment(oldest);
+        firstN = oldestLast + 1;
+    }
+}
+
+static bool readRecord(uint32_t n, LogRecord& out) {
+    uint32_t segment = segmentOf(n);
+    if (segment != readSegment) {
+        readFile.close();
+        char path[24];
+        segmentPath(segment, path, sizeof(path));
+        readFile = LittleFS.open(path, "r");
+        readSegment = readFile ? segment : UINT32_MAX;
+        if (!readFile) {
+            return false;
+        }
+    }
+    return readFile.seek(((n - 1) % LOG_SEGMENT_RECORDS) * sizeof(LogRecord)) &&
+           readFile.read((uint8_t*)&out, sizeof(out)) == sizeof(out) && out.n == n;
+}
+
+static void startReplay(uint32_t end) {
+    replayNext = meta.acked + 1;
+    replayEnd = end;
+    lastAckProgressMs = millis();
+    if (replayNext <= replayEnd) {
+        Serial.printf("[Log] Replaying products %lu..%lu (not acknowledged).\n", (unsigned long)replayNext,
+                      (unsigned long)replayEnd);
+    }
+}
+
+static void replaySome() {
+    for (int sent = 0; sent < LOG_REPLAY_PER_CALL && replayNext <= replayEnd;) {
+        if (replayNext <= meta.acked) {
+            replayNext = meta.acked + 1;  // Acknowledged during the replay
+            continue;
+        }
+        if (replayNext < firstN) {
+            replayNext = firstN;  // Dropped by the flash bound
+            continue;
+        }
+        if (!outboundHasSpace(CLASS_BACKLOG)) {
+            return;
+        }
+        LogRecord rec;
+        if (readRecord(replayNext, rec)) {
+            // The time of the product survives a reboot only on the synced clock
+            bool thisBoot = rec.bootId == meta.bootId;
+            outboundEnqueueProduct(thisBoot ? rec.clearedMs : millis(), rec.dwellMs, rec.n, rec.unixMs);
+            stats.replayed++;
+            sent++;
+        }
+        replayNext++;
+    }
+}
+
+// =====================================================================
+// Public Functions (defined in product_log.h)
+// =====================================================================
+
+void setupProductLog() {
+    if (!LittleFS.begin(true)) {
+        Serial.println(F("[Log] LittleFS mount FAILED. Products will not be logged."));
+        return;
+    }
+    LittleFS.mkdir(LOG_DIR);
+
+    File f = LittleFS.open(LOG_META, "r");
+    bool valid = f && f.read((uint8_t*)&meta, sizeof(meta)) == sizeof(meta) && meta.magic == LOG_META_MAGIC;
+    f.close();
+    if (!valid) {
+        // New log: numbers restart at 1 under a new epoch
+        File dir = LittleFS.open(LOG_DIR);
+        for (File old = dir.openNextFile(); old; old = dir.openNextFile()) {
+            String path = String(LOG_DIR) + "/" + baseName(old.name());
+            old.close();
+            LittleFS.remove(path);
+        }
+        meta = {LOG_META_MAGIC, esp_random() | 1, 0, 0};
+    }
+    meta.bootId++;
+    if (!saveMeta()) {
+        Serial.println(F("[Log] Cannot write the log metadata. Products will not be logged."));
+        return;
+    }
+
+    scanSegments();
+    lastBootN = nextN - 1;
+    bootReplayPending = lastBootN > meta.acked;
+    ready = true;
+    Serial.printf("[Log] Product log epoch %08lx: records %lu..%lu, acknowledged up to %lu.\n",
+                  (unsigned long)meta.epoch, (unsigned long)firstN, (unsigned long)lastBootN,
+                  (unsigned long)meta.acked);
+}
+
+uint32_t productLogAppend(uint32_t clearedMs, uint32_t dwellMs) {
+    if (!ready) {
+        return 0;
+    }
+    uint32_t n = nextN;
+    uint32_t segment = segmentOf(n);
+    if (segment != appendSegment) {
+        enforceFlashBound(segment);
+        if (!openAppendSegment(segment)) {
+            stats.failed++;
+            return 0;
+        }
+    }
+
+    uint32_t now = millis();
+    LogRecord rec = {n, meta.bootId, clearedMs, dwellMs, 0};
+    if (timesyncIsSynced()) {
+        rec.unixMs = timesyncUnixMs() - (int64_t)(now - clearedMs);
+    }
+    if (appendFile.write((const uint8_t*)&rec, sizeof(rec)) != sizeof(rec)) {
+        stats.failed++;
+        return 0;
+    }
+    appendFile.flush();
+
+    if (nextN - 1 == meta.acked) {
+        lastAckProgressMs = now;  // Nothing was waiting: the resend timer starts with this product
+    }
+    nextN++;
+    stats.appended++;
+    return n;
+}
+
+uint32_t productLogEpoch() {
+    return meta.epoch;
+}
+
+uint32_t productLogFirst() {
+    return ready ? firstN : 0;
+}
+
+void productLogOnConnect() {
+    ackSeen = false;
+    connectedMs = millis();
+    lastAckProgressMs = connectedMs;  // Give the RAM backlog its chance before replaying from flash
+}
+
+void productLogHandleAck(const uint8_t* payload, size_t length) {
+    char text[32];
+    size_t len = length < sizeof(text) - 1 ? length : sizeof(text) - 1;
+    memcpy(text, payload, len);
+    text[len] = '\0';
+
+    char* end = nullptr;
+    uint32_t epoch = strtoul(text, &end, 10);
+    if (!ready || end == text || *end != ',' || epoch != meta.epoch) {
+        return;  // Malformed, or retained for a previous log
+    }
+    uint32_t acked = strtoul(end + 1, nullptr, 10);
+    ackSeen = true;
+    stats.acks++;
+    if (acked >= nextN) {
+        acked = nextN - 1;
+    }
+    if (acked <= meta.acked) {
+        return;
+    }
+    meta.acked = acked;
+    lastAckProgressMs = millis();
+
+    // Delete whole segments below the ack, except the one being appended
+    bool trimmed = false;
+    while (segmentOf(firstN) < appendSegment && (segmentOf(firstN) + 1) * LOG_SEGMENT_RECORDS <= meta.acked) {
+        removeSegment(segmentOf(firstN));
+        firstN = (segmentOf(firstN) + 1) * LOG_SEGMENT_RECORDS + 1;
+        stats.trimmed++;
+        trimmed = true;
+    }
+    if (trimmed) {
+        saveMeta();
+    }
+}
+
+void handleProductLog() {
+    if (!ready) {
+        return;
+    }
+    uint32_t now = millis();
+    if (meta.acked != savedAcked && now - savedMs >= LOG_META_SAVE_MS) {
+        saveMeta();
+    }
+    if (!isMqttConnected()) {
+        return;
+    }
+
+    if (replayNext > replayEnd) {
+        if (bootReplayPending) {
+            if (ackSeen || now - connectedMs >= LOG_ACK_WAIT_MS) {
+                bootReplayPending = false;
+                startReplay(lastBootN);
+            }
+        } else if (nextN - 1 > meta.acked && now - lastAckProgressMs >= LOG_RESEND_AFTER_MS) {
+            startReplay(nextN - 1);
+        }
+    }
+    replaySome();
+}
+
+void productLogStatus(CommandReplyFn reply) {
+    char line[192];
+    uint32_t segments = ready && nextN > firstN ? segmentOf(nextN - 1) - segmentOf(firstN) + 1 : 0;
+    snprintf(line, sizeof(line),
+             "LOG epoch=%08lx first=%lu next=%lu acked=%lu unacked=%lu segments=%lu used_kb=%u",
+             (unsigned long)meta.epoch, (unsigned long)firstN, (unsigned long)nextN, (unsigned long)meta.acked,
+             (unsigned long)(nextN - 1 - meta.acked), (unsigned long)segments,
+             ready ? (unsigned)(LittleFS.usedBytes() / 1024) : 0);
+    reply(line);
+    snprintf(line, sizeof(line),
+             "LOG appended=%lu failed=%lu replayed=%lu replaying=%lu acks=%lu trimmed=%lu lost=%lu",
+             (unsigned long)stats.appended, (unsigned long)stats.failed, (unsigned long)stats.replayed,
+             (unsigned long)(replayNext <= replayEnd ? replayEnd - replayNext + 1 : 0), (unsigned long)stats.acks,
+             (unsigned long)stats.trimmed, (unsigned long)stats.lost);
+    reply(line);
+}
+
+#else
+
+uint32_t productLogEpoch() {
+    return 0;
+}
+
+uint32_t productLogFirst() {
+    return 0;
+}
+
+void productLogStatus(CommandReplyFn reply) {
+    reply("LOG durable product log needs a build with TERELINA_USE_PRODUCT_LOG");
+}
+
+#endif // TERELINA_USE_PRODUCT_LOG
@@ -0,0 +1,61 @@
+#ifndef PRODUCT_LOG_H
+#define PRODUCT_LOG_H
+
+#include <Arduino.h>
+#include "commands.h"
+
+/**
+ * @brief Opens (or creates) the durable product log on LittleFS.
+ * Every counted product is written to flash before it is published and
+ * stays there until the backend acknowledges that it is committed to the
+ * database. Only built with TERELINA_USE_PRODUCT_LOG.
+ */
+void setupProductLog();
+
+/**
+ * @brief Appends a product (the beam just cleared) and syncs it to flash.
+ * @return Its log number, sent with the product and acknowledged by the
+ * backend; 0 if the log is unavailable.
+ */
+uint32_t productLogAppend(uint32_t clearedMs, uint32_t dwellMs);
+
+/**
+ * @brief Random id of this log, created with it. Log numbers restart at 1
+ * in a new epoch (e.g. after the flash was erased), so the backend tracks
+ * acknowledgments per (device, epoch). 0 when built without the log.
+ */
+uint32_t productLogEpoch();
+
+/**
+ * @brief Oldest log number still in flash. Unacknowledged numbers below it
+ * were dropped by the flash bound and will never be sent: the backend
+ * acknowledges past them instead of waiting. 0 when built without the log.
+ */
+uint32_t productLogFirst();
+
+/**
+ * @brief Must be called once subscribed to MQTT_TOPIC_ACK on a new session.
+ * The retained acknowledgment arrives right after; the replay of products
+ * left from before a reboot waits for it, so only unacknowledged ones are sent.
+ */
+void productLogOnConnect();
+
+/**
+ * @brief Handles an acknowledgment "<epoch>,<n>": every product up to n is
+ * committed. Whole log segments below it are deleted.
+ */
+void productLogHandleAck(const uint8_t* payload, size_t length);
+
+/**
+ * @brief Replays unacknowledged products as backlog records: those left
+ * from before a reboot, and any not acknowledged within LOG_RESEND_AFTER_MS.
+ * Non-blocking. Call this in every main loop() iteration.
+ */
+void handleProductLog();
+
+/**
+ * @brief Writes the log range, acknowledgment point, flash usage and replay counters.
+ */
+void productLogStatus(CommandReplyFn reply);
+
+#endif // PRODUCT_LOG_H
@@ -0,0 +1,212 @@
+/**
+ * @file profiler.cpp
+ * @brief Low-overhead statistical profiler for both ESP32 cores.
+ *
+ * Each core's FreeRTOS tick interrupt (1 kHz) records the program counter of
+ * the code it interrupted. On interrupt entry the Xtensa port saves the
+ * interrupted context on the task stack and stores that stack pointer in the
+ * first field of the task's TCB (pxTopOfStack), so the PC is read straight
+ * from the saved exception frame. Samples go into a fixed open-addressing
+ * histogram per core: no allocation, no locks. The cycles spent in the hook
+ * are measured with the core's cycle counter and reported by "prof status".
+ */
+
+#include "profiler.h"
+
+#include <esp_freertos_hooks.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/xtensa_context.h>
+#include <xtensa/hal.h>
+
+// =====================================================================
+// Histogram Storage
+// =====================================================================
+static constexpr int      PROF_CORES      = 2;
+static constexpr uint32_t PROF_TABLE_BITS = 8;                    // 256 entries per core
+static constexpr uint32_t PROF_TABLE_SIZE = 1u << PROF_TABLE_BITS;
+static constexpr uint32_t PROF_MAX_PROBE  = 8;                    // Linear probe length before dropping
+
+struct ProfEntry {
+    uint32_t pc;
+    uint32_t count;
+};
+
+// Each table is written only by its own core's tick ISR, so no locking is needed.
+static ProfEntry profTable[PROF_CORES][PROF_TABLE_SIZE];
+static volatile uint32_t profSamples[PROF_CORES];
+static volatile uint32_t profDropped[PROF_CORES];
+static volatile uint32_t profTickCount[PROF_CORES];
+static volatile uint32_t profDivider = 1;
+static volatile bool     profRunning = false;
+
+// Hook overhead per core: calls, total and worst cycles, since the last start or clear
+static volatile uint32_t profHookCalls[PROF_CORES];
+static volatile uint64_t profHookCycles[PROF_CORES];
+static volatile uint32_t profHookMaxCycles[PROF_CORES];
+static uint32_t profStartedMs = 0;
+static uint32_t profStoppedMs = 0;
+
+// =====================================================================
+// Sampling (runs in the tick interrupt)
+// =====================================================================
+
+static inline void IRAM_ATTR recordSample(int core, uint32_t pc) {
+    // Fibonacci hashing of the word address
+    uint32_t slot = ((pc >> 2) * 2654435761u) >> (32 - PROF_TABLE_BITS);
+
+    for (uint32_t probe = 0; probe < PROF_MAX_PROBE; probe++) {
+        ProfEntry& e = profTable[core][(slot + probe) & (PROF_TABLE_SIZE - 1)];
+        if (e.pc == pc) {
+            e.count++;
+            profSamples[core]++;
+            return;
+        }
+        if (e.pc == 0) {
+            e.pc = pc;
+            e.count = 1;
+            profSamples[core]++;
+            return;
+        }
+    }
+    profDropped[core]++;
+}
+
+static inline void IRAM_ATTR sampleTick(int core) {
+    if (++profTickCount[core] < profDivider) {
+        return;
+    }
+    profTickCount[core] = 0;
+
+    TaskHandle_t task = xTaskGetCurrentTaskHandleForCPU(core);
+    if (task == nullptr) {
+        return;
+    }
+    const XtExcFrame* frame = *(const XtExcFrame* const*)task;
+    recordSample(core, (uint32_t)frame->pc);
+}
+
+static void IRAM_ATTR profTickHook() {
+    uint32_t started = xthal_get_ccount();
+    int core = xPortGetCoreID();
+    sampleTick(core);
+
+    uint32_t cycles = xthal_get_ccount() - started;
+    profHookCalls[core]++;
+    profHookCycles[core] += cycles;
+    if (cycles > profHookMaxCycles[core]) {
+        profHookMaxCycles[core] = cycles;
+    }
+}
+
+static void resetHookStats() {
+    for (int core = 0; core < PROF_CORES; core++) {
+        profHookCalls[core] = 0;
+        profHookCycles[core] = 0;
+        profHookMaxCycles[core] = 0;
+    }
+    profStartedMs = millis();
+}
+
+// =====================================================================
+// Public Functions (defined in profiler.h)
+// =====================================================================
+
+bool profilerStart(uint32_t tickDivider) {
+    profDivider = tickDivider > 0 ? tickDivider : 1;
+    if (profRunning) {
+        return true;
+    }
+
+    resetHookStats();
+    for (int core = 0; core < PROF_CORES; core++) {
+        profTickCount[core] = 0;
+        if (esp_register_freertos_tick_hook_for_cpu(profTickHook, core) != ESP_OK) {
+            for (int installed = 0; installed < core; installed++) {
+                esp_deregister_freertos_tick_hook_for_cpu(profTickHook, installed);
+            }
+            return false;
+        }
+    }
+    profRunning = true;
+    Serial.printf("[PROF] Sampling started (every %lu tick(s)).\n", (unsigned long)profDivider);
+    return true;
+}
+
+void profilerStop() {
+    if (!profRunning) {
+        return;
+    }
+    for (int core = 0; core < PROF_CORES; core++) {
+        esp_deregister_freertos_tick_hook_for_cpu(profTickHook, core);
+    }
+    profRunning = false;
+    profStoppedMs = millis();
+    Serial.println(F("[PROF] Sampling stopped."));
+}
+
+void profilerClear() {
+    bool wasRunning = profRunning;
+    profilerStop();
+    memset(profTable, 0, sizeof(profTable));
+    for (int core = 0; core < PROF_CORES; core++) {
+        profSamples[core] = 0;
+        profDropped[core] = 0;
+    }
+    resetHookStats();
+    profStoppedMs = profStartedMs;
+    if (wasRunning) {
+        profilerStart(profDivider);
+    }
+}
+
+bool profilerIsRunning() {
+    return profRunning;
+}
+
+void profilerStatus(CommandReplyFn reply) {
+    char line[128];
+    uint32_t elapsedMs = (profRunning ? millis() : profStoppedMs) - profStartedMs;
+    uint64_t elapsedCycles = (uint64_t)elapsedMs * getCpuFrequencyMhz() * 1000u;
+
+    snprintf(line, sizeof(line), "PROF STATUS running=%d divider=%lu samples=%lu dropped=%lu",
+             profRunning ? 1 : 0, (unsigned long)profDivider,
+             (unsigned long)(profSamples[0] + profSamples[1]),
+             (unsigned long)(profDropped[0] + profDropped[1]));
+    reply(line);
+
+    // The 64-bit totals are read without a lock: at worst slightly off while sampling
+    for (int core = 0; core < PROF_CORES; core++) {
+        uint32_t calls = profHookCalls[core];
+        uint64_t cycles = profHookCycles[core];
+        snprintf(line, sizeof(line), "PROF HOOK core=%d calls=%lu avg_cycles=%lu max_cycles=%lu cpu=%.4f%%",
+                 core, (unsigned long)calls, (unsigned long)(calls ? cycles / calls : 0),
+                 (unsigned long)profHookMaxCycles[core],
+                 elapsedCycles ? 100.0 * (double)cycles / (double)elapsedCycles : 0.0);
+        reply(line);
+    }
+}
+
+void profilerDump(CommandReplyFn reply) {
+    char line[128];
+
+    snprintf(line, sizeof(line), "PROF BEGIN samples=%lu dropped=%lu divider=%lu",
+             (unsigned long)(profSamples[0] + profSamples[1]),
+             (unsigned long)(profDropped[0] + profDropped[1]),
+             (unsigned long)profDivider);
+    reply(line);
+
+    // Entries are read while sampling may continue; each field is a single
+    // aligned 32-bit word, so a line is at worst one sample behind.
+    for (int core = 0; core < PROF_CORES; core++) {
+        for (uint32_t i = 0; i < PROF_TABLE_SIZE; i++) {
+            const ProfEntry& e = profTable[core][i];
+            if (e.pc != 0) {
+                snprintf(line, sizeof(line), "PROF %d %08lx %lu",
+                         core, (unsigned long)e.pc, (unsigned long)e.count);
+                reply(line);
+            }
+        }
+    }
+    reply("PROF END");
+}
@@ -0,0 +1,49 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+#include "commands.h"
+
+/**
+ * @brief Starts statistical PC sampling on both cores.
+ * The interrupted program counter of each core is recorded from the FreeRTOS
+ * tick interrupt into a fixed per-core histogram. Safe to call while running
+ * (only the divider changes).
+ * @param tickDivider Sample every N ticks (1 tick = 1 ms at the default 1 kHz).
+ * @return True if the tick hooks were installed.
+ */
+bool profilerStart(uint32_t tickDivider);
+
+/**
+ * @brief Stops sampling. The histogram is kept until profilerClear().
+ */
+void profilerStop();
+
+/**
+ * @brief Empties the histogram and resets the sample counters.
+ */
+void profilerClear();
+
+/**
+ * @return True while sampling is active.
+ */
+bool profilerIsRunning();
+
+/**
+ * @brief Writes the sampling state and the cost of the tick hook:
+ *   "PROF STATUS running=<0|1> divider=<n> samples=<n> dropped=<n>"
+ *   "PROF HOOK core=<n> calls=<n> avg_cycles=<n> max_cycles=<n> cpu=<percent>%"
+ * Hook figures cover every tick since the last start or clear, sampled or not.
+ */
+void profilerStatus(CommandReplyFn reply);
+
+/**
+ * @brief Writes the histogram as text lines:
+ *   "PROF BEGIN samples=<n> dropped=<n> divider=<n>"
+ *   "PROF <core> <pc hex> <count>"  (one per histogram entry)
+ *   "PROF END"
+ * Symbolize on the host with tools/symbolize_profile.py and the firmware ELF.
+ */
+void profilerDump(CommandReplyFn reply);
+
+#endif // PROFILER_H
@@ -0,0 +1,101 @@
+/**
+ * @file pulse_decoder.cpp
+ * @brief Edge debouncing and RMT block decoding (see pulse_decoder.h).
+ */
+
+#include "pulse_decoder.h"
+
+// =====================================================================
+// Public Functions (defined in pulse_decoder.h)
+// =====================================================================
+
+PulseDebouncer::PulseDebouncer(uint32_t debounceUs, bool initialInterrupted, uint64_t startUs)
+    : debounceUs_(debounceUs),
+      stable_(initialInterrupted),
+      stableSinceUs_(startUs),
+      raw_(initialInterrupted),
+      rawSinceUs_(startUs) {}
+
+bool PulseDebouncer::edge(bool interrupted, uint64_t tUs, PulseEvent& out) {
+    if (interrupted == raw_) {
+        return false;
+    }
+    if (tUs < rawSinceUs_) {
+        tUs = rawSinceUs_;  // Never go back in time (receive latency jitter)
+    }
+
+    // The level held until this edge may have lasted long enough to confirm
+    bool confirmed = advance(tUs, out);
+
+    if (raw_ == stable_ && !pending_) {
+        pending_ = true;
+        pendingStartUs_ = tUs;
+    }
+    raw_ = interrupted;
+    rawSinceUs_ = tUs;
+    return confirmed;
+}
+
+bool PulseDebouncer::advance(uint64_t nowUs, PulseEvent& out) {
+    if (!pending_ || nowUs < rawSinceUs_ || nowUs - rawSinceUs_ < debounceUs_) {
+        return false;
+    }
+    pending_ = false;
+    if (raw_ == stable_) {
+        // Bounced back before debounceUs: the excursion was noise
+        glitches_++;
+        return false;
+    }
+
+    out.interrupted = raw_;
+    out.edgeUs = pendingStartUs_;
+    uint64_t width = pendingStartUs_ - stableSinceUs_;
+    out.widthUs = width > UINT32_MAX ? UINT32_MAX : (uint32_t)width;
+
+    stable_ = raw_;
+    stableSinceUs_ = pendingStartUs_;
+    return true;
+}
+
+size_t decodeRmtBlock(const uint32_t* items, size_t count, uint64_t rxUs, const RmtTiming& timing,
+                      PulseDebouncer& debouncer, PulseEventFn onEvent, void* ctx) {
+    // Item layout: duration0 [14:0], level0 [15], duration1 [30:16], level1 [31]
+    uint64_t totalTicks = 0;
+    for (size_t i = 0; i < count * 2; i++) {
+        uint32_t field = (items[i / 2] >> ((i & 1) * 16)) & 0xFFFF;
+        uint32_t duration = field & 0x7FFF;
+        if (duration == 0) {
+            break;
+        }
+        totalTicks += duration;
+    }
+
+    uint64_t spanUs = (totalTicks + timing.idleTicks) * timing.tickNs / 1000;
+    uint64_t startUs = rxUs > spanUs ? rxUs - spanUs : 0;
+    if (startUs < debouncer.lastEdgeUs()) {
+        startUs = debouncer.lastEdgeUs();
+    }
+
+    size_t edges = 0;
+    uint64_t ticks = 0;
+    PulseEvent event;
+    for (size_t i = 0; i < count * 2; i++) {
+        uint32_t field = (items[i / 2] >> ((i & 1) * 16)) & 0xFFFF;
+        uint32_t duration = field & 0x7FFF;
+        bool level = (field & 0x8000) != 0;
+        bool interrupted = timing.activeLow ? !level : level;
+
+        uint64_t tUs = startUs + ticks * timing.tickNs / 1000;
+        if (interrupted != debouncer.rawInterrupted()) {
+            edges++;
+        }
+        if (debouncer.edge(interrupted, tUs, event) && onEvent) {
+            onEvent(event, ctx);
+        }
+        if (duration == 0) {
+            break;  // Idle level: the line has been quiet since this edge
+        }
+        ticks += duration;
+    }
+    return edges;
+}
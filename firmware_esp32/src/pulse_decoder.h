@@ -0,0 +1,85 @@
+#ifndef PULSE_DECODER_H
+#define PULSE_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Plain C++ only (no Arduino headers): this module is also compiled on the
+// host by tools/rmt_replay.cpp against recorded RMT symbol buffers.
+
+/**
+ * @brief A confirmed (debounced) beam state change.
+ */
+struct PulseEvent {
+    bool     interrupted;  // New state
+    uint64_t edgeUs;       // First raw edge of the change, on the esp_timer clock
+    uint32_t widthUs;      // Duration of the previous state: the dwell when the
+                           // beam clears, the gap when it is interrupted again
+};
+
+/**
+ * @brief Edge-level debouncer behind every sensing backend.
+ *
+ * Fed raw edges with microsecond timestamps. A change is confirmed once the
+ * new level has lasted debounceUs without any further edge; bursts of bounce
+ * around an edge are timestamped at their first edge, so dwell and spacing
+ * are measured from where the beam really started to change. Excursions that
+ * return to the stable level before debounceUs are counted as glitches.
+ */
+class PulseDebouncer {
+public:
+    PulseDebouncer(uint32_t debounceUs, bool initialInterrupted, uint64_t startUs);
+
+    /**
+     * @brief Feeds a raw edge to level `interrupted` at time tUs.
+     * Edges must be in time order; an edge that does not change the level is ignored.
+     * @return True if the edge confirmed a pending change (written to out).
+     */
+    bool edge(bool interrupted, uint64_t tUs, PulseEvent& out);
+
+    /**
+     * @brief Confirms a pending change if no edge happened until nowUs.
+     * @return True if a change was confirmed (written to out).
+     */
+    bool advance(uint64_t nowUs, PulseEvent& out);
+
+    bool     stableInterrupted() const { return stable_; }
+    bool     rawInterrupted() const { return raw_; }
+    uint64_t lastEdgeUs() const { return rawSinceUs_; }
+    uint32_t glitches() const { return glitches_; }
+
+private:
+    uint32_t debounceUs_;
+    bool     stable_;
+    uint64_t stableSinceUs_;
+    bool     raw_;
+    uint64_t rawSinceUs_;
+    bool     pending_ = false;    // Raw level left the stable level, not yet confirmed
+    uint64_t pendingStartUs_ = 0;
+    uint32_t glitches_ = 0;
+};
+
+/**
+ * @brief Timing of an RMT receive channel, needed to place a block's edges in time.
+ */
+struct RmtTiming {
+    uint32_t tickNs;       // Duration of one RMT tick (1000 with clk_div 80)
+    uint32_t idleTicks;    // Receive idle threshold: a block ends after this much silence
+    bool     activeLow;    // Pin level 0 means the beam is interrupted
+};
+
+typedef void (*PulseEventFn)(const PulseEvent& event, void* ctx);
+
+/**
+ * @brief Decodes one RMT receive block into edges and feeds them to the debouncer.
+ *
+ * A block is a sequence of 32-bit RMT items, each holding two (level, duration)
+ * fields; a zero duration marks the idle level that ended the block. The block
+ * is delivered idleTicks after its last edge, so its edges are placed
+ * backwards from rxUs, the time the block was received.
+ * @return Number of edges fed to the debouncer.
+ */
+size_t decodeRmtBlock(const uint32_t* items, size_t count, uint64_t rxUs, const RmtTiming& timing,
+                      PulseDebouncer& debouncer, PulseEventFn onEvent, void* ctx);
+
+#endif // PULSE_DECODER_H
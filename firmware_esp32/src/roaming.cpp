@@ -0,0 +1,221 @@
+/**
+ * @file roaming.cpp
+ * @brief RSSI-trend based roaming policy (see roaming.h).
+ *
+ * The station's auto-reconnect only reacts after the link has failed, which
+ * near the edge of AP coverage means long stalls and reconnect storms. This
+ * policy keeps an EWMA of the RSSI and of its slope, and starts an
+ * asynchronous scan of the current SSID when the average is weak or the trend
+ * predicts a failure. Scans wait for a quiet window (no product in the beam)
+ * unless the link is already near failure. Fruitless scans back off
+ * exponentially, but a link that keeps degrading is re-scanned sooner. It
+ * reassociates only to a clearly stronger BSSID (minGainDb, relaxed as the
+ * current link gets weaker), so two similar APs do not ping-pong.
+ *
+ * A roam pins auto-reconnect to the target BSSID. If the link then stays
+ * down for lockedOutageMs (the AP was switched off, say), the lock is dropped
+ * and the station reconnects to any AP of the SSID.
+ */
+
+#include "roaming.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const int MAX_SCAN_RESULTS = 16;
+
+// =====================================================================
+// Public Functions (defined in roaming.h)
+// =====================================================================
+
+RoamingController::RoamingController(RoamingRadio& radio, const RoamingConfig& config)
+    : radio_(radio), config_(config), backoffMs_(config.scanBackoffMs) {
+    memset(&target_, 0, sizeof(target_));
+}
+
+void RoamingController::tick(uint32_t nowMs, bool quiet) {
+    switch (state_) {
+        case MONITORING:
+            if (!radio_.isConnected()) {
+                // Auto-reconnect owns the link; restart the averages afterwards
+                haveSample_ = false;
+                if (!disconnected_) {
+                    disconnected_ = true;
+                    disconnectedSinceMs_ = nowMs;
+                } else if (bssidLocked_ && nowMs - disconnectedSinceMs_ > config_.lockedOutageMs) {
+                    log("[Roam] Disconnected for %lu ms on a locked BSSID. Reconnecting to any AP.",
+                        (unsigned long)(nowMs - disconnectedSinceMs_));
+                    radio_.reconnectAny();
+                    bssidLocked_ = false;
+                }
+                return;
+            }
+            disconnected_ = false;
+            sampleRssi(nowMs);
+            if (wantsScan(nowMs, quiet) && radio_.startScan()) {
+                stats_.scans++;
+                lastScanMs_ = nowMs;
+                rssiAtLastScan_ = stats_.rssiAvg;
+                scannedOnce_ = true;
+                state_ = SCANNING;
+            }
+            break;
+
+        case SCANNING: {
+            RoamCandidate results[MAX_SCAN_RESULTS];
+            int count = radio_.scanResults(results, MAX_SCAN_RESULTS);
+            if (count >= 0) {
+                state_ = MONITORING;
+                evaluateScan(nowMs, results, count);
+            }
+            break;
+        }
+
+        case ROAMING: {
+            uint8_t bssid[6];
+            radio_.currentBssid(bssid);
+            if (radio_.isConnected() && memcmp(bssid, target_.bssid, 6) == 0) {
+                uint32_t latency = nowMs - roamStartMs_;
+                stats_.roams++;
+                stats_.lastRoamLatencyMs = latency;
+                if (latency > stats_.maxRoamLatencyMs) {
+                    stats_.maxRoamLatencyMs = latency;
+                }
+                log("[Roam] Roamed in %lu ms", (unsigned long)latency);
+                lastRoamMs_ = nowMs;
+                roamedOnce_ = true;
+                haveSample_ = false;
+                backoffMs_ = config_.scanBackoffMs;
+                state_ = MONITORING;
+            } else if (nowMs - roamStartMs_ > config_.roamTimeoutMs) {
+                stats_.failedRoams++;
+                log("[Roam] Roam timed out after %lu ms. Reconnecting to any AP.",
+                    (unsigned long)(nowMs - roamStartMs_));
+                radio_.reconnectAny();
+                bssidLocked_ = false;
+                lastRoamMs_ = nowMs;
+                roamedOnce_ = true;
+                haveSample_ = false;
+                backOff();
+                state_ = MONITORING;
+            }
+            break;
+        }
+    }
+}
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+void RoamingController::sampleRssi(uint32_t nowMs) {
+    if (haveSample_ && nowMs - lastSampleMs_ < config_.sampleIntervalMs) {
+        return;
+    }
+    float rssi = (float)radio_.rssi();
+
+    if (!haveSample_) {
+        stats_.rssiAvg = rssi;
+        stats_.rssiSlope = 0;
+        haveSample_ = true;
+    } else {
+        float dtS = (nowMs - lastSampleMs_) / 1000.0f;
+        float previous = stats_.rssiAvg;
+        stats_.rssiAvg += config_.rssiAlpha * (rssi - stats_.rssiAvg);
+        float slope = (stats_.rssiAvg - previous) / dtS;
+        stats_.rssiSlope += config_.slopeAlpha * (slope - stats_.rssiSlope);
+    }
+    lastSampleMs_ = nowMs;
+
+    // Signal recovered: forget the backoff built up by fruitless scans
+    if (stats_.rssiAvg > config_.scanThresholdDbm + 5) {
+        backoffMs_ = config_.scanBackoffMs;
+    }
+}
+
+bool RoamingController::wantsScan(uint32_t nowMs, bool quiet) const {
+    if (!haveSample_) {
+        return false;
+    }
+    if (roamedOnce_ && nowMs - lastRoamMs_ < config_.holdDownMs) {
+        return false;
+    }
+    if (scannedOnce_) {
+        // A link that keeps degrading is re-scanned without waiting for the full backoff
+        uint32_t sinceScan = nowMs - lastScanMs_;
+        bool degraded = stats_.rssiAvg <= rssiAtLastScan_ - config_.rescanDropDb;
+        if (sinceScan < config_.minScanIntervalMs || (sinceScan < backoffMs_ && !degraded)) {
+            return false;
+        }
+    }
+
+    float predicted = stats_.rssiAvg + stats_.rssiSlope * config_.trendHorizonS;
+    bool weak = stats_.rssiAvg < config_.scanThresholdDbm;
+    bool fading = stats_.rssiSlope < 0 && predicted < config_.linkFailDbm;
+    bool urgent = stats_.rssiAvg < config_.urgentDbm;
+
+    return (weak || fading) && (quiet || urgent);
+}
+
+void RoamingController::evaluateScan(uint32_t nowMs, const RoamCandidate* results, int count) {
+    uint8_t current[6];
+    radio_.currentBssid(current);
+
+    const RoamCandidate* best = nullptr;
+    for (int i = 0; i < count; i++) {
+        if (memcmp(results[i].bssid, current, 6) == 0) {
+            continue;
+        }
+        if (!best || results[i].rssi > best->rssi) {
+            best = &results[i];
+        }
+    }
+
+    if (!best || best->rssi < stats_.rssiAvg + requiredGain()) {
+        log("[Roam] Scan found no better AP (current %d dBm, best %d dBm).",
+            (int)stats_.rssiAvg, best ? (int)best->rssi : 0);
+        backOff();
+        return;
+    }
+
+    log("[Roam] Roaming to %02X:%02X:%02X:%02X:%02X:%02X ch %d (%d dBm, current %d dBm).",
+        best->bssid[0], best->bssid[1], best->bssid[2], best->bssid[3], best->bssid[4], best->bssid[5],
+        (int)best->channel, (int)best->rssi, (int)stats_.rssiAvg);
+    target_ = *best;
+    roamStartMs_ = nowMs;
+    if (radio_.connectTo(target_)) {
+        bssidLocked_ = true;
+        state_ = ROAMING;
+    } else {
+        stats_.failedRoams++;
+        backOff();
+    }
+}
+
+float RoamingController::requiredGain() const {
+    float span = (float)(config_.scanThresholdDbm - config_.urgentDbm);
+    float weakness = (config_.scanThresholdDbm - stats_.rssiAvg) / span;
+    if (weakness < 0) weakness = 0;
+    if (weakness > 1) weakness = 1;
+    return config_.minGainDb - weakness * (config_.minGainDb - config_.minGainWeakDb);
+}
+
+void RoamingController::backOff() {
+    backoffMs_ *= 2;
+    if (backoffMs_ > config_.maxScanBackoffMs) {
+        backoffMs_ = config_.maxScanBackoffMs;
+    }
+}
+
+void RoamingController::log(const char* fmt, ...) {
+    if (!log_) {
+        return;
+    }
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    log_(buf);
+}
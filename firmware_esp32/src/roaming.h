@@ -0,0 +1,130 @@
+#ifndef ROAMING_H
+#define ROAMING_H
+
+#include <stdint.h>
+
+// Plain C++ only (no Arduino headers): this module is also compiled on the
+// host by tools/roaming_sim.cpp against a scripted radio.
+
+/**
+ * @brief One access point found by a scan.
+ */
+struct RoamCandidate {
+    uint8_t bssid[6];
+    int32_t channel;
+    int32_t rssi;
+};
+
+/**
+ * @brief The WiFi operations the roaming policy needs.
+ * Implemented over the Arduino WiFi API in wifi_manager.cpp and by a scripted
+ * mock in tools/roaming_sim.cpp.
+ */
+class RoamingRadio {
+public:
+    virtual ~RoamingRadio() {}
+    virtual bool isConnected() = 0;
+    virtual int32_t rssi() = 0;
+    virtual void currentBssid(uint8_t out[6]) = 0;
+    /** @brief Starts an asynchronous scan for the current SSID. */
+    virtual bool startScan() = 0;
+    /** @brief Copies up to maxResults scan results. Returns -1 while the scan is running. */
+    virtual int scanResults(RoamCandidate* out, int maxResults) = 0;
+    /**
+     * @brief Reassociates to a specific BSSID of the current SSID. The lock
+     * stays in effect for auto-reconnect until reconnectAny(), but must not
+     * outlive a reboot.
+     */
+    virtual bool connectTo(const RoamCandidate& target) = 0;
+    /** @brief Drops any BSSID lock and reconnects to the best AP of the SSID. */
+    virtual void reconnectAny() = 0;
+};
+
+/**
+ * @brief Thresholds of the roaming policy. The defaults suit a single-SSID hall.
+ */
+struct RoamingConfig {
+    uint32_t sampleIntervalMs = 1000;   // RSSI sampling period while connected
+    float    rssiAlpha        = 0.3f;   // EWMA weight of a new RSSI sample
+    float    slopeAlpha       = 0.2f;   // EWMA weight of a new slope sample (dB/s)
+    int32_t  scanThresholdDbm = -70;    // Look for a better AP below this average
+    int32_t  urgentDbm        = -80;    // Below this, scan even outside a quiet window
+    int32_t  linkFailDbm      = -85;    // Level at which the link is expected to drop
+    uint32_t trendHorizonS    = 10;     // Scan early if the trend reaches linkFailDbm within this
+    int32_t  minGainDb        = 8;      // A candidate must be this much stronger (hysteresis)...
+    int32_t  minGainWeakDb    = 4;      // ...relaxed linearly down to this at urgentDbm
+    uint32_t scanBackoffMs    = 30000;  // Minimum time between scans, doubled when nothing better is found
+    uint32_t maxScanBackoffMs = 240000;
+    int32_t  rescanDropDb     = 5;      // ...unless the average fell this much since the last scan
+    uint32_t minScanIntervalMs = 5000;  // Absolute minimum time between scans
+    uint32_t holdDownMs       = 20000;  // No scan right after a roam
+    uint32_t roamTimeoutMs    = 8000;   // Give up on the target AP after this
+    uint32_t lockedOutageMs   = 15000;  // Disconnected this long after a roam: drop the BSSID lock
+};
+
+/**
+ * @brief Roaming counters, reported by the "wifi status" command.
+ */
+struct RoamingStats {
+    uint32_t scans = 0;
+    uint32_t roams = 0;
+    uint32_t failedRoams = 0;
+    uint32_t lastRoamLatencyMs = 0;  // Reassociation request until connected with an IP
+    uint32_t maxRoamLatencyMs = 0;
+    float    rssiAvg = 0;
+    float    rssiSlope = 0;          // dB per second, negative when the signal is fading
+};
+
+typedef void (*RoamLogFn)(const char* line);
+
+/**
+ * @brief Proactive roaming: tracks the RSSI trend of the current AP, scans in
+ * quiet windows when the link is weak or fading, and reassociates to a
+ * clearly stronger BSSID before the link fails.
+ */
+class RoamingController {
+public:
+    explicit RoamingController(RoamingRadio& radio, const RoamingConfig& config = RoamingConfig());
+
+    /**
+     * @brief Advances the policy. Call this in every main loop() iteration.
+     * @param nowMs Current time in milliseconds.
+     * @param quiet True when a short off-channel scan will not disturb counting.
+     */
+    void tick(uint32_t nowMs, bool quiet);
+
+    const RoamingStats& stats() const { return stats_; }
+    void setLogger(RoamLogFn log) { log_ = log; }
+
+private:
+    enum State { MONITORING, SCANNING, ROAMING };
+
+    void sampleRssi(uint32_t nowMs);
+    bool wantsScan(uint32_t nowMs, bool quiet) const;
+    void evaluateScan(uint32_t nowMs, const RoamCandidate* results, int count);
+    float requiredGain() const;
+    void backOff();
+    void log(const char* fmt, ...);
+
+    RoamingRadio& radio_;
+    RoamingConfig config_;
+    RoamingStats stats_;
+    RoamLogFn log_ = nullptr;
+
+    State state_ = MONITORING;
+    bool haveSample_ = false;
+    uint32_t lastSampleMs_ = 0;
+    uint32_t lastScanMs_ = 0;
+    uint32_t lastRoamMs_ = 0;
+    uint32_t roamStartMs_ = 0;
+    uint32_t backoffMs_;
+    float rssiAtLastScan_ = 0;
+    bool scannedOnce_ = false;
+    bool roamedOnce_ = false;
+    bool bssidLocked_ = false;       // A roam pinned auto-reconnect to target_
+    bool disconnected_ = false;
+    uint32_t disconnectedSinceMs_ = 0;
+    RoamCandidate target_;
+};
+
+#endif // ROAMING_H
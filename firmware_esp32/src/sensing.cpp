@@ -0,0 +1,443 @@
+/**
+ * @file sensing.cpp
+ * @brief Network-independent beam acquisition (see sensing.h).
+ *
+ * The sensing task owns SENSOR_PIN: it turns raw edges into debounced state
+ * changes (PulseDebouncer) and hands them to the main loop through a queue,
+ * each with the timestamp of its first raw edge and the width of the state
+ * it ended (dwell or gap). A main loop stalled by a reconnect therefore
+ * delays publishing, never detection or timing.
+ *
+ * Three acquisition backends; the first two feed the same debouncer:
+ *  - Polling (default): the pin is read every 1 ms tick.
+ *  - RMT (TERELINA_USE_RMT): the RMT receiver timestamps every level in
+ *    hardware with 0.5 us ticks and delivers a block of symbols once the
+ *    line has been idle for RMT_IDLE_TICKS, so bounce and noise around an
+ *    edge cost no CPU interrupt per edge. Pulses under ~2.5 us are removed by
+ *    the RMT input filter. Levels longer than the idle threshold end a
+ *    block; the next block is placed in time from its receive timestamp.
+ *  - Light curtain (TERELINA_USE_CURTAIN): all of CURTAIN_PINS are read from
+ *    the GPIO input registers in one snapshot per 1 ms tick, gathered into a
+ *    bitmask and segmented by CurtainSegmenter, which also profiles each
+ *    product (width, position, broken/folded flags).
+ *
+ * With a belt encoder (TERELINA_USE_ENCODER) the task also samples the PCNT
+ * count on every iteration, and each confirmed change is stamped with the
+ * belt position at its first edge (BeltTracker), giving product length and
+ * spacing in mm whatever the belt speed.
+ *
+ * After every change the task also publishes its counters to a sequence
+ * lock (live_counters.h), which readers such as the Modbus server copy
+ * without ever blocking the task.
+ */
+
+#include "sensing.h"
+#include "config.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#if defined(TERELINA_USE_RMT)
+#include <driver/rmt.h>
+#elif defined(TERELINA_USE_CURTAIN)
+#include <soc/gpio_reg.h>
+#endif
+
+#ifdef TERELINA_USE_ENCODER
+#include "encoder.h"
+#endif
+
+// =====================================================================
+// Settings and State
+// =====================================================================
+static constexpr size_t   SENSING_QUEUE_LENGTH = 32;
+static constexpr uint32_t SENSING_STACK_BYTES  = 3072;
+static constexpr UBaseType_t SENSING_PRIORITY  = 5;   // Above loop() (1), below WiFi (on core 0)
+static constexpr int      SENSING_CORE         = 1;
+
+#ifdef TERELINA_USE_RMT
+static constexpr rmt_channel_t RMT_RX_CHANNEL  = RMT_CHANNEL_4;
+static constexpr uint8_t  RMT_CLK_DIV          = 40;     // 80 MHz APB / 40 = 0.5 us ticks
+static constexpr uint32_t RMT_TICK_NS          = 500;
+static constexpr uint16_t RMT_IDLE_TICKS       = 30000;  // 15 ms; must fit a 15-bit symbol duration
+static constexpr uint8_t  RMT_FILTER_APB_TICKS = 200;    // Drop pulses shorter than 2.5 us
+static constexpr uint8_t  RMT_MEM_BLOCKS       = 4;      // 256 symbols per block (channels 4..7)
+static constexpr size_t   RMT_RING_BYTES       = 4096;
+
+static constexpr size_t   RECORD_MAX_BLOCKS    = 4;
+static constexpr size_t   RECORD_MAX_ITEMS     = 64 * RMT_MEM_BLOCKS;
+#endif
+
+static QueueHandle_t eventQueue = nullptr;
+static PulseDebouncer debouncer(0, false, 0);
+
+#ifdef TERELINA_USE_CURTAIN
+static CurtainSegmenter curtain(CurtainConfig{}, 0);
+static ProductShape lastShape = {};
+static uint32_t brokenCount = 0;
+static uint32_t foldedCount = 0;
+static uint32_t edgeCount = 0;
+#endif
+
+#ifdef TERELINA_USE_ENCODER
+static BeltTracker belt(ENCODER_MM_PER_COUNT);
+static BeltStamp lastBelt = {};
+#endif
+
+struct SensingStats {
+    uint32_t events;
+    uint32_t dropped;       // Event queue full (main loop stalled for a long time)
+    uint32_t blocks;        // RMT blocks received
+    uint32_t edges;         // Raw edges decoded from RMT blocks
+    uint32_t lastDwellUs;
+    uint32_t minDwellUs;
+    uint32_t maxDwellUs;
+    uint32_t lastGapUs;
+    uint32_t minGapUs;
+};
+static SensingStats stats = {0, 0, 0, 0, 0, UINT32_MAX, 0, 0, UINT32_MAX};
+static bool firstEvent = true;
+
+static LiveCounters live = {};            // Written by the task only
+static LiveCountersSeqlock liveSnapshot;  // What everyone else reads
+
+#ifdef TERELINA_USE_RMT
+static RingbufHandle_t rmtRing = nullptr;
+static const RmtTiming rmtTiming = {RMT_TICK_NS, RMT_IDLE_TICKS, SENSOR_ACTIVE_LOW};
+
+// Raw blocks captured on request for offline replay (written by the task only)
+static uint32_t recordItems[RECORD_MAX_BLOCKS][RECORD_MAX_ITEMS];
+static size_t   recordCounts[RECORD_MAX_BLOCKS];
+static uint64_t recordRxUs[RECORD_MAX_BLOCKS];
+static volatile size_t recordWanted = 0;
+static volatile size_t recordHave = 0;
+#endif
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static inline bool readBeamInterrupted() {
+    return digitalRead(SENSOR_PIN) == (SENSOR_ACTIVE_LOW ? LOW : HIGH);
+}
+
+/**
+ * @brief Records the encoder count; called on every sensing task iteration.
+ */
+static inline void sampleBelt(uint64_t nowUs) {
+#ifdef TERELINA_USE_ENCODER
+    belt.sample(nowUs, encoderCount());
+#else
+    (void)nowUs;
+#endif
+}
+
+/**
+ * @brief Updates the dwell/gap statistics and queues a confirmed change.
+ * Runs in the sensing task.
+ */
+static void queueEvent(const PulseEvent& event, const ProductShape* shape) {
+    // The width before the first change started at boot, not at an edge
+    if (!firstEvent) {
+        if (event.interrupted) {
+            stats.lastGapUs = event.widthUs;
+            if (event.widthUs < stats.minGapUs) stats.minGapUs = event.widthUs;
+        } else {
+            stats.lastDwellUs = event.widthUs;
+            if (event.widthUs < stats.minDwellUs) stats.minDwellUs = event.widthUs;
+            if (event.widthUs > stats.maxDwellUs) stats.maxDwellUs = event.widthUs;
+        }
+    }
+    firstEvent = false;
+    stats.events++;
+
+    SensorEvent queued;
+    queued.pulse = event;
+    queued.hasShape = shape != nullptr;
+    if (shape) {
+        queued.shape = *shape;
+    }
+#ifdef TERELINA_USE_ENCODER
+    belt.stamp(event, queued.belt);
+    queued.hasBelt = true;
+    lastBelt = queued.belt;
+    if (shape && queued.belt.lengthMm) {
+        queued.shape.lengthMm = queued.belt.lengthMm;  // Measured, not dwell x nominal speed
+    }
+#else
+    queued.hasBelt = false;
+#endif
+    if (xQueueSend(eventQueue, &queued, 0) != pdTRUE) {
+        stats.dropped++;
+    }
+
+    if (!event.interrupted) {
+        live.products++;
+    }
+#ifdef TERELINA_USE_CURTAIN
+    live.glitches = curtain.glitches();
+#else
+    live.glitches = debouncer.glitches();
+#endif
+    live.dropped = stats.dropped;
+    live.lastChangeMs = (uint32_t)(event.edgeUs / 1000);  // Same clock as millis()
+    live.lastDwellMs = stats.lastDwellUs / 1000;
+    live.lastGapMs = stats.lastGapUs / 1000;
+    live.interrupted = event.interrupted ? 1 : 0;
+    live.updates++;
+    liveSnapshot.publish(live);
+}
+
+static void onPulseEvent(const PulseEvent& event, void* ctx) {
+    (void)ctx;
+    queueEvent(event, nullptr);
+}
+
+#if defined(TERELINA_USE_RMT)
+static void recordBlock(const uint32_t* items, size_t count, uint64_t rxUs) {
+    size_t n = recordHave;
+    if (n >= recordWanted) {
+        return;
+    }
+    if (count > RECORD_MAX_ITEMS) {
+        count = RECORD_MAX_ITEMS;
+    }
+    memcpy(recordItems[n], items, count * sizeof(uint32_t));
+    recordCounts[n] = count;
+    recordRxUs[n] = rxUs;
+    recordHave = n + 1;
+}
+
+static bool setupRmt() {
+    rmt_config_t config = RMT_DEFAULT_CONFIG_RX((gpio_num_t)SENSOR_PIN, RMT_RX_CHANNEL);
+    config.clk_div = RMT_CLK_DIV;
+    config.mem_block_num = RMT_MEM_BLOCKS;
+    config.rx_config.filter_en = true;
+    config.rx_config.filter_ticks_thresh = RMT_FILTER_APB_TICKS;
+    config.rx_config.idle_threshold = RMT_IDLE_TICKS;
+
+    if (rmt_config(&config) != ESP_OK || rmt_driver_install(RMT_RX_CHANNEL, RMT_RING_BYTES, 0) != ESP_OK ||
+        rmt_get_ringbuf_handle(RMT_RX_CHANNEL, &rmtRing) != ESP_OK) {
+        return false;
+    }
+    return rmt_rx_start(RMT_RX_CHANNEL, true) == ESP_OK;
+}
+
+static void sensingTask(void* arg) {
+    (void)arg;
+    PulseEvent event;
+    for (;;) {
+        size_t length = 0;
+        // Wake at least every 10 ms to confirm changes once the line is quiet
+        void* items = xRingbufferReceive(rmtRing, &length, pdMS_TO_TICKS(10));
+        uint64_t now = esp_timer_get_time();
+        sampleBelt(now);
+        if (items) {
+            size_t count = length / sizeof(uint32_t);
+            stats.blocks++;
+            stats.edges += decodeRmtBlock((const uint32_t*)items, count, now, rmtTiming, debouncer,
+                                          onPulseEvent, nullptr);
+            recordBlock((const uint32_t*)items, count, now);
+            vRingbufferReturnItem(rmtRing, items);
+        }
+        if (debouncer.advance(now, event)) {
+            onPulseEvent(event, nullptr);
+        }
+    }
+}
+#elif defined(TERELINA_USE_CURTAIN)
+/**
+ * @brief Samples all beams at once: bit i is set when beam i is blocked.
+ */
+static uint32_t readCurtainMask() {
+    // One snapshot of both input registers, so all beams are sampled together
+    uint64_t levels = REG_READ(GPIO_IN_REG) | ((uint64_t)REG_READ(GPIO_IN1_REG) << 32);
+    if (SENSOR_ACTIVE_LOW) {
+        levels = ~levels;
+    }
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < CURTAIN_BEAM_COUNT; i++) {
+        mask |= (uint32_t)((levels >> CURTAIN_PINS[i]) & 1) << i;
+    }
+    return mask;
+}
+
+static void sensingTask(void* arg) {
+    (void)arg;
+    PulseEvent event;
+    ProductShape shape;
+    TickType_t wake = xTaskGetTickCount();
+    for (;;) {
+        uint64_t now = esp_timer_get_time();
+        sampleBelt(now);
+        if (curtain.tick(readCurtainMask(), now, event, shape)) {
+            if (event.interrupted) {
+                queueEvent(event, nullptr);
+            } else {
+                lastShape = shape;
+                if (shape.flags & SHAPE_BROKEN) brokenCount++;
+                if (shape.flags & SHAPE_FOLDED) foldedCount++;
+                if (shape.flags & SHAPE_EDGE) edgeCount++;
+                queueEvent(event, &shape);
+            }
+        }
+        vTaskDelayUntil(&wake, 1);
+    }
+}
+#else
+static void sensingTask(void* arg) {
+    (void)arg;
+    PulseEvent event;
+    TickType_t wake = xTaskGetTickCount();
+    for (;;) {
+        uint64_t now = esp_timer_get_time();
+        sampleBelt(now);
+        if (debouncer.edge(readBeamInterrupted(), now, event)) {
+            onPulseEvent(event, nullptr);
+        }
+        if (debouncer.advance(now, event)) {
+            onPulseEvent(event, nullptr);
+        }
+        vTaskDelayUntil(&wake, 1);
+    }
+}
+#endif
+
+// =====================================================================
+// Public Functions (defined in sensing.h)
+// =====================================================================
+
+void setupSensing(bool initialInterrupted) {
+    debouncer = PulseDebouncer(SENSOR_DEBOUNCE_DELAY_MS * 1000, initialInterrupted, esp_timer_get_time());
+    live.interrupted = initialInterrupted ? 1 : 0;
+    liveSnapshot.publish(live);
+    eventQueue = xQueueCreate(SENSING_QUEUE_LENGTH, sizeof(SensorEvent));
+
+#if defined(TERELINA_USE_RMT)
+    if (!setupRmt()) {
+        Serial.println(F("[Sensor] RMT receiver setup FAILED. Sensor disabled."));
+        return;
+    }
+    Serial.println(F("[Sensor] RMT capture started (0.5 us resolution)."));
+#elif defined(TERELINA_USE_CURTAIN)
+    CurtainConfig config;
+    config.beams = CURTAIN_BEAM_COUNT;
+    config.pitchMm = CURTAIN_BEAM_PITCH_MM;
+    config.beltMmPerS = CURTAIN_BELT_MM_S;
+    config.confirmUs = SENSOR_DEBOUNCE_DELAY_MS * 1000;
+    config.endGapUs = SENSOR_DEBOUNCE_DELAY_MS * 1000;
+    curtain = CurtainSegmenter(config, esp_timer_get_time());
+    for (uint8_t i = 0; i < CURTAIN_BEAM_COUNT; i++) {
+        pinMode(CURTAIN_PINS[i], SENSOR_USE_PULLUP ? INPUT_PULLUP : INPUT);
+    }
+    Serial.printf("[Sensor] Light curtain: %u beams sampled every 1 ms.\n", CURTAIN_BEAM_COUNT);
+#else
+    Serial.println(F("[Sensor] Polling the sensor every 1 ms."));
+#endif
+
+#ifdef TERELINA_USE_ENCODER
+    // Same core as the sensing task, which reads the count
+    if (setupEncoder()) {
+        Serial.printf("[Sensor] Belt encoder on GPIO %d/%d (%.4f mm per count).\n", ENCODER_PIN_A, ENCODER_PIN_B,
+                      ENCODER_MM_PER_COUNT);
+    } else {
+        Serial.println(F("[Sensor] Belt encoder setup FAILED. Events will have no belt position."));
+    }
+#endif
+    xTaskCreatePinnedToCore(sensingTask, "sensing", SENSING_STACK_BYTES, nullptr, SENSING_PRIORITY, nullptr,
+                            SENSING_CORE);
+}
+
+uint32_t sensingCounters(LiveCounters& out) {
+    return liveSnapshot.read(out);
+}
+
+bool sensingNextEvent(SensorEvent& event) {
+    return eventQueue && xQueueReceive(eventQueue, &event, 0) == pdTRUE;
+}
+
+void sensingStatus(CommandReplyFn reply) {
+    char line[160];
+#if defined(TERELINA_USE_RMT)
+    const char* backend = "rmt";
+#elif defined(TERELINA_USE_CURTAIN)
+    const char* backend = "curtain";
+#else
+    const char* backend = "poll";
+#endif
+#ifdef TERELINA_USE_CURTAIN
+    bool interrupted = curtain.present();
+    uint32_t glitches = curtain.glitches();
+#else
+    bool interrupted = debouncer.stableInterrupted();
+    uint32_t glitches = debouncer.glitches();
+#endif
+    snprintf(line, sizeof(line), "SENSE backend=%s state=%s events=%lu glitches=%lu dropped=%lu blocks=%lu edges=%lu",
+             backend, interrupted ? "interrupted" : "clear", (unsigned long)stats.events, (unsigned long)glitches,
+             (unsigned long)stats.dropped, (unsigned long)stats.blocks, (unsigned long)stats.edges);
+    reply(line);
+
+    uint32_t minDwell = stats.minDwellUs == UINT32_MAX ? 0 : stats.minDwellUs;
+    uint32_t minGap = stats.minGapUs == UINT32_MAX ? 0 : stats.minGapUs;
+    snprintf(line, sizeof(line), "SENSE dwell_ms last=%.3f min=%.3f max=%.3f gap_ms last=%.3f min=%.3f",
+             stats.lastDwellUs / 1000.0, minDwell / 1000.0, stats.maxDwellUs / 1000.0, stats.lastGapUs / 1000.0,
+             minGap / 1000.0);
+    reply(line);
+
+#ifdef TERELINA_USE_CURTAIN
+    snprintf(line, sizeof(line),
+             "SENSE shape w_mm=%u len_mm=%u x_mm=%d pieces=%u fill=%u peak=%u flags=%u broken=%lu folded=%lu edge=%lu",
+             lastShape.widthMm, lastShape.lengthMm, lastShape.centerMm, lastShape.pieces, lastShape.fillPct,
+             lastShape.peakPct, lastShape.flags, (unsigned long)brokenCount, (unsigned long)foldedCount,
+             (unsigned long)edgeCount);
+    reply(line);
+#endif
+
+#ifdef TERELINA_USE_ENCODER
+    snprintf(line, sizeof(line), "SENSE belt counts=%lld pos_mm=%.0f mm_s=%.1f len_mm last=%u gap_mm last=%lu",
+             (long long)belt.counts(), (double)belt.counts() * belt.mmPerCount(), belt.speedMmPerS(),
+             lastBelt.lengthMm, (unsigned long)lastBelt.gapMm);
+    reply(line);
+#endif
+}
+
+bool sensingRecord(size_t blocks) {
+#ifdef TERELINA_USE_RMT
+    if (blocks == 0 || blocks > RECORD_MAX_BLOCKS) {
+        blocks = RECORD_MAX_BLOCKS;
+    }
+    recordWanted = 0;
+    recordHave = 0;
+    recordWanted = blocks;
+    return true;
+#else
+    (void)blocks;
+    return false;
+#endif
+}
+
+void sensingDump(CommandReplyFn reply) {
+#ifdef TERELINA_USE_RMT
+    char line[96];
+    size_t have = recordHave;
+    snprintf(line, sizeof(line), "# %u of %u blocks recorded", (unsigned)have, (unsigned)recordWanted);
+    reply(line);
+    snprintf(line, sizeof(line), "rmt %lu %u %d", (unsigned long)RMT_TICK_NS, (unsigned)RMT_IDLE_TICKS,
+             SENSOR_ACTIVE_LOW ? 1 : 0);
+    reply(line);
+    for (size_t b = 0; b < have; b++) {
+        snprintf(line, sizeof(line), "block %llu", (unsigned long long)recordRxUs[b]);
+        reply(line);
+        for (size_t i = 0; i < recordCounts[b]; i += 8) {
+            int n = snprintf(line, sizeof(line), "items");
+            for (size_t k = i; k < i + 8 && k < recordCounts[b]; k++) {
+                n += snprintf(line + n, sizeof(line) - n, " %08lx", (unsigned long)recordItems[b][k]);
+            }
+            reply(line);
+        }
+    }
+#else
+    reply("SENSE raw recording needs the RMT backend (TERELINA_USE_RMT)");
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef SENSING_H
+#define SENSING_H
+
+#include <Arduino.h>
+#include "commands.h"
+#include "pulse_decoder.h"
+#include "curtain.h"
+#include "belt_fusion.h"
+#include "live_counters.h"
+
+/**
+ * @brief A confirmed state change, as queued by the sensing task.
+ */
+struct SensorEvent {
+    PulseEvent   pulse;
+    bool         hasShape;  // Light curtain: set on "clear" with the product's profile
+    ProductShape shape;
+    bool         hasBelt;   // Encoder builds: belt position, product length and spacing
+    BeltStamp    belt;
+};
+
+/**
+ * @brief Starts the sensing task, which reads SENSOR_PIN independently of the
+ * main loop (WiFi and MQTT calls there can block for seconds).
+ * Built with TERELINA_USE_RMT, edges are captured by the RMT peripheral in
+ * blocks with 0.5 us resolution. Built with TERELINA_USE_CURTAIN, the beams
+ * of CURTAIN_PINS are sampled as one bitmask every 1 ms and each product is
+ * profiled (curtain.h). Otherwise SENSOR_PIN is polled every 1 ms.
+ * Built with TERELINA_USE_ENCODER, every change is also stamped with the belt
+ * position from the encoder (belt_fusion.h).
+ * @param initialInterrupted Beam state read at boot.
+ */
+void setupSensing(bool initialInterrupted);
+
+/**
+ * @brief Takes the next debounced state change detected by the sensing task.
+ * @return False if no change is waiting.
+ */
+bool sensingNextEvent(SensorEvent& event);
+
+/**
+ * @brief Copies the sensing task's counters without blocking it (sequence lock).
+ * Safe from any task.
+ * @return Retries needed because the task published during the copy.
+ */
+uint32_t sensingCounters(LiveCounters& out);
+
+/**
+ * @brief Writes the acquisition backend, counters and dwell/gap statistics
+ * (and belt position and speed with an encoder).
+ */
+void sensingStatus(CommandReplyFn reply);
+
+/**
+ * @brief Arms the capture of the next raw RMT blocks ("sense record [blocks]").
+ * @return False if not built with TERELINA_USE_RMT.
+ */
+bool sensingRecord(size_t blocks);
+
+/**
+ * @brief Prints the recorded RMT blocks in the tools/rmt_replay.cpp format.
+ */
+void sensingDump(CommandReplyFn reply);
+
+#endif // SENSING_H
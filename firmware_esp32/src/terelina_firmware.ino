@@ -3,13 +3,22 @@
  * @brief Main firmware for the Terelina Pizza Counter device.
  *
  * This firmware initializes the hardware, connects to WiFi via WiFiManager,
- * connects to MQTT, reads the barrier sensor with debounce, and publishes state changes.
+ * connects to MQTT, reads the barrier sensor with debounce in a dedicated task,
+ * and publishes state changes.
  */
 
 #include <Arduino.h>
 #include "config.h"
 #include "wifi_manager.h"
 #include "mqtt.h"
+#include "commands.h"
+#include "edge_trace.h"
+#include "outbound.h"
+#include "timesync.h"
+#include "sensing.h"
+#include "ulp_counter.h"
+#include "modbus_server.h"
+#include "product_log.h"
 
 // =====================================================================
 // Global State
@@ -21,6 +30,12 @@ bool isBeamInterrupted = false;
 // Timer for the non-blocking heartbeat task.
 unsigned long lastHeartbeatMillis = 0;
 
+// Time of the last confirmed sensor state change (quiet-window detection for roaming).
+unsigned long lastStateChangeMillis = 0;
+
+// True while a jam alarm (beam interrupted for JAM_ALARM_MS) is raised.
+bool jamAlarmActive = false;
+
 
 // =====================================================================
 // SETUP - Runs once on boot.
@@ -34,6 +49,10 @@ void setup() {
     Serial.println();
 
     // --- 1. Configure Hardware Sensor ---
+#ifdef TERELINA_USE_ULP
+    // The ULP coprocessor owns the sensor pin and keeps counting in deep sleep.
+    bool coldBoot = setupUlpCounter();
+#else
     if (SENSOR_USE_PULLUP) {
         pinMode(SENSOR_PIN, INPUT_PULLUP);
         Serial.printf("[HW] Sensor pin %d configured with INPUT_PULLUP.\n", SENSOR_PIN);
@@ -46,15 +65,38 @@ void setup() {
     isBeamInterrupted = (digitalRead(SENSOR_PIN) == (SENSOR_ACTIVE_LOW ? LOW : HIGH));
     Serial.printf("[HW] Initial sensor state: %s\n", isBeamInterrupted ? "INTERRUPTED" : "CLEAR");
 
+    // The sensing task reads the beam from now on, whatever the network does.
+    setupSensing(isBeamInterrupted);
+#endif
+
     // --- 2. Connect to WiFi ---
     // This function is blocking. It will handle the connection, AP portal,
     // and fallback logic automatically.
+#ifdef TERELINA_USE_ULP
+    // After a deep-sleep wake-up only reconnect: the portal would keep the device awake.
+    if (coldBoot) {
+        setupWifi();
+    } else {
+        resumeWifi();
+    }
+#else
     setupWifi();
+#endif
 
     // --- 3. Initialize MQTT Client ---
     Serial.println(F("[MQTT] Initializing MQTT client..."));
     setupMqtt(); // Sets the broker server, port, buffer, etc.
 
+#ifdef TERELINA_USE_MODBUS
+    // --- 4. Modbus TCP Server for the line PLCs ---
+    setupModbus();
+#endif
+
+#ifdef TERELINA_USE_PRODUCT_LOG
+    // --- 5. Durable product log (products are logged from the first loop) ---
+    setupProductLog();
+#endif
+
     Serial.println(F("=========================================="));
     Serial.println(F("System initialized. Starting main loop..."));
     Serial.println();
@@ -71,14 +113,50 @@ void loop() {
     handleMqttConnection();
     loopMqtt();
 
-    // 2. Read the sensor and publish any state changes.
+    // 2. Publish the state changes detected by the sensing task.
     handleSensor();
 
     // 3. Perform periodic tasks, like sending the heartbeat.
     handleTimedTasks();
 
+    // 4. Execute diagnostic commands typed on the Serial Monitor.
+    handleSerialCommands();
+
+    // 5. Finish raw edge captures and upload them in the background.
+    handleTraceTasks();
+
+    // 6. Roam to a stronger AP before the link fails; scan only while the line is quiet.
+    bool sensorQuiet = !isBeamInterrupted && (millis() - lastStateChangeMillis) >= ROAM_QUIET_MS;
+    handleWifiRoaming(sensorQuiet);
+
+    // 7. Send queued MQTT traffic by priority (alarms, live states, heartbeat, backlog, diag, traces).
+    handleOutbound();
+
+    // 8. Keep the clock in sync with the backend (event timestamps use it).
+    handleTimeSync();
+
+#ifdef TERELINA_USE_MODBUS
+    // 9. Answer Modbus TCP polls from the line PLCs.
+    handleModbus();
+#endif
+
+#ifdef TERELINA_USE_PRODUCT_LOG
+    // 10. Replay logged products the backend has not acknowledged.
+    handleProductLog();
+#endif
+
+#ifdef TERELINA_USE_ULP
+    // 11. Go back to deep sleep once the products counted by the ULP are sent.
+    handleUlpSleep();
+#endif
+
+#ifdef TERELINA_LOW_LATENCY
+    // Only let same-priority tasks run: sensing and WiFi preempt loop() anyway.
+    yield();
+#else
     // Small delay to allow the ESP32's background tasks to run.
     delay(1);
+#endif
 }
 
 
@@ -87,30 +165,39 @@ void loop() {
 // =====================================================================
 
 /**
- * @brief Reads the sensor, applies debounce logic, and publishes if the state changes.
+ * @brief Publishes the state changes confirmed by the sensing task.
+ * Detection and debounce run in the sensing task (sensing.cpp), so each change
+ * carries the time of its first edge even if this loop was stalled.
  */
 void handleSensor() {
-    static bool lastStableState = isBeamInterrupted;
-    static bool lastReadState = isBeamInterrupted;
-    static unsigned long lastChangeTime = 0;
-
-    bool currentRead = (digitalRead(SENSOR_PIN) == (SENSOR_ACTIVE_LOW ? LOW : HIGH));
-
-    if (currentRead != lastReadState) {
-        lastReadState = currentRead;
-        lastChangeTime = millis();
-        return;
+#ifdef TERELINA_USE_ULP
+    // The ULP counts the products; they are queued as backlog with their own times.
+    bool interrupted = ulpCounterCollect();
+    if (interrupted != isBeamInterrupted) {
+        isBeamInterrupted = interrupted;
+        lastStateChangeMillis = millis();
     }
-
-    if ((millis() - lastChangeTime) >= SENSOR_DEBOUNCE_DELAY_MS && currentRead != lastStableState) {
-        Serial.printf("[Sensor] State change confirmed: %s -> %s\n",
-                      lastStableState ? "INTERRUPTED" : "CLEAR",
-                      currentRead ? "INTERRUPTED" : "CLEAR");
-
-        lastStableState = currentRead;
-        isBeamInterrupted = currentRead;
-        publishSensorState(isBeamInterrupted);
+#else
+    SensorEvent event;
+    while (sensingNextEvent(event)) {
+        Serial.printf("[Sensor] State change confirmed: %s -> %s (after %lu ms)\n",
+                      isBeamInterrupted ? "INTERRUPTED" : "CLEAR",
+                      event.pulse.interrupted ? "INTERRUPTED" : "CLEAR",
+                      (unsigned long)(event.pulse.widthUs / 1000));
+
+        isBeamInterrupted = event.pulse.interrupted;
+        lastStateChangeMillis = (unsigned long)(event.pulse.edgeUs / 1000); // Same clock as millis()
+        uint32_t logN = 0;
+#ifdef TERELINA_USE_PRODUCT_LOG
+        // A product is complete when the beam clears: log it before publishing
+        if (!isBeamInterrupted) {
+            logN = productLogAppend(lastStateChangeMillis, event.pulse.widthUs / 1000);
+        }
+#endif
+        publishSensorState(isBeamInterrupted, lastStateChangeMillis, event.hasShape ? &event.shape : nullptr,
+                           event.hasBelt ? &event.belt : nullptr, logN);
     }
+#endif
 }
 
 
@@ -130,6 +217,17 @@ void handleTimedTasks() {
         // Also print a general status update for debugging.
         printSystemStatus();
     }
+
+    // --- Jam Alarm ---
+    // A beam that stays interrupted usually means a product is stuck.
+    unsigned long blockedFor = now - lastStateChangeMillis;
+    if (isBeamInterrupted && !jamAlarmActive && blockedFor >= JAM_ALARM_MS) {
+        jamAlarmActive = true;
+        publishAlarm("jam", true, blockedFor);
+    } else if (!isBeamInterrupted && jamAlarmActive) {
+        jamAlarmActive = false;
+        publishAlarm("jam", false, 0);
+    }
 }
 
 /**
@@ -0,0 +1,229 @@
+/**
+ * @file timesync.cpp
+ * @brief Clock synchronization with the backend over MQTT (no NTP needed).
+ *
+ * The device publishes "<seq>,<t1>" on MQTT_TOPIC_TIME_REQ, where t1 is its
+ * monotonic esp_timer clock in microseconds. The backend answers on
+ * MQTT_TOPIC_TIME_RESP with "<seq>,<t1>,<t2>,<t3>" (Unix microseconds when
+ * the request arrived and when the reply left). With t4 the local receive
+ * time, as in NTP:
+ *
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2      rtt = (t4 - t1) - (t3 - t2)
+ *
+ * The broker adds asymmetric, variable delay, so samples with a round trip
+ * well above the recent minimum are rejected, and the offset comes from the
+ * fastest samples. Drift is the least-squares slope of offset over local
+ * time across the retained samples. The poll interval doubles after each
+ * good sample up to TIMESYNC_MAX_POLL_MS, so a converged device sends one
+ * small message pair every ~17 minutes. Several rejections in a row mean the
+ * path itself got slower, so the window is rebuilt at the fast poll rate.
+ */
+
+#include "timesync.h"
+#include "config.h"
+#include "mqtt.h"
+#include <esp_timer.h>
+
+// =====================================================================
+// Settings and State
+// =====================================================================
+static constexpr size_t   TIMESYNC_WINDOW       = 8;
+static constexpr uint32_t TIMESYNC_MIN_POLL_MS  = 2000;
+static constexpr uint32_t TIMESYNC_MAX_POLL_MS  = 1024000;
+static constexpr uint32_t TIMESYNC_TIMEOUT_MS   = 5000;    // Reply considered lost after this
+static constexpr uint32_t TIMESYNC_RTT_SLACK_US = 20000;   // Allowed RTT above 2x the recent minimum
+static constexpr size_t   TIMESYNC_CONVERGED    = 4;       // Samples before backing off
+static constexpr uint8_t  TIMESYNC_MAX_REJECTS  = 4;       // In a row: the path changed, start over
+
+struct SyncSample {
+    int64_t  localUs;   // Midpoint of the exchange on the local clock
+    int64_t  offsetUs;  // Backend time minus local time
+    uint32_t rttUs;
+};
+
+static SyncSample samples[TIMESYNC_WINDOW];
+static size_t sampleCount = 0;
+static size_t sampleNext = 0;
+
+static bool     synced = false;
+static int64_t  refLocalUs = 0;     // Local time at which refOffsetUs applies
+static int64_t  refOffsetUs = 0;
+static double   driftPpm = 0;       // Local clock error in parts per million
+static uint32_t accuracyUs = 0;     // Half the best recent round trip
+
+static uint16_t pendingSeq = 0;
+static int64_t  pendingT1 = 0;
+static bool     pending = false;
+static uint32_t pollIntervalMs = TIMESYNC_MIN_POLL_MS;
+static uint32_t lastPollMs = 0;
+static bool     polledOnce = false;
+static uint32_t accepted = 0;
+static uint32_t rejected = 0;
+static uint32_t lost = 0;
+static uint8_t  rejectsInRow = 0;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static uint32_t minRecentRtt() {
+    uint32_t best = UINT32_MAX;
+    for (size_t i = 0; i < sampleCount; i++) {
+        if (samples[i].rttUs < best) {
+            best = samples[i].rttUs;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Re-estimates offset and drift from the retained samples.
+ */
+static void updateEstimate() {
+    uint32_t minRtt = minRecentRtt();
+    uint32_t goodRtt = minRtt + minRtt / 2 + 5000;
+
+    // The fastest sample gives the offset; its RTT bounds the error
+    const SyncSample* best = nullptr;
+    for (size_t i = 0; i < sampleCount; i++) {
+        if (!best || samples[i].rttUs < best->rttUs ||
+            (samples[i].rttUs == best->rttUs && samples[i].localUs > best->localUs)) {
+            best = &samples[i];
+        }
+    }
+
+    // Drift: least-squares slope of offset(local) over the good samples
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int64_t x0 = best->localUs;
+    int64_t y0 = best->offsetUs;
+    int64_t minX = INT64_MAX, maxX = INT64_MIN;
+    for (size_t i = 0; i < sampleCount; i++) {
+        if (samples[i].rttUs > goodRtt) {
+            continue;
+        }
+        double x = (double)(samples[i].localUs - x0);
+        double y = (double)(samples[i].offsetUs - y0);
+        n++; sx += x; sy += y; sxx += x * x; sxy += x * y;
+        if (samples[i].localUs < minX) minX = samples[i].localUs;
+        if (samples[i].localUs > maxX) maxX = samples[i].localUs;
+    }
+    double denom = n * sxx - sx * sx;
+    // Require 60 s of spread, otherwise the slope is mostly jitter
+    if (n >= 3 && denom > 0 && maxX - minX >= 60000000LL) {
+        driftPpm = (n * sxy - sx * sy) / denom * 1e6;
+    }
+
+    refLocalUs = best->localUs;
+    refOffsetUs = best->offsetUs;
+    accuracyUs = minRtt / 2;
+    synced = true;
+}
+
+static void sendPing() {
+    char payload[48];
+    pendingSeq++;
+    pendingT1 = esp_timer_get_time();
+    int len = snprintf(payload, sizeof(payload), "%u,%lld", pendingSeq, (long long)pendingT1);
+    // Sent directly, not through the outbound queue: queueing would add to the RTT
+    pending = mqttPublish(TOPIC_TIME_REQ, (const uint8_t*)payload, (size_t)len);
+}
+
+// =====================================================================
+// Public Functions (defined in timesync.h)
+// =====================================================================
+
+void handleTimeSync() {
+    if (!isMqttConnected()) {
+        return;
+    }
+    uint32_t now = millis();
+
+    if (pending && now - lastPollMs > TIMESYNC_TIMEOUT_MS) {
+        pending = false;
+        lost++;
+    }
+    if (pending || (polledOnce && now - lastPollMs < pollIntervalMs)) {
+        return;
+    }
+    lastPollMs = now;
+    polledOnce = true;
+    sendPing();
+}
+
+void timesyncHandleResponse(const uint8_t* payload, size_t length) {
+    int64_t t4 = esp_timer_get_time();
+
+    char text[96];
+    size_t len = length < sizeof(text) - 1 ? length : sizeof(text) - 1;
+    memcpy(text, payload, len);
+    text[len] = '\0';
+
+    unsigned int seq;
+    long long t1, t2, t3;
+    if (sscanf(text, "%u,%lld,%lld,%lld", &seq, &t1, &t2, &t3) != 4) {
+        return;
+    }
+    if (!pending || seq != pendingSeq || t1 != pendingT1) {
+        return; // Late or foreign reply
+    }
+    pending = false;
+
+    int64_t rtt = (t4 - t1) - (t3 - t2);
+    if (rtt < 0) {
+        rtt = 0;
+    }
+    int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+    // Outlier rejection: the broker sometimes holds a message for a while
+    uint32_t minRtt = minRecentRtt();
+    if (sampleCount >= TIMESYNC_CONVERGED && (uint64_t)rtt > 2ULL * minRtt + TIMESYNC_RTT_SLACK_US) {
+        rejected++;
+        if (++rejectsInRow >= TIMESYNC_MAX_REJECTS) {
+            // Persistently slower path (e.g. after a roam): rebuild the window,
+            // keeping the current estimate until new samples arrive
+            sampleCount = 0;
+            sampleNext = 0;
+            rejectsInRow = 0;
+            pollIntervalMs = TIMESYNC_MIN_POLL_MS;
+        }
+        return;
+    }
+    rejectsInRow = 0;
+
+    samples[sampleNext] = {t1 + (t4 - t1) / 2, offset, (uint32_t)rtt};
+    sampleNext = (sampleNext + 1) % TIMESYNC_WINDOW;
+    if (sampleCount < TIMESYNC_WINDOW) {
+        sampleCount++;
+    }
+    accepted++;
+    updateEstimate();
+
+    if (sampleCount >= TIMESYNC_CONVERGED && pollIntervalMs < TIMESYNC_MAX_POLL_MS) {
+        pollIntervalMs *= 2;
+    }
+}
+
+bool timesyncIsSynced() {
+    return synced;
+}
+
+int64_t timesyncUnixMs() {
+    if (!synced) {
+        return 0;
+    }
+    int64_t local = esp_timer_get_time();
+    int64_t elapsed = local - refLocalUs;
+    int64_t unixUs = local + refOffsetUs + (int64_t)(elapsed * driftPpm / 1e6);
+    return unixUs / 1000;
+}
+
+void timesyncStatus(CommandReplyFn reply) {
+    char line[160];
+    snprintf(line, sizeof(line),
+             "TIME synced=%d unix_ms=%lld offset_ms=%.3f drift_ppm=%.2f accuracy_ms=%.3f "
+             "poll_s=%lu accepted=%lu rejected=%lu lost=%lu",
+             synced ? 1 : 0, (long long)timesyncUnixMs(), refOffsetUs / 1000.0, driftPpm,
+             accuracyUs / 1000.0, (unsigned long)(pollIntervalMs / 1000), (unsigned long)accepted,
+             (unsigned long)rejected, (unsigned long)lost);
+    reply(line);
+}
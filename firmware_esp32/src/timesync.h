@@ -0,0 +1,37 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <Arduino.h>
+#include "commands.h"
+
+/**
+ * @brief Sends time-sync pings to the backend when due.
+ * Polls every few seconds until converged, then backs off to one ping every
+ * ~17 minutes. Call this in every main loop() iteration.
+ */
+void handleTimeSync();
+
+/**
+ * @brief Processes a time-sync reply "<seq>,<t1_us>,<t2_us>,<t3_us>".
+ * Call as soon as the message arrives: the receive time is taken on entry.
+ */
+void timesyncHandleResponse(const uint8_t* payload, size_t length);
+
+/**
+ * @return True once the offset to backend time has been estimated.
+ */
+bool timesyncIsSynced();
+
+/**
+ * @brief Current backend (Unix) time in milliseconds, derived from the
+ * monotonic esp_timer clock plus the estimated offset and drift.
+ * @return 0 if not synchronized yet.
+ */
+int64_t timesyncUnixMs();
+
+/**
+ * @brief Writes offset, drift, round-trip and accuracy estimates as one line.
+ */
+void timesyncStatus(CommandReplyFn reply);
+
+#endif // TIMESYNC_H
@@ -0,0 +1,232 @@
+/**
+ * @file ulp_counter.cpp
+ * @brief Deep-sleep product counting on the ULP coprocessor (see ulp_counter.h).
+ *
+ * The portable program in ulp_program.cpp is assembled here into ULP macro
+ * instructions and loaded at the start of RTC slow memory, with its data
+ * block at ULP_DATA_ADDR. The ULP timer runs it every ULP_SAMPLE_PERIOD_US.
+ *
+ * Products reach the backend as backlog products. The number of products
+ * known to be sent survives deep sleep in RTC memory, so products that
+ * could not be sent before going back to sleep are collected again on the
+ * next wake-up, as long as they are still in the ULP's timestamp ring
+ * (older ones are sent with the oldest timestamp left).
+ */
+
+#include "ulp_counter.h"
+
+#ifdef TERELINA_USE_ULP
+
+#include "config.h"
+#include "mqtt.h"
+#include "outbound.h"
+#include "product_log.h"
+#include "ulp_program.h"
+#include <driver/rtc_io.h>
+#include <esp32/ulp.h>
+#include <esp_sleep.h>
+#include <soc/rtc_cntl_reg.h>
+#include <soc/rtc_io_reg.h>
+
+// =====================================================================
+// Settings and State
+// =====================================================================
+static constexpr size_t   ULP_MAX_INSNS    = 128;   // Macro instructions before label resolution
+static constexpr uint16_t ULP_LABEL_WAKE   = 200;   // Private labels of the expanded WAKE
+
+// Products confirmed sent to the backend; kept across deep sleep
+static RTC_DATA_ATTR uint16_t publishedProducts = 0;
+static RTC_DATA_ATTR uint32_t wakeUps = 0;
+
+static uint16_t collectedProducts = 0;   // Queued in the outbound backlog this boot
+static uint16_t publishedAtBoot = 0;
+static uint32_t sentAtBoot = 0;
+static esp_sleep_wakeup_cause_t wakeCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+// =====================================================================
+// Private helpers
+// =====================================================================
+
+static inline uint16_t ulpVar(uint16_t var) {
+    return (uint16_t)(RTC_SLOW_MEM[ULP_DATA_ADDR + var] & 0xFFFF);
+}
+
+static inline void setUlpVar(uint16_t var, uint16_t value) {
+    RTC_SLOW_MEM[ULP_DATA_ADDR + var] = value;
+}
+
+/**
+ * @brief Translates the portable program into ULP macro instructions.
+ * @return Number of instructions written, 0 if the program does not fit.
+ */
+static size_t assembleProgram(ulp_insn_t* out, int rtcio) {
+    size_t n = 0;
+#define EMIT(insn)                        \
+    do {                                  \
+        const ulp_insn_t emitted_ = insn; \
+        out[n++] = emitted_;              \
+    } while (0)
+
+    for (size_t i = 0; i < ULP_COUNTER_PROGRAM_LENGTH; i++) {
+        if (n + 4 > ULP_MAX_INSNS) {
+            return 0;
+        }
+        const UlpInsn& in = ULP_COUNTER_PROGRAM[i];
+        switch (in.op) {
+            case ULP_MOVI: EMIT(I_MOVI(in.a, in.imm)); break;
+            case ULP_MOVR: EMIT(I_MOVR(in.a, in.b)); break;
+            case ULP_ADDI: EMIT(I_ADDI(in.a, in.b, in.imm)); break;
+            case ULP_ADDR: EMIT(I_ADDR(in.a, in.b, in.c)); break;
+            case ULP_SUBR: EMIT(I_SUBR(in.a, in.b, in.c)); break;
+            case ULP_ANDI: EMIT(I_ANDI(in.a, in.b, in.imm)); break;
+            case ULP_LD:   EMIT(I_LD(in.a, in.b, in.imm)); break;
+            case ULP_ST:   EMIT(I_ST(in.a, in.b, in.imm)); break;
+            case ULP_READ_PIN:
+                EMIT(I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + rtcio, RTC_GPIO_IN_NEXT_S + rtcio));
+                break;
+            case ULP_LABEL: EMIT(M_LABEL(in.imm)); break;
+            case ULP_BL:    EMIT(M_BL(in.a, in.imm)); break;
+            case ULP_BGE:   EMIT(M_BGE(in.a, in.imm)); break;
+            case ULP_JUMP:  EMIT(M_BX(in.a)); break;
+            case ULP_WAKE:
+                // Only wake the SoC if it is asleep and ready; otherwise try on the next product
+                EMIT(I_RD_REG(RTC_CNTL_LOW_POWER_ST_REG, RTC_CNTL_RDY_FOR_WAKEUP_S, RTC_CNTL_RDY_FOR_WAKEUP_S));
+                EMIT(M_BL(ULP_LABEL_WAKE, 1));
+                EMIT(I_WAKE());
+                EMIT(M_LABEL(ULP_LABEL_WAKE));
+                break;
+            case ULP_HALT: EMIT(I_HALT()); break;
+        }
+    }
+#undef EMIT
+    return n;
+}
+
+static bool startUlp() {
+    int rtcio = rtc_io_number_get((gpio_num_t)SENSOR_PIN);
+    if (rtcio < 0) {
+        Serial.printf("[ULP] GPIO %d is not an RTC GPIO; the ULP cannot read it.\n", SENSOR_PIN);
+        return false;
+    }
+    rtc_gpio_init((gpio_num_t)SENSOR_PIN);
+    rtc_gpio_set_direction((gpio_num_t)SENSOR_PIN, RTC_GPIO_MODE_INPUT_ONLY);
+    if (SENSOR_USE_PULLUP) {
+        rtc_gpio_pullup_en((gpio_num_t)SENSOR_PIN);
+    }
+    rtc_gpio_pulldown_dis((gpio_num_t)SENSOR_PIN);
+
+    static ulp_insn_t program[ULP_MAX_INSNS];
+    size_t size = assembleProgram(program, rtcio);
+    if (size == 0 || ulp_process_macros_and_load(0, program, &size) != ESP_OK || size > ULP_DATA_ADDR) {
+        Serial.println(F("[ULP] Program does not fit below its data block."));
+        return false;
+    }
+
+    for (uint16_t i = 0; i < ULP_DATA_WORDS; i++) {
+        setUlpVar(i, 0);
+    }
+    setUlpVar(ULP_VAR_DEBOUNCE, (uint16_t)(SENSOR_DEBOUNCE_DELAY_MS * 1000 / ULP_SAMPLE_PERIOD_US));
+    setUlpVar(ULP_VAR_ACTIVE_LOW, SENSOR_ACTIVE_LOW ? 1 : 0);
+    setUlpVar(ULP_VAR_WAKE_AT, ULP_WAKE_PRODUCTS);
+    publishedProducts = 0;
+
+    ulp_set_wakeup_period(0, ULP_SAMPLE_PERIOD_US);
+    return ulp_run(0) == ESP_OK;
+}
+
+static void goToSleep() {
+    uint32_t sent = outboundSentCount(CLASS_BACKLOG) - sentAtBoot;
+    uint16_t queued = (uint16_t)(collectedProducts - publishedAtBoot);
+    publishedProducts = (uint16_t)(publishedAtBoot + (sent < queued ? sent : queued));
+
+    Serial.printf("[ULP] Deep sleep: %u of %u products sent; next wake-up in %lu s or after %u products.\n",
+                  (unsigned)(sent < queued ? sent : queued), (unsigned)queued, (unsigned long)ULP_PUBLISH_INTERVAL_S,
+                  (unsigned)ULP_WAKE_PRODUCTS);
+    Serial.flush();
+
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);  // RTC GPIO and its pull-up
+    esp_sleep_enable_ulp_wakeup();
+    esp_sleep_enable_timer_wakeup((uint64_t)ULP_PUBLISH_INTERVAL_S * 1000000ULL);
+    esp_deep_sleep_start();
+}
+
+// =====================================================================
+// Public Functions (defined in ulp_counter.h)
+// =====================================================================
+
+bool setupUlpCounter() {
+    wakeCause = esp_sleep_get_wakeup_cause();
+    bool coldBoot = wakeCause != ESP_SLEEP_WAKEUP_ULP && wakeCause != ESP_SLEEP_WAKEUP_TIMER;
+    if (coldBoot) {
+        if (!startUlp()) {
+            Serial.println(F("[ULP] Counter setup FAILED. Sensor disabled."));
+        } else {
+            Serial.printf("[ULP] Counting on the ULP: one sample every %lu us.\n",
+                          (unsigned long)ULP_SAMPLE_PERIOD_US);
+        }
+    } else {
+        wakeUps++;
+        Serial.printf("[ULP] Woken up by the %s; %u products counted while asleep.\n",
+                      wakeCause == ESP_SLEEP_WAKEUP_ULP ? "ULP" : "timer",
+                      (unsigned)(uint16_t)(ulpVar(ULP_VAR_PRODUCTS) - publishedProducts));
+    }
+    collectedProducts = publishedProducts;
+    publishedAtBoot = publishedProducts;
+    sentAtBoot = outboundSentCount(CLASS_BACKLOG);
+    return coldBoot;
+}
+
+bool ulpCounterCollect() {
+    uint16_t products = ulpVar(ULP_VAR_PRODUCTS);
+    uint16_t pending = (uint16_t)(products - collectedProducts);
+    if (pending > 0) {
+        setUlpVar(ULP_VAR_BATCH, 0);
+        uint16_t coarseNow = ulpVar(ULP_VAR_COARSE);
+        uint32_t coarseMs = ULP_COARSE_SAMPLES * ULP_SAMPLE_PERIOD_US / 1000;
+        uint32_t now = millis();
+
+        for (uint16_t k = 1; k <= pending; k++) {
+            uint16_t n = (uint16_t)(collectedProducts + k);
+            // Start times of the last ULP_RING_SIZE products only
+            if ((uint16_t)(products - n) >= ULP_RING_SIZE) {
+                n = (uint16_t)(products - (ULP_RING_SIZE - 1));
+            }
+            uint16_t start = ulpVar(ULP_VAR_RING + n % ULP_RING_SIZE);
+            uint32_t ageMs = (uint16_t)(coarseNow - start) * coarseMs;
+#ifdef TERELINA_USE_PRODUCT_LOG
+            outboundEnqueueProduct(now - ageMs, 0, productLogAppend(now - ageMs, 0));
+#else
+            outboundEnqueueProduct(now - ageMs, 0);
+#endif
+        }
+        collectedProducts = products;
+    }
+    return ulpVar(ULP_VAR_STABLE) != 0;
+}
+
+void handleUlpSleep() {
+    bool sentAll = isMqttConnected() && outboundIdle() &&
+                   outboundSentCount(CLASS_BACKLOG) - sentAtBoot >= (uint16_t)(collectedProducts - publishedAtBoot);
+    if (sentAll || millis() >= ULP_AWAKE_MAX_MS) {
+        ulpCounterCollect();
+        goToSleep();
+    }
+}
+
+void ulpCounterStatus(CommandReplyFn reply) {
+    char line[160];
+    snprintf(line, sizeof(line),
+             "ULP state=%s products=%u glitches=%u batch=%u wake_at=%u collected=%u published=%u wake_ups=%lu",
+             ulpVar(ULP_VAR_STABLE) ? "interrupted" : "clear", ulpVar(ULP_VAR_PRODUCTS),
+             ulpVar(ULP_VAR_GLITCHES), ulpVar(ULP_VAR_BATCH), ulpVar(ULP_VAR_WAKE_AT), collectedProducts,
+             publishedProducts, (unsigned long)wakeUps);
+    reply(line);
+}
+
+#else
+
+void ulpCounterStatus(CommandReplyFn reply) {
+    reply("ULP counting needs a build with TERELINA_USE_ULP");
+}
+
+#endif // TERELINA_USE_ULP
@@ -0,0 +1,37 @@
+#ifndef ULP_COUNTER_H
+#define ULP_COUNTER_H
+
+#include <Arduino.h>
+#include "commands.h"
+
+/**
+ * @brief Hands SENSOR_PIN to the ULP coprocessor, which samples, debounces
+ * and counts products (ulp_program.cpp) whether the main cores run or
+ * deep-sleep. On a cold boot the program is loaded and started; after a
+ * deep-sleep wake-up it is already running and only its counts are read.
+ * Only built with TERELINA_USE_ULP.
+ * @return True on a cold boot (not a wake-up from deep sleep).
+ */
+bool setupUlpCounter();
+
+/**
+ * @brief Queues the products counted by the ULP since the last call as
+ * backlog products, each with its age from the ULP's coarse clock.
+ * Call this in every main loop() iteration.
+ * @return The ULP's debounced beam state (true = interrupted).
+ */
+bool ulpCounterCollect();
+
+/**
+ * @brief Enters deep sleep once the collected products have been sent, or
+ * after ULP_AWAKE_MAX_MS. Wakes up again after ULP_PUBLISH_INTERVAL_S or
+ * when the ULP has counted ULP_WAKE_PRODUCTS. Call this in every main loop() iteration.
+ */
+void handleUlpSleep();
+
+/**
+ * @brief Writes the ULP counters, batch and publishing progress.
+ */
+void ulpCounterStatus(CommandReplyFn reply);
+
+#endif // ULP_COUNTER_H
@@ -0,0 +1,139 @@
+/**
+ * @file ulp_program.cpp
+ * @brief Product counter for the ULP coprocessor and its host emulator (see ulp_program.h).
+ *
+ * Each run (one per ULP timer period) takes one sample of the sensor pin and
+ * applies the same rules as PulseDebouncer fed by the 1 ms polling task:
+ *  1. The samples since the last raw change are counted (RUN).
+ *  2. A pending change whose raw level has now lasted DEBOUNCE samples is
+ *     confirmed if it differs from the stable state, or counted as a glitch.
+ *     A confirmed interrupted -> clear change is a product: its start time
+ *     goes into the ring and the batch may wake the main cores.
+ *  3. A new raw level restarts RUN; it opens a pending change (timestamped
+ *     with the coarse clock) unless one is already open.
+ * R3 holds ULP_DATA_ADDR throughout, so variables are R3-relative.
+ */
+
+#include "ulp_program.h"
+
+// =====================================================================
+// Program
+// =====================================================================
+enum : uint8_t { R0, R1, R2, R3 };
+enum : uint8_t { L_RUN = 1, L_SAMPLE, L_GLITCH, L_DONE };
+
+#define MOVI(d, imm)      {ULP_MOVI, d, 0, 0, imm}
+#define MOVR(d, s)        {ULP_MOVR, d, s, 0, 0}
+#define ADDI(d, s, imm)   {ULP_ADDI, d, s, 0, imm}
+#define ADDR(d, s1, s2)   {ULP_ADDR, d, s1, s2, 0}
+#define SUBR(d, s1, s2)   {ULP_SUBR, d, s1, s2, 0}
+#define ANDI(d, s, imm)   {ULP_ANDI, d, s, 0, imm}
+#define LDV(d, var)       {ULP_LD, d, R3, 0, var}
+#define STV(s, var)       {ULP_ST, s, R3, 0, var}
+#define LABEL(l)          {ULP_LABEL, 0, 0, 0, l}
+#define BL(l, imm)        {ULP_BL, l, 0, 0, imm}
+#define BGE(l, imm)       {ULP_BGE, l, 0, 0, imm}
+#define JUMP(l)           {ULP_JUMP, l, 0, 0, 0}
+
+const UlpInsn ULP_COUNTER_PROGRAM[] = {
+    MOVI(R3, ULP_DATA_ADDR),
+
+    // Coarse clock
+    LDV(R0, ULP_VAR_TICK), ADDI(R0, R0, 1), STV(R0, ULP_VAR_TICK),
+    ANDI(R0, R0, ULP_COARSE_SAMPLES - 1), BGE(L_RUN, 1),
+    LDV(R0, ULP_VAR_COARSE), ADDI(R0, R0, 1), STV(R0, ULP_VAR_COARSE),
+
+    // 1. One more sample at the current raw level
+    LABEL(L_RUN),
+    LDV(R0, ULP_VAR_RUN), ADDI(R0, R0, 1), STV(R0, ULP_VAR_RUN),
+
+    // 2. Confirm a pending change once RUN >= DEBOUNCE (16-bit difference below 0x8000)
+    LDV(R0, ULP_VAR_PENDING), BL(L_SAMPLE, 1),
+    LDV(R0, ULP_VAR_RUN), LDV(R1, ULP_VAR_DEBOUNCE), SUBR(R0, R0, R1), BGE(L_SAMPLE, 0x8000),
+    MOVI(R0, 0), STV(R0, ULP_VAR_PENDING),
+    LDV(R0, ULP_VAR_RAW), LDV(R1, ULP_VAR_STABLE), SUBR(R0, R0, R1), BL(L_GLITCH, 1),
+    LDV(R0, ULP_VAR_RAW), STV(R0, ULP_VAR_STABLE), BGE(L_SAMPLE, 1),  // Now interrupted: nothing to count
+
+    // Now clear: one product, started at PSTART
+    LDV(R0, ULP_VAR_PRODUCTS), ADDI(R0, R0, 1), STV(R0, ULP_VAR_PRODUCTS),
+    ANDI(R0, R0, ULP_RING_SIZE - 1), ADDR(R2, R0, R3),
+    LDV(R1, ULP_VAR_PSTART), {ULP_ST, R1, R2, 0, ULP_VAR_RING},
+    LDV(R0, ULP_VAR_BATCH), ADDI(R0, R0, 1), STV(R0, ULP_VAR_BATCH),
+    LDV(R1, ULP_VAR_WAKE_AT), SUBR(R0, R0, R1), BGE(L_SAMPLE, 0x8000),
+    {ULP_WAKE, 0, 0, 0, 0},
+    JUMP(L_SAMPLE),
+
+    LABEL(L_GLITCH),
+    LDV(R0, ULP_VAR_GLITCHES), ADDI(R0, R0, 1), STV(R0, ULP_VAR_GLITCHES),
+
+    // 3. Sample the pin: interrupted = (level + ACTIVE_LOW) & 1
+    LABEL(L_SAMPLE),
+    {ULP_READ_PIN, 0, 0, 0, 0},
+    LDV(R1, ULP_VAR_ACTIVE_LOW), ADDR(R0, R0, R1), ANDI(R0, R0, 1), MOVR(R2, R0),
+    LDV(R1, ULP_VAR_RAW), SUBR(R0, R2, R1), BL(L_DONE, 1),
+    STV(R2, ULP_VAR_RAW), MOVI(R0, 0), STV(R0, ULP_VAR_RUN),
+    LDV(R0, ULP_VAR_PENDING), BGE(L_DONE, 1),
+    MOVI(R0, 1), STV(R0, ULP_VAR_PENDING),
+    LDV(R0, ULP_VAR_COARSE), STV(R0, ULP_VAR_PSTART),
+
+    LABEL(L_DONE),
+    {ULP_HALT, 0, 0, 0, 0},
+};
+
+const size_t ULP_COUNTER_PROGRAM_LENGTH = sizeof(ULP_COUNTER_PROGRAM) / sizeof(ULP_COUNTER_PROGRAM[0]);
+
+// =====================================================================
+// Host Emulator
+// =====================================================================
+
+UlpEmulator::UlpEmulator() {
+    for (uint16_t i = 0; i < ULP_DATA_WORDS; i++) {
+        data_[i] = 0;
+    }
+}
+
+bool UlpEmulator::sample(bool level) {
+    uint16_t reg[4] = {0, 0, 0, 0};
+    bool woke = false;
+    uint32_t executed = 0;
+    size_t pc = 0;
+
+    auto jump = [](uint8_t label) -> size_t {
+        for (size_t i = 0; i < ULP_COUNTER_PROGRAM_LENGTH; i++) {
+            if (ULP_COUNTER_PROGRAM[i].op == ULP_LABEL && ULP_COUNTER_PROGRAM[i].imm == label) {
+                return i;
+            }
+        }
+        return ULP_COUNTER_PROGRAM_LENGTH;
+    };
+    auto word = [this](uint16_t addr) -> uint16_t& {
+        // The program only addresses its data block
+        return data_[(uint16_t)(addr - ULP_DATA_ADDR) % ULP_DATA_WORDS];
+    };
+
+    while (pc < ULP_COUNTER_PROGRAM_LENGTH) {
+        const UlpInsn& in = ULP_COUNTER_PROGRAM[pc++];
+        if (in.op != ULP_LABEL) {
+            executed++;
+        }
+        switch (in.op) {
+            case ULP_MOVI:     reg[in.a] = in.imm; break;
+            case ULP_MOVR:     reg[in.a] = reg[in.b]; break;
+            case ULP_ADDI:     reg[in.a] = (uint16_t)(reg[in.b] + in.imm); break;
+            case ULP_ADDR:     reg[in.a] = (uint16_t)(reg[in.b] + reg[in.c]); break;
+            case ULP_SUBR:     reg[in.a] = (uint16_t)(reg[in.b] - reg[in.c]); break;
+            case ULP_ANDI:     reg[in.a] = reg[in.b] & in.imm; break;
+            case ULP_LD:       reg[in.a] = word(reg[in.b] + in.imm); break;
+            case ULP_ST:       word(reg[in.b] + in.imm) = reg[in.a]; break;
+            case ULP_READ_PIN: reg[0] = level ? 1 : 0; break;
+            case ULP_LABEL:    break;
+            case ULP_BL:       if (reg[0] < in.imm) pc = jump(in.a); break;
+            case ULP_BGE:      if (reg[0] >= in.imm) pc = jump(in.a); break;
+            case ULP_JUMP:     pc = jump(in.a); break;
+            case ULP_WAKE:     woke = true; break;
+            case ULP_HALT:     pc = ULP_COUNTER_PROGRAM_LENGTH; break;
+        }
+    }
+    lastInstructions_ = executed;
+    return woke;
+}
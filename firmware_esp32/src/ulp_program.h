@@ -0,0 +1,93 @@
+#ifndef ULP_PROGRAM_H
+#define ULP_PROGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Plain C++ only (no Arduino headers): the program below is assembled for the
+// ULP coprocessor by ulp_counter.cpp and run by UlpEmulator on the host
+// (tools/ulp_sim.cpp), so both execute exactly the same instructions.
+
+/**
+ * @brief The subset of ULP FSM instructions the counter uses.
+ * Registers are R0..R3 (16 bits); branches compare R0 with an immediate.
+ */
+enum UlpOp : uint8_t {
+    ULP_MOVI,      // a = imm
+    ULP_MOVR,      // a = b
+    ULP_ADDI,      // a = b + imm
+    ULP_ADDR,      // a = b + c
+    ULP_SUBR,      // a = b - c
+    ULP_ANDI,      // a = b & imm
+    ULP_LD,        // a = mem[b + imm] (low 16 bits)
+    ULP_ST,        // mem[b + imm] = a
+    ULP_READ_PIN,  // R0 = level of the sensor's RTC GPIO
+    ULP_LABEL,     // Branch target imm
+    ULP_BL,        // Jump to label a if R0 < imm
+    ULP_BGE,       // Jump to label a if R0 >= imm
+    ULP_JUMP,      // Jump to label a
+    ULP_WAKE,      // Wake the main cores if they are in deep sleep (no-op otherwise)
+    ULP_HALT,      // End of this run; the ULP timer starts the next one
+};
+
+struct UlpInsn {
+    UlpOp    op;
+    uint8_t  a;
+    uint8_t  b;
+    uint8_t  c;
+    uint16_t imm;
+};
+
+/**
+ * @brief Words of the counter's data block in RTC slow memory, from ULP_DATA_ADDR.
+ * The main cores set the ULP_VAR_DEBOUNCE.. configuration words before
+ * starting the program and read the rest (low 16 bits of each word).
+ */
+enum UlpVar : uint16_t {
+    ULP_VAR_STABLE = 0,   // Debounced state: 1 interrupted
+    ULP_VAR_RAW,          // Level seen at the last sample
+    ULP_VAR_RUN,          // Samples since the raw level last changed
+    ULP_VAR_PENDING,      // Raw level left the stable level, not yet confirmed
+    ULP_VAR_PSTART,       // Coarse time of the pending change's first edge
+    ULP_VAR_PRODUCTS,     // interrupted -> clear changes (wraps at 65536)
+    ULP_VAR_GLITCHES,     // Excursions shorter than the debounce
+    ULP_VAR_TICK,         // Samples taken (wraps)
+    ULP_VAR_COARSE,       // Coarse clock: +1 every ULP_COARSE_SAMPLES samples (wraps)
+    ULP_VAR_BATCH,        // Products since the main cores last collected (they reset it)
+    ULP_VAR_WAKE_AT,      // Wake the main cores when the batch reaches this (>= 1)
+    ULP_VAR_DEBOUNCE,     // Samples a level must last to be confirmed
+    ULP_VAR_ACTIVE_LOW,   // 1 if a low level means interrupted
+    ULP_VAR_RING = 16,    // Coarse start time of product n at RING + (n % ULP_RING_SIZE)
+};
+
+static const uint16_t ULP_DATA_ADDR      = 96;   // Words; the program must fit below
+static const uint16_t ULP_RING_SIZE      = 16;
+static const uint16_t ULP_DATA_WORDS     = ULP_VAR_RING + ULP_RING_SIZE;
+static const uint16_t ULP_COARSE_SAMPLES = 64;   // Must be a power of two
+
+extern const UlpInsn ULP_COUNTER_PROGRAM[];
+extern const size_t  ULP_COUNTER_PROGRAM_LENGTH;
+
+/**
+ * @brief Executes the counter program on the host, one ULP timer run per sample().
+ */
+class UlpEmulator {
+public:
+    UlpEmulator();
+
+    /**
+     * @brief Runs the program once with the sensor pin at `level`.
+     * @return True if the program tried to wake the main cores.
+     */
+    bool sample(bool level);
+
+    uint16_t& var(uint16_t index) { return data_[index]; }
+    uint16_t  var(uint16_t index) const { return data_[index]; }
+    uint32_t  lastInstructions() const { return lastInstructions_; }
+
+private:
+    uint16_t data_[ULP_DATA_WORDS];
+    uint32_t lastInstructions_ = 0;
+};
+
+#endif // ULP_PROGRAM_H
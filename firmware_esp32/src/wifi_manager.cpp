@@ -8,10 +8,12 @@
  * - Maintenance Mode: hold BOOT (GPIO0) for 5s during boot to clear saved WiFi and force portal.
  * - Optional secure fallback via secrets.h (compile-time gated).
  * - Avoids infinite reboot loops: if fallback fails, returns to portal mode.
+ * - Proactive roaming to a stronger BSSID of the same SSID (see roaming.cpp).
  */
 
 #include "wifi_manager.h"
 #include "config.h"
+#include "roaming.h"
 
 #include <Arduino.h>
 #include <WiFi.h>
@@ -37,6 +39,78 @@ static constexpr uint32_t MAINT_HOLD_MS = 5000;  // 5 seconds hold to trigger
 // Private helpers
 // =====================================================================
 
+/**
+ * @brief RoamingRadio over the Arduino WiFi API.
+ */
+class ArduinoRoamingRadio : public RoamingRadio {
+public:
+    bool isConnected() override { return WiFi.status() == WL_CONNECTED; }
+    int32_t rssi() override { return WiFi.RSSI(); }
+
+    void currentBssid(uint8_t out[6]) override {
+        const uint8_t* bssid = WiFi.BSSID();
+        if (bssid) {
+            memcpy(out, bssid, 6);
+        } else {
+            memset(out, 0, 6);
+        }
+    }
+
+    bool startScan() override {
+        ssid_ = WiFi.SSID();
+        psk_ = WiFi.psk();
+        // Async active scan of our SSID only, with short dwell per channel to
+        // keep the radio off the home channel as little as possible.
+        int16_t rc = WiFi.scanNetworks(true, false, false, 60, 0, ssid_.c_str());
+        return rc == WIFI_SCAN_RUNNING;
+    }
+
+    int scanResults(RoamCandidate* out, int maxResults) override {
+        int16_t n = WiFi.scanComplete();
+        if (n == WIFI_SCAN_RUNNING) {
+            return -1;
+        }
+        int count = 0;
+        for (int16_t i = 0; i < n && count < maxResults; i++) {
+            memcpy(out[count].bssid, WiFi.BSSID(i), 6);
+            out[count].channel = WiFi.channel(i);
+            out[count].rssi = WiFi.RSSI(i);
+            count++;
+        }
+        WiFi.scanDelete();
+        return count;
+    }
+
+    bool connectTo(const RoamCandidate& target) override {
+        // Reassociation with a BSSID lock; DHCP completes before status() is WL_CONNECTED.
+        // The lock is not persisted: after a reboot or resumeWifi() the saved
+        // SSID-only config connects to any AP.
+        WiFi.persistent(false);
+        bool ok = WiFi.begin(ssid_.c_str(), psk_.c_str(), target.channel, target.bssid) != WL_CONNECT_FAILED;
+        WiFi.persistent(true);
+        return ok;
+    }
+
+    void reconnectAny() override {
+        if (ssid_.length() == 0) {
+            WiFi.begin();  // No scan yet: the saved SSID-only config
+            return;
+        }
+        WiFi.begin(ssid_.c_str(), psk_.c_str());
+    }
+
+private:
+    String ssid_;
+    String psk_;
+};
+
+static ArduinoRoamingRadio roamingRadio;
+static RoamingController roaming(roamingRadio);
+
+static void roamingLog(const char* line) {
+    Serial.println(line);
+}
+
 static void onWifiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
     switch (event) {
         case ARDUINO_EVENT_WIFI_STA_CONNECTED:
@@ -151,6 +225,7 @@ static bool tryFallbackCredentials(uint32_t timeoutMs = 20000) {
 
 void setupWifi() {
     WiFi.onEvent(onWifiEvent);
+    roaming.setLogger(roamingLog);
 
     // Enforce station mode and reconnection behavior (good for corporate networks).
     WiFi.mode(WIFI_STA);
@@ -200,6 +275,30 @@ void setupWifi() {
     printWifiStatus();
 }
 
+void resumeWifi() {
+    WiFi.onEvent(onWifiEvent);
+    roaming.setLogger(roamingLog);
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
+    WiFi.begin();  // Credentials saved by WiFiManager on the last cold boot
+    Serial.println(F("[WiFi] Reconnecting with saved credentials (no portal)."));
+}
+
+void handleWifiRoaming(bool quiet) {
+    roaming.tick(millis(), quiet);
+}
+
+void wifiStatus(CommandReplyFn reply) {
+    const RoamingStats& st = roaming.stats();
+    char buf[160];
+    snprintf(buf, sizeof(buf),
+             "WIFI %s rssi=%d avg=%.1f slope=%.2fdB/s scans=%lu roams=%lu failed=%lu last_roam_ms=%lu max_roam_ms=%lu",
+             isWifiConnected() ? "connected" : "disconnected", isWifiConnected() ? (int)WiFi.RSSI() : 0,
+             st.rssiAvg, st.rssiSlope, (unsigned long)st.scans, (unsigned long)st.roams,
+             (unsigned long)st.failedRoams, (unsigned long)st.lastRoamLatencyMs, (unsigned long)st.maxRoamLatencyMs);
+    reply(buf);
+}
+
 bool isWifiConnected() {
     return (WiFi.status() == WL_CONNECTED);
 }
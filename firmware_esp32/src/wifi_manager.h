@@ -2,6 +2,7 @@
 #define WIFI_MANAGER_H
 
 #include <Arduino.h>
+#include "commands.h"
 
 /**
  * @brief Initializes and manages the WiFi connection.
@@ -10,6 +11,13 @@
  */
 void setupWifi();
 
+/**
+ * @brief Reconnects to the saved network without blocking and without ever
+ * opening the portal. Used after a deep-sleep wake-up, where a missing
+ * network must not keep the device awake.
+ */
+void resumeWifi();
+
 /**
  * @brief Checks if the device is currently connected to a WiFi network.
  * @return True if connected, false otherwise.
@@ -22,4 +30,16 @@ bool isWifiConnected();
  */
 void printWifiStatus();
 
+/**
+ * @brief Runs the proactive roaming policy (see roaming.h).
+ * Call this in every main loop() iteration.
+ * @param quiet True when the sensor is idle, so a background scan is harmless.
+ */
+void handleWifiRoaming(bool quiet);
+
+/**
+ * @brief Writes RSSI trend and roaming counters (scans, roams, latency) as one line.
+ */
+void wifiStatus(CommandReplyFn reply);
+
 #endif // WIFI_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,233 @@
+/**
+ * @file belt_sim.cpp
+ * @brief Host check of the belt encoder fusion (src/belt_fusion.cpp).
+ *
+ * Build and run from firmware_esp32/:
+ *   g++ -std=c++17 -O2 -Isrc tools/belt_sim.cpp src/belt_fusion.cpp src/pulse_decoder.cpp -o belt_sim
+ *   ./belt_sim [products_per_scenario]
+ *
+ * Products of known length and spacing are laid on a belt whose speed
+ * changes (ramps, slowdowns, stops with a product in the beam). The
+ * simulation produces the quantized encoder count and the bouncy beam level
+ * over time and runs them through the firmware path: PulseDebouncer, then
+ * BeltTracker::stamp(). Two sampling patterns are covered: the 1 ms polling
+ * task, and the RMT task (exact edge times, encoder read every ~10 ms).
+ *
+ * For each scenario it prints the length and gap errors from the encoder
+ * next to those of the wall-clock estimate (dwell x nominal speed). Exits
+ * with status 1 if a product is missed or an encoder error exceeds
+ * TOLERANCE_MM.
+ */
+
+#include "belt_fusion.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// =====================================================================
+// Belt and Products
+// =====================================================================
+
+static const float    MM_PER_COUNT   = 0.0654f;  // Same as the default ENCODER_MM_PER_COUNT
+static const double   NOMINAL_MM_S   = 200;
+static const uint32_t DEBOUNCE_US    = 50000;
+static const double   TOLERANCE_MM   = 1.5;
+
+/**
+ * @brief Piecewise-constant belt acceleration: speed ramps between targets.
+ */
+struct SpeedProfile {
+    struct Step {
+        double untilS;
+        double targetMmS;
+    };
+    std::vector<Step> steps;
+    double rampMmS2 = 400;  // Belt acceleration
+
+    double target(double tS) const {
+        for (const Step& s : steps) {
+            if (tS < s.untilS) return s.targetMmS;
+        }
+        return steps.back().targetMmS;
+    }
+};
+
+struct Product {
+    double startMm;  // Belt coordinate of the leading edge
+    double lengthMm;
+};
+
+struct Scenario {
+    const char* name;
+    SpeedProfile profile;
+    uint64_t encoderPeriodUs;  // How often the task reads the encoder
+    bool exactEdges;           // RMT: edges at their true time; otherwise seen on 1 ms ticks
+};
+
+// =====================================================================
+// Simulation
+// =====================================================================
+
+struct Result {
+    int expected = 0;
+    int measured = 0;
+    double lenErrMax = 0, lenErrSum = 0;
+    double gapErrMax = 0, gapErrSum = 0;
+    double wallLenErrMax = 0, wallGapErrMax = 0;
+    int gaps = 0;
+};
+
+static void track(double err, double& maxErr, double& sum) {
+    err = std::fabs(err);
+    if (err > maxErr) maxErr = err;
+    sum += err;
+}
+
+static Result run(const Scenario& sc, int products, std::mt19937& rng) {
+    std::uniform_real_distribution<double> length(280, 320);
+    std::uniform_real_distribution<double> gap(100, 600);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    // The beam sits at belt coordinate 0; the belt moves products towards it
+    std::vector<Product> items;
+    double next = -200;
+    for (int i = 0; i < products; i++) {
+        Product p = {next, length(rng)};
+        items.push_back(p);
+        next -= p.lengthMm + gap(rng);
+    }
+
+    BeltTracker belt(MM_PER_COUNT);
+    PulseDebouncer debouncer(DEBOUNCE_US, false, 0);
+    PulseEvent event;
+    BeltStamp stamp;
+    Result r;
+    r.expected = products;
+
+    double posMm = 0, speed = sc.profile.target(0);
+    bool level = false;
+    uint64_t lastEncoderUs = 0;
+    uint64_t bounceUntilUs = 0;
+    size_t measured = 0;
+    uint64_t startUs = 0, lastEndUs = 0;
+    bool haveEnd = false;
+
+    auto onEvent = [&](const PulseEvent& e) {
+        belt.stamp(e, stamp);
+        if (e.interrupted) {
+            if (haveEnd && measured < items.size() && measured > 0) {
+                double trueGap = -items[measured].startMm - (-items[measured - 1].startMm + items[measured - 1].lengthMm);
+                track(stamp.gapMm - trueGap, r.gapErrMax, r.gapErrSum);
+                double wall = (e.edgeUs - lastEndUs) / 1e6 * NOMINAL_MM_S;
+                if (std::fabs(wall - trueGap) > r.wallGapErrMax) r.wallGapErrMax = std::fabs(wall - trueGap);
+                r.gaps++;
+            }
+            startUs = e.edgeUs;
+            return;
+        }
+        if (measured < items.size()) {
+            track(stamp.lengthMm - items[measured].lengthMm, r.lenErrMax, r.lenErrSum);
+            double wall = (e.edgeUs - startUs) / 1e6 * NOMINAL_MM_S;
+            if (std::fabs(wall - items[measured].lengthMm) > r.wallLenErrMax) {
+                r.wallLenErrMax = std::fabs(wall - items[measured].lengthMm);
+            }
+        }
+        measured++;
+        lastEndUs = e.edgeUs;
+        haveEnd = true;
+    };
+
+    // Physics at 10 us steps; the task sees it on its own schedule
+    const uint64_t stepUs = 10;
+    double endMm = -next + 500;
+    for (uint64_t t = 0; posMm < endMm; t += stepUs) {
+        double tS = t / 1e6;
+        double target = sc.profile.target(tS);
+        double dv = sc.profile.rampMmS2 * stepUs / 1e6;
+        speed = speed < target ? std::fmin(target, speed + dv) : std::fmax(target, speed - dv);
+        posMm += speed * stepUs / 1e6;
+
+        // True beam level: some product covers belt coordinate 0
+        bool blocked = false;
+        for (size_t i = measured > 0 ? measured - 1 : 0; i < items.size() && i <= measured + 1; i++) {
+            double lead = items[i].startMm + posMm;
+            if (lead >= 0 && lead - items[i].lengthMm < 0) blocked = true;
+        }
+        if (blocked != level) {
+            level = blocked;
+            bounceUntilUs = t + 2000;
+            if (sc.exactEdges && debouncer.edge(level, t, event)) onEvent(event);
+        }
+
+        bool encoderDue = t - lastEncoderUs >= sc.encoderPeriodUs;
+        if (encoderDue) {
+            lastEncoderUs = t;
+            belt.sample(t, (int64_t)std::floor(posMm / MM_PER_COUNT));
+        }
+
+        if (sc.exactEdges) {
+            // Bounce as short pulses within 2 ms of the true edge
+            if (t < bounceUntilUs && unit(rng) < 0.002) {
+                if (debouncer.edge(!level, t, event)) onEvent(event);
+                if (debouncer.edge(level, t + stepUs / 2, event)) onEvent(event);
+            }
+            if (encoderDue && debouncer.advance(t, event)) onEvent(event);
+        } else if (t % 1000 == 0) {
+            bool raw = (t < bounceUntilUs && unit(rng) < 0.3) ? !level : level;
+            if (debouncer.edge(raw, t, event)) onEvent(event);
+            if (debouncer.advance(t, event)) onEvent(event);
+        }
+    }
+    r.measured = (int)measured;
+    return r;
+}
+
+// =====================================================================
+// Main
+// =====================================================================
+
+int main(int argc, char** argv) {
+    int products = argc > 1 ? std::atoi(argv[1]) : 200;
+    std::mt19937 rng(4321);
+
+    SpeedProfile steady;
+    steady.steps = {{1e9, 200}};
+    SpeedProfile varying;
+    varying.steps = {{20, 200}, {40, 320}, {60, 90}, {80, 250}, {1e9, 150}};
+    SpeedProfile stopGo;
+    stopGo.steps = {{6, 200}, {9, 0}, {15, 200}, {18, 0}, {21, 260}, {26, 0}, {28, 120}, {1e9, 200}};
+    stopGo.rampMmS2 = 1000;
+
+    const Scenario scenarios[] = {
+        {"steady/poll", steady, 1000, false},
+        {"varying/poll", varying, 1000, false},
+        {"stop-go/poll", stopGo, 1000, false},
+        {"varying/rmt", varying, 10000, true},
+        {"stop-go/rmt", stopGo, 10000, true},
+    };
+
+    std::printf("%-14s %9s  %-21s %-21s  %-23s\n", "scenario", "products", "encoder len err mm",
+                "encoder gap err mm", "wall-clock err mm (max)");
+    std::printf("%-14s %9s  %10s %10s %10s %10s  %11s %11s\n", "", "", "mean", "max", "mean", "max", "len",
+                "gap");
+    int failures = 0;
+    for (const Scenario& sc : scenarios) {
+        Result r = run(sc, products, rng);
+        double lenMean = r.measured ? r.lenErrSum / r.measured : 0;
+        double gapMean = r.gaps ? r.gapErrSum / r.gaps : 0;
+        std::printf("%-14s %4d/%-4d  %10.2f %10.2f %10.2f %10.2f  %11.1f %11.1f\n", sc.name, r.measured,
+                    r.expected, lenMean, r.lenErrMax, gapMean, r.gapErrMax, r.wallLenErrMax, r.wallGapErrMax);
+        if (r.measured != r.expected) {
+            std::printf("FAIL  %s: %d of %d products measured\n", sc.name, r.measured, r.expected);
+            failures++;
+        }
+        if (r.lenErrMax > TOLERANCE_MM || r.gapErrMax > TOLERANCE_MM) {
+            std::printf("FAIL  %s: encoder error above %.1f mm\n", sc.name, TOLERANCE_MM);
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file curtain_bench.cpp
+ * @brief Host benchmark and check of the light-curtain segmenter (src/curtain.cpp).
+ *
+ * Build and run from firmware_esp32/:
+ *   g++ -std=c++17 -O2 -Isrc tools/curtain_bench.cpp src/curtain.cpp -o curtain_bench
+ *   ./curtain_bench [products_per_config]
+ *
+ * For 8, 16 and 32 beams it rasterizes a stream of products passing the
+ * curtain on a belt (1 ms ticks): whole pizzas, broken ones (a crack along
+ * the belt, wider than the beam pitch), folded ones (half discs) and pizzas hanging over the edge of the
+ * curtain, with random single-tick beam flicker. It reports how each kind
+ * was classified and the segmentation cost per tick, next to a reference
+ * that processes the same masks beam by beam.
+ *
+ * Exits with status 1 if a product is missed or split, or if fewer than 95%
+ * of any kind get the expected flags.
+ */
+
+#include "curtain.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// =====================================================================
+// Synthetic Products
+// =====================================================================
+
+enum Kind { KIND_WHOLE, KIND_BROKEN, KIND_FOLDED, KIND_EDGE, KIND_COUNT };
+static const char* KIND_NAMES[KIND_COUNT] = {"whole", "broken", "folded", "edge"};
+static const uint8_t KIND_FLAGS[KIND_COUNT] = {0, SHAPE_BROKEN, SHAPE_FOLDED, SHAPE_EDGE};
+
+static const uint32_t TICK_US = 1000;
+static const double   FLICKER_PER_BEAM_TICK = 0.0005;
+
+struct Stream {
+    std::vector<uint32_t> masks;
+    std::vector<Kind> kinds;  // In order of appearance
+};
+
+/**
+ * @brief Half-width (mm) of a product at distance y (mm) from its leading edge.
+ * @return Negative when y is past the product.
+ */
+static double halfWidth(Kind kind, double radius, double y) {
+    if (kind == KIND_FOLDED) {
+        // Half disc, fold line leading: widest at the front
+        return y <= radius ? std::sqrt(radius * radius - y * y) : -1;
+    }
+    if (y > 2 * radius) {
+        return -1;
+    }
+    double d = y - radius;
+    return std::sqrt(radius * radius - d * d);
+}
+
+static Stream makeStream(const CurtainConfig& cfg, int products, std::mt19937& rng) {
+    Stream s;
+    std::uniform_real_distribution<double> diameter(280, 320);
+    std::uniform_real_distribution<double> offset(-30, 30);
+    std::uniform_real_distribution<double> gapMs(150, 600);
+    std::uniform_real_distribution<double> unit(0, 1);
+    double curtainMm = cfg.beams * cfg.pitchMm;
+    double mmPerTick = cfg.beltMmPerS * (TICK_US / 1e6);
+
+    for (int p = 0; p < products; p++) {
+        Kind kind = (Kind)(p % KIND_COUNT);
+        double radius = diameter(rng) / 2;
+        double cx = (curtainMm - cfg.pitchMm) / 2 + offset(rng);
+        if (kind == KIND_EDGE) {
+            cx = radius * 0.6;  // Hangs over beam 0
+        }
+        s.kinds.push_back(kind);
+
+        for (double y = 0;; y += mmPerTick) {
+            double h = halfWidth(kind, radius, y);
+            if (h < 0) break;
+            uint32_t mask = 0;
+            for (int b = 0; b < cfg.beams; b++) {
+                double dx = std::fabs(b * cfg.pitchMm - cx);
+                bool crack = kind == KIND_BROKEN && dx < 35;  // 70 mm crack along the belt (> 1 pitch)
+                if (dx <= h && !crack) mask |= 1u << b;
+            }
+            s.masks.push_back(mask);
+        }
+        int gapTicks = (int)(gapMs(rng) * 1000 / TICK_US);
+        s.masks.insert(s.masks.end(), gapTicks, 0);
+    }
+
+    // Single-tick flicker on random beams
+    for (uint32_t& m : s.masks) {
+        for (int b = 0; b < cfg.beams; b++) {
+            if (unit(rng) < FLICKER_PER_BEAM_TICK) m ^= 1u << b;
+        }
+    }
+    return s;
+}
+
+// =====================================================================
+// Beam-by-beam Reference
+// =====================================================================
+
+/**
+ * @brief The per-tick work of CurtainSegmenter::tick() done one beam at a
+ * time, as a baseline for the bit-parallel version.
+ */
+struct ScalarCurtain {
+    int beams;
+    bool prev[32] = {};
+    bool stable[32] = {};
+    uint32_t area = 0;
+    uint32_t checksum = 0;
+
+    void tick(uint32_t mask) {
+        int width = 0, runs = 0, lo = -1, hi = -1;
+        bool last = false;
+        for (int b = 0; b < beams; b++) {
+            bool m = (mask >> b) & 1;
+            bool f = (m && prev[b]) || (stable[b] && (m || prev[b]));
+            prev[b] = m;
+            stable[b] = f;
+            if (f) {
+                width++;
+                if (!last) runs++;
+                if (lo < 0) lo = b;
+                hi = b;
+            }
+            last = f;
+        }
+        area += width;
+        checksum += runs + lo + hi;
+    }
+};
+
+// =====================================================================
+// Main
+// =====================================================================
+
+int main(int argc, char** argv) {
+    int products = argc > 1 ? std::atoi(argv[1]) : 400;
+    std::mt19937 rng(1234);
+    int failures = 0;
+
+    std::printf("%5s %8s %9s %9s  %-24s %11s %11s\n", "beams", "ticks", "products", "detected",
+                "classified ok (w/b/f/e)", "ns/tick", "scalar ns");
+
+    for (uint8_t beams : {8, 16, 32}) {
+        CurtainConfig cfg;
+        cfg.beams = beams;
+        cfg.pitchMm = (uint16_t)(500 / beams);  // 500 mm curtain over a belt of 300 mm pizzas
+        cfg.beltMmPerS = 200;
+        cfg.confirmUs = 50000;
+        cfg.endGapUs = 50000;
+
+        Stream s = makeStream(cfg, products, rng);
+
+        // Classification pass
+        CurtainSegmenter seg(cfg, 0);
+        PulseEvent event;
+        ProductShape shape;
+        size_t detected = 0;
+        int ok[KIND_COUNT] = {}, seen[KIND_COUNT] = {};
+        for (size_t t = 0; t < s.masks.size(); t++) {
+            if (seg.tick(s.masks[t], (uint64_t)t * TICK_US, event, shape) && !event.interrupted) {
+                if (detected < s.kinds.size()) {
+                    Kind kind = s.kinds[detected];
+                    seen[kind]++;
+                    uint8_t relevant = SHAPE_BROKEN | SHAPE_FOLDED | SHAPE_EDGE;
+                    if ((shape.flags & relevant) == KIND_FLAGS[kind]) ok[kind]++;
+                }
+                detected++;
+            }
+        }
+
+        // Timing passes (best of 5)
+        double bestNs = 1e30, bestScalarNs = 1e30;
+        uint32_t sink = 0;
+        for (int rep = 0; rep < 5; rep++) {
+            CurtainSegmenter timed(cfg, 0);
+            auto t0 = std::chrono::steady_clock::now();
+            for (size_t t = 0; t < s.masks.size(); t++) {
+                sink += timed.tick(s.masks[t], (uint64_t)t * TICK_US, event, shape);
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            bestNs = std::min(bestNs, std::chrono::duration<double, std::nano>(t1 - t0).count() / s.masks.size());
+
+            ScalarCurtain scalar;
+            scalar.beams = beams;
+            t0 = std::chrono::steady_clock::now();
+            for (uint32_t m : s.masks) scalar.tick(m);
+            t1 = std::chrono::steady_clock::now();
+            sink += scalar.checksum;
+            bestScalarNs =
+                std::min(bestScalarNs, std::chrono::duration<double, std::nano>(t1 - t0).count() / s.masks.size());
+        }
+
+        char classified[64];
+        std::snprintf(classified, sizeof(classified), "%d/%d %d/%d %d/%d %d/%d", ok[0], seen[0], ok[1], seen[1],
+                      ok[2], seen[2], ok[3], seen[3]);
+        std::printf("%5u %8zu %9d %9zu  %-24s %11.2f %11.2f%s\n", beams, s.masks.size(), products, detected,
+                    classified, bestNs, bestScalarNs, sink == 0xFFFFFFFF ? " " : "");
+
+        if (detected != (size_t)products) failures++;
+        for (int k = 0; k < KIND_COUNT; k++) {
+            if (seen[k] == 0 || ok[k] * 100 < seen[k] * 95) {
+                std::printf("FAIL  %u beams: %s classified correctly %d/%d\n", beams, KIND_NAMES[k], ok[k], seen[k]);
+                failures++;
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
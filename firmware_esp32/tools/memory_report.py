@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+# firmware_esp32/tools/memory_report.py
+"""
+Reports flash, IRAM and DRAM usage per module from the linker map and ELF, and checks budgets.
+
+The map file attributes every input section to its object file, so each
+firmware module (src/<module>.cpp) gets its own line; libraries are grouped
+per archive. Region totals come from the ELF section headers; the map's
+"Memory Configuration" gives the IRAM and DRAM capacity. Budgets are read
+from memory_budget.ini (see the comments there).
+
+Usage:
+    python tools/memory_report.py .pio/build/esp32dev
+    python tools/memory_report.py --map firmware.map --elf firmware.elf --env esp32dev_release
+    python tools/memory_report.py .pio/build/esp32dev --top 40 --objects
+
+Runs after every PlatformIO build (tools/pio_memory_report.py). Exits with
+status 1 if a budget is exceeded.
+"""
+
+import argparse
+import collections
+import configparser
+import os
+import re
+import struct
+import sys
+
+REGIONS = ("flash", "iram", "dram", "rtc")
+
+# Output sections of the ESP32 linker scripts, by region. .dram0.data is also
+# stored in flash (its initial values); it is counted as DRAM only.
+SECTION_PREFIXES = (
+    (".iram0", "iram"),
+    (".dram0", "dram"),
+    (".noinit", "dram"),
+    (".flash", "flash"),
+    (".rtc", "rtc"),
+)
+
+OUTPUT_SECTION = re.compile(r"^(\.\S+)")
+INPUT_ONE_LINE = re.compile(r"^ (\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+INPUT_NAME_ONLY = re.compile(r"^ (\S+)$")
+INPUT_CONTINUED = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+FILL = re.compile(r"^ \*fill\*\s+0x[0-9a-f]+\s+0x([0-9a-f]+)")
+MEMORY_SEGMENT = re.compile(r"^(\w+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)")
+
+
+def region_of(section: str) -> str | None:
+    for prefix, region in SECTION_PREFIXES:
+        if section.startswith(prefix):
+            return region
+    return None
+
+
+def module_of(path: str, objects: bool) -> str:
+    """
+    src/<name>.cpp.o -> <name>; lib<X>.a(<obj>) -> lib:<X> (or lib:<X>/<obj> with objects).
+    """
+    path = path.strip()
+    archive = re.match(r"(.*?)\(([^)]*)\)$", path)
+    if archive:
+        lib = os.path.basename(archive.group(1))
+        lib = re.sub(r"^lib|\.a$", "", lib)
+        return f"lib:{lib}/{archive.group(2)}" if objects else f"lib:{lib}"
+    name = os.path.basename(path)
+    for suffix in (".ino.cpp.o", ".cpp.o", ".c.o", ".S.o", ".o"):
+        if name.endswith(suffix):
+            return name[: -len(suffix)]
+    return name
+
+
+def parse_map(map_path: str, objects: bool):
+    """
+    Returns ({module: {region: bytes}}, {segment: length}) from a GNU ld map file.
+    """
+    usage = collections.defaultdict(lambda: dict.fromkeys(REGIONS, 0))
+    segments = {}
+    in_memory_config = False
+    in_map = False
+    region = None
+    pending = None  # Input section whose address and size are on the next line
+
+    with open(map_path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("Memory Configuration"):
+                in_memory_config = True
+                continue
+            if line.startswith("Linker script and memory map"):
+                in_memory_config = False
+                in_map = True
+                continue
+            if in_memory_config:
+                m = MEMORY_SEGMENT.match(line)
+                if m:
+                    segments[m.group(1)] = int(m.group(3), 16)
+                continue
+            if not in_map:
+                continue  # The discarded input sections are listed before the map
+
+            m = OUTPUT_SECTION.match(line)
+            if m:
+                region = region_of(m.group(1))
+                pending = None
+                continue
+            if region is None:
+                continue
+
+            m = FILL.match(line)
+            if m:
+                usage["(alignment)"][region] += int(m.group(1), 16)
+                continue
+            m = INPUT_ONE_LINE.match(line)
+            if m:
+                name, size, path = m.group(1), int(m.group(3), 16), m.group(4)
+            else:
+                m = INPUT_NAME_ONLY.match(line)
+                if m:
+                    pending = m.group(1)
+                    continue
+                m = INPUT_CONTINUED.match(line)
+                if not m or pending is None:
+                    continue
+                name, size, path = pending, int(m.group(2), 16), m.group(3)
+                pending = None
+
+            if size == 0 or name == "*fill*":
+                continue
+            usage[module_of(path, objects)][region] += size
+    return usage, segments
+
+
+def parse_elf_sections(elf_path: str) -> dict:
+    """
+    Sums the sizes of allocated ELF32 sections per region, plus "image": the
+    bytes written to the app partition (everything but zero-initialized data).
+    """
+    totals = dict.fromkeys(REGIONS + ("image",), 0)
+    with open(elf_path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1:
+        raise ValueError(f"{elf_path} is not a 32-bit ELF file")
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+    headers = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize) for i in range(shnum)]
+    strtab_offset = headers[shstrndx][4]
+
+    SHF_ALLOC = 0x2
+    SHT_NOBITS = 8
+    for name_offset, section_type, flags, _addr, _offset, size, *_ in headers:
+        if not flags & SHF_ALLOC or size == 0:
+            continue
+        if section_type != SHT_NOBITS:
+            totals["image"] += size
+        end = data.index(b"\0", strtab_offset + name_offset)
+        region = region_of(data[strtab_offset + name_offset:end].decode())
+        if region:
+            totals[region] += size
+    return totals
+
+
+def load_budgets(path: str, env_name: str | None):
+    """
+    Returns ({region: bytes}, {module: {region: bytes}}). [total] is overridden
+    by [total.<env>] for the given environment.
+    """
+    parser = configparser.ConfigParser(inline_comment_prefixes=(";", "#"))
+    parser.read(path)
+    totals = {}
+    modules = {}
+    for section in ("total", f"total.{env_name}" if env_name else None):
+        if section and parser.has_section(section):
+            totals.update({key: int(value) for key, value in parser.items(section)})
+    for section in parser.sections():
+        if section.startswith("module."):
+            modules[section[len("module."):]] = {key: int(value) for key, value in parser.items(section)}
+    return totals, modules
+
+
+def _kb(value: int) -> str:
+    return f"{value / 1024:8.1f}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    parser.add_argument("build_dir", nargs="?", help="PlatformIO build directory (.pio/build/<env>)")
+    parser.add_argument("--map", help="Linker map (default: <build_dir>/firmware.map)")
+    parser.add_argument("--elf", help="Firmware ELF (default: <build_dir>/firmware.elf)")
+    parser.add_argument("--env", help="Environment name for [total.<env>] budgets (default: build_dir name)")
+    parser.add_argument("--budget", default=os.path.join(os.path.dirname(__file__), "..", "memory_budget.ini"))
+    parser.add_argument("--top", type=int, default=25, help="Modules listed, largest first")
+    parser.add_argument("--objects", action="store_true", help="Split libraries per object file")
+    args = parser.parse_args()
+
+    if not args.build_dir and not (args.map and args.elf):
+        parser.error("give a build directory, or both --map and --elf")
+    map_path = args.map or os.path.join(args.build_dir, "firmware.map")
+    elf_path = args.elf or os.path.join(args.build_dir, "firmware.elf")
+    env_name = args.env or (os.path.basename(os.path.normpath(args.build_dir)) if args.build_dir else None)
+
+    usage, segments = parse_map(map_path, args.objects)
+    totals = parse_elf_sections(elf_path)
+    total_budgets, module_budgets = load_budgets(args.budget, env_name)
+
+    capacity = {
+        "image": total_budgets.get("app_partition"),
+        "flash": None,
+        "iram": segments.get("iram0_0_seg"),
+        "dram": segments.get("dram0_0_seg"),
+        "rtc": segments.get("rtc_slow_seg"),
+    }
+
+    print(f"memory report: {env_name or elf_path}")
+    print(f"{'region':<8} {'used KB':>8} {'of KB':>8} {'free KB':>8}")
+    for region in ("image",) + REGIONS:
+        cap = capacity[region]
+        if cap:
+            print(f"{region:<8} {_kb(totals[region])} {_kb(cap)} {_kb(cap - totals[region])}")
+        else:
+            print(f"{region:<8} {_kb(totals[region])} {'?':>8} {'?':>8}")
+
+    ranked = sorted(usage.items(), key=lambda item: -sum(item[1].values()))
+    print()
+    print(f"{'module':<32} {'flash':>8} {'iram':>8} {'dram':>8} {'rtc':>6}")
+    for module, regions in ranked[: args.top]:
+        print(f"{module:<32} {regions['flash']:>8} {regions['iram']:>8} {regions['dram']:>8} {regions['rtc']:>6}")
+    if len(ranked) > args.top:
+        rest = dict.fromkeys(REGIONS, 0)
+        for _, regions in ranked[args.top:]:
+            for region in REGIONS:
+                rest[region] += regions[region]
+        print(f"{f'({len(ranked) - args.top} more)':<32} {rest['flash']:>8} {rest['iram']:>8} {rest['dram']:>8} "
+              f"{rest['rtc']:>6}")
+
+    # --- Budgets ---
+    violations = []
+    for region in ("image",) + REGIONS:
+        budget = total_budgets.get(region)
+        if budget is not None and totals[region] > budget:
+            violations.append(f"total {region}: {totals[region]} bytes > budget {budget}")
+    for module, budgets in module_budgets.items():
+        for region, budget in budgets.items():
+            used = usage.get(module, {}).get(region, 0)
+            if used > budget:
+                violations.append(f"{module} {region}: {used} bytes > budget {budget}")
+
+    print()
+    if violations:
+        for violation in violations:
+            print(f"OVER BUDGET  {violation}")
+        sys.exit(1)
+    checked = sum(len(b) for b in module_budgets.values()) + sum(1 for r in ("image",) + REGIONS if r in total_budgets)
+    print(f"all {checked} budgets met ({os.path.normpath(args.budget)})")
+
+
+if __name__ == "__main__":
+    main()
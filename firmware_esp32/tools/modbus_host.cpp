@@ -0,0 +1,209 @@
+/**
+ * @file modbus_host.cpp
+ * @brief Host Modbus TCP server for the device register map (src/modbus_tcp.cpp).
+ *
+ * Build and run from firmware_esp32/:
+ *   g++ -std=c++17 -O2 -pthread -Isrc tools/modbus_host.cpp src/modbus_tcp.cpp src/live_counters.cpp -o modbus_host
+ *   ./modbus_host [port] [seconds]
+ *
+ * Serves the same frames and registers as the firmware, so PLC setups and
+ * tools/modbus_poll.py can be tried without a device. The counters come
+ * from a writer thread that plays the sensing task: it publishes through
+ * LiveCountersSeqlock every 100 us, much more often than the real task.
+ * Every snapshot it writes satisfies glitches == 3 x products + interrupted
+ * and lastGapMs == updates % 1000, so a torn copy would break the relation. A
+ * checker thread reads the snapshot in a tight loop, and the server checks
+ * every snapshot it serves.
+ *
+ * Prints the request count, service times, read retries and torn snapshots
+ * at the end. Exits with status 1 if any snapshot was torn.
+ */
+
+#include "live_counters.h"
+#include "modbus_tcp.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t PUBLISH_US       = 100;
+static const uint32_t PRODUCT_EVERY_US = 350000;  // ~170 products per minute
+
+static LiveCountersSeqlock snapshot;
+static std::atomic<bool> running{true};
+static std::atomic<uint64_t> tornReads{0};
+
+static uint64_t nowUs() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static bool consistent(const LiveCounters& c) {
+    return c.glitches == 3 * c.products + c.interrupted && c.lastGapMs == c.updates % 1000;
+}
+
+// =====================================================================
+// Sensing Task Stand-in
+// =====================================================================
+
+static void writerThread() {
+    LiveCounters c = {};
+    uint64_t start = nowUs();
+    uint64_t nextProduct = start + PRODUCT_EVERY_US;
+    while (running) {
+        uint64_t t = nowUs();
+        if (t >= nextProduct) {
+            c.products++;
+            nextProduct += PRODUCT_EVERY_US;
+        }
+        c.interrupted = (t - start) % PRODUCT_EVERY_US < PRODUCT_EVERY_US / 2 ? 1 : 0;
+        c.glitches = 3 * c.products + c.interrupted;
+        c.lastChangeMs = (uint32_t)(t / 1000);
+        c.lastDwellMs = PRODUCT_EVERY_US / 2000;
+        c.updates++;
+        c.lastGapMs = c.updates % 1000;
+        snapshot.publish(c);
+        std::this_thread::sleep_for(std::chrono::microseconds(PUBLISH_US));
+    }
+}
+
+static void checkerThread(uint64_t& reads, uint64_t& retries) {
+    LiveCounters c;
+    while (running) {
+        retries += snapshot.read(c);
+        reads++;
+        if (c.updates && !consistent(c)) {
+            tornReads++;
+        }
+    }
+}
+
+// =====================================================================
+// Server
+// =====================================================================
+
+struct Connection {
+    int fd;
+    std::vector<uint8_t> rx;
+};
+
+static void onSignal(int) {
+    running = false;
+}
+
+int main(int argc, char** argv) {
+    int port = argc > 1 ? std::atoi(argv[1]) : 1502;
+    int seconds = argc > 2 ? std::atoi(argv[2]) : 0;  // 0: until Ctrl+C
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0) {
+        std::perror("bind/listen");
+        return 2;
+    }
+    std::printf("modbus_host: listening on port %d\n", port);
+    std::fflush(stdout);
+
+    uint64_t checkerReads = 0, checkerRetries = 0;
+    std::thread writer(writerThread);
+    std::thread checker(checkerThread, std::ref(checkerReads), std::ref(checkerRetries));
+
+    ThroughputWindow throughput;
+    std::vector<Connection> connections;
+    uint64_t requests = 0, exceptions = 0, serveRetries = 0, sumServiceUs = 0, maxServiceUs = 0;
+    uint64_t start = nowUs();
+
+    while (running && (seconds == 0 || nowUs() - start < (uint64_t)seconds * 1000000)) {
+        std::vector<pollfd> fds;
+        fds.push_back({listener, POLLIN, 0});
+        for (const Connection& c : connections) fds.push_back({c.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), 10) < 0) continue;
+
+        uint32_t nowMs = (uint32_t)(nowUs() / 1000);
+        LiveCounters counters;
+        snapshot.read(counters);
+        throughput.sample(nowMs, counters.products);
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                connections.push_back({fd, {}});
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Connection& c = connections[i - 1];
+            uint8_t buf[512];
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                close(c.fd);
+                c.fd = -1;
+                continue;
+            }
+            c.rx.insert(c.rx.end(), buf, buf + n);
+            for (;;) {
+                size_t frame = modbusFrameLength(c.rx.data(), c.rx.size());
+                if (frame == 0) break;
+                if (frame == SIZE_MAX) {
+                    close(c.fd);
+                    c.fd = -1;
+                    break;
+                }
+                uint64_t t0 = nowUs();
+                serveRetries += snapshot.read(counters);
+                if (counters.updates && !consistent(counters)) tornReads++;
+                ModbusHealth health = {MB_HEALTH_WIFI | MB_HEALTH_MQTT | MB_HEALTH_CLOCK, -58,
+                                       (uint32_t)((t0 - start) / 1000000)};
+                uint16_t regs[MB_REG_COUNT];
+                modbusFillRegisters(regs, counters, throughput.perMinuteX10(), health, (uint32_t)(t0 / 1000));
+                uint8_t response[MODBUS_MAX_ADU];
+                size_t length = modbusHandleFrame(c.rx.data(), frame, regs, MB_REG_COUNT, response);
+                if (length) {
+                    send(c.fd, response, length, MSG_NOSIGNAL);
+                    requests++;
+                    if (response[7] & 0x80) exceptions++;
+                }
+                uint64_t serviceUs = nowUs() - t0;
+                sumServiceUs += serviceUs;
+                if (serviceUs > maxServiceUs) maxServiceUs = serviceUs;
+                c.rx.erase(c.rx.begin(), c.rx.begin() + frame);
+            }
+        }
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (connections[i].fd < 0) connections.erase(connections.begin() + i);
+        }
+    }
+
+    running = false;
+    writer.join();
+    checker.join();
+    for (Connection& c : connections) close(c.fd);
+    close(listener);
+
+    std::printf("requests %llu  exceptions %llu  service us avg %.1f max %llu\n", (unsigned long long)requests,
+                (unsigned long long)exceptions, requests ? (double)sumServiceUs / requests : 0.0,
+                (unsigned long long)maxServiceUs);
+    std::printf("snapshot reads %llu  retries %llu (checker) + %llu (server)  torn %llu\n",
+                (unsigned long long)checkerReads, (unsigned long long)checkerRetries,
+                (unsigned long long)serveRetries, (unsigned long long)tornReads.load());
+    return tornReads ? 1 : 0;
+}
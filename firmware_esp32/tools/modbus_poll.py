@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+# firmware_esp32/tools/modbus_poll.py
+"""
+Polls the device's Modbus TCP server like a line PLC and measures response latency.
+
+Each client opens its own connection and reads the whole register map
+(function 04, or 03 with --holding) on a fixed schedule. Latency is the
+time from sending a request to receiving its complete response. A poll
+that cannot start on time because the previous response was late is
+counted as late.
+
+Usage:
+    python tools/modbus_poll.py 192.168.1.50 --rate 100 --duration 60
+    python tools/modbus_poll.py 127.0.0.1 --port 1502 --clients 3    # against tools/modbus_host.cpp
+
+Prints latency percentiles per client, how often the product count changed,
+and the last register values. Exits with status 1 if any request failed or
+the p99 latency is above --max-p99-ms.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+REGISTER_NAMES = [
+    "products_hi", "products_lo", "state", "throughput_x10", "glitches_hi", "glitches_lo",
+    "since_change_hi", "since_change_lo", "last_dwell_ms", "last_gap_ms", "health", "rssi",
+    "uptime_hi", "uptime_lo", "dropped_hi", "dropped_lo", "sequence",
+]
+
+
+def _percentile(values: list, pct: float) -> float:
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(pct / 100 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def _recv_exact(sock: socket.socket, size: int) -> bytes:
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed by the device")
+        data += chunk
+    return data
+
+
+def decode(registers: list) -> dict:
+    """Turns the raw register list into named values (32-bit pairs joined, RSSI signed)."""
+    raw = dict(zip(REGISTER_NAMES, registers))
+    joined = {}
+    for name in ("products", "glitches", "since_change", "uptime", "dropped"):
+        joined[name] = (raw[f"{name}_hi"] << 16) | raw[f"{name}_lo"]
+    joined.update({
+        "state": "interrupted" if raw["state"] else "clear",
+        "throughput_per_min": raw["throughput_x10"] / 10,
+        "last_dwell_ms": raw["last_dwell_ms"],
+        "last_gap_ms": raw["last_gap_ms"],
+        "health": f"0x{raw['health']:02x}",
+        "rssi": raw["rssi"] - 0x10000 if raw["rssi"] & 0x8000 else raw["rssi"],
+        "sequence": raw["sequence"],
+    })
+    return joined
+
+
+class Poller(threading.Thread):
+    def __init__(self, index: int, args):
+        super().__init__(daemon=True)
+        self.index = index
+        self.args = args
+        self.latencies_ms = []
+        self.errors = 0
+        self.late = 0
+        self.product_changes = 0
+        self.last_registers = None
+
+    def run(self):
+        args = self.args
+        function = 0x03 if args.holding else 0x04
+        count = len(REGISTER_NAMES)
+        period = 1.0 / args.rate
+        sock = socket.create_connection((args.host, args.port), timeout=args.timeout)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        transaction = 0
+        last_products = None
+        deadline = time.perf_counter()
+        end = deadline + args.duration
+        try:
+            while deadline < end:
+                now = time.perf_counter()
+                if now < deadline:
+                    time.sleep(deadline - now)
+                elif now - deadline > period:
+                    self.late += 1
+                transaction = (transaction + 1) & 0xFFFF
+                request = struct.pack(">HHHBBHH", transaction, 0, 6, args.unit, function, 0, count)
+                sent = time.perf_counter()
+                try:
+                    sock.sendall(request)
+                    header = _recv_exact(sock, 7)
+                    tid, proto, length, _unit = struct.unpack(">HHHB", header)
+                    body = _recv_exact(sock, length - 1)
+                except (OSError, ConnectionError):
+                    self.errors += 1
+                    sock.close()
+                    sock = socket.create_connection((args.host, args.port), timeout=args.timeout)
+                    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                    deadline = time.perf_counter() + period
+                    continue
+                self.latencies_ms.append((time.perf_counter() - sent) * 1000)
+
+                if tid != transaction or proto != 0 or body[0] != function or body[1] != count * 2:
+                    self.errors += 1
+                else:
+                    registers = list(struct.unpack(f">{count}H", body[2:2 + count * 2]))
+                    products = (registers[0] << 16) | registers[1]
+                    if last_products is not None and products != last_products:
+                        self.product_changes += 1
+                    last_products = products
+                    self.last_registers = registers
+                deadline += period
+        finally:
+            sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=502)
+    parser.add_argument("--unit", type=int, default=1)
+    parser.add_argument("--rate", type=float, default=100, help="Polls per second per client")
+    parser.add_argument("--duration", type=float, default=30, help="Seconds")
+    parser.add_argument("--clients", type=int, default=1)
+    parser.add_argument("--holding", action="store_true", help="Read holding registers (function 03)")
+    parser.add_argument("--timeout", type=float, default=1.0)
+    parser.add_argument("--max-p99-ms", type=float, default=100)
+    args = parser.parse_args()
+
+    pollers = [Poller(i, args) for i in range(args.clients)]
+    for p in pollers:
+        p.start()
+    for p in pollers:
+        p.join()
+
+    print(f"{'client':>6} {'polls':>7} {'errors':>6} {'late':>5} {'p50 ms':>8} {'p90 ms':>8} {'p99 ms':>8} "
+          f"{'max ms':>8} {'count changes':>13}")
+    failed = False
+    for p in pollers:
+        lat = p.latencies_ms
+        p99 = _percentile(lat, 99)
+        print(f"{p.index:>6} {len(lat):>7} {p.errors:>6} {p.late:>5} {_percentile(lat, 50):>8.2f} "
+              f"{_percentile(lat, 90):>8.2f} {p99:>8.2f} {max(lat, default=0):>8.2f} {p.product_changes:>13}")
+        failed |= p.errors > 0 or p99 > args.max_p99_ms or not lat
+
+    last = next((p.last_registers for p in pollers if p.last_registers), None)
+    if last:
+        print("registers: " + ", ".join(f"{k}={v}" for k, v in decode(last).items()))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
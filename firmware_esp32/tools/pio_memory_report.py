@@ -0,0 +1,31 @@
+# firmware_esp32/tools/pio_memory_report.py
+"""
+PlatformIO extra script: links with a map file and runs tools/memory_report.py
+after every firmware build. A budget overrun (memory_budget.ini) fails the build.
+"""
+
+import os
+import subprocess
+import sys
+
+Import("env")  # noqa: F821 (provided by PlatformIO)
+
+env.Append(LINKFLAGS=["-Wl,-Map,${BUILD_DIR}/firmware.map"])  # noqa: F821
+
+# -flto must reach the linker too, or the LTO objects are not optimized across modules
+if "-flto" in env.get("CCFLAGS", []):  # noqa: F821
+    env.Append(LINKFLAGS=["-flto"])  # noqa: F821
+
+
+def memory_report(source, target, env):
+    project_dir = env.subst("$PROJECT_DIR")
+    result = subprocess.run([
+        sys.executable, os.path.join(project_dir, "tools", "memory_report.py"), env.subst("$BUILD_DIR"),
+        "--env", env.subst("$PIOENV"), "--budget", os.path.join(project_dir, "memory_budget.ini"),
+    ])
+    if result.returncode != 0:
+        sys.stderr.write("Memory budget exceeded (see memory_budget.ini).\n")
+        env.Exit(1)
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", memory_report)  # noqa: F821
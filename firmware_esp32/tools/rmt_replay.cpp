@@ -0,0 +1,184 @@
+/**
+ * @file rmt_replay.cpp
+ * @brief Replays recorded RMT receive blocks through the firmware's pulse
+ * decoder and debouncer (src/pulse_decoder.cpp) on the host.
+ *
+ * Build and run from firmware_esp32/:
+ *   g++ -std=c++17 -O2 -Isrc tools/rmt_replay.cpp src/pulse_decoder.cpp -o rmt_replay
+ *   ./rmt_replay tools/rmt_recordings/bouncy_edges.txt
+ *
+ * Recording format (one directive per line, '#' starts a comment). A device
+ * built with TERELINA_USE_RMT prints the rmt/block/items lines with
+ * "sense record" followed by "sense dump":
+ *   rmt <tick_ns> <idle_ticks> <active_low>
+ *                                  Receiver timing and polarity
+ *   debounce_ms <ms>               Debounce delay (default 50)
+ *   initial clear|interrupted      Beam state before the first block
+ *   block <rx_us>                  A block received at rx_us (esp_timer clock)...
+ *   items <hex> ...                ...and its raw 32-bit RMT items
+ *   end <us>                       Time the replay runs to after the last block
+ *   expect <stat> <op> <value>     Checked at the end; op is one of < <= == >= >
+ *                                  stats: events products glitches edges
+ *                                  min_dwell_ms max_dwell_ms min_gap_ms max_gap_ms
+ *
+ * Exits with status 1 if any expectation fails.
+ */
+
+#include "pulse_decoder.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Block {
+    uint64_t rxUs;
+    std::vector<uint32_t> items;
+};
+
+struct Expectation {
+    std::string stat;
+    std::string op;
+    double value;
+};
+
+struct Replay {
+    std::map<std::string, double> stats;
+    bool seenFirst = false;
+
+    void add(const PulseEvent& e) {
+        std::printf("%12.3f ms  %-11s  after %10.3f ms %s\n", e.edgeUs / 1000.0,
+                    e.interrupted ? "INTERRUPTED" : "CLEAR", e.widthUs / 1000.0,
+                    e.interrupted ? "gap" : "dwell");
+        stats["events"]++;
+        if (!e.interrupted) {
+            stats["products"]++;
+        }
+        // The state before the first change started with the recording, not at an edge
+        if (seenFirst) {
+            double ms = e.widthUs / 1000.0;
+            const char* kind = e.interrupted ? "gap" : "dwell";
+            std::string minKey = std::string("min_") + kind + "_ms";
+            std::string maxKey = std::string("max_") + kind + "_ms";
+            if (!stats.count(minKey) || ms < stats[minKey]) stats[minKey] = ms;
+            if (!stats.count(maxKey) || ms > stats[maxKey]) stats[maxKey] = ms;
+        }
+        seenFirst = true;
+    }
+};
+
+static void onEvent(const PulseEvent& event, void* ctx) {
+    static_cast<Replay*>(ctx)->add(event);
+}
+
+static bool compare(double actual, const std::string& op, double expected) {
+    if (op == "<") return actual < expected;
+    if (op == "<=") return actual <= expected;
+    if (op == "==") return actual == expected;
+    if (op == ">=") return actual >= expected;
+    if (op == ">") return actual > expected;
+    return false;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s <recording.txt>\n", argv[0]);
+        return 2;
+    }
+    std::ifstream in(argv[1]);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 2;
+    }
+
+    RmtTiming timing = {500, 30000, true};
+    uint32_t debounceMs = 50;
+    bool initialInterrupted = false;
+    uint64_t endUs = 0;
+    std::vector<Block> blocks;
+    std::vector<Expectation> expects;
+
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        std::istringstream ss(line);
+        std::string cmd;
+        if (!(ss >> cmd)) continue;
+
+        bool ok = true;
+        if (cmd == "rmt") {
+            int activeLow = 1;
+            ok = (bool)(ss >> timing.tickNs >> timing.idleTicks >> activeLow);
+            timing.activeLow = activeLow != 0;
+        } else if (cmd == "debounce_ms") {
+            ok = (bool)(ss >> debounceMs);
+        } else if (cmd == "initial") {
+            std::string state;
+            ok = (bool)(ss >> state) && (state == "clear" || state == "interrupted");
+            initialInterrupted = state == "interrupted";
+        } else if (cmd == "block") {
+            Block b;
+            ok = (bool)(ss >> b.rxUs);
+            blocks.push_back(b);
+        } else if (cmd == "items") {
+            ok = !blocks.empty();
+            std::string word;
+            while (ok && ss >> word) {
+                blocks.back().items.push_back((uint32_t)std::strtoul(word.c_str(), nullptr, 16));
+            }
+        } else if (cmd == "end") {
+            ok = (bool)(ss >> endUs);
+        } else if (cmd == "expect") {
+            Expectation e;
+            ok = (bool)(ss >> e.stat >> e.op >> e.value);
+            expects.push_back(e);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::fprintf(stderr, "%s:%d: cannot parse '%s'\n", argv[1], lineNo, line.c_str());
+            return 2;
+        }
+    }
+
+    uint64_t startUs = blocks.empty() ? 0 : blocks.front().rxUs;
+    startUs = startUs > 1000000 ? startUs - 1000000 : 0;
+    PulseDebouncer debouncer(debounceMs * 1000, initialInterrupted, startUs);
+    Replay replay;
+    PulseEvent event;
+
+    // Between blocks the sensing task wakes every 10 ms to confirm changes
+    uint64_t now = startUs;
+    for (const Block& b : blocks) {
+        for (; now + 10000 < b.rxUs; now += 10000) {
+            if (debouncer.advance(now, event)) replay.add(event);
+        }
+        replay.stats["edges"] += decodeRmtBlock(b.items.data(), b.items.size(), b.rxUs, timing, debouncer,
+                                                onEvent, &replay);
+        now = b.rxUs;
+        if (debouncer.advance(now, event)) replay.add(event);
+    }
+    for (; now <= endUs; now += 10000) {
+        if (debouncer.advance(now, event)) replay.add(event);
+    }
+    replay.stats["glitches"] = debouncer.glitches();
+
+    std::printf("\n%zu blocks, %.0f edges, %.0f events, %.0f products, %.0f glitches\n", blocks.size(),
+                replay.stats["edges"], replay.stats["events"], replay.stats["products"], replay.stats["glitches"]);
+
+    int failures = 0;
+    for (const Expectation& e : expects) {
+        double actual = replay.stats.count(e.stat) ? replay.stats[e.stat] : 0;
+        bool pass = compare(actual, e.op, e.value);
+        std::printf("%s  %s %s %g (actual %g)\n", pass ? "PASS" : "FAIL", e.stat.c_str(), e.op.c_str(), e.value,
+                    actual);
+        if (!pass) failures++;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,329 @@
+/**
+ * @file roaming_sim.cpp
+ * @brief Runs the firmware's roaming policy (src/roaming.cpp) against a
+ * scripted WiFi layer on the host.
+ *
+ * Build and run from firmware_esp32/:
+ *   g++ -std=c++17 -O2 -Isrc tools/roaming_sim.cpp src/roaming.cpp -o roaming_sim
+ *   ./roaming_sim tools/roaming_scenarios/walk_away.txt
+ *
+ * Scenario format (one directive per line, '#' starts a comment):
+ *   duration <ms>                      Simulated time (1 ms steps)
+ *   ap <name> <bssid> <channel> <t_ms>:<dbm> ...
+ *                                      RSSI of the AP at the device over time,
+ *                                      linearly interpolated between points
+ *   connect <name>                     AP the device starts on
+ *   busy <from_ms> <to_ms>             Sensor active: not a quiet window
+ *   link_fail_dbm <dbm>                The link drops below this (default -88)
+ *   scan_ms / assoc_ms / reconnect_ms <ms>
+ *                                      Scan duration, BSSID-locked reassociation
+ *                                      time, auto-reconnect time after a drop
+ *   expect <stat> <op> <value>         Checked at the end; op is one of < <= == >= >
+ *                                      stats: roams failed scans disconnects
+ *                                      max_roam_ms outage_ms busy_scans
+ *
+ * Exits with status 1 if any expectation fails.
+ */
+
+#include "roaming.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// =====================================================================
+// Scripted Radio
+// =====================================================================
+
+struct SimAp {
+    std::string name;
+    uint8_t bssid[6];
+    int32_t channel;
+    std::vector<std::pair<uint32_t, float>> track;
+
+    float rssiAt(uint32_t t) const {
+        if (track.empty()) return -100;
+        if (t <= track.front().first) return track.front().second;
+        for (size_t i = 1; i < track.size(); i++) {
+            if (t <= track[i].first) {
+                const auto& a = track[i - 1];
+                const auto& b = track[i];
+                return a.second + (b.second - a.second) * (float)(t - a.first) / (float)(b.first - a.first);
+            }
+        }
+        return track.back().second;
+    }
+};
+
+struct Expectation {
+    std::string stat;
+    std::string op;
+    double value;
+};
+
+class ScriptedRadio : public RoamingRadio {
+public:
+    std::vector<SimAp> aps;
+    std::vector<std::pair<uint32_t, uint32_t>> busy;
+    float linkFailDbm = -88;
+    uint32_t scanMs = 800;
+    uint32_t assocMs = 300;
+    uint32_t reconnectMs = 4000;
+
+    uint32_t now = 0;
+    int current = -1;            // Associated AP, -1 while disconnected
+    int locked = -1;             // BSSID lock set by connectTo(), -1 for any AP
+    int pending = -1;            // AP being joined
+    uint32_t pendingReadyAt = 0;
+    bool scanning = false;
+    uint32_t scanDoneAt = 0;
+
+    uint32_t disconnects = 0;
+    uint32_t outageMs = 0;
+    uint32_t busyScans = 0;
+
+    bool isBusy(uint32_t t) const {
+        for (const auto& b : busy) {
+            if (t >= b.first && t < b.second) return true;
+        }
+        return false;
+    }
+
+    /** @brief The AP auto-reconnect joins: the locked one, if any. */
+    int reconnectTarget() const {
+        return locked >= 0 ? locked : strongest();
+    }
+
+    int strongest() const {
+        int best = -1;
+        for (size_t i = 0; i < aps.size(); i++) {
+            if (best < 0 || aps[i].rssiAt(now) > aps[best].rssiAt(now)) best = (int)i;
+        }
+        return best;
+    }
+
+    /** @brief Advances the link model by one millisecond. */
+    void step(uint32_t t) {
+        now = t;
+        if (current >= 0 && aps[current].rssiAt(now) < linkFailDbm) {
+            std::printf("%8u ms  LINK LOST on %s (%.1f dBm)\n", now, aps[current].name.c_str(),
+                        aps[current].rssiAt(now));
+            disconnects++;
+            current = -1;
+            pending = reconnectTarget();  // Auto-reconnect picks the best AP (or the locked one), slowly
+            pendingReadyAt = now + reconnectMs;
+        }
+        if (current < 0 && pending >= 0 && now >= pendingReadyAt) {
+            if (aps[pending].rssiAt(now) >= linkFailDbm) {
+                current = pending;
+                std::printf("%8u ms  associated with %s\n", now, aps[current].name.c_str());
+            } else {
+                pending = reconnectTarget();
+                pendingReadyAt = now + reconnectMs;
+            }
+        }
+        if (current < 0) outageMs++;
+    }
+
+    // --- RoamingRadio ---
+
+    bool isConnected() override { return current >= 0; }
+    int32_t rssi() override { return current >= 0 ? (int32_t)aps[current].rssiAt(now) : 0; }
+
+    void currentBssid(uint8_t out[6]) override {
+        if (current >= 0) std::memcpy(out, aps[current].bssid, 6);
+        else std::memset(out, 0, 6);
+    }
+
+    bool startScan() override {
+        if (isBusy(now)) busyScans++;
+        scanning = true;
+        scanDoneAt = now + scanMs;
+        std::printf("%8u ms  scan started\n", now);
+        return true;
+    }
+
+    int scanResults(RoamCandidate* out, int maxResults) override {
+        if (!scanning || now < scanDoneAt) return -1;
+        scanning = false;
+        int n = 0;
+        for (const auto& ap : aps) {
+            float rssi = ap.rssiAt(now);
+            if (rssi < -95 || n >= maxResults) continue;
+            std::memcpy(out[n].bssid, ap.bssid, 6);
+            out[n].channel = ap.channel;
+            out[n].rssi = (int32_t)rssi;
+            n++;
+        }
+        return n;
+    }
+
+    bool connectTo(const RoamCandidate& target) override {
+        for (size_t i = 0; i < aps.size(); i++) {
+            if (std::memcmp(aps[i].bssid, target.bssid, 6) == 0) {
+                current = -1;
+                pending = (int)i;
+                locked = (int)i;
+                pendingReadyAt = now + assocMs;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void reconnectAny() override {
+        current = -1;
+        locked = -1;
+        pending = strongest();
+        pendingReadyAt = now + reconnectMs;
+    }
+};
+
+// =====================================================================
+// Scenario Parsing
+// =====================================================================
+
+static bool parseBssid(const std::string& text, uint8_t out[6]) {
+    unsigned int b[6];
+    if (std::sscanf(text.c_str(), "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) out[i] = (uint8_t)b[i];
+    return true;
+}
+
+static bool loadScenario(const char* path, ScriptedRadio& radio, uint32_t& duration,
+                         std::string& startAp, std::vector<Expectation>& expects) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        std::string cmd;
+        if (!(ls >> cmd)) continue;
+
+        if (cmd == "duration") {
+            ls >> duration;
+        } else if (cmd == "ap") {
+            SimAp ap;
+            std::string bssid, point;
+            ls >> ap.name >> bssid >> ap.channel;
+            if (!parseBssid(bssid, ap.bssid)) {
+                std::fprintf(stderr, "%s:%d: bad BSSID '%s'\n", path, lineNo, bssid.c_str());
+                return false;
+            }
+            while (ls >> point) {
+                size_t colon = point.find(':');
+                ap.track.emplace_back((uint32_t)std::strtoul(point.c_str(), nullptr, 10),
+                                      std::strtof(point.c_str() + colon + 1, nullptr));
+            }
+            radio.aps.push_back(ap);
+        } else if (cmd == "connect") {
+            ls >> startAp;
+        } else if (cmd == "busy") {
+            uint32_t from, to;
+            ls >> from >> to;
+            radio.busy.emplace_back(from, to);
+        } else if (cmd == "link_fail_dbm") {
+            ls >> radio.linkFailDbm;
+        } else if (cmd == "scan_ms") {
+            ls >> radio.scanMs;
+        } else if (cmd == "assoc_ms") {
+            ls >> radio.assocMs;
+        } else if (cmd == "reconnect_ms") {
+            ls >> radio.reconnectMs;
+        } else if (cmd == "expect") {
+            Expectation e;
+            ls >> e.stat >> e.op >> e.value;
+            expects.push_back(e);
+        } else {
+            std::fprintf(stderr, "%s:%d: unknown directive '%s'\n", path, lineNo, cmd.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compare(double actual, const std::string& op, double expected) {
+    if (op == "<") return actual < expected;
+    if (op == "<=") return actual <= expected;
+    if (op == "==") return actual == expected;
+    if (op == ">=") return actual >= expected;
+    if (op == ">") return actual > expected;
+    return false;
+}
+
+// =====================================================================
+// Main
+// =====================================================================
+
+static void printLine(const char* line) {
+    std::printf("            %s\n", line);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s <scenario.txt>\n", argv[0]);
+        return 2;
+    }
+
+    ScriptedRadio radio;
+    uint32_t duration = 60000;
+    std::string startAp;
+    std::vector<Expectation> expects;
+    if (!loadScenario(argv[1], radio, duration, startAp, expects)) {
+        return 2;
+    }
+    for (size_t i = 0; i < radio.aps.size(); i++) {
+        if (radio.aps[i].name == startAp) radio.current = (int)i;
+    }
+    if (radio.current < 0) {
+        std::fprintf(stderr, "scenario must 'connect' to a known AP\n");
+        return 2;
+    }
+
+    RoamingController roaming(radio);
+    roaming.setLogger(printLine);
+
+    for (uint32_t t = 0; t <= duration; t++) {
+        radio.step(t);
+        roaming.tick(t, !radio.isBusy(t));
+    }
+
+    const RoamingStats& st = roaming.stats();
+    std::printf("\nroams=%u failed=%u scans=%u disconnects=%u max_roam_ms=%u outage_ms=%u busy_scans=%u\n",
+                st.roams, st.failedRoams, st.scans, radio.disconnects, st.maxRoamLatencyMs,
+                radio.outageMs, radio.busyScans);
+
+    int failures = 0;
+    for (const auto& e : expects) {
+        double actual = 0;
+        if (e.stat == "roams") actual = st.roams;
+        else if (e.stat == "failed") actual = st.failedRoams;
+        else if (e.stat == "scans") actual = st.scans;
+        else if (e.stat == "disconnects") actual = radio.disconnects;
+        else if (e.stat == "max_roam_ms") actual = st.maxRoamLatencyMs;
+        else if (e.stat == "outage_ms") actual = radio.outageMs;
+        else if (e.stat == "busy_scans") actual = radio.busyScans;
+        else {
+            std::printf("UNKNOWN stat %s\n", e.stat.c_str());
+            failures++;
+            continue;
+        }
+        bool ok = compare(actual, e.op, e.value);
+        std::printf("%s  %s %s %g (actual %g)\n", ok ? "PASS" : "FAIL", e.stat.c_str(), e.op.c_str(),
+                    e.value, actual);
+        if (!ok) failures++;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# firmware_esp32/tools/symbolize_profile.py
+"""
+Symbolizes a firmware profile dump ("prof dump") using the firmware ELF.
+
+Input is any text containing the profiler's "PROF <core> <pc> <count>" lines:
+a Serial Monitor log, or the output of
+    mosquitto_sub -h <broker> -t sensors/barrier/diag/<device_id>
+
+Usage:
+    python tools/symbolize_profile.py profile.txt
+    python tools/symbolize_profile.py profile.txt --elf .pio/build/esp32dev/firmware.elf --collapsed > prof.folded
+
+By default prints the hottest functions per core. With --collapsed, emits
+"core;function count" lines for flamegraph.pl / speedscope.
+
+The device's counters are cumulative since the last "prof clear", so when the
+input holds several dumps only the last one is used. With --since-first, the
+first dump is subtracted from the last: the profile of the time between them.
+"""
+
+import argparse
+import collections
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+PROF_LINE = re.compile(r"PROF (\d) ([0-9a-fA-F]{8}) (\d+)")
+HEADER_LINE = re.compile(r"PROF BEGIN samples=(\d+) dropped=(\d+)")
+
+
+def parse_dumps(text: str) -> list:
+    """[(dropped, Counter((core, pc) -> count))] for each dump in the input, oldest first."""
+    dumps = []
+    for block in re.split(r"(?=PROF BEGIN )", text):
+        header = HEADER_LINE.search(block)
+        samples = collections.Counter()
+        for match in PROF_LINE.finditer(block):
+            samples[(int(match.group(1)), int(match.group(2), 16))] = int(match.group(3))
+        if header or samples:
+            dumps.append((int(header.group(2)) if header else 0, samples))
+    return dumps
+
+
+def find_addr2line(explicit: str | None) -> str:
+    if explicit:
+        return explicit
+    candidates = [
+        shutil.which("xtensa-esp32-elf-addr2line"),
+        os.path.expanduser("~/.platformio/packages/toolchain-xtensa-esp32/bin/xtensa-esp32-elf-addr2line"),
+    ]
+    for candidate in candidates:
+        if candidate and os.path.exists(candidate):
+            return candidate
+    sys.exit("xtensa-esp32-elf-addr2line not found; pass --addr2line")
+
+
+def symbolize(addr2line: str, elf: str, pcs: list) -> dict:
+    """Maps each PC to 'function (file:line)' with a single addr2line call."""
+    if not pcs:
+        return {}
+    out = subprocess.run(
+        [addr2line, "-f", "-C", "-e", elf, *[f"0x{pc:08x}" for pc in pcs]],
+        check=True, capture_output=True, text=True
+    ).stdout.splitlines()
+
+    symbols = {}
+    for i, pc in enumerate(pcs):
+        function = out[2 * i].strip() if 2 * i < len(out) else "??"
+        location = os.path.basename(out[2 * i + 1].strip()) if 2 * i + 1 < len(out) else "??"
+        symbols[pc] = function if function != "??" else f"0x{pc:08x}"
+        if location and not location.startswith("??"):
+            symbols[pc] += f" ({location.split(' ')[0]})"
+    return symbols
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolize an ESP32 profiler dump.")
+    parser.add_argument("dump", help="File with PROF lines ('-' for stdin)")
+    parser.add_argument("--elf", default=".pio/build/esp32dev/firmware.elf")
+    parser.add_argument("--addr2line", default=None)
+    parser.add_argument("--top", type=int, default=25, help="Functions listed per core")
+    parser.add_argument("--collapsed", action="store_true", help="Emit collapsed stacks instead of a table")
+    parser.add_argument("--by-line", action="store_true", help="Aggregate by source line instead of function")
+    parser.add_argument("--since-first", action="store_true",
+                        help="Profile the interval between the first and the last dump of the input")
+    args = parser.parse_args()
+
+    text = sys.stdin.read() if args.dump == "-" else open(args.dump, encoding="utf-8", errors="ignore").read()
+
+    dumps = [d for d in parse_dumps(text) if d[1]]
+    if not dumps:
+        sys.exit("No PROF lines found in the input.")
+    dropped, samples = dumps[-1]  # (core, pc) -> count
+    if args.since_first and len(dumps) > 1:
+        first = dumps[0][1]
+        if any(samples[key] < count for key, count in first.items()):
+            print("Note: the histogram was cleared between the dumps; using the last one only.", file=sys.stderr)
+        else:
+            samples = samples - first
+            dropped -= dumps[0][0]
+            if not samples:
+                sys.exit("No samples between the first and the last dump.")
+    elif len(dumps) > 1:
+        print(f"Note: {len(dumps)} dumps in the input; using the last one (counts are cumulative).", file=sys.stderr)
+
+    symbols = symbolize(find_addr2line(args.addr2line), args.elf, sorted({pc for _, pc in samples}))
+
+    per_function = collections.Counter()
+    for (core, pc), count in samples.items():
+        label = symbols[pc] if args.by_line else symbols[pc].split(" (")[0]
+        per_function[(core, label)] += count
+
+    if args.collapsed:
+        for (core, label), count in per_function.most_common():
+            print(f"core{core};{label} {count}")
+        return
+
+    for core in sorted({c for c, _ in per_function}):
+        total = sum(n for (c, _), n in per_function.items() if c == core)
+        print(f"\n=== Core {core}: {total} samples ===")
+        rows = [(label, n) for (c, label), n in per_function.most_common() if c == core][:args.top]
+        for label, n in rows:
+            print(f"{100.0 * n / total:6.2f}%  {n:8d}  {label}")
+    if dropped:
+        print(f"\nNote: {dropped} samples were dropped (histogram full); the profile is slightly truncated.")
+
+
+if __name__ == "__main__":
+    main()
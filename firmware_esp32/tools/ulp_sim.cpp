@@ -0,0 +1,189 @@
+/**
+ * @file ulp_sim.cpp
+ * @brief Host check of the ULP counter program (src/ulp_program.cpp).
+ *
+ * Build and run from firmware_esp32/:
+ *   g++ -std=c++17 -O2 -Isrc tools/ulp_sim.cpp src/ulp_program.cpp src/pulse_decoder.cpp -o ulp_sim
+ *   ./ulp_sim [products]
+ *
+ * Generates a beam signal with products, contact bounce and noise spikes
+ * (some just under the debounce), samples it at the ULP period and feeds
+ * every sample both to the emulated ULP program and to PulseDebouncer, the
+ * debouncer behind the main firmware's sensing task. After every sample the
+ * stable state, product and glitch counts must agree, and each product's
+ * ring timestamp must match the debouncer's edge time. Both sensor
+ * polarities are run, and the batch wake-up is checked.
+ *
+ * Exits with status 1 on any mismatch or if the program does not fit below
+ * ULP_DATA_ADDR.
+ */
+
+#include "pulse_decoder.h"
+#include "ulp_program.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static const uint32_t SAMPLE_US        = 2000;  // Same as the default ULP_SAMPLE_PERIOD_US
+static const uint16_t DEBOUNCE_SAMPLES = 25;    // 50 ms
+static const uint16_t WAKE_AT          = 12;
+
+// =====================================================================
+// Signal
+// =====================================================================
+
+/**
+ * @brief Beam level (true = interrupted) for each sample.
+ */
+static std::vector<bool> makeSignal(int products, std::mt19937& rng) {
+    std::uniform_int_distribution<int> dwellMs(160, 600);
+    std::uniform_int_distribution<int> gapMs(150, 1200);
+    std::uniform_int_distribution<int> bounceMs(0, 8);
+    std::uniform_int_distribution<int> spikeMs(2, 49);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    std::vector<bool> level;
+    auto hold = [&](bool v, int ms) { level.insert(level.end(), ms * 1000 / SAMPLE_US, v); };
+
+    hold(false, 300);
+    for (int p = 0; p < products; p++) {
+        // Edges bounce for a few ms
+        for (int b = bounceMs(rng); b > 0; b -= 2) {
+            hold(true, 2);
+            hold(false, 2);
+        }
+        int dwell = dwellMs(rng);
+        hold(true, dwell / 2);
+        if (unit(rng) < 0.2) hold(false, spikeMs(rng));  // Dropout inside the product
+        hold(true, dwell / 2);
+        for (int b = bounceMs(rng); b > 0; b -= 2) {
+            hold(false, 2);
+            hold(true, 2);
+        }
+        int gap = gapMs(rng);
+        hold(false, gap / 2);
+        if (unit(rng) < 0.2) hold(true, spikeMs(rng));  // Noise spike between products
+        hold(false, gap / 2);
+    }
+    return level;
+}
+
+// =====================================================================
+// Comparison
+// =====================================================================
+
+struct RunResult {
+    int products = 0;
+    int glitches = 0;
+    int wakes = 0;
+    int mismatches = 0;
+    uint32_t maxInstructions = 0;
+    uint64_t sumInstructions = 0;
+};
+
+static RunResult compare(const std::vector<bool>& signal, bool activeLow) {
+    RunResult r;
+    UlpEmulator ulp;
+    ulp.var(ULP_VAR_DEBOUNCE) = DEBOUNCE_SAMPLES;
+    ulp.var(ULP_VAR_ACTIVE_LOW) = activeLow ? 1 : 0;
+    ulp.var(ULP_VAR_WAKE_AT) = WAKE_AT;
+
+    PulseDebouncer debouncer(DEBOUNCE_SAMPLES * SAMPLE_US, false, 0);
+    PulseEvent event;
+    std::vector<uint64_t> starts;
+    uint16_t checkedProducts = 0;
+
+    auto onEvent = [&](const PulseEvent& e) {
+        if (!e.interrupted) starts.push_back(e.edgeUs);
+    };
+
+    for (size_t k = 0; k < signal.size(); k++) {
+        bool interrupted = signal[k];
+        uint64_t t = (uint64_t)k * SAMPLE_US;
+
+        // Main firmware: the polling task's order of calls
+        if (debouncer.edge(interrupted, t, event)) onEvent(event);
+        if (debouncer.advance(t, event)) onEvent(event);
+
+        // ULP: the pin level depends on the sensor polarity
+        if (ulp.sample(interrupted != activeLow)) {
+            r.wakes++;
+            ulp.var(ULP_VAR_BATCH) = 0;  // What the main cores do when they collect
+        }
+        r.sumInstructions += ulp.lastInstructions();
+        if (ulp.lastInstructions() > r.maxInstructions) r.maxInstructions = ulp.lastInstructions();
+
+        bool same = (ulp.var(ULP_VAR_STABLE) != 0) == debouncer.stableInterrupted() &&
+                    ulp.var(ULP_VAR_PRODUCTS) == (uint16_t)starts.size() &&
+                    ulp.var(ULP_VAR_GLITCHES) == (uint16_t)debouncer.glitches();
+        if (!same) {
+            if (r.mismatches < 5) {
+                std::printf("  mismatch at sample %zu: ulp stable=%u products=%u glitches=%u, "
+                            "debouncer stable=%d products=%zu glitches=%u\n",
+                            k, ulp.var(ULP_VAR_STABLE), ulp.var(ULP_VAR_PRODUCTS), ulp.var(ULP_VAR_GLITCHES),
+                            debouncer.stableInterrupted(), starts.size(), debouncer.glitches());
+            }
+            r.mismatches++;
+        }
+
+        // The newest product's start in the ring, on the coarse clock
+        if (same && !starts.empty() && ulp.var(ULP_VAR_PRODUCTS) != checkedProducts) {
+            checkedProducts = ulp.var(ULP_VAR_PRODUCTS);
+            uint16_t slot = ULP_VAR_RING + (ulp.var(ULP_VAR_PRODUCTS) % ULP_RING_SIZE);
+            uint16_t expected = (uint16_t)((starts.back() / SAMPLE_US + 1) / ULP_COARSE_SAMPLES);
+            if (ulp.var(slot) != expected) {
+                if (r.mismatches < 5) {
+                    std::printf("  product %zu: ring time %u, expected %u\n", starts.size(), ulp.var(slot), expected);
+                }
+                r.mismatches++;
+            }
+        }
+    }
+    r.products = (int)starts.size();
+    r.glitches = (int)debouncer.glitches();
+    return r;
+}
+
+// =====================================================================
+// Main
+// =====================================================================
+
+int main(int argc, char** argv) {
+    int products = argc > 1 ? std::atoi(argv[1]) : 2000;
+    std::mt19937 rng(2024);
+    int failures = 0;
+
+    // Words on the ULP: WAKE is assembled as 3 instructions, labels take none
+    size_t words = 0;
+    for (size_t i = 0; i < ULP_COUNTER_PROGRAM_LENGTH; i++) {
+        UlpOp op = ULP_COUNTER_PROGRAM[i].op;
+        words += op == ULP_LABEL ? 0 : (op == ULP_WAKE ? 3 : 1);
+    }
+    std::printf("program: %zu words (data at word %u)\n", words, ULP_DATA_ADDR);
+    if (words > ULP_DATA_ADDR) {
+        std::printf("FAIL  program overlaps its data\n");
+        failures++;
+    }
+
+    std::vector<bool> signal = makeSignal(products, rng);
+    std::printf("%-11s %9s %9s %9s %7s %11s %14s\n", "polarity", "samples", "products", "glitches", "wakes",
+                "mismatches", "insns avg/max");
+    for (bool activeLow : {false, true}) {
+        RunResult r = compare(signal, activeLow);
+        std::printf("%-11s %9zu %9d %9d %7d %11d %9.1f/%u\n", activeLow ? "active-low" : "active-high",
+                    signal.size(), r.products, r.glitches, r.wakes, r.mismatches,
+                    (double)r.sumInstructions / signal.size(), r.maxInstructions);
+        if (r.mismatches) failures++;
+        if (r.products != products) {
+            std::printf("FAIL  %d of %d products counted\n", r.products, products);
+            failures++;
+        }
+        if (r.wakes != r.products / WAKE_AT) {
+            std::printf("FAIL  %d wake-ups for %d products (one per %u expected)\n", r.wakes, r.products, WAKE_AT);
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}